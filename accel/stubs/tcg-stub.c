@@ -17,6 +17,8 @@
 #include "exec/cpu-common.h"
 #include "exec/exec-all.h"
 
+unsigned int tb_superblock_threshold;
+
 void tb_flush(CPUState *cpu)
 {
 }
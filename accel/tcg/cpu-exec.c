@@ -400,11 +400,23 @@ static inline TranslationBlock *tb_find(CPUState *cpu,
 
     tb = tb_lookup__cpu_state(cpu, &pc, &cs_base, &flags, cf_mask);
     if (tb == NULL) {
+        uint32_t cflags = cf_mask;
+
+        /* icount needs the same translation every time for replay */
+        if (tb_superblock_threshold && !(cf_mask & CF_USE_ICOUNT)) {
+            cflags |= CF_PROFILE;
+        }
         mmap_lock();
-        tb = tb_gen_code(cpu, pc, cs_base, flags, cf_mask);
+        tb = tb_gen_code(cpu, pc, cs_base, flags, cflags);
         mmap_unlock();
         /* We add the TB in the virtual pc hash table for the fast lookup */
         atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+    } else if (unlikely(tb_cflags(tb) & CF_PROFILE) &&
+               atomic_read(&tb->exec_count) >= tb_superblock_threshold) {
+        mmap_lock();
+        tb = tb_gen_superblock(cpu, tb);
+        mmap_unlock();
+        atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
     }
 #ifndef CONFIG_USER_ONLY
     /* We don't take care of direct jumps when address mapping changes in
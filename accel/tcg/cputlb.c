@@ -33,6 +33,7 @@
 #include "exec/helper-proto.h"
 #include "qemu/atomic.h"
 #include "qemu/atomic128.h"
+#include "qemu/timer.h"
 
 /* DEBUG defines, enable DEBUG_TLB_LOG to log to the CPU_LOG_MMU target */
 /* #define DEBUG_TLB */
@@ -74,16 +75,165 @@ QEMU_BUILD_BUG_ON(sizeof(target_ulong) > sizeof(run_on_cpu_data));
 QEMU_BUILD_BUG_ON(NB_MMU_MODES > 16);
 #define ALL_MMUIDX_BITS ((1 << NB_MMU_MODES) - 1)
 
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/* Use rates, in percent, outside of which the TLB is resized */
+#define TLB_RESIZE_GROW_RATE   70
+#define TLB_RESIZE_SHRINK_RATE 30
+
+/* The TLB is only shrunk after being underused for this long */
+#define TLB_RESIZE_WINDOW_NS   (100 * SCALE_MS)
+
+static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
+                             size_t max_entries)
+{
+    desc->window_begin_ns = ns;
+    desc->window_max_entries = max_entries;
+}
+
+static void tlb_dyn_init(CPUArchState *env)
+{
+    int i;
+
+    for (i = 0; i < NB_MMU_MODES; i++) {
+        size_t n_entries = 1 << CPU_TLB_DYN_DEFAULT_BITS;
+
+        tlb_window_reset(&env->tlb_d[i], get_clock_realtime(), 0);
+        env->tlb_d[i].n_used_entries = 0;
+        env->tlb_mask[i] = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
+        env->tlb_table[i] = g_new(CPUTLBEntry, n_entries);
+        env->iotlb[i] = g_new(CPUIOTLBEntry, n_entries);
+    }
+}
+
+static void tlb_dyn_destroy(CPUArchState *env)
+{
+    int i;
+
+    for (i = 0; i < NB_MMU_MODES; i++) {
+        g_free(env->tlb_table[i]);
+        g_free(env->iotlb[i]);
+    }
+}
+
+/*
+ * Called on every flush of @mmu_idx, before the table is cleared.
+ *
+ * The number of entries that were filled since the last flush tells how
+ * much of the table the guest's working set needs.  Grow the table as soon
+ * as the use rate goes above TLB_RESIZE_GROW_RATE, so that a large working
+ * set stops thrashing quickly.  Shrink it only when the highest use rate
+ * seen over a whole window of TLB_RESIZE_WINDOW_NS stayed below
+ * TLB_RESIZE_SHRINK_RATE; a small table makes flushes cheap, but one
+ * busy phase between many small ones should not cause repeated resizing.
+ */
+static void tlb_mmu_resize_locked(CPUArchState *env, int mmu_idx)
+{
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    size_t old_size = tlb_n_entries(env, mmu_idx);
+    size_t new_size = old_size;
+    int64_t now = get_clock_realtime();
+    bool window_expired = now > desc->window_begin_ns + TLB_RESIZE_WINDOW_NS;
+    size_t rate;
+
+    desc->window_max_entries = MAX(desc->window_max_entries,
+                                   desc->n_used_entries);
+    rate = desc->window_max_entries * 100 / old_size;
+
+    if (rate > TLB_RESIZE_GROW_RATE) {
+        new_size = MIN(old_size << 1, 1 << CPU_TLB_DYN_MAX_BITS);
+    } else if (rate < TLB_RESIZE_SHRINK_RATE && window_expired) {
+        size_t ceil = pow2ceil(desc->window_max_entries);
+
+        /*
+         * Leave room for growth, or a working set just below a power
+         * of two would be above TLB_RESIZE_GROW_RATE in the new table.
+         */
+        if (desc->window_max_entries * 100 / ceil > TLB_RESIZE_GROW_RATE) {
+            ceil *= 2;
+        }
+        new_size = MAX(ceil, 1 << CPU_TLB_DYN_MIN_BITS);
+    }
+
+    if (new_size == old_size) {
+        if (window_expired) {
+            tlb_window_reset(desc, now, desc->n_used_entries);
+        }
+        return;
+    }
+
+    g_free(env->tlb_table[mmu_idx]);
+    g_free(env->iotlb[mmu_idx]);
+
+    tlb_window_reset(desc, now, 0);
+    env->tlb_table[mmu_idx] = g_try_new(CPUTLBEntry, new_size);
+    env->iotlb[mmu_idx] = g_try_new(CPUIOTLBEntry, new_size);
+    /* Halve the size on allocation failure, down to the minimum */
+    while (env->tlb_table[mmu_idx] == NULL || env->iotlb[mmu_idx] == NULL) {
+        if (new_size == (1 << CPU_TLB_DYN_MIN_BITS)) {
+            error_report("%s: %s", __func__, strerror(errno));
+            abort();
+        }
+        new_size = MAX(new_size >> 1, 1 << CPU_TLB_DYN_MIN_BITS);
+
+        g_free(env->tlb_table[mmu_idx]);
+        g_free(env->iotlb[mmu_idx]);
+        env->tlb_table[mmu_idx] = g_try_new(CPUTLBEntry, new_size);
+        env->iotlb[mmu_idx] = g_try_new(CPUIOTLBEntry, new_size);
+    }
+    env->tlb_mask[mmu_idx] = (new_size - 1) << CPU_TLB_ENTRY_BITS;
+
+    atomic_set(&env->tlb_c.resize_count, env->tlb_c.resize_count + 1);
+}
+
+static inline void tlb_n_used_entries_inc(CPUArchState *env, int mmu_idx)
+{
+    env->tlb_d[mmu_idx].n_used_entries++;
+}
+
+static inline void tlb_n_used_entries_dec(CPUArchState *env, int mmu_idx)
+{
+    env->tlb_d[mmu_idx].n_used_entries--;
+}
+#else
+static inline void tlb_dyn_init(CPUArchState *env)
+{
+}
+
+static inline void tlb_dyn_destroy(CPUArchState *env)
+{
+}
+
+static inline void tlb_mmu_resize_locked(CPUArchState *env, int mmu_idx)
+{
+}
+
+static inline void tlb_n_used_entries_inc(CPUArchState *env, int mmu_idx)
+{
+}
+
+static inline void tlb_n_used_entries_dec(CPUArchState *env, int mmu_idx)
+{
+}
+#endif /* TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 void tlb_init(CPUState *cpu)
 {
     CPUArchState *env = cpu->env_ptr;
 
     qemu_spin_init(&env->tlb_c.lock);
+    tlb_dyn_init(env);
 
     /* Ensure that cpu_reset performs a full flush.  */
     env->tlb_c.dirty = ALL_MMUIDX_BITS;
 }
 
+void tlb_destroy(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+
+    tlb_dyn_destroy(env);
+}
+
 /* flush_all_helper: run fn across all cpus
  *
  * If the wait flag is set then the src cpu's helper will be queued as
@@ -120,13 +270,33 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+void tlb_victim_resize_counts(size_t *pvictim, size_t *presize)
+{
+    CPUState *cpu;
+    size_t victim = 0, resize = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        victim += atomic_read(&env->tlb_c.victim_hit_count);
+        resize += atomic_read(&env->tlb_c.resize_count);
+    }
+    *pvictim = victim;
+    *presize = resize;
+}
+
 static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx)
 {
-    memset(env->tlb_table[mmu_idx], -1, sizeof(env->tlb_table[0]));
+    tlb_mmu_resize_locked(env, mmu_idx);
+    memset(env->tlb_table[mmu_idx], -1,
+           tlb_n_entries(env, mmu_idx) * sizeof(CPUTLBEntry));
     memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
     env->tlb_d[mmu_idx].large_page_addr = -1;
     env->tlb_d[mmu_idx].large_page_mask = -1;
     env->tlb_d[mmu_idx].vindex = 0;
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    env->tlb_d[mmu_idx].n_used_entries = 0;
+#endif
 }
 
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
@@ -224,13 +394,20 @@ static inline bool tlb_hit_page_anyprot(CPUTLBEntry *tlb_entry,
            tlb_hit_page(tlb_entry->addr_code, page);
 }
 
+static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
+{
+    return te->addr_read == -1 && te->addr_write == -1 && te->addr_code == -1;
+}
+
 /* Called with tlb_c.lock held */
-static inline void tlb_flush_entry_locked(CPUTLBEntry *tlb_entry,
+static inline bool tlb_flush_entry_locked(CPUTLBEntry *tlb_entry,
                                           target_ulong page)
 {
     if (tlb_hit_page_anyprot(tlb_entry, page)) {
         memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
     }
+    return false;
 }
 
 /* Called with tlb_c.lock held */
@@ -258,7 +435,9 @@ static void tlb_flush_page_locked(CPUArchState *env, int midx,
                   midx, lp_addr, lp_mask);
         tlb_flush_one_mmuidx_locked(env, midx);
     } else {
-        tlb_flush_entry_locked(tlb_entry(env, midx, page), page);
+        if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
+            tlb_n_used_entries_dec(env, midx);
+        }
         tlb_flush_vtlb_page_locked(env, midx, page);
     }
 }
@@ -435,8 +614,9 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
     qemu_spin_lock(&env->tlb_c.lock);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         unsigned int i;
+        unsigned int n = tlb_n_entries(env, mmu_idx);
 
-        for (i = 0; i < CPU_TLB_SIZE; i++) {
+        for (i = 0; i < n; i++) {
             tlb_reset_dirty_range_locked(&env->tlb_table[mmu_idx][i], start1,
                                          length);
         }
@@ -591,7 +771,9 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
      * Only evict the old entry to the victim tlb if it's for a
      * different page; otherwise just overwrite the stale data.
      */
-    if (!tlb_hit_page_anyprot(te, vaddr_page)) {
+    if (tlb_entry_is_empty(te)) {
+        tlb_n_used_entries_inc(env, mmu_idx);
+    } else if (!tlb_hit_page_anyprot(te, vaddr_page)) {
         unsigned vidx = env->tlb_d[mmu_idx].vindex++ % CPU_VTLB_SIZE;
         CPUTLBEntry *tv = &env->tlb_v_table[mmu_idx][vidx];
 
@@ -701,6 +883,8 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
         tlb_fill(cpu, addr, size, MMU_DATA_LOAD, mmu_idx, retaddr);
 
         entry = tlb_entry(env, mmu_idx, addr);
+        /* The fill may have resized the TLB */
+        iotlbentry = &env->iotlb[mmu_idx][tlb_index(env, mmu_idx, addr)];
         tlb_addr = entry->addr_read;
         if (!(tlb_addr & ~(TARGET_PAGE_MASK | TLB_RECHECK))) {
             /* RAM access */
@@ -768,6 +952,8 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
         tlb_fill(cpu, addr, size, MMU_DATA_STORE, mmu_idx, retaddr);
 
         entry = tlb_entry(env, mmu_idx, addr);
+        /* The fill may have resized the TLB */
+        iotlbentry = &env->iotlb[mmu_idx][tlb_index(env, mmu_idx, addr)];
         tlb_addr = tlb_addr_write(entry);
         if (!(tlb_addr & ~(TARGET_PAGE_MASK | TLB_RECHECK))) {
             /* RAM access */
@@ -831,6 +1017,9 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             CPUTLBEntry tmptlb, *tlb = &env->tlb_table[mmu_idx][index];
 
             qemu_spin_lock(&env->tlb_c.lock);
+            if (tlb_entry_is_empty(tlb)) {
+                tlb_n_used_entries_inc(env, mmu_idx);
+            }
             copy_tlb_helper_locked(&tmptlb, tlb);
             copy_tlb_helper_locked(tlb, vtlb);
             copy_tlb_helper_locked(vtlb, &tmptlb);
@@ -839,6 +1028,9 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
             CPUIOTLBEntry tmpio, *io = &env->iotlb[mmu_idx][index];
             CPUIOTLBEntry *vio = &env->iotlb_v[mmu_idx][vidx];
             tmpio = *io; *io = *vio; *vio = tmpio;
+
+            atomic_set(&env->tlb_c.victim_hit_count,
+                       env->tlb_c.victim_hit_count + 1);
             return true;
         }
     }
@@ -865,6 +1057,8 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env, target_ulong addr)
     if (unlikely(!tlb_hit(entry->addr_code, addr))) {
         if (!VICTIM_TLB_HIT(addr_code, addr)) {
             tlb_fill(ENV_GET_CPU(env), addr, 0, MMU_INST_FETCH, mmu_idx, 0);
+            index = tlb_index(env, mmu_idx, addr);
+            entry = tlb_entry(env, mmu_idx, addr);
         }
         assert(tlb_hit(entry->addr_code, addr));
     }
@@ -945,6 +1139,8 @@ static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
         if (!VICTIM_TLB_HIT(addr_write, addr)) {
             tlb_fill(ENV_GET_CPU(env), addr, 1 << s_bits, MMU_DATA_STORE,
                      mmu_idx, retaddr);
+            index = tlb_index(env, mmu_idx, addr);
+            tlbe = tlb_entry(env, mmu_idx, addr);
         }
         tlb_addr = tlb_addr_write(tlbe) & ~TLB_INVALID_MASK;
     }
@@ -167,3 +167,9 @@ void HELPER(exit_atomic)(CPUArchState *env)
 {
     cpu_loop_exit_atomic(ENV_GET_CPU(env), GETPC());
 }
+
+/* vCPUs in different threads may run the same TB concurrently */
+uint32_t HELPER(tb_profile)(void *exec_count)
+{
+    return atomic_inc_fetch((uint32_t *)exec_count);
+}
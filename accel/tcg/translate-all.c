@@ -215,6 +215,7 @@ TCGContext tcg_init_ctx;
 __thread TCGContext *tcg_ctx;
 TBContext tb_ctx;
 bool parallel_cpus;
+unsigned int tb_superblock_threshold;
 
 static void page_table_config_init(void)
 {
@@ -1710,6 +1711,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->exec_count = 0;
+    tb->superblock_jumps = 0;
     tcg_ctx->tb_cflags = cflags;
 
 #ifdef CONFIG_PROFILER
@@ -1841,6 +1844,30 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     return tb;
 }
 
+/*
+ * Replace @tb, which has run tb_superblock_threshold times, with a
+ * superblock that starts at the same address.  The superblock is not
+ * profiled any more; the translator may use CF_SUPERBLOCK to extend it
+ * past the branches that would end a normal TB.
+ *
+ * Called with mmap_lock held for user mode emulation.
+ */
+TranslationBlock *tb_gen_superblock(CPUState *cpu, TranslationBlock *tb)
+{
+    uint32_t cflags = tb_cflags(tb);
+
+    cflags &= ~(CF_PROFILE | CF_INVALID);
+    cflags |= CF_SUPERBLOCK;
+
+    /*
+     * Remove @tb first, or tb_link_page() would find it in the hash table
+     * and discard the superblock.  If somebody else got here first, the
+     * superblock they generated is found instead.
+     */
+    tb_phys_invalidate(tb, -1);
+    return tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags, cflags);
+}
+
 /*
  * @p must be non-NULL.
  * user-mode: call with mmap_lock held.
@@ -2261,6 +2288,8 @@ struct tb_tree_stats {
     size_t direct_jmp_count;
     size_t direct_jmp2_count;
     size_t cross_page;
+    size_t superblocks;
+    size_t superblock_jumps;
 };
 
 static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
@@ -2277,6 +2306,10 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     if (tb->page_addr[1] != -1) {
         tst->cross_page++;
     }
+    if (tb->cflags & CF_SUPERBLOCK) {
+        tst->superblocks++;
+        tst->superblock_jumps += tb->superblock_jumps;
+    }
     if (tb->jmp_reset_offset[0] != TB_JMP_RESET_OFFSET_INVALID) {
         tst->direct_jmp_count++;
         if (tb->jmp_reset_offset[1] != TB_JMP_RESET_OFFSET_INVALID) {
@@ -2291,6 +2324,7 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t victim_hits, resizes;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -2312,6 +2346,9 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 tst.target_size ? (double)tst.host_size / tst.target_size : 0);
     cpu_fprintf(f, "cross page TB count %zu (%zu%%)\n", tst.cross_page,
             nb_tbs ? (tst.cross_page * 100) / nb_tbs : 0);
+    cpu_fprintf(f, "superblock count    %zu (%zu%%)\n", tst.superblocks,
+                nb_tbs ? (tst.superblocks * 100) / nb_tbs : 0);
+    cpu_fprintf(f, "superblock jumps    %zu\n", tst.superblock_jumps);
     cpu_fprintf(f, "direct jump count   %zu (%zu%%) (2 jumps=%zu %zu%%)\n",
                 tst.direct_jmp_count,
                 nb_tbs ? (tst.direct_jmp_count * 100) / nb_tbs : 0,
@@ -2331,6 +2368,9 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
     cpu_fprintf(f, "TLB full flushes    %zu\n", flush_full);
     cpu_fprintf(f, "TLB partial flushes %zu\n", flush_part);
     cpu_fprintf(f, "TLB elided flushes  %zu\n", flush_elide);
+    tlb_victim_resize_counts(&victim_hits, &resizes);
+    cpu_fprintf(f, "TLB victim hits     %zu\n", victim_hits);
+    cpu_fprintf(f, "TLB resizes         %zu\n", resizes);
     tcg_dump_info(f, cpu_fprintf);
 }
 
@@ -3513,6 +3513,7 @@ static void bdrv_close(BlockDriverState *bs)
     bs->total_sectors = 0;
     bs->encrypted = false;
     bs->sg = false;
+    memset(&bs->block_status_cache, 0, sizeof(bs->block_status_cache));
     qobject_unref(bs->options);
     qobject_unref(bs->explicit_options);
     bs->options = NULL;
@@ -4527,6 +4528,9 @@ static void coroutine_fn bdrv_co_invalidate_cache(BlockDriverState *bs,
     }
     bdrv_set_perm(bs, perm, shared_perm);
 
+    /* The migration source may have discarded data since we looked */
+    bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
+
     if (bs->drv->bdrv_co_invalidate_cache) {
         bs->drv->bdrv_co_invalidate_cache(bs, &local_err);
         if (local_err) {
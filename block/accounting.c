@@ -27,6 +27,7 @@
 #include "block/accounting.h"
 #include "block/block_int.h"
 #include "qemu/timer.h"
+#include "qemu/host-utils.h"
 #include "sysemu/qtest.h"
 
 static QEMUClockType clock_type = QEMU_CLOCK_REALTIME;
@@ -53,9 +54,28 @@ void block_acct_cleanup(BlockAcctStats *stats)
     QSLIST_FOREACH_SAFE(s, &stats->intervals, entries, next) {
         g_free(s);
     }
+    g_free(stats->queues);
     qemu_mutex_destroy(&stats->lock);
 }
 
+/*
+ * Keep separate latency histograms for @nr_queues device queues, in
+ * addition to the ones for the whole device.  Devices call this when they
+ * are realized, and again with @nr_queues == 0 when they go away.
+ * Requests that complete after a reset are only accounted for the device.
+ */
+void block_acct_setup_queues(BlockAcctStats *stats, unsigned nr_queues)
+{
+    BlockAcctQueueStats *old;
+
+    qemu_mutex_lock(&stats->lock);
+    old = stats->queues;
+    stats->queues = nr_queues ? g_new0(BlockAcctQueueStats, nr_queues) : NULL;
+    stats->nr_queues = nr_queues;
+    qemu_mutex_unlock(&stats->lock);
+    g_free(old);
+}
+
 void block_acct_add_interval(BlockAcctStats *stats, unsigned interval_length)
 {
     BlockAcctTimedStats *s;
@@ -92,6 +112,87 @@ void block_acct_start(BlockAcctStats *stats, BlockAcctCookie *cookie,
     cookie->bytes = bytes;
     cookie->start_time_ns = qemu_clock_get_ns(clock_type);
     cookie->type = type;
+    cookie->queue = -1;
+}
+
+/* Account the request of @cookie to device queue @queue as well */
+void block_acct_set_queue(BlockAcctStats *stats, BlockAcctCookie *cookie,
+                          unsigned queue)
+{
+    if (queue < stats->nr_queues) {
+        cookie->queue = queue;
+    }
+}
+
+static int block_latency_hdr_index(uint64_t latency_ns)
+{
+    int exp;
+
+    if (latency_ns < (1 << BLOCK_LATENCY_SUB_BITS)) {
+        return latency_ns;
+    }
+
+    exp = 63 - clz64(latency_ns);
+    if (exp >= BLOCK_LATENCY_MAX_EXP) {
+        return BLOCK_LATENCY_BUCKETS - 1;
+    }
+
+    /* The leading bit selects the group, the next SUB_BITS the bucket */
+    return ((exp - BLOCK_LATENCY_SUB_BITS + 1) << BLOCK_LATENCY_SUB_BITS) +
+           ((latency_ns >> (exp - BLOCK_LATENCY_SUB_BITS)) &
+            ((1 << BLOCK_LATENCY_SUB_BITS) - 1));
+}
+
+/* Return the highest latency that falls into bucket @index */
+static uint64_t block_latency_hdr_value(int index)
+{
+    int group = index >> BLOCK_LATENCY_SUB_BITS;
+    uint64_t sub = index & ((1 << BLOCK_LATENCY_SUB_BITS) - 1);
+
+    if (group == 0) {
+        return index;
+    }
+    return (((1 << BLOCK_LATENCY_SUB_BITS) + sub + 1) << (group - 1)) - 1;
+}
+
+void block_latency_hdr_account(BlockLatencyHdr *hdr, uint64_t latency_ns)
+{
+    stat64_add(&hdr->buckets[block_latency_hdr_index(latency_ns)], 1);
+}
+
+/*
+ * Compute @n percentiles of @hdr.  @per_mille must be sorted in
+ * ascending order; for example 500 requests the median.  Each result in
+ * @values is the highest latency of the bucket that holds the request at
+ * that rank.  Return the number of requests in the histogram; if it is
+ * zero, @values is left untouched.
+ *
+ * Concurrent updates may be partially visible, which is harmless.
+ */
+uint64_t block_latency_hdr_percentiles(BlockLatencyHdr *hdr, int n,
+                                       const unsigned *per_mille,
+                                       uint64_t *values)
+{
+    uint64_t counts[BLOCK_LATENCY_BUCKETS];
+    uint64_t total = 0, seen = 0;
+    int i, j = 0;
+
+    for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++) {
+        counts[i] = stat64_get(&hdr->buckets[i]);
+        total += counts[i];
+    }
+    if (!total) {
+        return 0;
+    }
+
+    for (i = 0; i < BLOCK_LATENCY_BUCKETS && j < n; i++) {
+        seen += counts[i];
+        /* The request at rank ceil(total * per_mille / 1000) */
+        while (j < n && seen * 1000 >= total * per_mille[j]) {
+            values[j++] = block_latency_hdr_value(i);
+        }
+    }
+    return total;
 }
 
 /* block_latency_histogram_compare_func:
@@ -195,8 +296,20 @@ static void block_account_one_io(BlockAcctStats *stats, BlockAcctCookie *cookie,
 
     assert(cookie->type < BLOCK_MAX_IOTYPE);
 
+    if (!failed || stats->account_failed) {
+        block_latency_hdr_account(&stats->latency_hdr[cookie->type],
+                                  latency_ns);
+    }
+
     qemu_mutex_lock(&stats->lock);
 
+    /* The queues may have been reset since the request was started */
+    if ((!failed || stats->account_failed) && cookie->queue >= 0 &&
+        cookie->queue < stats->nr_queues) {
+        BlockAcctQueueStats *qs = &stats->queues[cookie->queue];
+        block_latency_hdr_account(&qs->latency_hdr[cookie->type], latency_ns);
+    }
+
     if (failed) {
         stats->failed_ops[cookie->type]++;
     } else {
@@ -256,6 +369,21 @@ void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
     qemu_mutex_unlock(&stats->lock);
 }
 
+/*
+ * Account @num_requests requests that were merged into a request from an
+ * earlier submission batch, because the device held that request back.
+ * They must also be passed to block_acct_merge_done().
+ */
+void block_acct_merge_window_done(BlockAcctStats *stats,
+                                  enum BlockAcctType type, int num_requests)
+{
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    qemu_mutex_lock(&stats->lock);
+    stats->merged_window[type] += num_requests;
+    qemu_mutex_unlock(&stats->lock);
+}
+
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats)
 {
     return qemu_clock_get_ns(clock_type) - stats->last_access_time_ns;
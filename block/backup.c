@@ -27,6 +27,7 @@
 #include "qemu/error-report.h"
 
 #define BACKUP_CLUSTER_SIZE_DEFAULT (1 << 16)
+#define BACKUP_WORKER_STEP_MAX (1 << 20)
 
 typedef struct BackupBlockJob {
     BlockJob common;
@@ -38,145 +39,22 @@ typedef struct BackupBlockJob {
     BlockdevOnError on_target_error;
     CoRwlock flush_rwlock;
     uint64_t len;
-    uint64_t bytes_read;
     int64_t cluster_size;
-    bool compress;
     NotifierWithReturn before_write;
-    QLIST_HEAD(, CowRequest) inflight_reqs;
 
-    HBitmap *copy_bitmap;
-    bool use_copy_range;
-    int64_t copy_range_size;
-
-    bool serialize_target_writes;
+    BlockCopyState *bcs;
 } BackupBlockJob;
 
 static const BlockJobDriver backup_job_driver;
 
-/* See if in-flight requests overlap and wait for them to complete */
-static void coroutine_fn wait_for_overlapping_requests(BackupBlockJob *job,
-                                                       int64_t start,
-                                                       int64_t end)
-{
-    CowRequest *req;
-    bool retry;
-
-    do {
-        retry = false;
-        QLIST_FOREACH(req, &job->inflight_reqs, list) {
-            if (end > req->start_byte && start < req->end_byte) {
-                qemu_co_queue_wait(&req->wait_queue, NULL);
-                retry = true;
-                break;
-            }
-        }
-    } while (retry);
-}
-
-/* Keep track of an in-flight request */
-static void cow_request_begin(CowRequest *req, BackupBlockJob *job,
-                              int64_t start, int64_t end)
-{
-    req->start_byte = start;
-    req->end_byte = end;
-    qemu_co_queue_init(&req->wait_queue);
-    QLIST_INSERT_HEAD(&job->inflight_reqs, req, list);
-}
-
-/* Forget about a completed request */
-static void cow_request_end(CowRequest *req)
+static void backup_progress_bytes_callback(int64_t bytes, void *opaque)
 {
-    QLIST_REMOVE(req, list);
-    qemu_co_queue_restart_all(&req->wait_queue);
-}
-
-/* Copy range to target with a bounce buffer and return the bytes copied. If
- * error occurred, return a negative error number */
-static int coroutine_fn backup_cow_with_bounce_buffer(BackupBlockJob *job,
-                                                      int64_t start,
-                                                      int64_t end,
-                                                      bool is_write_notifier,
-                                                      bool *error_is_read,
-                                                      void **bounce_buffer)
-{
-    int ret;
-    struct iovec iov;
-    QEMUIOVector qiov;
-    BlockBackend *blk = job->common.blk;
-    int nbytes;
-    int read_flags = is_write_notifier ? BDRV_REQ_NO_SERIALISING : 0;
-    int write_flags = job->serialize_target_writes ? BDRV_REQ_SERIALISING : 0;
-
-    hbitmap_reset(job->copy_bitmap, start / job->cluster_size, 1);
-    nbytes = MIN(job->cluster_size, job->len - start);
-    if (!*bounce_buffer) {
-        *bounce_buffer = blk_blockalign(blk, job->cluster_size);
-    }
-    iov.iov_base = *bounce_buffer;
-    iov.iov_len = nbytes;
-    qemu_iovec_init_external(&qiov, &iov, 1);
-
-    ret = blk_co_preadv(blk, start, qiov.size, &qiov, read_flags);
-    if (ret < 0) {
-        trace_backup_do_cow_read_fail(job, start, ret);
-        if (error_is_read) {
-            *error_is_read = true;
-        }
-        goto fail;
-    }
-
-    if (qemu_iovec_is_zero(&qiov)) {
-        ret = blk_co_pwrite_zeroes(job->target, start,
-                                   qiov.size, write_flags | BDRV_REQ_MAY_UNMAP);
-    } else {
-        ret = blk_co_pwritev(job->target, start,
-                             qiov.size, &qiov, write_flags |
-                             (job->compress ? BDRV_REQ_WRITE_COMPRESSED : 0));
-    }
-    if (ret < 0) {
-        trace_backup_do_cow_write_fail(job, start, ret);
-        if (error_is_read) {
-            *error_is_read = false;
-        }
-        goto fail;
-    }
-
-    return nbytes;
-fail:
-    hbitmap_set(job->copy_bitmap, start / job->cluster_size, 1);
-    return ret;
+    BackupBlockJob *s = opaque;
 
-}
-
-/* Copy range to target and return the bytes copied. If error occurred, return a
- * negative error number. */
-static int coroutine_fn backup_cow_with_offload(BackupBlockJob *job,
-                                                int64_t start,
-                                                int64_t end,
-                                                bool is_write_notifier)
-{
-    int ret;
-    int nr_clusters;
-    BlockBackend *blk = job->common.blk;
-    int nbytes;
-    int read_flags = is_write_notifier ? BDRV_REQ_NO_SERIALISING : 0;
-    int write_flags = job->serialize_target_writes ? BDRV_REQ_SERIALISING : 0;
-
-    assert(QEMU_IS_ALIGNED(job->copy_range_size, job->cluster_size));
-    nbytes = MIN(job->copy_range_size, end - start);
-    nr_clusters = DIV_ROUND_UP(nbytes, job->cluster_size);
-    hbitmap_reset(job->copy_bitmap, start / job->cluster_size,
-                  nr_clusters);
-    ret = blk_co_copy_range(blk, start, job->target, start, nbytes,
-                            read_flags, write_flags);
-    if (ret < 0) {
-        trace_backup_do_cow_copy_range_fail(job, start, ret);
-        hbitmap_set(job->copy_bitmap, start / job->cluster_size,
-                    nr_clusters);
-        return ret;
-    }
-
-    return nbytes;
+    /* Publish progress, guest I/O counts as progress too.  Note that the
+     * offset field is an opaque progress value, it is not a disk offset.
+     */
+    job_progress_update(&s->common.job, bytes);
 }
 
 static int coroutine_fn backup_do_cow(BackupBlockJob *job,
@@ -184,58 +62,15 @@ static int coroutine_fn backup_do_cow(BackupBlockJob *job,
                                       bool *error_is_read,
                                       bool is_write_notifier)
 {
-    CowRequest cow_request;
-    int ret = 0;
-    int64_t start, end; /* bytes */
-    void *bounce_buffer = NULL;
+    int ret;
 
     qemu_co_rwlock_rdlock(&job->flush_rwlock);
 
-    start = QEMU_ALIGN_DOWN(offset, job->cluster_size);
-    end = QEMU_ALIGN_UP(bytes + offset, job->cluster_size);
-
-    trace_backup_do_cow_enter(job, start, offset, bytes);
+    trace_backup_do_cow_enter(job, QEMU_ALIGN_DOWN(offset, job->cluster_size),
+                              offset, bytes);
 
-    wait_for_overlapping_requests(job, start, end);
-    cow_request_begin(&cow_request, job, start, end);
-
-    while (start < end) {
-        if (!hbitmap_get(job->copy_bitmap, start / job->cluster_size)) {
-            trace_backup_do_cow_skip(job, start);
-            start += job->cluster_size;
-            continue; /* already copied */
-        }
-
-        trace_backup_do_cow_process(job, start);
-
-        if (job->use_copy_range) {
-            ret = backup_cow_with_offload(job, start, end, is_write_notifier);
-            if (ret < 0) {
-                job->use_copy_range = false;
-            }
-        }
-        if (!job->use_copy_range) {
-            ret = backup_cow_with_bounce_buffer(job, start, end, is_write_notifier,
-                                                error_is_read, &bounce_buffer);
-        }
-        if (ret < 0) {
-            break;
-        }
-
-        /* Publish progress, guest I/O counts as progress too.  Note that the
-         * offset field is an opaque progress value, it is not a disk offset.
-         */
-        start += ret;
-        job->bytes_read += ret;
-        job_progress_update(&job->common.job, ret);
-        ret = 0;
-    }
-
-    if (bounce_buffer) {
-        qemu_vfree(bounce_buffer);
-    }
-
-    cow_request_end(&cow_request);
+    ret = block_copy(job->bcs, offset, bytes, error_is_read,
+                     is_write_notifier);
 
     trace_backup_do_cow_return(job, offset, bytes, ret);
 
@@ -294,6 +129,8 @@ static void backup_clean(Job *job)
 {
     BackupBlockJob *s = container_of(job, BackupBlockJob, common.job);
     assert(s->target);
+    block_copy_state_free(s->bcs);
+    s->bcs = NULL;
     blk_unref(s->target);
     s->target = NULL;
 }
@@ -319,38 +156,32 @@ void backup_do_checkpoint(BlockJob *job, Error **errp)
     }
 
     len = DIV_ROUND_UP(backup_job->len, backup_job->cluster_size);
-    hbitmap_set(backup_job->copy_bitmap, 0, len);
+    hbitmap_set(backup_job->bcs->copy_bitmap, 0, len);
 }
 
 void backup_wait_for_overlapping_requests(BlockJob *job, int64_t offset,
                                           uint64_t bytes)
 {
     BackupBlockJob *backup_job = container_of(job, BackupBlockJob, common);
-    int64_t start, end;
 
     assert(block_job_driver(job) == &backup_job_driver);
 
-    start = QEMU_ALIGN_DOWN(offset, backup_job->cluster_size);
-    end = QEMU_ALIGN_UP(offset + bytes, backup_job->cluster_size);
-    wait_for_overlapping_requests(backup_job, start, end);
+    block_copy_wait_for_overlapping(backup_job->bcs, offset, bytes);
 }
 
 void backup_cow_request_begin(CowRequest *req, BlockJob *job,
                               int64_t offset, uint64_t bytes)
 {
     BackupBlockJob *backup_job = container_of(job, BackupBlockJob, common);
-    int64_t start, end;
 
     assert(block_job_driver(job) == &backup_job_driver);
 
-    start = QEMU_ALIGN_DOWN(offset, backup_job->cluster_size);
-    end = QEMU_ALIGN_UP(offset + bytes, backup_job->cluster_size);
-    cow_request_begin(req, backup_job, start, end);
+    block_copy_inflight_req_begin(backup_job->bcs, req, offset, bytes);
 }
 
 void backup_cow_request_end(CowRequest *req)
 {
-    cow_request_end(req);
+    block_copy_inflight_req_end(req);
 }
 
 static void backup_drain(BlockJob *job)
@@ -390,8 +221,7 @@ static bool coroutine_fn yield_and_check(BackupBlockJob *job)
 
     /* We need to yield even for delay_ns = 0 so that bdrv_drain_all() can
      * return. Without a yield, the VM would not reboot. */
-    delay_ns = block_job_ratelimit_get_delay(&job->common, job->bytes_read);
-    job->bytes_read = 0;
+    delay_ns = block_copy_ratelimit_get_delay(job->bcs);
     job_sleep_ns(&job->common.job, delay_ns);
 
     if (job_is_cancelled(&job->common.job)) {
@@ -401,27 +231,108 @@ static bool coroutine_fn yield_and_check(BackupBlockJob *job)
     return false;
 }
 
-static int coroutine_fn backup_run_incremental(BackupBlockJob *job)
+/* Number of bytes to hand to block_copy() between two rate limit checks */
+static int64_t backup_step_bytes(BackupBlockJob *job)
+{
+    /* Copy offload requests can be large, but pause and cancel requests
+     * should not have to wait for several of them per worker */
+    int64_t worker_step = MIN(job->bcs->copy_size,
+                              MAX(job->cluster_size, BACKUP_WORKER_STEP_MAX));
+    int64_t step = worker_step * job->bcs->max_workers;
+
+    if (job->common.speed) {
+        /* Do not burst much beyond what one ratelimit slice allows */
+        step = MIN(step, QEMU_ALIGN_UP(job->common.speed / 10,
+                                       job->cluster_size));
+    }
+    return step;
+}
+
+/* For sync=top, find out whether the cluster at @offset has data in the
+ * topmost image.  *pnum is set to the number of consecutive clusters,
+ * starting at @offset, that are in the same state.  A cluster counts as
+ * allocated if any part of it is. */
+static int backup_is_cluster_allocated(BackupBlockJob *job, int64_t offset,
+                                       int64_t *pnum)
 {
+    BlockDriverState *bs = blk_bs(job->common.blk);
+    int64_t count, total_count = 0;
+    int64_t bytes = job->len - offset;
     int ret;
-    bool error_is_read;
-    int64_t cluster;
+
+    assert(QEMU_IS_ALIGNED(offset, job->cluster_size));
+
+    while (true) {
+        ret = bdrv_is_allocated(bs, offset, bytes, &count);
+        if (ret < 0) {
+            return ret;
+        }
+
+        total_count += count;
+
+        if (ret || count == 0) {
+            /* Allocated data makes the whole (partial) cluster allocated;
+             * an unallocated tail counts as a whole cluster. */
+            *pnum = DIV_ROUND_UP(total_count, job->cluster_size);
+            return ret;
+        }
+
+        /* Unallocated so far, the rest of the cluster still has to be
+         * checked unless it is complete already. */
+        if (total_count >= job->cluster_size) {
+            *pnum = total_count / job->cluster_size;
+            return 0;
+        }
+
+        offset += count;
+        bytes -= count;
+    }
+}
+
+static int coroutine_fn backup_loop(BackupBlockJob *job)
+{
+    HBitmap *copy_bitmap = job->bcs->copy_bitmap;
     HBitmapIter hbi;
+    int64_t cluster;
+    int ret;
 
-    hbitmap_iter_init(&hbi, job->copy_bitmap, 0);
+    hbitmap_iter_init(&hbi, copy_bitmap, 0);
     while ((cluster = hbitmap_iter_next(&hbi, true)) != -1) {
-        do {
-            if (yield_and_check(job)) {
-                return 0;
-            }
-            ret = backup_do_cow(job, cluster * job->cluster_size,
-                                job->cluster_size, &error_is_read, false);
-            if (ret < 0 && backup_error_action(job, error_is_read, -ret) ==
-                           BLOCK_ERROR_ACTION_REPORT)
-            {
-                return ret;
+        int64_t offset = cluster * job->cluster_size;
+        int64_t bytes = MIN(backup_step_bytes(job), job->len - offset);
+        bool error_is_read = false;
+
+        if (yield_and_check(job)) {
+            return 0;
+        }
+
+        ret = 0;
+        if (job->sync_mode == MIRROR_SYNC_MODE_TOP) {
+            int64_t nr_clusters;
+
+            ret = backup_is_cluster_allocated(job, offset, &nr_clusters);
+            if (ret == 0) {
+                /* Nothing to copy, the target has the same backing chain */
+                hbitmap_reset(copy_bitmap, cluster, nr_clusters);
+            } else if (ret > 0) {
+                bytes = MIN(bytes, nr_clusters * job->cluster_size);
+            } else {
+                error_is_read = true;
             }
-        } while (ret < 0);
+        }
+
+        if (ret > 0 || job->sync_mode != MIRROR_SYNC_MODE_TOP) {
+            ret = backup_do_cow(job, offset, bytes, &error_is_read, false);
+        }
+        if (ret < 0 && backup_error_action(job, error_is_read, -ret) ==
+                       BLOCK_ERROR_ACTION_REPORT)
+        {
+            return ret;
+        }
+
+        /* Clusters that were copied are clean now, failed ones are retried.
+         * Restart from here so that no stale part of the iterator is used. */
+        hbitmap_iter_init(&hbi, copy_bitmap, cluster);
     }
 
     return 0;
@@ -442,18 +353,18 @@ static void backup_incremental_init_copy_bitmap(BackupBlockJob *job)
 
         offset += bdrv_dirty_bitmap_granularity(job->sync_bitmap);
         if (offset >= bdrv_dirty_bitmap_size(job->sync_bitmap)) {
-            hbitmap_set(job->copy_bitmap, cluster, end - cluster);
+            hbitmap_set(job->bcs->copy_bitmap, cluster, end - cluster);
             break;
         }
 
         offset = bdrv_dirty_bitmap_next_zero(job->sync_bitmap, offset);
         if (offset == -1) {
-            hbitmap_set(job->copy_bitmap, cluster, end - cluster);
+            hbitmap_set(job->bcs->copy_bitmap, cluster, end - cluster);
             break;
         }
 
         next_cluster = DIV_ROUND_UP(offset, job->cluster_size);
-        hbitmap_set(job->copy_bitmap, cluster, next_cluster - cluster);
+        hbitmap_set(job->bcs->copy_bitmap, cluster, next_cluster - cluster);
         if (next_cluster >= end) {
             break;
         }
@@ -463,7 +374,7 @@ static void backup_incremental_init_copy_bitmap(BackupBlockJob *job)
 
     /* TODO job_progress_set_remaining() would make more sense */
     job_progress_update(&job->common.job,
-        job->len - hbitmap_count(job->copy_bitmap) * job->cluster_size);
+        job->len - hbitmap_count(job->bcs->copy_bitmap) * job->cluster_size);
 
     bdrv_dirty_iter_free(dbi);
 }
@@ -472,20 +383,18 @@ static int coroutine_fn backup_run(Job *job, Error **errp)
 {
     BackupBlockJob *s = container_of(job, BackupBlockJob, common.job);
     BlockDriverState *bs = blk_bs(s->common.blk);
-    int64_t offset, nb_clusters;
+    int64_t nb_clusters;
     int ret = 0;
 
-    QLIST_INIT(&s->inflight_reqs);
     qemu_co_rwlock_init(&s->flush_rwlock);
 
     nb_clusters = DIV_ROUND_UP(s->len, s->cluster_size);
     job_progress_set_remaining(job, s->len);
 
-    s->copy_bitmap = hbitmap_alloc(nb_clusters, 0);
     if (s->sync_mode == MIRROR_SYNC_MODE_INCREMENTAL) {
         backup_incremental_init_copy_bitmap(s);
     } else {
-        hbitmap_set(s->copy_bitmap, 0, nb_clusters);
+        hbitmap_set(s->bcs->copy_bitmap, 0, nb_clusters);
     }
 
 
@@ -500,68 +409,9 @@ static int coroutine_fn backup_run(Job *job, Error **errp)
              * notify callback service CoW requests. */
             job_yield(job);
         }
-    } else if (s->sync_mode == MIRROR_SYNC_MODE_INCREMENTAL) {
-        ret = backup_run_incremental(s);
     } else {
-        /* Both FULL and TOP SYNC_MODE's require copying.. */
-        for (offset = 0; offset < s->len;
-             offset += s->cluster_size) {
-            bool error_is_read;
-            int alloced = 0;
-
-            if (yield_and_check(s)) {
-                break;
-            }
-
-            if (s->sync_mode == MIRROR_SYNC_MODE_TOP) {
-                int i;
-                int64_t n;
-
-                /* Check to see if these blocks are already in the
-                 * backing file. */
-
-                for (i = 0; i < s->cluster_size;) {
-                    /* bdrv_is_allocated() only returns true/false based
-                     * on the first set of sectors it comes across that
-                     * are are all in the same state.
-                     * For that reason we must verify each sector in the
-                     * backup cluster length.  We end up copying more than
-                     * needed but at some point that is always the case. */
-                    alloced =
-                        bdrv_is_allocated(bs, offset + i,
-                                          s->cluster_size - i, &n);
-                    i += n;
-
-                    if (alloced || n == 0) {
-                        break;
-                    }
-                }
-
-                /* If the above loop never found any sectors that are in
-                 * the topmost image, skip this backup. */
-                if (alloced == 0) {
-                    continue;
-                }
-            }
-            /* FULL sync mode we copy the whole drive. */
-            if (alloced < 0) {
-                ret = alloced;
-            } else {
-                ret = backup_do_cow(s, offset, s->cluster_size,
-                                    &error_is_read, false);
-            }
-            if (ret < 0) {
-                /* Depending on error action, fail now or retry cluster */
-                BlockErrorAction action =
-                    backup_error_action(s, error_is_read, -ret);
-                if (action == BLOCK_ERROR_ACTION_REPORT) {
-                    break;
-                } else {
-                    offset -= s->cluster_size;
-                    continue;
-                }
-            }
-        }
+        /* FULL, TOP and INCREMENTAL all copy what is left in copy_bitmap */
+        ret = backup_loop(s);
     }
 
     notifier_with_return_remove(&s->before_write);
@@ -569,11 +419,20 @@ static int coroutine_fn backup_run(Job *job, Error **errp)
     /* wait until pending backup_do_cow() calls have completed */
     qemu_co_rwlock_wrlock(&s->flush_rwlock);
     qemu_co_rwlock_unlock(&s->flush_rwlock);
-    hbitmap_free(s->copy_bitmap);
 
     return ret;
 }
 
+static void backup_set_speed(BlockJob *job, int64_t speed)
+{
+    BackupBlockJob *s = container_of(job, BackupBlockJob, common);
+
+    /* block_job_create() sets the speed before the copy state exists */
+    if (s->bcs) {
+        block_copy_set_speed(s->bcs, speed);
+    }
+}
+
 static const BlockJobDriver backup_job_driver = {
     .job_driver = {
         .instance_size          = sizeof(BackupBlockJob),
@@ -588,12 +447,13 @@ static const BlockJobDriver backup_job_driver = {
     },
     .attached_aio_context   = backup_attached_aio_context,
     .drain                  = backup_drain,
+    .set_speed              = backup_set_speed,
 };
 
 BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *target, int64_t speed,
                   MirrorSyncMode sync_mode, BdrvDirtyBitmap *sync_bitmap,
-                  bool compress,
+                  bool compress, int64_t max_workers,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
                   int creation_flags,
@@ -603,6 +463,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     int64_t len;
     BlockDriverInfo bdi;
     BackupBlockJob *job = NULL;
+    BdrvRequestFlags write_flags = 0;
     int ret;
 
     assert(bs);
@@ -625,6 +486,15 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
         return NULL;
     }
 
+    if (max_workers < 0 || max_workers > BLOCK_COPY_MAX_WORKERS) {
+        error_setg(errp, "Invalid parameter 'max-workers'");
+        return NULL;
+    }
+
+    if (max_workers == 0) {
+        max_workers = BLOCK_COPY_DEFAULT_WORKERS;
+    }
+
     if (compress && target->drv->bdrv_co_pwritev_compressed == NULL) {
         error_setg(errp, "Compression is not supported for this drive %s",
                    bdrv_get_device_name(target));
@@ -689,10 +559,6 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     job->sync_mode = sync_mode;
     job->sync_bitmap = sync_mode == MIRROR_SYNC_MODE_INCREMENTAL ?
                        sync_bitmap : NULL;
-    job->compress = compress;
-
-    /* Detect image-fleecing (and similar) schemes */
-    job->serialize_target_writes = bdrv_chain_contains(target, bs);
 
     /* If there is no backing file on the target, we cannot rely on COW if our
      * backup cluster size is smaller than the target cluster size. Even for
@@ -720,12 +586,24 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     } else {
         job->cluster_size = MAX(BACKUP_CLUSTER_SIZE_DEFAULT, bdi.cluster_size);
     }
-    job->use_copy_range = true;
-    job->copy_range_size = MIN_NON_ZERO(blk_get_max_transfer(job->common.blk),
-                                        blk_get_max_transfer(job->target));
-    job->copy_range_size = MAX(job->cluster_size,
-                               QEMU_ALIGN_UP(job->copy_range_size,
-                                             job->cluster_size));
+
+    /* Detect image-fleecing (and similar) schemes */
+    if (bdrv_chain_contains(target, bs)) {
+        write_flags |= BDRV_REQ_SERIALISING;
+    }
+    if (compress) {
+        write_flags |= BDRV_REQ_WRITE_COMPRESSED;
+    }
+
+    job->bcs = block_copy_state_new(job->common.blk, job->target,
+                                    job->cluster_size, max_workers,
+                                    write_flags, errp);
+    if (!job->bcs) {
+        goto error;
+    }
+    job->bcs->detect_zeroes = true;
+    block_copy_set_callbacks(job->bcs, backup_progress_bytes_callback, job);
+    block_copy_set_speed(job->bcs, speed);
 
     /* Required permissions are already taken with target's blk_new() */
     block_job_add_bdrv(&job->common, "target", target, 0, BLK_PERM_ALL,
@@ -0,0 +1,378 @@
+/*
+ * block_copy API
+ *
+ * Copy clusters between two BlockBackends, through copy offload where
+ * possible and with several requests in flight.  The copy logic started out
+ * in block/backup.c.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "trace.h"
+#include "qapi/error.h"
+#include "block/block_int.h"
+#include "block/block-copy.h"
+#include "sysemu/block-backend.h"
+#include "qemu/cutils.h"
+#include "qemu/units.h"
+
+#define BLOCK_COPY_MAX_BUFFER (1 * MiB)
+#define BLOCK_COPY_MAX_COPY_RANGE (16 * MiB)
+#define BLOCK_COPY_SLICE_TIME 100000000ULL /* ns */
+
+/* State of one block_copy() call and the workers it has spawned */
+typedef struct BlockCopyCallState {
+    Coroutine *co;
+    int in_flight;
+    bool waiting;
+    int ret;
+    bool error_is_read;
+} BlockCopyCallState;
+
+typedef struct BlockCopyTask {
+    BlockCopyState *s;
+    BlockCopyCallState *call;
+    int64_t offset;
+    int64_t bytes;
+    BdrvRequestFlags read_flags;
+} BlockCopyTask;
+
+static int64_t block_copy_bounce_size(BlockCopyState *s)
+{
+    if (s->write_flags & BDRV_REQ_WRITE_COMPRESSED) {
+        /* Compressed writes must be exactly one cluster */
+        return s->cluster_size;
+    }
+    return MAX(s->cluster_size, BLOCK_COPY_MAX_BUFFER);
+}
+
+BlockCopyState *block_copy_state_new(BlockBackend *source,
+                                     BlockBackend *target,
+                                     int64_t cluster_size, int max_workers,
+                                     BdrvRequestFlags write_flags,
+                                     Error **errp)
+{
+    BlockCopyState *s;
+    int64_t len;
+    uint32_t max_transfer;
+
+    assert(cluster_size > 0 && max_workers >= 0);
+
+    len = blk_getlength(source);
+    if (len < 0) {
+        error_setg_errno(errp, -len, "unable to get length for '%s'",
+                         blk_name(source));
+        return NULL;
+    }
+
+    s = g_new(BlockCopyState, 1);
+    *s = (BlockCopyState) {
+        .source             = source,
+        .target             = target,
+        .cluster_size       = cluster_size,
+        .len                = len,
+        .max_workers        = max_workers,
+        .write_flags        = write_flags,
+    };
+    if (max_workers) {
+        s->copy_bitmap = hbitmap_alloc(DIV_ROUND_UP(len, cluster_size), 0);
+    }
+    QLIST_INIT(&s->inflight_reqs);
+
+    max_transfer = MIN(blk_get_max_transfer(source),
+                       blk_get_max_transfer(target));
+    max_transfer = MIN(max_transfer, BLOCK_COPY_MAX_COPY_RANGE);
+
+    /*
+     * Compressed writes are cluster-sized, and copy offload cannot do
+     * partial-cluster requests when the transfer limit is below the
+     * cluster size.
+     */
+    s->use_copy_range = !(write_flags & BDRV_REQ_WRITE_COMPRESSED) &&
+                        max_transfer >= cluster_size;
+    if (s->use_copy_range) {
+        s->copy_size = QEMU_ALIGN_DOWN(max_transfer, cluster_size);
+    } else {
+        s->copy_size = block_copy_bounce_size(s);
+    }
+
+    return s;
+}
+
+void block_copy_set_callbacks(BlockCopyState *s,
+                              ProgressBytesCallbackFunc progress_bytes_callback,
+                              void *progress_opaque)
+{
+    s->progress_bytes_callback = progress_bytes_callback;
+    s->progress_opaque = progress_opaque;
+}
+
+void block_copy_state_free(BlockCopyState *s)
+{
+    if (!s) {
+        return;
+    }
+
+    assert(QLIST_EMPTY(&s->inflight_reqs));
+    if (s->copy_bitmap) {
+        hbitmap_free(s->copy_bitmap);
+    }
+    g_free(s);
+}
+
+/* See if in-flight requests overlap and wait for them to complete */
+void coroutine_fn block_copy_wait_for_overlapping(BlockCopyState *s,
+                                                  int64_t offset,
+                                                  uint64_t bytes)
+{
+    BlockCopyInFlightReq *req;
+    int64_t start = QEMU_ALIGN_DOWN(offset, s->cluster_size);
+    int64_t end = QEMU_ALIGN_UP(offset + bytes, s->cluster_size);
+    bool retry;
+
+    do {
+        retry = false;
+        QLIST_FOREACH(req, &s->inflight_reqs, list) {
+            if (end > req->start_byte && start < req->end_byte) {
+                qemu_co_queue_wait(&req->wait_queue, NULL);
+                retry = true;
+                break;
+            }
+        }
+    } while (retry);
+}
+
+/* Keep track of an in-flight request */
+void block_copy_inflight_req_begin(BlockCopyState *s,
+                                   BlockCopyInFlightReq *req,
+                                   int64_t offset, uint64_t bytes)
+{
+    req->start_byte = QEMU_ALIGN_DOWN(offset, s->cluster_size);
+    req->end_byte = QEMU_ALIGN_UP(offset + bytes, s->cluster_size);
+    qemu_co_queue_init(&req->wait_queue);
+    QLIST_INSERT_HEAD(&s->inflight_reqs, req, list);
+}
+
+/* Forget about a completed request */
+void block_copy_inflight_req_end(BlockCopyInFlightReq *req)
+{
+    QLIST_REMOVE(req, list);
+    qemu_co_queue_restart_all(&req->wait_queue);
+}
+
+int coroutine_fn block_copy_chunk(BlockCopyState *s,
+                                  int64_t offset, int64_t bytes,
+                                  QEMUIOVector *qiov,
+                                  BdrvRequestFlags read_flags,
+                                  bool *error_is_read)
+{
+    int ret;
+    struct iovec iov;
+    QEMUIOVector bounce_qiov;
+    void *bounce_buffer = NULL;
+
+    assert(bytes > 0 && bytes <= BDRV_REQUEST_MAX_BYTES);
+    assert(!qiov || qiov->size == bytes);
+
+    if (s->use_copy_range) {
+        int64_t done = 0;
+
+        /* Unlike reads and writes, copy offload is not split by the block
+         * layer, so keep every request within the transfer limits */
+        do {
+            int64_t n = MIN(bytes - done, s->copy_size);
+
+            ret = blk_co_copy_range(s->source, offset + done,
+                                    s->target, offset + done, n,
+                                    read_flags, s->write_flags);
+            done += n;
+        } while (ret >= 0 && done < bytes);
+        if (ret >= 0) {
+            return 0;
+        }
+
+        /* Offload is not going to work any better next time.  Whatever
+         * went through before the failure is simply copied again. */
+        trace_block_copy_copy_range_fail(s, offset, ret);
+        s->use_copy_range = false;
+        s->copy_size = block_copy_bounce_size(s);
+    }
+
+    if (!qiov) {
+        bounce_buffer = blk_try_blockalign(s->source, bytes);
+        if (!bounce_buffer) {
+            *error_is_read = true;
+            return -ENOMEM;
+        }
+        iov.iov_base = bounce_buffer;
+        iov.iov_len = bytes;
+        qemu_iovec_init_external(&bounce_qiov, &iov, 1);
+        qiov = &bounce_qiov;
+    }
+
+    ret = blk_co_preadv(s->source, offset, bytes, qiov, read_flags);
+    if (ret < 0) {
+        trace_block_copy_read_fail(s, offset, ret);
+        *error_is_read = true;
+        goto out;
+    }
+
+    if (s->detect_zeroes && qemu_iovec_is_zero(qiov)) {
+        ret = blk_co_pwrite_zeroes(s->target, offset, bytes,
+                                   (s->write_flags &
+                                    ~BDRV_REQ_WRITE_COMPRESSED) |
+                                   BDRV_REQ_MAY_UNMAP);
+    } else {
+        ret = blk_co_pwritev(s->target, offset, bytes, qiov, s->write_flags);
+    }
+    if (ret < 0) {
+        trace_block_copy_write_fail(s, offset, ret);
+        *error_is_read = false;
+    }
+
+out:
+    qemu_vfree(bounce_buffer);
+    return ret < 0 ? ret : 0;
+}
+
+static void coroutine_fn block_copy_task_entry(void *opaque)
+{
+    BlockCopyTask *t = opaque;
+    BlockCopyState *s = t->s;
+    BlockCopyCallState *call = t->call;
+    int64_t cluster = t->offset / s->cluster_size;
+    int64_t nr_clusters = DIV_ROUND_UP(t->bytes, s->cluster_size);
+    bool error_is_read = false;
+    int ret;
+
+    ret = block_copy_chunk(s, t->offset, t->bytes, NULL, t->read_flags,
+                           &error_is_read);
+    if (ret < 0) {
+        hbitmap_set(s->copy_bitmap, cluster, nr_clusters);
+        if (call->ret == 0) {
+            call->ret = ret;
+            call->error_is_read = error_is_read;
+        }
+    } else if (s->progress_bytes_callback) {
+        s->progress_bytes_callback(t->bytes, s->progress_opaque);
+    }
+
+    call->in_flight--;
+    if (call->waiting) {
+        call->waiting = false;
+        aio_co_wake(call->co);
+    }
+    g_free(t);
+}
+
+/* Wait until fewer than @max_in_flight workers of @call are running */
+static void coroutine_fn block_copy_wait_workers(BlockCopyCallState *call,
+                                                 int max_in_flight)
+{
+    while (call->in_flight > max_in_flight) {
+        call->waiting = true;
+        qemu_coroutine_yield();
+        assert(!call->waiting);
+    }
+}
+
+void block_copy_set_speed(BlockCopyState *s, int64_t speed)
+{
+    s->speed = speed;
+    if (speed) {
+        ratelimit_set_speed(&s->rate_limit, speed, BLOCK_COPY_SLICE_TIME);
+    }
+}
+
+int64_t block_copy_ratelimit_get_delay(BlockCopyState *s)
+{
+    if (!s->speed) {
+        return 0;
+    }
+    return ratelimit_calculate_delay(&s->rate_limit, 0);
+}
+
+int coroutine_fn block_copy(BlockCopyState *s, int64_t offset, uint64_t bytes,
+                            bool *error_is_read, bool is_write_notifier)
+{
+    BlockCopyInFlightReq req;
+    BlockCopyCallState call = {
+        .co = qemu_coroutine_self(),
+    };
+    BdrvRequestFlags read_flags = is_write_notifier ? BDRV_REQ_NO_SERIALISING
+                                                    : 0;
+    int64_t start, end;
+
+    assert(s->copy_bitmap);
+    start = QEMU_ALIGN_DOWN(offset, s->cluster_size);
+    end = MIN(QEMU_ALIGN_UP(offset + bytes, s->cluster_size),
+              QEMU_ALIGN_UP(s->len, s->cluster_size));
+
+    block_copy_wait_for_overlapping(s, offset, bytes);
+    block_copy_inflight_req_begin(s, &req, offset, bytes);
+
+    while (start < end) {
+        int64_t cluster = start / s->cluster_size;
+        int64_t chunk_end, next_zero;
+        BlockCopyTask *t;
+
+        if (!hbitmap_get(s->copy_bitmap, cluster)) {
+            trace_block_copy_skip(s, start);
+            start += s->cluster_size;
+            continue; /* already copied */
+        }
+
+        /* Coalesce as many consecutive dirty clusters as one request allows */
+        chunk_end = MIN(end, start + s->copy_size);
+        next_zero = hbitmap_next_zero(s->copy_bitmap, cluster);
+        if (next_zero >= 0 && next_zero * s->cluster_size < chunk_end) {
+            chunk_end = next_zero * s->cluster_size;
+        }
+
+        block_copy_wait_workers(&call, s->max_workers - 1);
+        if (call.ret < 0) {
+            break;
+        }
+
+        /* copy_size may have shrunk while we were waiting */
+        chunk_end = MIN(chunk_end, start + s->copy_size);
+
+        if (s->speed) {
+            /* Guest writes wait for copy-before-write, never delay them */
+            if (!is_write_notifier &&
+                ratelimit_calculate_delay(&s->rate_limit, 0) > 0) {
+                trace_block_copy_ratelimit(s, start);
+                break;
+            }
+            ratelimit_calculate_delay(&s->rate_limit, chunk_end - start);
+        }
+
+        trace_block_copy_process(s, start, chunk_end - start);
+
+        t = g_new(BlockCopyTask, 1);
+        *t = (BlockCopyTask) {
+            .s          = s,
+            .call       = &call,
+            .offset     = start,
+            .bytes      = MIN(chunk_end, s->len) - start,
+            .read_flags = read_flags,
+        };
+        hbitmap_reset(s->copy_bitmap, cluster,
+                      (chunk_end - start) / s->cluster_size);
+        call.in_flight++;
+        qemu_coroutine_enter(qemu_coroutine_create(block_copy_task_entry, t));
+
+        start = chunk_end;
+    }
+
+    block_copy_wait_workers(&call, 0);
+    block_copy_inflight_req_end(&req);
+
+    if (call.ret < 0 && error_is_read) {
+        *error_is_read = call.error_is_read;
+    }
+    return call.ret;
+}
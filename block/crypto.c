@@ -23,6 +23,7 @@
 #include "block/block_int.h"
 #include "block/qdict.h"
 #include "sysemu/block-backend.h"
+#include "block/thread-pool.h"
 #include "crypto/block.h"
 #include "qapi/opts-visitor.h"
 #include "qapi/qapi-visit-crypto.h"
@@ -229,6 +230,7 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
                                        block_crypto_read_func,
                                        bs,
                                        cflags,
+                                       BLOCK_CRYPTO_MAX_THREADS,
                                        errp);
 
     if (!crypto->block) {
@@ -323,6 +325,131 @@ static int block_crypto_reopen_prepare(BDRVReopenState *state,
  */
 #define BLOCK_CRYPTO_MAX_IO_SIZE (1024 * 1024)
 
+/*
+ * Buffers of at least twice this size are split by sector ranges and
+ * processed by up to BLOCK_CRYPTO_MAX_THREADS workers of the thread pool.
+ * Smaller ones are not worth the round trip to another thread.
+ */
+#define BLOCK_CRYPTO_THREAD_MIN_SIZE (64 * 1024)
+
+typedef struct BlockCryptoTask {
+    Coroutine *co;
+    int in_flight;
+    int ret;
+} BlockCryptoTask;
+
+typedef struct BlockCryptoWork {
+    BlockCryptoTask *task;
+    QCryptoBlock *block;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t len;
+    bool encrypt;
+} BlockCryptoWork;
+
+static int block_crypto_work_func(void *opaque)
+{
+    BlockCryptoWork *work = opaque;
+    int ret;
+
+    if (work->encrypt) {
+        ret = qcrypto_block_encrypt(work->block, work->offset,
+                                    work->buf, work->len, NULL);
+    } else {
+        ret = qcrypto_block_decrypt(work->block, work->offset,
+                                    work->buf, work->len, NULL);
+    }
+
+    return ret < 0 ? -EIO : 0;
+}
+
+static void block_crypto_work_complete(void *opaque, int ret)
+{
+    BlockCryptoWork *work = opaque;
+    BlockCryptoTask *task = work->task;
+
+    if (ret < 0) {
+        task->ret = ret;
+    }
+    if (--task->in_flight == 0) {
+        qemu_coroutine_enter(task->co);
+    }
+}
+
+static int coroutine_fn
+block_crypto_co_crypt(BlockDriverState *bs, QCryptoBlock *block,
+                      uint64_t offset, uint8_t *buf, size_t len,
+                      bool encrypt)
+{
+    uint64_t sector_size = qcrypto_block_get_sector_size(block);
+    BlockCryptoTask task = {
+        .co = qemu_coroutine_self(),
+    };
+    BlockCryptoWork work[BLOCK_CRYPTO_MAX_THREADS];
+    ThreadPool *pool;
+    size_t chunk;
+    int i, n;
+
+    n = MIN(len / BLOCK_CRYPTO_THREAD_MIN_SIZE, BLOCK_CRYPTO_MAX_THREADS);
+    if (n <= 1) {
+        work[0] = (BlockCryptoWork) {
+            .block   = block,
+            .offset  = offset,
+            .buf     = buf,
+            .len     = len,
+            .encrypt = encrypt,
+        };
+        return block_crypto_work_func(&work[0]);
+    }
+
+    pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    chunk = ROUND_UP(DIV_ROUND_UP(len, n), sector_size);
+
+    for (i = 0; i < n && len; i++) {
+        work[i] = (BlockCryptoWork) {
+            .task    = &task,
+            .block   = block,
+            .offset  = offset,
+            .buf     = buf,
+            .len     = MIN(chunk, len),
+            .encrypt = encrypt,
+        };
+        offset += work[i].len;
+        buf += work[i].len;
+        len -= work[i].len;
+
+        task.in_flight++;
+        thread_pool_submit_aio(pool, block_crypto_work_func, &work[i],
+                               block_crypto_work_complete, &work[i]);
+    }
+
+    /* Completion callbacks run in our AioContext, so none has run yet */
+    qemu_coroutine_yield();
+    assert(task.in_flight == 0);
+
+    return task.ret;
+}
+
+/*
+ * Encrypt @len bytes of @buf in place, using the thread pool of @bs for
+ * large buffers.  @offset and @len must be multiples of the sector size
+ * of @block.  Returns 0 on success, -EIO on failure.
+ */
+int coroutine_fn
+block_crypto_co_encrypt(BlockDriverState *bs, QCryptoBlock *block,
+                        uint64_t offset, uint8_t *buf, size_t len)
+{
+    return block_crypto_co_crypt(bs, block, offset, buf, len, true);
+}
+
+/* Like block_crypto_co_encrypt(), but decrypting */
+int coroutine_fn
+block_crypto_co_decrypt(BlockDriverState *bs, QCryptoBlock *block,
+                        uint64_t offset, uint8_t *buf, size_t len)
+{
+    return block_crypto_co_crypt(bs, block, offset, buf, len, false);
+}
+
 static coroutine_fn int
 block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
                        QEMUIOVector *qiov, int flags)
@@ -366,9 +493,9 @@ block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             goto cleanup;
         }
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_decrypt(bs, crypto->block, offset + bytes_done,
+                                      cipher_data, cur_bytes);
+        if (ret < 0) {
             goto cleanup;
         }
 
@@ -422,9 +549,9 @@ block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
         qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
-            ret = -EIO;
+        ret = block_crypto_co_encrypt(bs, crypto->block, offset + bytes_done,
+                                      cipher_data, cur_bytes);
+        if (ret < 0) {
             goto cleanup;
         }
 
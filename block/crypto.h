@@ -94,4 +94,15 @@ block_crypto_create_opts_init(QDict *opts, Error **errp);
 QCryptoBlockOpenOptions *
 block_crypto_open_opts_init(QDict *opts, Error **errp);
 
+/* Number of cipher contexts to request from qcrypto_block_open() */
+#define BLOCK_CRYPTO_MAX_THREADS 4
+
+int coroutine_fn
+block_crypto_co_encrypt(BlockDriverState *bs, QCryptoBlock *block,
+                        uint64_t offset, uint8_t *buf, size_t len);
+
+int coroutine_fn
+block_crypto_co_decrypt(BlockDriverState *bs, QCryptoBlock *block,
+                        uint64_t offset, uint8_t *buf, size_t len);
+
 #endif /* BLOCK_CRYPTO_H__ */
@@ -585,7 +585,7 @@ void bdrv_drain_all(void)
 }
 
 /**
- * Remove an active request from the tracked requests list
+ * Remove an active request from the tracked requests tree
  *
  * This function should be called when a tracked request is completing.
  */
@@ -596,13 +596,13 @@ static void tracked_request_end(BdrvTrackedRequest *req)
     }
 
     qemu_co_mutex_lock(&req->bs->reqs_lock);
-    QLIST_REMOVE(req, list);
+    interval_tree_remove(&req->node, &req->bs->tracked_requests);
     qemu_co_queue_restart_all(&req->wait_queue);
     qemu_co_mutex_unlock(&req->bs->reqs_lock);
 }
 
 /**
- * Add an active request to the tracked requests list
+ * Add an active request to the tracked requests tree
  */
 static void tracked_request_begin(BdrvTrackedRequest *req,
                                   BlockDriverState *bs,
@@ -621,28 +621,48 @@ static void tracked_request_begin(BdrvTrackedRequest *req,
         .serialising    = false,
         .overlap_offset = offset,
         .overlap_bytes  = bytes,
+        .node = {
+            .start      = offset,
+            .end        = offset + bytes,
+        },
     };
 
     qemu_co_queue_init(&req->wait_queue);
 
     qemu_co_mutex_lock(&bs->reqs_lock);
-    QLIST_INSERT_HEAD(&bs->tracked_requests, req, list);
+    interval_tree_insert(&req->node, &bs->tracked_requests);
     qemu_co_mutex_unlock(&bs->reqs_lock);
 }
 
-static void mark_request_serialising(BdrvTrackedRequest *req, uint64_t align)
+static void coroutine_fn mark_request_serialising(BdrvTrackedRequest *req,
+                                                  uint64_t align)
 {
+    BlockDriverState *bs = req->bs;
     int64_t overlap_offset = req->offset & ~(align - 1);
     uint64_t overlap_bytes = ROUND_UP(req->offset + req->bytes, align)
                                - overlap_offset;
 
     if (!req->serialising) {
-        atomic_inc(&req->bs->serialising_in_flight);
+        atomic_inc(&bs->serialising_in_flight);
         req->serialising = true;
     }
 
-    req->overlap_offset = MIN(req->overlap_offset, overlap_offset);
-    req->overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    overlap_offset = MIN(req->overlap_offset, overlap_offset);
+    overlap_bytes = MAX(req->overlap_bytes, overlap_bytes);
+    if (overlap_offset == req->overlap_offset &&
+        overlap_bytes == req->overlap_bytes) {
+        return;
+    }
+
+    /* The overlap range is the key in tracked_requests; re-insert */
+    qemu_co_mutex_lock(&bs->reqs_lock);
+    interval_tree_remove(&req->node, &bs->tracked_requests);
+    req->overlap_offset = overlap_offset;
+    req->overlap_bytes = overlap_bytes;
+    req->node.start = overlap_offset;
+    req->node.end = overlap_offset + overlap_bytes;
+    interval_tree_insert(&req->node, &bs->tracked_requests);
+    qemu_co_mutex_unlock(&bs->reqs_lock);
 }
 
 static bool is_request_serialising_and_aligned(BdrvTrackedRequest *req)
@@ -690,20 +710,6 @@ static int bdrv_get_cluster_size(BlockDriverState *bs)
     }
 }
 
-static bool tracked_request_overlaps(BdrvTrackedRequest *req,
-                                     int64_t offset, uint64_t bytes)
-{
-    /*        aaaa   bbbb */
-    if (offset >= req->overlap_offset + req->overlap_bytes) {
-        return false;
-    }
-    /* bbbb   aaaa        */
-    if (req->overlap_offset >= offset + bytes) {
-        return false;
-    }
-    return true;
-}
-
 void bdrv_inc_in_flight(BlockDriverState *bs)
 {
     atomic_inc(&bs->in_flight);
@@ -723,7 +729,9 @@ void bdrv_dec_in_flight(BlockDriverState *bs)
 static bool coroutine_fn wait_serialising_requests(BdrvTrackedRequest *self)
 {
     BlockDriverState *bs = self->bs;
+    IntervalTreeNode *node;
     BdrvTrackedRequest *req;
+    uint64_t start, end;
     bool retry;
     bool waited = false;
 
@@ -734,30 +742,31 @@ static bool coroutine_fn wait_serialising_requests(BdrvTrackedRequest *self)
     do {
         retry = false;
         qemu_co_mutex_lock(&bs->reqs_lock);
-        QLIST_FOREACH(req, &bs->tracked_requests, list) {
+        start = self->overlap_offset;
+        end = self->overlap_offset + self->overlap_bytes;
+        for (node = interval_tree_iter_first(&bs->tracked_requests, start, end);
+             node; node = interval_tree_iter_next(node, start, end)) {
+            req = container_of(node, BdrvTrackedRequest, node);
             if (req == self || (!req->serialising && !self->serialising)) {
                 continue;
             }
-            if (tracked_request_overlaps(req, self->overlap_offset,
-                                         self->overlap_bytes))
-            {
-                /* Hitting this means there was a reentrant request, for
-                 * example, a block driver issuing nested requests.  This must
-                 * never happen since it means deadlock.
-                 */
-                assert(qemu_coroutine_self() != req->co);
-
-                /* If the request is already (indirectly) waiting for us, or
-                 * will wait for us as soon as it wakes up, then just go on
-                 * (instead of producing a deadlock in the former case). */
-                if (!req->waiting_for) {
-                    self->waiting_for = req;
-                    qemu_co_queue_wait(&req->wait_queue, &bs->reqs_lock);
-                    self->waiting_for = NULL;
-                    retry = true;
-                    waited = true;
-                    break;
-                }
+
+            /* Hitting this means there was a reentrant request, for
+             * example, a block driver issuing nested requests.  This must
+             * never happen since it means deadlock.
+             */
+            assert(qemu_coroutine_self() != req->co);
+
+            /* If the request is already (indirectly) waiting for us, or
+             * will wait for us as soon as it wakes up, then just go on
+             * (instead of producing a deadlock in the former case). */
+            if (!req->waiting_for) {
+                self->waiting_for = req;
+                qemu_co_queue_wait(&req->wait_queue, &bs->reqs_lock);
+                self->waiting_for = NULL;
+                retry = true;
+                waited = true;
+                break;
             }
         }
         qemu_co_mutex_unlock(&bs->reqs_lock);
@@ -1652,12 +1661,18 @@ bdrv_co_write_req_finish(BdrvChild *child, int64_t offset, uint64_t bytes,
         bdrv_parent_cb_resize(bs);
         bdrv_dirty_bitmap_truncate(bs, end_sector << BDRV_SECTOR_BITS);
     }
+    if (req->type == BDRV_TRACKED_TRUNCATE) {
+        /* Shrinking and growing again leaves a hole where data was */
+        bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
+    }
     if (req->bytes) {
         switch (req->type) {
         case BDRV_TRACKED_WRITE:
             stat64_max(&bs->wr_highest_offset, offset + bytes);
-            /* fall through, to set dirty bits */
+            bdrv_set_dirty(bs, offset, bytes);
+            break;
         case BDRV_TRACKED_DISCARD:
+            bdrv_bsc_invalidate_range(bs, offset, bytes);
             bdrv_set_dirty(bs, offset, bytes);
             break;
         default:
@@ -1712,6 +1727,8 @@ static int coroutine_fn bdrv_aligned_pwritev(BdrvChild *child,
     } else if (flags & BDRV_REQ_ZERO_WRITE) {
         bdrv_debug_event(bs, BLKDBG_PWRITEV_ZERO);
         ret = bdrv_co_do_pwrite_zeroes(bs, offset, bytes, flags);
+        /* Even a failed request may have punched a hole */
+        bdrv_bsc_invalidate_range(bs, offset, bytes);
     } else if (flags & BDRV_REQ_WRITE_COMPRESSED) {
         ret = bdrv_driver_pwritev_compressed(bs, offset, bytes, qiov);
     } else if (bytes <= max_transfer) {
@@ -2056,6 +2073,41 @@ int coroutine_fn bdrv_co_block_status_from_backing(BlockDriverState *bs,
     return BDRV_BLOCK_RAW | BDRV_BLOCK_OFFSET_VALID;
 }
 
+static bool bdrv_bsc_is_data(BlockDriverState *bs, int64_t offset,
+                             int64_t *pnum)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+
+    if (!bsc->valid || offset < bsc->data_start || offset >= bsc->data_end) {
+        bsc->misses++;
+        return false;
+    }
+
+    bsc->hits++;
+    *pnum = bsc->data_end - offset;
+    return true;
+}
+
+static void bdrv_bsc_fill(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+
+    bsc->data_start = offset;
+    bsc->data_end = offset + bytes;
+    bsc->valid = true;
+}
+
+void bdrv_bsc_invalidate_range(BlockDriverState *bs,
+                               int64_t offset, int64_t bytes)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+
+    if (bsc->valid && offset < bsc->data_end &&
+        offset + bytes > bsc->data_start) {
+        bsc->valid = false;
+    }
+}
+
 /*
  * Returns the allocation status of the specified sectors.
  * Drivers not implementing the functionality are assumed to not support
@@ -2096,6 +2148,8 @@ static int coroutine_fn bdrv_co_block_status(BlockDriverState *bs,
     BlockDriverState *local_file = NULL;
     int64_t aligned_offset, aligned_bytes;
     uint32_t align;
+    unsigned int write_gen;
+    bool use_cache;
 
     assert(pnum);
     *pnum = 0;
@@ -2142,12 +2196,36 @@ static int coroutine_fn bdrv_co_block_status(BlockDriverState *bs,
     aligned_offset = QEMU_ALIGN_DOWN(offset, align);
     aligned_bytes = ROUND_UP(offset + bytes, align) - aligned_offset;
 
-    ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
-                                        aligned_bytes, pnum, &local_map,
-                                        &local_file);
-    if (ret < 0) {
-        *pnum = 0;
-        goto out;
+    /*
+     * Only protocol nodes use the cache: what they report does not depend
+     * on any child, so a write to the node itself is the only thing that
+     * can turn data into a hole.
+     */
+    use_cache = want_zero && QLIST_EMPTY(&bs->children);
+    if (use_cache && bdrv_bsc_is_data(bs, aligned_offset, pnum)) {
+        ret = BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID;
+        local_map = aligned_offset;
+        local_file = bs;
+    } else {
+        write_gen = atomic_read(&bs->write_gen);
+        ret = bs->drv->bdrv_co_block_status(bs, want_zero, aligned_offset,
+                                            aligned_bytes, pnum, &local_map,
+                                            &local_file);
+        if (ret < 0) {
+            *pnum = 0;
+            goto out;
+        }
+
+        /*
+         * Skip results that a concurrent write may have made stale.  The
+         * driver may have reported more than aligned_bytes; remember all
+         * of it before pnum is clamped below.
+         */
+        if (use_cache && ret == (BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID) &&
+            local_file == bs && local_map == aligned_offset &&
+            atomic_read(&bs->write_gen) == write_gen) {
+            bdrv_bsc_fill(bs, aligned_offset, *pnum);
+        }
     }
 
     /*
@@ -3054,6 +3132,8 @@ static int coroutine_fn bdrv_co_copy_range_internal(
                                                       bytes,
                                                       read_flags, write_flags);
         }
+        /* The destination may become sparse where the source is */
+        bdrv_bsc_invalidate_range(dst->bs, dst_offset, bytes);
         bdrv_co_write_req_finish(dst, dst_offset, bytes, &req, ret);
         tracked_request_end(&req);
         bdrv_dec_in_flight(dst->bs);
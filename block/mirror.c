@@ -18,6 +18,7 @@
 #include "trace.h"
 #include "block/blockjob_int.h"
 #include "block/block_int.h"
+#include "block/block-copy.h"
 #include "sysemu/block-backend.h"
 #include "qapi/error.h"
 #include "qapi/qmp/qerror.h"
@@ -27,6 +28,8 @@
 #define MAX_IN_FLIGHT 16
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
+/* Amount of the disk that one step of the skip-zeroes bulk pass covers */
+#define MIRROR_SCAN_WINDOW (1LL << 30)
 
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
@@ -75,8 +78,16 @@ typedef struct MirrorBlockJob {
     QTAILQ_HEAD(MirrorOpList, MirrorOp) ops_in_flight;
     int ret;
     bool unmap;
+    bool skip_zeroes;
+    /* Progress of the bulk pass that runs along with copying in skip-zeroes
+     * mode; bdev_length when there is none or it is done */
+    int64_t scan_offset;
     int target_cluster_size;
     int max_iov;
+    /* Maximum number of operations in flight, MAX_IN_FLIGHT by default */
+    int max_in_flight;
+    /* Moves the data of MIRROR_METHOD_COPY operations */
+    BlockCopyState *bcs;
     bool initial_zeroing_ongoing;
     int in_active_write_counter;
     bool prepared;
@@ -212,11 +223,12 @@ static void coroutine_fn mirror_write_complete(MirrorOp *op, int ret)
     mirror_iteration_done(op, ret);
 }
 
-static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
+static void coroutine_fn mirror_copy_complete(MirrorOp *op, int ret,
+                                              bool error_is_read)
 {
     MirrorBlockJob *s = op->s;
 
-    if (ret < 0) {
+    if (ret < 0 && error_is_read) {
         BlockErrorAction action;
 
         bdrv_set_dirty_bitmap(s->dirty_bitmap, op->offset, op->bytes);
@@ -229,7 +241,6 @@ static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
         return;
     }
 
-    ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
     mirror_write_complete(op, ret);
 }
 
@@ -314,7 +325,8 @@ static void coroutine_fn mirror_co_read(void *opaque)
     MirrorOp *op = opaque;
     MirrorBlockJob *s = op->s;
     int nb_chunks;
-    uint64_t ret;
+    int ret;
+    bool error_is_read = false;
     uint64_t max_bytes;
 
     max_bytes = s->granularity * s->max_iov;
@@ -362,9 +374,9 @@ static void coroutine_fn mirror_co_read(void *opaque)
     s->bytes_in_flight += op->bytes;
     trace_mirror_one_iteration(s, op->offset, op->bytes);
 
-    ret = bdrv_co_preadv(s->mirror_top_bs->backing, op->offset, op->bytes,
-                         &op->qiov, 0);
-    mirror_read_complete(op, ret);
+    ret = block_copy_chunk(s->bcs, op->offset, op->bytes, &op->qiov, 0,
+                           &error_is_read);
+    mirror_copy_complete(op, ret, error_is_read);
 }
 
 static void coroutine_fn mirror_co_zero(void *opaque)
@@ -439,6 +451,26 @@ static unsigned mirror_perform(MirrorBlockJob *s, int64_t offset,
     return bytes_handled;
 }
 
+/* Return true if [offset, offset + bytes) is known to read as zeroes from
+ * the target. */
+static bool coroutine_fn mirror_target_is_zero(MirrorBlockJob *s,
+                                               int64_t offset, int64_t bytes)
+{
+    BlockDriverState *target_bs = blk_bs(s->target);
+    int64_t count;
+    int ret;
+
+    while (bytes > 0) {
+        ret = bdrv_block_status(target_bs, offset, bytes, &count, NULL, NULL);
+        if (ret < 0 || !(ret & BDRV_BLOCK_ZERO) || count == 0) {
+            return false;
+        }
+        offset += count;
+        bytes -= count;
+    }
+    return true;
+}
+
 static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
 {
     BlockDriverState *source = s->mirror_top_bs->backing->bs;
@@ -448,7 +480,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int max_io_bytes = MAX(s->buf_size / s->max_in_flight, MAX_IO_BYTES);
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     offset = bdrv_dirty_iter_next(s->dbi);
@@ -545,7 +577,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -556,11 +588,21 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
         }
 
         io_bytes = mirror_clip_bytes(s, offset, io_bytes);
-        io_bytes = mirror_perform(s, offset, io_bytes, mirror_method);
-        if (mirror_method != MIRROR_METHOD_COPY && write_zeroes_ok) {
+        if (mirror_method == MIRROR_METHOD_ZERO && s->skip_zeroes &&
+            mirror_target_is_zero(s, offset, io_bytes))
+        {
+            /* The target already reads as zeroes, nothing to write */
+            bitmap_clear(s->in_flight_bitmap, offset / s->granularity,
+                         DIV_ROUND_UP(io_bytes, s->granularity));
+            job_progress_update(&s->common.job, io_bytes);
             io_bytes_acct = 0;
         } else {
-            io_bytes_acct = io_bytes;
+            io_bytes = mirror_perform(s, offset, io_bytes, mirror_method);
+            if (mirror_method != MIRROR_METHOD_COPY && write_zeroes_ok) {
+                io_bytes_acct = 0;
+            } else {
+                io_bytes_acct = io_bytes;
+            }
         }
         assert(io_bytes);
         offset += io_bytes;
@@ -770,7 +812,7 @@ static int coroutine_fn mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -811,6 +853,175 @@ static int coroutine_fn mirror_dirty_init(MirrorBlockJob *s)
     return 0;
 }
 
+/* Release the in-flight bits that mirror_scan_step() holds for
+ * [*claimed, offset).  Everything before *claimed has been released or
+ * handed over to operations already.
+ */
+static void mirror_scan_release(MirrorBlockJob *s, int64_t *claimed,
+                                int64_t offset)
+{
+    int64_t start_chunk = *claimed / s->granularity;
+    int64_t end_chunk = DIV_ROUND_UP(offset, s->granularity);
+
+    if (end_chunk > start_chunk) {
+        bitmap_clear(s->in_flight_bitmap, start_chunk,
+                     end_chunk - start_chunk);
+    }
+    *claimed = offset;
+}
+
+/* Zero [offset, offset + bytes) of the target in as few operations as
+ * possible.  The range is claimed by mirror_scan_step(), and its in-flight
+ * bits are handed over to the zeroing operations.  The unused claim in front
+ * of it is released.
+ */
+static void coroutine_fn mirror_prezero(MirrorBlockJob *s, int64_t *claimed,
+                                        int64_t offset, int64_t bytes)
+{
+    if (bytes == 0) {
+        return;
+    }
+
+    mirror_scan_release(s, claimed, offset);
+    while (bytes > 0 && s->ret >= 0) {
+        int64_t n = MIN(bytes, QEMU_ALIGN_DOWN(INT_MAX, s->granularity));
+
+        while (s->in_flight >= s->max_in_flight) {
+            trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
+                               s->in_flight);
+            mirror_wait_for_free_in_flight_slot(s);
+        }
+        if (s->ret < 0) {
+            break;
+        }
+
+        trace_mirror_prezero(s, offset, n);
+        mirror_perform(s, offset, n, MIRROR_METHOD_ZERO);
+
+        offset += n;
+        bytes -= n;
+        *claimed = offset;
+    }
+}
+
+/* One step of the skip-zeroes bulk pass, which replaces mirror_dirty_init()
+ * and runs while the main loop is already copying.  Areas with data on the
+ * source are marked dirty.  Of the areas without, those that do not read as
+ * zeroes from the target yet are zeroed in large batches; partial chunks are
+ * left to the copy path.
+ *
+ * The window being scanned is claimed in the in-flight bitmap until its
+ * zeroing operations have been started.  Otherwise an active write, or a copy
+ * of data the guest wrote in the meantime, could reach the target between
+ * the time an area is found to need zeroing and the time it is zeroed, and
+ * then be overwritten.  Guest writes outside of the window are tracked by the
+ * dirty bitmap as usual.
+ */
+static int coroutine_fn mirror_scan_step(MirrorBlockJob *s)
+{
+    BlockDriverState *bs = s->mirror_top_bs->backing->bs;
+    BlockDriverState *target_bs = blk_bs(s->target);
+    int64_t end = MIN(s->bdev_length, s->scan_offset + MIRROR_SCAN_WINDOW);
+    int64_t zero_start = 0, zero_end = 0;
+    int64_t claimed = s->scan_offset;
+    MirrorOp *pseudo_op;
+    int64_t count;
+    int ret = 0;
+
+    assert(!s->base);
+
+    mirror_wait_on_conflicts(NULL, s, s->scan_offset, end - s->scan_offset);
+    if (s->ret < 0) {
+        return 0;
+    }
+
+    pseudo_op = g_new(MirrorOp, 1);
+    *pseudo_op = (MirrorOp){
+        .offset         = s->scan_offset,
+        .bytes          = end - s->scan_offset,
+        .is_pseudo_op   = true,
+    };
+    qemu_co_queue_init(&pseudo_op->waiting_requests);
+    QTAILQ_INSERT_TAIL(&s->ops_in_flight, pseudo_op, next);
+    bitmap_set(s->in_flight_bitmap, s->scan_offset / s->granularity,
+               DIV_ROUND_UP(end, s->granularity) -
+               s->scan_offset / s->granularity);
+
+    while (s->scan_offset < end && s->ret >= 0) {
+        int64_t offset = s->scan_offset;
+        int64_t start, stop;
+
+        ret = bdrv_block_status_above(bs, NULL, offset, end - offset,
+                                      &count, NULL, NULL);
+        if (ret < 0) {
+            goto out;
+        }
+        assert(count);
+        s->scan_offset += count;
+
+        if ((ret & BDRV_BLOCK_ALLOCATED) && !(ret & BDRV_BLOCK_ZERO)) {
+            bdrv_set_dirty_bitmap(s->dirty_bitmap, offset, count);
+            continue;
+        }
+
+        /* Only whole chunks are zeroed, except at the end of the disk */
+        start = QEMU_ALIGN_UP(offset, s->granularity);
+        stop = offset + count;
+        if (stop < s->bdev_length) {
+            stop = QEMU_ALIGN_DOWN(stop, s->granularity);
+        }
+        if (start >= stop) {
+            bdrv_set_dirty_bitmap(s->dirty_bitmap, offset, count);
+            continue;
+        }
+        if (start > offset) {
+            bdrv_set_dirty_bitmap(s->dirty_bitmap, offset, start - offset);
+        }
+        if (stop < offset + count) {
+            bdrv_set_dirty_bitmap(s->dirty_bitmap, stop,
+                                  offset + count - stop);
+        }
+
+        while (start < stop) {
+            bool target_zero;
+
+            ret = bdrv_block_status(target_bs, start, stop - start, &count,
+                                    NULL, NULL);
+            target_zero = ret >= 0 && (ret & BDRV_BLOCK_ZERO);
+            if (ret < 0 || count == 0) {
+                count = stop - start;
+            } else if (start + count < stop) {
+                count = QEMU_ALIGN_DOWN(count, s->granularity);
+                if (count == 0) {
+                    /* Partially zero chunk, zero it as a whole */
+                    count = s->granularity;
+                    target_zero = false;
+                }
+            }
+
+            if (!target_zero) {
+                if (zero_end != start) {
+                    mirror_prezero(s, &claimed, zero_start,
+                                   zero_end - zero_start);
+                    zero_start = start;
+                }
+                zero_end = start + count;
+            }
+            start += count;
+        }
+    }
+
+    mirror_prezero(s, &claimed, zero_start, zero_end - zero_start);
+    ret = 0;
+
+out:
+    mirror_scan_release(s, &claimed, end);
+    QTAILQ_REMOVE(&s->ops_in_flight, pseudo_op, next);
+    qemu_co_queue_restart_all(&pseudo_op->waiting_requests);
+    g_free(pseudo_op);
+    return ret;
+}
+
 /* Called when going out of the streaming phase to flush the bulk of the
  * data to the medium, or just before completing.
  */
@@ -900,6 +1111,14 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     }
     s->max_iov = MIN(bs->bl.max_iov, target_bs->bl.max_iov);
 
+    /* The requests are scheduled here, only block_copy_chunk() is used */
+    s->bcs = block_copy_state_new(s->common.blk, s->target, s->granularity,
+                                  0, 0, errp);
+    if (!s->bcs) {
+        ret = -EIO;
+        goto immediate_exit;
+    }
+
     s->buf = qemu_try_blockalign(bs, s->buf_size);
     if (s->buf == NULL) {
         ret = -ENOMEM;
@@ -909,7 +1128,11 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     mirror_free_init(s);
 
     s->last_pause_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
-    if (!s->is_none_mode) {
+    s->scan_offset = s->bdev_length;
+    if (s->skip_zeroes) {
+        /* The bulk pass is interleaved with the main loop below */
+        s->scan_offset = 0;
+    } else if (!s->is_none_mode) {
         ret = mirror_dirty_init(s);
         if (ret < 0 || job_is_cancelled(&s->common.job)) {
             goto immediate_exit;
@@ -949,8 +1172,17 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         delta = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - s->last_pause_ns;
         if (delta < BLOCK_JOB_SLICE_TIME &&
             s->common.iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
-                (cnt == 0 && s->in_flight > 0)) {
+            if (s->scan_offset < s->bdev_length && cnt < s->buf_size &&
+                s->in_flight < s->max_in_flight) {
+                /* Keep the copy pipeline fed while scanning */
+                ret = mirror_scan_step(s);
+                if (ret < 0) {
+                    goto immediate_exit;
+                }
+                continue;
+            } else if (s->in_flight >= s->max_in_flight ||
+                       s->buf_free_count == 0 ||
+                       (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
                 continue;
@@ -960,7 +1192,8 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
 
         should_complete = false;
-        if (s->in_flight == 0 && cnt == 0) {
+        if (s->in_flight == 0 && cnt == 0 &&
+            s->scan_offset >= s->bdev_length) {
             trace_mirror_before_flush(s);
             if (!s->synced) {
                 if (mirror_flush(s) < 0) {
@@ -1007,7 +1240,7 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
             /* The two disks are in sync.  Exit and report successful
              * completion.
              */
-            assert(QLIST_EMPTY(&bs->tracked_requests));
+            assert(interval_tree_empty(&bs->tracked_requests));
             s->common.job.cancelled = false;
             need_drain = false;
             break;
@@ -1046,6 +1279,7 @@ immediate_exit:
     g_free(s->cow_bitmap);
     g_free(s->in_flight_bitmap);
     bdrv_dirty_iter_free(s->dbi);
+    block_copy_state_free(s->bcs);
 
     if (need_drain) {
         bdrv_drained_begin(bs);
@@ -1428,6 +1662,16 @@ static int coroutine_fn bdrv_mirror_top_pdiscard(BlockDriverState *bs,
                                     NULL, 0);
 }
 
+/* Lets block_copy_chunk() offload copies from the source to the target */
+static int coroutine_fn bdrv_mirror_top_copy_range_from(
+        BlockDriverState *bs, BdrvChild *src, uint64_t src_offset,
+        BdrvChild *dst, uint64_t dst_offset, uint64_t bytes,
+        BdrvRequestFlags read_flags, BdrvRequestFlags write_flags)
+{
+    return bdrv_co_copy_range_from(bs->backing, src_offset, dst, dst_offset,
+                                   bytes, read_flags, write_flags);
+}
+
 static void bdrv_mirror_top_refresh_filename(BlockDriverState *bs, QDict *opts)
 {
     if (bs->backing == NULL) {
@@ -1464,6 +1708,7 @@ static BlockDriver bdrv_mirror_top = {
     .bdrv_co_pwrite_zeroes      = bdrv_mirror_top_pwrite_zeroes,
     .bdrv_co_pdiscard           = bdrv_mirror_top_pdiscard,
     .bdrv_co_flush              = bdrv_mirror_top_flush,
+    .bdrv_co_copy_range_from    = bdrv_mirror_top_copy_range_from,
     .bdrv_co_block_status       = bdrv_co_block_status_from_backing,
     .bdrv_refresh_filename      = bdrv_mirror_top_refresh_filename,
     .bdrv_child_perm            = bdrv_mirror_top_child_perm,
@@ -1473,10 +1718,11 @@ static void mirror_start_job(const char *job_id, BlockDriverState *bs,
                              int creation_flags, BlockDriverState *target,
                              const char *replaces, int64_t speed,
                              uint32_t granularity, int64_t buf_size,
+                             int64_t max_workers,
                              BlockMirrorBackingMode backing_mode,
                              BlockdevOnError on_source_error,
                              BlockdevOnError on_target_error,
-                             bool unmap,
+                             bool unmap, bool skip_zeroes,
                              BlockCompletionFunc *cb,
                              void *opaque,
                              const BlockJobDriver *driver,
@@ -1508,6 +1754,15 @@ static void mirror_start_job(const char *job_id, BlockDriverState *bs,
         buf_size = DEFAULT_MIRROR_BUF_SIZE;
     }
 
+    if (max_workers < 0 || max_workers > BLOCK_COPY_MAX_WORKERS) {
+        error_setg(errp, "Invalid parameter 'max-workers'");
+        return;
+    }
+
+    if (max_workers == 0) {
+        max_workers = MAX_IN_FLIGHT;
+    }
+
     if (bs == target) {
         error_setg(errp, "Can't mirror node into itself");
         return;
@@ -1599,7 +1854,10 @@ static void mirror_start_job(const char *job_id, BlockDriverState *bs,
     s->base = base;
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
+    s->max_in_flight = max_workers;
     s->unmap = unmap;
+    /* The bulk pass replaces mirror_dirty_init(), which only sync=full has */
+    s->skip_zeroes = skip_zeroes && !is_none_mode && !base;
     if (auto_complete) {
         s->should_complete = true;
     }
@@ -1659,11 +1917,11 @@ fail:
 void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *target, const char *replaces,
                   int creation_flags, int64_t speed,
-                  uint32_t granularity, int64_t buf_size,
+                  uint32_t granularity, int64_t buf_size, int64_t max_workers,
                   MirrorSyncMode mode, BlockMirrorBackingMode backing_mode,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
-                  bool unmap, const char *filter_node_name,
+                  bool unmap, bool skip_zeroes, const char *filter_node_name,
                   MirrorCopyMode copy_mode, Error **errp)
 {
     bool is_none_mode;
@@ -1676,9 +1934,9 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
     is_none_mode = mode == MIRROR_SYNC_MODE_NONE;
     base = mode == MIRROR_SYNC_MODE_TOP ? backing_bs(bs) : NULL;
     mirror_start_job(job_id, bs, creation_flags, target, replaces,
-                     speed, granularity, buf_size, backing_mode,
-                     on_source_error, on_target_error, unmap, NULL, NULL,
-                     &mirror_job_driver, is_none_mode, base, false,
+                     speed, granularity, buf_size, max_workers, backing_mode,
+                     on_source_error, on_target_error, unmap, skip_zeroes,
+                     NULL, NULL, &mirror_job_driver, is_none_mode, base, false,
                      filter_node_name, true, copy_mode, errp);
 }
 
@@ -1698,9 +1956,9 @@ void commit_active_start(const char *job_id, BlockDriverState *bs,
         return;
     }
 
-    mirror_start_job(job_id, bs, creation_flags, base, NULL, speed, 0, 0,
+    mirror_start_job(job_id, bs, creation_flags, base, NULL, speed, 0, 0, 0,
                      MIRROR_LEAVE_BACKING_CHAIN,
-                     on_error, on_error, true, cb, opaque,
+                     on_error, on_error, true, false, cb, opaque,
                      &commit_active_job_driver, false, base, auto_complete,
                      filter_node_name, false, MIRROR_COPY_MODE_BACKGROUND,
                      &local_err);
@@ -425,10 +425,30 @@ static void bdrv_latency_histogram_stats(BlockLatencyHistogram *hist,
     }
 }
 
+static void bdrv_latency_percentiles(BlockLatencyHdr *hdr, bool *not_null,
+                                     BlockLatencyPercentiles **info)
+{
+    static const unsigned per_mille[] = { 500, 990, 999 };
+    uint64_t values[ARRAY_SIZE(per_mille)];
+    uint64_t count;
+
+    count = block_latency_hdr_percentiles(hdr, ARRAY_SIZE(per_mille),
+                                          per_mille, values);
+    *not_null = count != 0;
+    if (*not_null) {
+        *info = g_new0(BlockLatencyPercentiles, 1);
+        (*info)->count = count;
+        (*info)->p50 = values[0];
+        (*info)->p99 = values[1];
+        (*info)->p999 = values[2];
+    }
+}
+
 static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
 {
     BlockAcctStats *stats = blk_get_stats(blk);
     BlockAcctTimedStats *ts = NULL;
+    unsigned i;
 
     ds->rd_bytes = stats->nr_bytes[BLOCK_ACCT_READ];
     ds->wr_bytes = stats->nr_bytes[BLOCK_ACCT_WRITE];
@@ -446,6 +466,8 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
 
     ds->rd_merged = stats->merged[BLOCK_ACCT_READ];
     ds->wr_merged = stats->merged[BLOCK_ACCT_WRITE];
+    ds->rd_merged_window = stats->merged_window[BLOCK_ACCT_READ];
+    ds->wr_merged_window = stats->merged_window[BLOCK_ACCT_WRITE];
     ds->flush_operations = stats->nr_ops[BLOCK_ACCT_FLUSH];
     ds->wr_total_time_ns = stats->total_time_ns[BLOCK_ACCT_WRITE];
     ds->rd_total_time_ns = stats->total_time_ns[BLOCK_ACCT_READ];
@@ -500,6 +522,37 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
     bdrv_latency_histogram_stats(&stats->latency_histogram[BLOCK_ACCT_FLUSH],
                                  &ds->has_x_flush_latency_histogram,
                                  &ds->x_flush_latency_histogram);
+
+    bdrv_latency_percentiles(&stats->latency_hdr[BLOCK_ACCT_READ],
+                             &ds->has_rd_latency_percentiles,
+                             &ds->rd_latency_percentiles);
+    bdrv_latency_percentiles(&stats->latency_hdr[BLOCK_ACCT_WRITE],
+                             &ds->has_wr_latency_percentiles,
+                             &ds->wr_latency_percentiles);
+    bdrv_latency_percentiles(&stats->latency_hdr[BLOCK_ACCT_FLUSH],
+                             &ds->has_flush_latency_percentiles,
+                             &ds->flush_latency_percentiles);
+
+    ds->has_queue_stats = stats->nr_queues > 0;
+    for (i = stats->nr_queues; i-- > 0;) {
+        BlockLatencyHdr *hdr = stats->queues[i].latency_hdr;
+        BlockDeviceQueueStatsList *entry = g_new0(BlockDeviceQueueStatsList, 1);
+        BlockDeviceQueueStats *qs = g_new0(BlockDeviceQueueStats, 1);
+
+        qs->queue = i;
+        bdrv_latency_percentiles(&hdr[BLOCK_ACCT_READ],
+                                 &qs->has_rd_latency_percentiles,
+                                 &qs->rd_latency_percentiles);
+        bdrv_latency_percentiles(&hdr[BLOCK_ACCT_WRITE],
+                                 &qs->has_wr_latency_percentiles,
+                                 &qs->wr_latency_percentiles);
+        bdrv_latency_percentiles(&hdr[BLOCK_ACCT_FLUSH],
+                                 &qs->has_flush_latency_percentiles,
+                                 &qs->flush_latency_percentiles);
+        entry->value = qs;
+        entry->next = ds->queue_stats;
+        ds->queue_stats = entry;
+    }
 }
 
 static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
@@ -529,6 +582,14 @@ static BlockStats *bdrv_query_bds_stats(BlockDriverState *bs,
 
     s->stats->wr_highest_offset = stat64_get(&bs->wr_highest_offset);
 
+    if (bs->drv && bs->drv->bdrv_co_block_status &&
+        QLIST_EMPTY(&bs->children)) {
+        s->has_block_status_cache = true;
+        s->block_status_cache = g_new0(BlockStatusCacheStats, 1);
+        s->block_status_cache->hits = bs->block_status_cache.hits;
+        s->block_status_cache->misses = bs->block_status_cache.misses;
+    }
+
     if (bs->file) {
         s->has_parent = true;
         s->parent = bdrv_query_bds_stats(bs->file->bs, blk_level);
@@ -413,6 +413,31 @@ int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     return qcow2_cache_do_get(bs, c, offset, table, false);
 }
 
+/*
+ * Like qcow2_cache_get(), but never reads from disk and so never yields.
+ * Returns -EAGAIN if the table is not in the cache.
+ */
+int qcow2_cache_get_cached(Qcow2Cache *c, uint64_t offset, void **table)
+{
+    int i, lookup_index;
+
+    assert(offset != 0);
+
+    i = lookup_index = (offset / c->table_size * 4) % c->size;
+    do {
+        if (c->entries[i].offset == offset) {
+            c->entries[i].ref++;
+            *table = qcow2_cache_get_table_addr(c, i);
+            return 0;
+        }
+        if (++i == c->size) {
+            i = 0;
+        }
+    } while (i != lookup_index);
+
+    return -EAGAIN;
+}
+
 void qcow2_cache_put(Qcow2Cache *c, void **table)
 {
     int i = qcow2_cache_get_table_idx(c, *table);
@@ -458,3 +483,46 @@ void qcow2_cache_discard(Qcow2Cache *c, void *table)
 
     qcow2_cache_table_release(c, i, 1);
 }
+
+int qcow2_cache_get_num_tables(Qcow2Cache *c)
+{
+    return c->size;
+}
+
+static int compare_lru_counter_desc(const void *a, const void *b)
+{
+    const Qcow2CachedTable *ta = a;
+    const Qcow2CachedTable *tb = b;
+
+    if (ta->lru_counter == tb->lru_counter) {
+        return 0;
+    }
+    return ta->lru_counter > tb->lru_counter ? -1 : 1;
+}
+
+/*
+ * Return the offsets of all tables in the cache, most recently used first.
+ * The caller must free the array with g_free().
+ */
+uint64_t *qcow2_cache_get_hot_offsets(Qcow2Cache *c, int *nb_offsets)
+{
+    Qcow2CachedTable *tables = g_new(Qcow2CachedTable, c->size);
+    uint64_t *offsets;
+    int i, n = 0;
+
+    for (i = 0; i < c->size; i++) {
+        if (c->entries[i].offset != 0) {
+            tables[n++] = c->entries[i];
+        }
+    }
+    qsort(tables, n, sizeof(*tables), compare_lru_counter_desc);
+
+    offsets = g_new(uint64_t, n);
+    for (i = 0; i < n; i++) {
+        offsets[i] = tables[i].offset;
+    }
+    g_free(tables);
+
+    *nb_offsets = n;
+    return offsets;
+}
@@ -73,6 +73,7 @@ typedef struct {
 #define  QCOW2_EXT_MAGIC_FEATURE_TABLE 0x6803f857
 #define  QCOW2_EXT_MAGIC_CRYPTO_HEADER 0x0537be77
 #define  QCOW2_EXT_MAGIC_BITMAPS 0x23852875
+#define  QCOW2_EXT_MAGIC_CACHE_HINTS 0x7c2b4dd1
 
 static int qcow2_probe(const uint8_t *buf, int buf_size, const char *filename)
 {
@@ -294,12 +295,55 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            qcow2_crypto_hdr_read_func,
-                                           bs, cflags, errp);
+                                           bs, cflags,
+                                           BLOCK_CRYPTO_MAX_THREADS, errp);
             if (!s->crypto) {
                 return -EINVAL;
             }
         }   break;
 
+        case QCOW2_EXT_MAGIC_CACHE_HINTS: {
+            Qcow2CacheHintsHeaderExt hints_ext;
+            uint64_t nb_hints;
+            uint32_t i;
+
+            /* The hints are only advisory, so skip them if they are broken */
+            if (ext.len < sizeof(hints_ext)) {
+                break;
+            }
+
+            ret = bdrv_pread(bs->file, offset, &hints_ext, sizeof(hints_ext));
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "cache_hints_ext: "
+                                 "Could not read ext header");
+                return ret;
+            }
+
+            hints_ext.nb_l2_hints = be32_to_cpu(hints_ext.nb_l2_hints);
+            hints_ext.nb_refblock_hints =
+                be32_to_cpu(hints_ext.nb_refblock_hints);
+            nb_hints = (uint64_t) hints_ext.nb_l2_hints +
+                       hints_ext.nb_refblock_hints;
+            if (ext.len != sizeof(hints_ext) + nb_hints * sizeof(uint64_t)) {
+                break;
+            }
+
+            g_free(s->cache_hints);
+            s->cache_hints = g_new(uint64_t, nb_hints);
+            ret = bdrv_pread(bs->file, offset + sizeof(hints_ext),
+                             s->cache_hints, nb_hints * sizeof(uint64_t));
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "cache_hints_ext: "
+                                 "Could not read hints");
+                return ret;
+            }
+            for (i = 0; i < nb_hints; i++) {
+                be64_to_cpus(&s->cache_hints[i]);
+            }
+            s->nb_l2_hints = hints_ext.nb_l2_hints;
+            s->nb_refblock_hints = hints_ext.nb_refblock_hints;
+        }   break;
+
         case QCOW2_EXT_MAGIC_BITMAPS:
             if (ext.len != sizeof(bitmaps_ext)) {
                 error_setg_errno(errp, -ret, "bitmaps_ext: "
@@ -712,6 +756,12 @@ static QemuOptsList qcow2_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "Clean unused cache entries after this time (in seconds)",
         },
+        {
+            .name = QCOW2_OPT_CACHE_WARMUP,
+            .type = QEMU_OPT_BOOL,
+            .help = "Save the hot metadata tables on close and prefetch "
+                    "them on open",
+        },
         BLOCK_CRYPTO_OPT_DEF_KEY_SECRET("encrypt.",
             "ID of secret providing qcow2 AES key or LUKS passphrase"),
         { /* end of list */ }
@@ -762,15 +812,267 @@ static void cache_clean_timer_del(BlockDriverState *bs)
     }
 }
 
+static bool cache_warmup_pending(BDRVQcow2State *s)
+{
+    return s->cache_warmup &&
+           s->cache_warmup_pos < s->nb_l2_hints + s->nb_refblock_hints;
+}
+
+/* Load the table described by cache hint @i into its cache */
+static int coroutine_fn qcow2_cache_warmup_one(BlockDriverState *bs,
+                                               uint32_t i)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t hint = s->cache_hints[i];
+    Qcow2Cache *c;
+    uint64_t offset;
+    void *table;
+    int ret;
+
+    /* Stale hints are skipped; lookups report corrupted tables themselves */
+    if (i < s->nb_l2_hints) {
+        uint64_t l1_index = hint >> s->l2_bits;
+        int l2_index = hint & (s->l2_size - 1);
+
+        c = s->l2_table_cache;
+        if (i >= qcow2_cache_get_num_tables(c) || l1_index >= s->l1_size) {
+            return 0;
+        }
+        offset = s->l1_table[l1_index] & L1E_OFFSET_MASK;
+        if (offset == 0 || offset_into_cluster(s, offset)) {
+            return 0;
+        }
+        offset += QEMU_ALIGN_DOWN(l2_index, s->l2_slice_size) *
+                  l2_entry_size(s);
+    } else {
+        c = s->refcount_block_cache;
+        if (i - s->nb_l2_hints >= qcow2_cache_get_num_tables(c) ||
+            hint >= s->refcount_table_size) {
+            return 0;
+        }
+        offset = s->refcount_table[hint] & REFT_OFFSET_MASK;
+        if (offset == 0 || offset_into_cluster(s, offset)) {
+            return 0;
+        }
+    }
+
+    ret = qcow2_cache_get(bs, c, offset, &table);
+    if (ret < 0) {
+        return ret;
+    }
+    qcow2_cache_put(c, &table);
+    return 0;
+}
+
+static void coroutine_fn qcow2_cache_warmup_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    /* Get out of the way of drains, the timer resumes where we left off */
+    while (cache_warmup_pending(s) && !atomic_read(&bs->quiesce_counter)) {
+        qemu_co_mutex_lock(&s->lock);
+        if (cache_warmup_pending(s)) {
+            ret = qcow2_cache_warmup_one(bs, s->cache_warmup_pos++);
+            if (ret < 0) {
+                s->cache_warmup_pos = s->nb_l2_hints + s->nb_refblock_hints;
+            }
+        }
+        qemu_co_mutex_unlock(&s->lock);
+    }
+
+    trace_qcow2_cache_warmup(bs, s->cache_warmup_pos,
+                             s->nb_l2_hints + s->nb_refblock_hints);
+    s->cache_warmup_running = false;
+    if (cache_warmup_pending(s)) {
+        timer_mod(s->cache_warmup_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME)
+                  + CACHE_WARMUP_RETRY_MS);
+    }
+    bdrv_dec_in_flight(bs);
+}
+
+static void cache_warmup_timer_cb(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVQcow2State *s = bs->opaque;
+    Coroutine *co;
+
+    if (!cache_warmup_pending(s) || s->cache_warmup_running) {
+        return;
+    }
+    if (atomic_read(&bs->quiesce_counter)) {
+        timer_mod(s->cache_warmup_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME)
+                  + CACHE_WARMUP_RETRY_MS);
+        return;
+    }
+
+    s->cache_warmup_running = true;
+    bdrv_inc_in_flight(bs);
+    co = qemu_coroutine_create(qcow2_cache_warmup_entry, bs);
+    qemu_coroutine_enter(co);
+}
+
+/* Prefetch the remaining cache hints in the background */
+static void cache_warmup_timer_init(BlockDriverState *bs, AioContext *context)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    if (!cache_warmup_pending(s)) {
+        return;
+    }
+    /* Unlike the virtual clock, this also runs while the guest is paused */
+    if (!s->cache_warmup_timer) {
+        s->cache_warmup_timer = aio_timer_new(context, QEMU_CLOCK_REALTIME,
+                                              SCALE_MS, cache_warmup_timer_cb,
+                                              bs);
+    }
+    timer_mod(s->cache_warmup_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME));
+}
+
+static void cache_warmup_timer_del(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    if (s->cache_warmup_timer) {
+        timer_del(s->cache_warmup_timer);
+        timer_free(s->cache_warmup_timer);
+        s->cache_warmup_timer = NULL;
+    }
+}
+
+typedef struct Qcow2HotTable {
+    uint64_t offset;
+    int rank;
+} Qcow2HotTable;
+
+static int compare_hot_table_offsets(const void *a, const void *b)
+{
+    const Qcow2HotTable *ta = a;
+    const Qcow2HotTable *tb = b;
+
+    if (ta->offset == tb->offset) {
+        return 0;
+    }
+    return ta->offset < tb->offset ? -1 : 1;
+}
+
+/*
+ * Find the entries of @table that point to the cached tables at @offsets.
+ * Each cluster referenced by @table is made of 1 << @slice_bits cache
+ * entries; for each cached table that @table references, store
+ * (index << slice_bits) + slice in @hints, keeping the order of @offsets.
+ *
+ * Returns the number of hints stored.
+ */
+static uint32_t cache_hints_from_offsets(BDRVQcow2State *s,
+                                         const uint64_t *offsets,
+                                         int nb_offsets,
+                                         const uint64_t *table,
+                                         uint64_t table_size,
+                                         uint64_t offset_mask,
+                                         int slice_bits, uint64_t *hints)
+{
+    Qcow2HotTable *sorted = g_new(Qcow2HotTable, nb_offsets);
+    uint64_t *by_rank = g_new(uint64_t, nb_offsets);
+    uint32_t nb_hints = 0;
+    uint64_t i;
+    int j;
+
+    for (j = 0; j < nb_offsets; j++) {
+        sorted[j] = (Qcow2HotTable) { .offset = offsets[j], .rank = j };
+        by_rank[j] = UINT64_MAX;
+    }
+    qsort(sorted, nb_offsets, sizeof(*sorted), compare_hot_table_offsets);
+
+    for (i = 0; i < table_size; i++) {
+        uint64_t start = table[i] & offset_mask;
+        int lo = 0, hi = nb_offsets;
+
+        if (start == 0) {
+            continue;
+        }
+
+        /* Find the first cached table at or after @start */
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (sorted[mid].offset < start) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        for (j = lo; j < nb_offsets &&
+                     sorted[j].offset < start + s->cluster_size; j++) {
+            by_rank[sorted[j].rank] = (i << slice_bits) +
+                ((sorted[j].offset - start) >> (s->cluster_bits - slice_bits));
+        }
+    }
+
+    /* Tables of internal snapshots are not referenced and get dropped */
+    for (j = 0; j < nb_offsets; j++) {
+        if (by_rank[j] != UINT64_MAX) {
+            hints[nb_hints++] = by_rank[j];
+        }
+    }
+
+    g_free(sorted);
+    g_free(by_rank);
+    return nb_hints;
+}
+
+/* Replace the cache hints with the tables that are in the caches now */
+static void qcow2_save_cache_hints(BlockDriverState *bs)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int slice_shift = ctz32(s->l2_slice_size);
+    uint64_t nb_clusters = size_to_clusters(s, bs->total_sectors *
+                                               BDRV_SECTOR_SIZE);
+    uint64_t *l2_offsets, *refblock_offsets;
+    int nb_l2, nb_refblock;
+    uint32_t i, j;
+
+    l2_offsets = qcow2_cache_get_hot_offsets(s->l2_table_cache, &nb_l2);
+    refblock_offsets = qcow2_cache_get_hot_offsets(s->refcount_block_cache,
+                                                   &nb_refblock);
+
+    g_free(s->cache_hints);
+    s->cache_hints = g_new(uint64_t, nb_l2 + nb_refblock);
+
+    s->nb_l2_hints =
+        cache_hints_from_offsets(s, l2_offsets, nb_l2, s->l1_table,
+                                 s->l1_size, L1E_OFFSET_MASK,
+                                 s->l2_bits - slice_shift, s->cache_hints);
+    /* New L2 tables go through the cache in full, even beyond the disk */
+    for (i = 0, j = 0; i < s->nb_l2_hints; i++) {
+        uint64_t hint = s->cache_hints[i] << slice_shift;
+        if (hint < nb_clusters) {
+            s->cache_hints[j++] = hint;
+        }
+    }
+    s->nb_l2_hints = j;
+
+    s->nb_refblock_hints =
+        cache_hints_from_offsets(s, refblock_offsets, nb_refblock,
+                                 s->refcount_table, s->refcount_table_size,
+                                 REFT_OFFSET_MASK, 0,
+                                 s->cache_hints + s->nb_l2_hints);
+
+    g_free(l2_offsets);
+    g_free(refblock_offsets);
+}
+
 static void qcow2_detach_aio_context(BlockDriverState *bs)
 {
     cache_clean_timer_del(bs);
+    cache_warmup_timer_del(bs);
 }
 
 static void qcow2_attach_aio_context(BlockDriverState *bs,
                                      AioContext *new_context)
 {
     cache_clean_timer_init(bs, new_context);
+    cache_warmup_timer_init(bs, new_context);
 }
 
 static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
@@ -783,7 +1085,8 @@ static void read_cache_sizes(BlockDriverState *bs, QemuOpts *opts,
     bool l2_cache_size_set, refcount_cache_size_set, combined_cache_size_set;
     int min_refcount_cache = MIN_REFCOUNT_CACHE_SIZE * s->cluster_size;
     uint64_t virtual_disk_size = bs->total_sectors * BDRV_SECTOR_SIZE;
-    uint64_t max_l2_cache = virtual_disk_size / (s->cluster_size / 8);
+    uint64_t max_l2_cache =
+        virtual_disk_size / (s->cluster_size / l2_entry_size(s));
 
     combined_cache_size_set = qemu_opt_get(opts, QCOW2_OPT_CACHE_SIZE);
     l2_cache_size_set = qemu_opt_get(opts, QCOW2_OPT_L2_CACHE_SIZE);
@@ -855,6 +1158,7 @@ typedef struct Qcow2ReopenState {
     int overlap_check;
     bool discard_passthrough[QCOW2_DISCARD_MAX];
     uint64_t cache_clean_interval;
+    bool cache_warmup;
     QCryptoBlockOpenOptions *crypto_opts; /* Disk encryption runtime options */
 } Qcow2ReopenState;
 
@@ -932,7 +1236,7 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         }
     }
 
-    r->l2_slice_size = l2_cache_entry_size / sizeof(uint64_t);
+    r->l2_slice_size = l2_cache_entry_size / l2_entry_size(s);
     r->l2_table_cache = qcow2_cache_create(bs, l2_cache_size,
                                            l2_cache_entry_size);
     r->refcount_block_cache = qcow2_cache_create(bs, refcount_cache_size,
@@ -961,6 +1265,8 @@ static int qcow2_update_options_prepare(BlockDriverState *bs,
         goto fail;
     }
 
+    r->cache_warmup = qemu_opt_get_bool(opts, QCOW2_OPT_CACHE_WARMUP, false);
+
     /* lazy-refcounts; flush if going from enabled to disabled */
     r->use_lazy_refcounts = qemu_opt_get_bool(opts, QCOW2_OPT_LAZY_REFCOUNTS,
         (s->compatible_features & QCOW2_COMPAT_LAZY_REFCOUNTS));
@@ -1111,6 +1417,10 @@ static void qcow2_update_options_commit(BlockDriverState *bs,
         cache_clean_timer_init(bs, bdrv_get_aio_context(bs));
     }
 
+    /* The caches are empty again, so start over */
+    s->cache_warmup = r->cache_warmup;
+    s->cache_warmup_pos = 0;
+
     qapi_free_QCryptoBlockOpenOptions(s->crypto_opts);
     s->crypto_opts = r->crypto_opts;
 }
@@ -1322,7 +1632,23 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
         bs->encrypted = true;
     }
 
-    s->l2_bits = s->cluster_bits - 3; /* L2 is always one cluster */
+    if (has_subclusters(s)) {
+        if (s->cluster_bits < MIN_EXTL2_CLUSTER_BITS) {
+            error_setg(errp, "Extended L2 entries are only supported with "
+                       "cluster sizes of at least %u bytes",
+                       1 << MIN_EXTL2_CLUSTER_BITS);
+            ret = -EINVAL;
+            goto fail;
+        }
+        s->subclusters_per_cluster = QCOW_EXTL2_SUBCLUSTERS_PER_CLUSTER;
+    } else {
+        s->subclusters_per_cluster = 1;
+    }
+    s->subcluster_size = s->cluster_size / s->subclusters_per_cluster;
+    s->subcluster_bits = ctz32(s->subcluster_size);
+
+    /* L2 is always one cluster */
+    s->l2_bits = s->cluster_bits - ctz32(l2_entry_size(s));
     s->l2_size = 1 << s->l2_bits;
     /* 2^(s->refcount_order - 3) is the refcount width in bytes */
     s->refcount_block_bits = s->cluster_bits - (s->refcount_order - 3);
@@ -1445,7 +1771,8 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
                 cflags |= QCRYPTO_BLOCK_OPEN_NO_IO;
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
-                                           NULL, NULL, cflags, errp);
+                                           NULL, NULL, cflags,
+                                           BLOCK_CRYPTO_MAX_THREADS, errp);
             if (!s->crypto) {
                 ret = -EINVAL;
                 goto fail;
@@ -1600,17 +1927,26 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
 
     qemu_co_queue_init(&s->compress_wait_queue);
 
+    if (flags & (BDRV_O_INACTIVE | BDRV_O_NO_IO)) {
+        s->cache_warmup_pos = s->nb_l2_hints + s->nb_refblock_hints;
+    } else {
+        cache_warmup_timer_init(bs, bdrv_get_aio_context(bs));
+    }
+
     return ret;
 
  fail:
     g_free(s->unknown_header_fields);
     cleanup_unknown_header_ext(bs);
+    g_free(s->cache_hints);
+    s->cache_hints = NULL;
     qcow2_free_snapshots(bs);
     qcow2_refcount_close(bs);
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
     cache_clean_timer_del(bs);
+    cache_warmup_timer_del(bs);
     if (s->l2_table_cache) {
         qcow2_cache_destroy(s->l2_table_cache);
     }
@@ -1679,7 +2015,7 @@ static void qcow2_refresh_limits(BlockDriverState *bs, Error **errp)
         /* Encryption works on a sector granularity */
         bs->bl.request_alignment = qcrypto_block_get_sector_size(s->crypto);
     }
-    bs->bl.pwrite_zeroes_alignment = s->cluster_size;
+    bs->bl.pwrite_zeroes_alignment = s->subcluster_size;
     bs->bl.pdiscard_alignment = s->cluster_size;
 }
 
@@ -1728,6 +2064,14 @@ static void qcow2_reopen_commit(BDRVReopenState *state)
 {
     qcow2_update_options_commit(state->bs, state->opaque);
     g_free(state->opaque);
+
+    /*
+     * qcow2_do_open() starts the warmup itself once the image is fully
+     * set up, so only do it here for reopens.
+     */
+    if (!(state->flags & (BDRV_O_INACTIVE | BDRV_O_NO_IO))) {
+        cache_warmup_timer_init(state->bs, bdrv_get_aio_context(state->bs));
+    }
 }
 
 static void qcow2_reopen_abort(BDRVReopenState *state)
@@ -1782,6 +2126,32 @@ static void qcow2_join_options(QDict *options, QDict *old_options)
     }
 }
 
+/*
+ * Like qcow2_get_cluster_offset(), but s->lock is only taken if the L2 slice
+ * is not cached yet.  Lookups of cached slices do not contend with each
+ * other, nor with requests that hold s->lock while they wait for I/O.
+ */
+static int coroutine_fn qcow2_co_get_cluster_offset(BlockDriverState *bs,
+                                                    uint64_t offset,
+                                                    unsigned int *bytes,
+                                                    uint64_t *cluster_offset,
+                                                    QCow2SubclusterType *type)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+
+    ret = qcow2_get_cluster_offset_cached(bs, offset, bytes, cluster_offset,
+                                          type);
+    if (ret == -EAGAIN) {
+        qemu_co_mutex_lock(&s->lock);
+        trace_qcow2_get_cluster_offset_locked(qemu_coroutine_self(), offset);
+        ret = qcow2_get_cluster_offset(bs, offset, bytes, cluster_offset,
+                                       type);
+        qemu_co_mutex_unlock(&s->lock);
+    }
+    return ret;
+}
+
 static int coroutine_fn qcow2_co_block_status(BlockDriverState *bs,
                                               bool want_zero,
                                               int64_t offset, int64_t count,
@@ -1790,30 +2160,31 @@ static int coroutine_fn qcow2_co_block_status(BlockDriverState *bs,
 {
     BDRVQcow2State *s = bs->opaque;
     uint64_t cluster_offset;
-    int index_in_cluster, ret;
+    QCow2SubclusterType type;
+    int ret;
     unsigned int bytes;
     int status = 0;
 
     bytes = MIN(INT_MAX, count);
-    qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_get_cluster_offset(bs, offset, &bytes, &cluster_offset);
-    qemu_co_mutex_unlock(&s->lock);
+    ret = qcow2_co_get_cluster_offset(bs, offset, &bytes, &cluster_offset,
+                                      &type);
     if (ret < 0) {
         return ret;
     }
 
     *pnum = bytes;
 
-    if (cluster_offset != 0 && ret != QCOW2_CLUSTER_COMPRESSED &&
-        !s->crypto) {
-        index_in_cluster = offset & (s->cluster_size - 1);
-        *map = cluster_offset | index_in_cluster;
+    if ((type == QCOW2_SUBCLUSTER_NORMAL ||
+         type == QCOW2_SUBCLUSTER_ZERO_ALLOC) && !s->crypto) {
+        *map = cluster_offset | offset_into_cluster(s, offset);
         *file = bs->file->bs;
         status |= BDRV_BLOCK_OFFSET_VALID;
     }
-    if (ret == QCOW2_CLUSTER_ZERO_PLAIN || ret == QCOW2_CLUSTER_ZERO_ALLOC) {
+    if (type == QCOW2_SUBCLUSTER_ZERO_PLAIN ||
+        type == QCOW2_SUBCLUSTER_ZERO_ALLOC) {
         status |= BDRV_BLOCK_ZERO;
-    } else if (ret != QCOW2_CLUSTER_UNALLOCATED) {
+    } else if (type != QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN &&
+               type != QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC) {
         status |= BDRV_BLOCK_DATA;
     }
     return status;
@@ -1863,14 +2234,13 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
     int ret;
     unsigned int cur_bytes; /* number of bytes in current iteration */
     uint64_t cluster_offset = 0;
+    QCow2SubclusterType type;
     uint64_t bytes_done = 0;
     QEMUIOVector hd_qiov;
     uint8_t *cluster_data = NULL;
 
     qemu_iovec_init(&hd_qiov, qiov->niov);
 
-    qemu_co_mutex_lock(&s->lock);
-
     while (bytes != 0) {
 
         /* prepare next request */
@@ -1880,7 +2250,8 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
                             QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
         }
 
-        ret = qcow2_get_cluster_offset(bs, offset, &cur_bytes, &cluster_offset);
+        ret = qcow2_co_get_cluster_offset(bs, offset, &cur_bytes,
+                                          &cluster_offset, &type);
         if (ret < 0) {
             goto fail;
         }
@@ -1890,15 +2261,14 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
         qemu_iovec_reset(&hd_qiov);
         qemu_iovec_concat(&hd_qiov, qiov, bytes_done, cur_bytes);
 
-        switch (ret) {
-        case QCOW2_CLUSTER_UNALLOCATED:
+        switch (type) {
+        case QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN:
+        case QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC:
 
             if (bs->backing) {
                 BLKDBG_EVENT(bs->file, BLKDBG_READ_BACKING_AIO);
-                qemu_co_mutex_unlock(&s->lock);
                 ret = bdrv_co_preadv(bs->backing, offset, cur_bytes,
                                      &hd_qiov, 0);
-                qemu_co_mutex_lock(&s->lock);
                 if (ret < 0) {
                     goto fail;
                 }
@@ -1908,24 +2278,27 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
             }
             break;
 
-        case QCOW2_CLUSTER_ZERO_PLAIN:
-        case QCOW2_CLUSTER_ZERO_ALLOC:
+        case QCOW2_SUBCLUSTER_ZERO_PLAIN:
+        case QCOW2_SUBCLUSTER_ZERO_ALLOC:
             qemu_iovec_memset(&hd_qiov, 0, 0, cur_bytes);
             break;
 
-        case QCOW2_CLUSTER_COMPRESSED:
+        case QCOW2_SUBCLUSTER_COMPRESSED:
             /* add AIO support for compressed blocks ? */
+            qemu_co_mutex_lock(&s->lock);
             ret = qcow2_decompress_cluster(bs, cluster_offset);
+            if (ret >= 0) {
+                qemu_iovec_from_buf(&hd_qiov, 0,
+                                    s->cluster_cache + offset_in_cluster,
+                                    cur_bytes);
+            }
+            qemu_co_mutex_unlock(&s->lock);
             if (ret < 0) {
                 goto fail;
             }
-
-            qemu_iovec_from_buf(&hd_qiov, 0,
-                                s->cluster_cache + offset_in_cluster,
-                                cur_bytes);
             break;
 
-        case QCOW2_CLUSTER_NORMAL:
+        case QCOW2_SUBCLUSTER_NORMAL:
             if ((cluster_offset & 511) != 0) {
                 ret = -EIO;
                 goto fail;
@@ -1955,28 +2328,25 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
             }
 
             BLKDBG_EVENT(bs->file, BLKDBG_READ_AIO);
-            qemu_co_mutex_unlock(&s->lock);
             ret = bdrv_co_preadv(bs->file,
                                  cluster_offset + offset_in_cluster,
                                  cur_bytes, &hd_qiov, 0);
-            qemu_co_mutex_lock(&s->lock);
+            if (ret >= 0 && bs->encrypted) {
+                assert(s->crypto);
+                assert((offset & (BDRV_SECTOR_SIZE - 1)) == 0);
+                assert((cur_bytes & (BDRV_SECTOR_SIZE - 1)) == 0);
+                ret = block_crypto_co_decrypt(bs, s->crypto,
+                                              (s->crypt_physical_offset ?
+                                               cluster_offset +
+                                               offset_in_cluster :
+                                               offset),
+                                              cluster_data,
+                                              cur_bytes);
+            }
             if (ret < 0) {
                 goto fail;
             }
             if (bs->encrypted) {
-                assert(s->crypto);
-                assert((offset & (BDRV_SECTOR_SIZE - 1)) == 0);
-                assert((cur_bytes & (BDRV_SECTOR_SIZE - 1)) == 0);
-                if (qcrypto_block_decrypt(s->crypto,
-                                          (s->crypt_physical_offset ?
-                                           cluster_offset + offset_in_cluster :
-                                           offset),
-                                          cluster_data,
-                                          cur_bytes,
-                                          NULL) < 0) {
-                    ret = -EIO;
-                    goto fail;
-                }
                 qemu_iovec_from_buf(qiov, bytes_done, cluster_data, cur_bytes);
             }
             break;
@@ -1994,8 +2364,6 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
     ret = 0;
 
 fail:
-    qemu_co_mutex_unlock(&s->lock);
-
     qemu_iovec_destroy(&hd_qiov);
     qemu_vfree(cluster_data);
 
@@ -2102,13 +2470,18 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
                    QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
             qemu_iovec_to_buf(&hd_qiov, 0, cluster_data, hd_qiov.size);
 
-            if (qcrypto_block_encrypt(s->crypto,
-                                      (s->crypt_physical_offset ?
-                                       cluster_offset + offset_in_cluster :
-                                       offset),
-                                      cluster_data,
-                                      cur_bytes, NULL) < 0) {
-                ret = -EIO;
+            /*
+             * The guest data is written without s->lock below, so there
+             * is no need to hold it while encrypting either.
+             */
+            qemu_co_mutex_unlock(&s->lock);
+            ret = block_crypto_co_encrypt(bs, s->crypto,
+                                          (s->crypt_physical_offset ?
+                                           cluster_offset + offset_in_cluster :
+                                           offset),
+                                          cluster_data, cur_bytes);
+            qemu_co_mutex_lock(&s->lock);
+            if (ret < 0) {
                 goto fail;
             }
 
@@ -2178,6 +2551,15 @@ static int qcow2_inactivate(BlockDriverState *bs)
                           bdrv_get_device_or_node_name(bs));
     }
 
+    /* qcow2_close() saves the hints itself before freeing the L1 table */
+    if (s->cache_warmup && s->l1_table && !(s->flags & BDRV_O_NO_IO)) {
+        qcow2_save_cache_hints(bs);
+    }
+    s->cache_warmup_pos = s->nb_l2_hints + s->nb_refblock_hints;
+    if (s->cache_warmup_timer) {
+        timer_del(s->cache_warmup_timer);
+    }
+
     ret = qcow2_cache_flush(bs, s->l2_table_cache);
     if (ret) {
         result = ret;
@@ -2193,6 +2575,10 @@ static int qcow2_inactivate(BlockDriverState *bs)
     }
 
     if (result == 0) {
+        if (s->cache_warmup && !bdrv_is_read_only(bs)) {
+            /* The hints are only advisory, so ignore errors */
+            qcow2_update_header(bs);
+        }
         qcow2_mark_clean(bs);
     }
 
@@ -2202,6 +2588,12 @@ static int qcow2_inactivate(BlockDriverState *bs)
 static void qcow2_close(BlockDriverState *bs)
 {
     BDRVQcow2State *s = bs->opaque;
+
+    /* Without I/O the caches say nothing, so keep the old hints */
+    if (s->cache_warmup && !(s->flags & (BDRV_O_INACTIVE | BDRV_O_NO_IO))) {
+        qcow2_save_cache_hints(bs);
+    }
+
     qemu_vfree(s->l1_table);
     /* else pre-write overlap checks in cache_destroy may crash */
     s->l1_table = NULL;
@@ -2211,8 +2603,10 @@ static void qcow2_close(BlockDriverState *bs)
     }
 
     cache_clean_timer_del(bs);
+    cache_warmup_timer_del(bs);
     qcow2_cache_destroy(s->l2_table_cache);
     qcow2_cache_destroy(s->refcount_block_cache);
+    g_free(s->cache_hints);
 
     qcrypto_block_free(s->crypto);
     s->crypto = NULL;
@@ -2293,6 +2687,44 @@ static size_t header_ext_add(char *buf, uint32_t magic, const void *s,
     return ext_len;
 }
 
+static int cache_hints_ext_add(BDRVQcow2State *s, char *buf, size_t buflen)
+{
+    Qcow2CacheHintsHeaderExt *hints_ext;
+    size_t reserved, ext_len;
+    uint64_t max_hints, *hints;
+    uint32_t nb_l2, nb_refblock, i;
+    int ret;
+
+    /* Leave room for the end of extensions and the backing file name */
+    reserved = 2 * sizeof(QCowExtension) + sizeof(*hints_ext) +
+               (s->image_backing_file ? strlen(s->image_backing_file) : 0);
+    if (buflen < reserved + sizeof(uint64_t)) {
+        return 0;
+    }
+
+    max_hints = (buflen - reserved) / sizeof(uint64_t);
+    nb_l2 = MIN(s->nb_l2_hints, max_hints);
+    nb_refblock = MIN(s->nb_refblock_hints, max_hints - nb_l2);
+
+    ext_len = sizeof(*hints_ext) + (nb_l2 + nb_refblock) * sizeof(uint64_t);
+    hints_ext = g_malloc(ext_len);
+    hints_ext->nb_l2_hints = cpu_to_be32(nb_l2);
+    hints_ext->nb_refblock_hints = cpu_to_be32(nb_refblock);
+
+    hints = (uint64_t *)(hints_ext + 1);
+    for (i = 0; i < nb_l2; i++) {
+        hints[i] = cpu_to_be64(s->cache_hints[i]);
+    }
+    for (i = 0; i < nb_refblock; i++) {
+        hints[nb_l2 + i] = cpu_to_be64(s->cache_hints[s->nb_l2_hints + i]);
+    }
+
+    ret = header_ext_add(buf, QCOW2_EXT_MAGIC_CACHE_HINTS, hints_ext, ext_len,
+                         buflen);
+    g_free(hints_ext);
+    return ret;
+}
+
 /*
  * Updates the qcow2 header, including the variable length parts of it, i.e.
  * the backing file name and all extensions. qcow2 was not designed to allow
@@ -2423,6 +2855,11 @@ int qcow2_update_header(BlockDriverState *bs)
                 .bit  = QCOW2_INCOMPAT_CORRUPT_BITNR,
                 .name = "corrupt bit",
             },
+            {
+                .type = QCOW2_FEAT_TYPE_INCOMPATIBLE,
+                .bit  = QCOW2_INCOMPAT_EXTL2_BITNR,
+                .name = "extended L2 entries",
+            },
             {
                 .type = QCOW2_FEAT_TYPE_COMPATIBLE,
                 .bit  = QCOW2_COMPAT_LAZY_REFCOUNTS_BITNR,
@@ -2469,6 +2906,17 @@ int qcow2_update_header(BlockDriverState *bs)
         buflen -= ret;
     }
 
+    /* Cache hints, as many as fit into the rest of the first cluster */
+    if (s->nb_l2_hints + s->nb_refblock_hints > 0) {
+        ret = cache_hints_ext_add(s, buf, buflen);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        buf += ret;
+        buflen -= ret;
+    }
+
     /* End of header extensions */
     ret = header_ext_add(buf, QCOW2_EXT_MAGIC_END, NULL, 0, buflen);
     if (ret < 0) {
@@ -2609,11 +3057,11 @@ static int coroutine_fn preallocate_co(BlockDriverState *bs, uint64_t offset,
 
         while (meta) {
             QCowL2Meta *next = meta->next;
+            meta->prealloc = true;
 
             ret = qcow2_alloc_cluster_link_l2(bs, meta);
             if (ret < 0) {
-                qcow2_free_any_clusters(bs, meta->alloc_offset,
-                                        meta->nb_clusters, QCOW2_DISCARD_NEVER);
+                qcow2_alloc_cluster_abort(bs, meta);
                 return ret;
             }
 
@@ -2702,28 +3150,31 @@ int64_t qcow2_refcount_metadata_size(int64_t clusters, size_t cluster_size,
  * @total_size: virtual disk size in bytes
  * @cluster_size: cluster size in bytes
  * @refcount_order: refcount bits power-of-2 exponent
+ * @extended_l2: true if the image has extended L2 entries
  *
  * Returns: Total number of bytes required for the fully allocated image
  * (including metadata).
  */
 static int64_t qcow2_calc_prealloc_size(int64_t total_size,
                                         size_t cluster_size,
-                                        int refcount_order)
+                                        int refcount_order,
+                                        bool extended_l2)
 {
     int64_t meta_size = 0;
     uint64_t nl1e, nl2e;
     int64_t aligned_total_size = ROUND_UP(total_size, cluster_size);
+    size_t l2e_size = extended_l2 ? L2E_SIZE_EXTENDED : L2E_SIZE_NORMAL;
 
     /* header: 1 cluster */
     meta_size += cluster_size;
 
     /* total size of L2 tables */
     nl2e = aligned_total_size / cluster_size;
-    nl2e = ROUND_UP(nl2e, cluster_size / sizeof(uint64_t));
-    meta_size += nl2e * sizeof(uint64_t);
+    nl2e = ROUND_UP(nl2e, cluster_size / l2e_size);
+    meta_size += nl2e * l2e_size;
 
     /* total size of L1 tables */
-    nl1e = nl2e * sizeof(uint64_t) / cluster_size;
+    nl1e = nl2e * l2e_size / cluster_size;
     nl1e = ROUND_UP(nl1e, cluster_size / sizeof(uint64_t));
     meta_size += nl1e * sizeof(uint64_t);
 
@@ -2898,6 +3349,26 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         goto out;
     }
 
+    if (!qcow2_opts->has_extended_l2) {
+        qcow2_opts->extended_l2 = false;
+    }
+    if (qcow2_opts->extended_l2) {
+        if (version < 3) {
+            error_setg(errp, "Extended L2 entries are only supported with "
+                       "compatibility level 1.1 and above (use version=v3 or "
+                       "greater)");
+            ret = -EINVAL;
+            goto out;
+        }
+        if (cluster_size < (1 << MIN_EXTL2_CLUSTER_BITS)) {
+            error_setg(errp, "Extended L2 entries are only supported with "
+                       "cluster sizes of at least %u bytes",
+                       1 << MIN_EXTL2_CLUSTER_BITS);
+            ret = -EINVAL;
+            goto out;
+        }
+    }
+
     if (!qcow2_opts->has_refcount_bits) {
         qcow2_opts->refcount_bits = 16;
     }
@@ -2938,7 +3409,7 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
     {
         int64_t prealloc_size =
             qcow2_calc_prealloc_size(qcow2_opts->size, cluster_size,
-                                     refcount_order);
+                                     refcount_order, qcow2_opts->extended_l2);
 
         ret = blk_truncate(blk, prealloc_size, qcow2_opts->preallocation, errp);
         if (ret < 0) {
@@ -2969,6 +3440,10 @@ qcow2_co_create(BlockdevCreateOptions *create_options, Error **errp)
         header->compatible_features |=
             cpu_to_be64(QCOW2_COMPAT_LAZY_REFCOUNTS);
     }
+    if (qcow2_opts->extended_l2) {
+        header->incompatible_features |=
+            cpu_to_be64(QCOW2_INCOMPAT_EXTL2);
+    }
 
     ret = blk_pwrite(blk, 0, header, cluster_size, 0);
     g_free(header);
@@ -3147,6 +3622,7 @@ static int coroutine_fn qcow2_co_create_opts(const char *filename, QemuOpts *opt
         { BLOCK_OPT_CLUSTER_SIZE,       "cluster-size" },
         { BLOCK_OPT_LAZY_REFCOUNTS,     "lazy-refcounts" },
         { BLOCK_OPT_REFCOUNT_BITS,      "refcount-bits" },
+        { BLOCK_OPT_EXTL2,              "extended-l2" },
         { BLOCK_OPT_ENCRYPT,            BLOCK_OPT_ENCRYPT_FORMAT },
         { BLOCK_OPT_COMPAT_LEVEL,       "version" },
         { NULL, NULL },
@@ -3232,8 +3708,8 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
     int ret;
     BDRVQcow2State *s = bs->opaque;
 
-    uint32_t head = offset % s->cluster_size;
-    uint32_t tail = (offset + bytes) % s->cluster_size;
+    uint32_t head = offset_into_subcluster(s, offset);
+    uint32_t tail = offset_into_subcluster(s, offset + bytes);
 
     trace_qcow2_pwrite_zeroes_start_req(qemu_coroutine_self(), offset, bytes);
     if (offset + bytes == bs->total_sectors * BDRV_SECTOR_SIZE) {
@@ -3243,27 +3719,30 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
     if (head || tail) {
         uint64_t off;
         unsigned int nr;
+        QCow2SubclusterType type;
 
-        assert(head + bytes <= s->cluster_size);
+        assert(head + bytes <= s->subcluster_size);
 
-        /* check whether remainder of cluster already reads as zero */
+        /* check whether remainder of subcluster already reads as zero */
         if (!(is_zero(bs, offset - head, head) &&
               is_zero(bs, offset + bytes,
-                      tail ? s->cluster_size - tail : 0))) {
+                      tail ? s->subcluster_size - tail : 0))) {
             return -ENOTSUP;
         }
 
         qemu_co_mutex_lock(&s->lock);
         /* We can have new write after previous check */
-        offset = QEMU_ALIGN_DOWN(offset, s->cluster_size);
-        bytes = s->cluster_size;
-        nr = s->cluster_size;
-        ret = qcow2_get_cluster_offset(bs, offset, &nr, &off);
-        if (ret != QCOW2_CLUSTER_UNALLOCATED &&
-            ret != QCOW2_CLUSTER_ZERO_PLAIN &&
-            ret != QCOW2_CLUSTER_ZERO_ALLOC) {
+        offset -= head;
+        bytes = s->subcluster_size;
+        nr = s->subcluster_size;
+        ret = qcow2_get_cluster_offset(bs, offset, &nr, &off, &type);
+        if (ret < 0 ||
+            (type != QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN &&
+             type != QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC &&
+             type != QCOW2_SUBCLUSTER_ZERO_PLAIN &&
+             type != QCOW2_SUBCLUSTER_ZERO_ALLOC)) {
             qemu_co_mutex_unlock(&s->lock);
-            return -ENOTSUP;
+            return ret < 0 ? ret : -ENOTSUP;
         }
     } else {
         qemu_co_mutex_lock(&s->lock);
@@ -3271,8 +3750,8 @@ static coroutine_fn int qcow2_co_pwrite_zeroes(BlockDriverState *bs,
 
     trace_qcow2_pwrite_zeroes(qemu_coroutine_self(), offset, bytes);
 
-    /* Whatever is left can use real zero clusters */
-    ret = qcow2_cluster_zeroize(bs, offset, bytes, flags);
+    /* Whatever is left can use real zero subclusters */
+    ret = qcow2_subcluster_zeroize(bs, offset, bytes, flags);
     qemu_co_mutex_unlock(&s->lock);
 
     return ret;
@@ -3311,6 +3790,7 @@ qcow2_co_copy_range_from(BlockDriverState *bs,
     BDRVQcow2State *s = bs->opaque;
     int ret;
     unsigned int cur_bytes; /* number of bytes in current iteration */
+    QCow2SubclusterType type;
     BdrvChild *child = NULL;
     BdrvRequestFlags cur_write_flags;
 
@@ -3323,13 +3803,15 @@ qcow2_co_copy_range_from(BlockDriverState *bs,
         cur_bytes = MIN(bytes, INT_MAX);
         cur_write_flags = write_flags;
 
-        ret = qcow2_get_cluster_offset(bs, src_offset, &cur_bytes, &copy_offset);
+        ret = qcow2_get_cluster_offset(bs, src_offset, &cur_bytes,
+                                       &copy_offset, &type);
         if (ret < 0) {
             goto out;
         }
 
-        switch (ret) {
-        case QCOW2_CLUSTER_UNALLOCATED:
+        switch (type) {
+        case QCOW2_SUBCLUSTER_UNALLOCATED_PLAIN:
+        case QCOW2_SUBCLUSTER_UNALLOCATED_ALLOC:
             if (bs->backing && bs->backing->bs) {
                 int64_t backing_length = bdrv_getlength(bs->backing->bs);
                 if (src_offset >= backing_length) {
@@ -3344,16 +3826,16 @@ qcow2_co_copy_range_from(BlockDriverState *bs,
             }
             break;
 
-        case QCOW2_CLUSTER_ZERO_PLAIN:
-        case QCOW2_CLUSTER_ZERO_ALLOC:
+        case QCOW2_SUBCLUSTER_ZERO_PLAIN:
+        case QCOW2_SUBCLUSTER_ZERO_ALLOC:
             cur_write_flags |= BDRV_REQ_ZERO_WRITE;
             break;
 
-        case QCOW2_CLUSTER_COMPRESSED:
+        case QCOW2_SUBCLUSTER_COMPRESSED:
             ret = -ENOTSUP;
             goto out;
 
-        case QCOW2_CLUSTER_NORMAL:
+        case QCOW2_SUBCLUSTER_NORMAL:
             child = bs->file;
             copy_offset += offset_into_cluster(s, src_offset);
             if ((copy_offset & 511) != 0) {
@@ -3610,7 +4092,7 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
          *  preallocation. All that matters is that we will not have to allocate
          *  new refcount structures for them.) */
         nb_new_l2_tables = DIV_ROUND_UP(nb_new_data_clusters,
-                                        s->cluster_size / sizeof(uint64_t));
+                                        s->cluster_size / l2_entry_size(s));
         /* The cluster range may not be aligned to L2 boundaries, so add one L2
          * table for a potential head/tail */
         nb_new_l2_tables++;
@@ -3660,6 +4142,10 @@ static int coroutine_fn qcow2_co_truncate(BlockDriverState *bs, int64_t offset,
                 .offset       = guest_offset,
                 .alloc_offset = host_offset,
                 .nb_clusters  = nb_clusters,
+                /* The whole range is allocated and reads as the file data */
+                .cow_end      = {
+                    .offset       = nb_clusters << s->cluster_bits,
+                },
             };
             qemu_co_queue_init(&allocation.dependent_requests);
 
@@ -4127,6 +4613,8 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
     char *optstr;
     PreallocMode prealloc;
     bool has_backing_file;
+    bool extended_l2;
+    size_t l2e_size;
 
     /* Parse image creation options */
     cluster_size = qcow2_opt_get_cluster_size_del(opts, &local_err);
@@ -4144,6 +4632,23 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
         goto err;
     }
 
+    extended_l2 = qemu_opt_get_bool_del(opts, BLOCK_OPT_EXTL2, false);
+    if (extended_l2) {
+        if (version < 3) {
+            error_setg(&local_err, "Extended L2 entries are only supported "
+                       "with compatibility level 1.1 and above (use "
+                       "version=v3 or greater)");
+            goto err;
+        }
+        if (cluster_size < (1 << MIN_EXTL2_CLUSTER_BITS)) {
+            error_setg(&local_err, "Extended L2 entries are only supported "
+                       "with cluster sizes of at least %u bytes",
+                       1 << MIN_EXTL2_CLUSTER_BITS);
+            goto err;
+        }
+    }
+    l2e_size = extended_l2 ? L2E_SIZE_EXTENDED : L2E_SIZE_NORMAL;
+
     optstr = qemu_opt_get_del(opts, BLOCK_OPT_PREALLOC);
     prealloc = qapi_enum_parse(&PreallocMode_lookup, optstr,
                                PREALLOC_MODE_OFF, &local_err);
@@ -4161,7 +4666,7 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
 
     /* Check that virtual disk size is valid */
     l2_tables = DIV_ROUND_UP(virtual_size / cluster_size,
-                             cluster_size / sizeof(uint64_t));
+                             cluster_size / l2e_size);
     if (l2_tables * sizeof(uint64_t) > QCOW_MAX_L1_SIZE) {
         error_setg(&local_err, "The image size is too large "
                                "(try using a larger cluster size)");
@@ -4226,7 +4731,7 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
     info = g_new(BlockMeasureInfo, 1);
     info->fully_allocated =
         qcow2_calc_prealloc_size(virtual_size, cluster_size,
-                                 ctz32(refcount_bits));
+                                 ctz32(refcount_bits), extended_l2);
 
     /* Remove data clusters that are not required.  This overestimates the
      * required size because metadata needed for the fully allocated file is
@@ -4309,6 +4814,11 @@ static ImageInfoSpecific *qcow2_get_specific_info(BlockDriverState *bs)
         spec_info->u.qcow2.data->encrypt = qencrypt;
     }
 
+    if (has_subclusters(s)) {
+        spec_info->u.qcow2.data->has_extended_l2 = true;
+        spec_info->u.qcow2.data->extended_l2 = true;
+    }
+
     return spec_info;
 }
 
@@ -4547,6 +5057,12 @@ static int qcow2_amend_options(BlockDriverState *bs, QemuOpts *opts,
         } else if (!strcmp(desc->name, BLOCK_OPT_LAZY_REFCOUNTS)) {
             lazy_refcounts = qemu_opt_get_bool(opts, BLOCK_OPT_LAZY_REFCOUNTS,
                                                lazy_refcounts);
+        } else if (!strcmp(desc->name, BLOCK_OPT_EXTL2)) {
+            if (qemu_opt_get_bool(opts, BLOCK_OPT_EXTL2, false) !=
+                has_subclusters(s)) {
+                error_setg(errp, "Changing extended_l2 is not supported");
+                return -ENOTSUP;
+            }
         } else if (!strcmp(desc->name, BLOCK_OPT_REFCOUNT_BITS)) {
             refcount_bits = qemu_opt_get_number(opts, BLOCK_OPT_REFCOUNT_BITS,
                                                 refcount_bits);
@@ -4794,6 +5310,12 @@ static QemuOptsList qcow2_create_opts = {
             .help = "Width of a reference count entry in bits",
             .def_value_str = "16"
         },
+        {
+            .name = BLOCK_OPT_EXTL2,
+            .type = QEMU_OPT_BOOL,
+            .help = "Extended L2 tables with subcluster allocation "
+                    "(default: off)",
+        },
         { /* end of list */ }
     }
 };
@@ -523,6 +523,12 @@ static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
 {
     int ret;
 
+    if (bs->probed && dst_offset < BLOCK_PROBE_BUF_SIZE && bytes) {
+        /* The data cannot be checked here, let the caller fall back to a
+         * regular write so that raw_co_pwritev() can do it */
+        return -ENOTSUP;
+    }
+
     ret = raw_adjust_offset(bs, &dst_offset, bytes, true);
     if (ret) {
         return ret;
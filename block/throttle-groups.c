@@ -430,7 +430,8 @@ static void throttle_group_restart_queue(ThrottleGroupMember *tgm, bool is_write
      * be no timer pending on this tgm at this point */
     assert(!timer_pending(tgm->throttle_timers.timers[is_write]));
 
-    co = qemu_coroutine_create(throttle_group_restart_queue_entry, rd);
+    /* The restarted requests run on their own stacks */
+    co = qemu_coroutine_create_small(throttle_group_restart_queue_entry, rd);
     aio_co_enter(tgm->aio_context, co);
 }
 
@@ -244,6 +244,7 @@ static bool job_timer_pending(Job *job)
 
 void block_job_set_speed(BlockJob *job, int64_t speed, Error **errp)
 {
+    const BlockJobDriver *drv = block_job_driver(job);
     int64_t old_speed = job->speed;
 
     if (job_apply_verb(&job->job, JOB_VERB_SET_SPEED, errp)) {
@@ -255,6 +256,9 @@ void block_job_set_speed(BlockJob *job, int64_t speed, Error **errp)
     }
 
     ratelimit_set_speed(&job->limit, speed, BLOCK_JOB_SLICE_TIME);
+    if (drv->set_speed) {
+        drv->set_speed(job, speed);
+    }
 
     job->speed = speed;
     if (speed && speed <= old_speed) {
@@ -203,6 +203,8 @@ static bool default_mttcg_enabled(void)
 void qemu_tcg_configure(QemuOpts *opts, Error **errp)
 {
     const char *t = qemu_opt_get(opts, "thread");
+    uint64_t threshold;
+
     if (t) {
         if (strcmp(t, "multi") == 0) {
             if (TCG_OVERSIZED_GUEST) {
@@ -229,6 +231,21 @@ void qemu_tcg_configure(QemuOpts *opts, Error **errp)
     } else {
         mttcg_enabled = default_mttcg_enabled();
     }
+
+    threshold = qemu_opt_get_number(opts, "superblock-threshold", 0);
+    if (threshold > UINT_MAX) {
+        error_setg(errp, "Invalid 'superblock-threshold' setting %" PRIu64,
+                   threshold);
+        return;
+    }
+#ifndef TARGET_SUPPORTS_SUPERBLOCK
+    if (threshold) {
+        error_setg(errp, "'superblock-threshold' is not supported "
+                   "on this target");
+        return;
+    }
+#endif
+    tb_superblock_threshold = threshold;
 }
 
 /* The current number of executed instructions is based on what we
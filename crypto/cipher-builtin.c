@@ -19,6 +19,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
 #include "crypto/aes.h"
 #include "crypto/desrfb.h"
 #include "crypto/xts.h"
@@ -28,6 +29,9 @@ typedef struct QCryptoCipherBuiltinAESContext QCryptoCipherBuiltinAESContext;
 struct QCryptoCipherBuiltinAESContext {
     AES_KEY enc;
     AES_KEY dec;
+    /* The round keys of enc and dec in byte order, for AES instructions */
+    uint8_t enc_rk[AES_MAXNR + 1][AES_BLOCK_SIZE];
+    uint8_t dec_rk[AES_MAXNR + 1][AES_BLOCK_SIZE];
 };
 typedef struct QCryptoCipherBuiltinAES QCryptoCipherBuiltinAES;
 struct QCryptoCipherBuiltinAES {
@@ -74,13 +78,213 @@ static void qcrypto_cipher_free_aes(QCryptoCipher *cipher)
 }
 
 
-static void qcrypto_cipher_aes_ecb_encrypt(AES_KEY *key,
+/*
+ * Hardware AES.  Both implementations take the round keys computed by
+ * AES_set_encrypt_key and AES_set_decrypt_key; the latter are already
+ * in the form needed by the "equivalent inverse cipher" that AESDEC
+ * and AESD/AESIMC implement.  Eight independent blocks are kept in
+ * flight to hide the latency of the AES units.
+ */
+typedef void QCryptoAESAccelFunc(const uint8_t (*rk)[AES_BLOCK_SIZE],
+                                 int rounds,
+                                 const uint8_t *in,
+                                 uint8_t *out,
+                                 size_t nblocks);
+
+static QCryptoAESAccelFunc *aes_accel_encrypt;
+static QCryptoAESAccelFunc *aes_accel_decrypt;
+
+#if defined(CONFIG_AES_OPT) && (defined(__x86_64__) || defined(__i386__))
+#include "qemu/cpuid.h"
+#pragma GCC push_options
+#pragma GCC target("aes")
+#include <wmmintrin.h>
+
+#define AESNI_LOAD(i)   _mm_loadu_si128((const __m128i *)in + (i))
+#define AESNI_STORE(i, x) _mm_storeu_si128((__m128i *)out + (i), (x))
+
+#define AESNI_ROUND8(op, k) do {                        \
+        b0 = op(b0, k); b1 = op(b1, k);                 \
+        b2 = op(b2, k); b3 = op(b3, k);                 \
+        b4 = op(b4, k); b5 = op(b5, k);                 \
+        b6 = op(b6, k); b7 = op(b7, k);                 \
+    } while (0)
+
+#define AESNI_CRYPT(name, round, lastround)                                 \
+static void name(const uint8_t (*rk)[AES_BLOCK_SIZE], int rounds,          \
+                 const uint8_t *in, uint8_t *out, size_t nblocks)           \
+{                                                                           \
+    __m128i k[AES_MAXNR + 1];                                               \
+    __m128i b0, b1, b2, b3, b4, b5, b6, b7;                                 \
+    int r;                                                                  \
+                                                                            \
+    for (r = 0; r <= rounds; r++) {                                         \
+        k[r] = _mm_loadu_si128((const __m128i *)rk[r]);                     \
+    }                                                                       \
+                                                                            \
+    for (; nblocks >= 8; nblocks -= 8) {                                    \
+        b0 = AESNI_LOAD(0); b1 = AESNI_LOAD(1);                             \
+        b2 = AESNI_LOAD(2); b3 = AESNI_LOAD(3);                             \
+        b4 = AESNI_LOAD(4); b5 = AESNI_LOAD(5);                             \
+        b6 = AESNI_LOAD(6); b7 = AESNI_LOAD(7);                             \
+        AESNI_ROUND8(_mm_xor_si128, k[0]);                                  \
+        for (r = 1; r < rounds; r++) {                                      \
+            AESNI_ROUND8(round, k[r]);                                      \
+        }                                                                   \
+        AESNI_ROUND8(lastround, k[rounds]);                                 \
+        AESNI_STORE(0, b0); AESNI_STORE(1, b1);                             \
+        AESNI_STORE(2, b2); AESNI_STORE(3, b3);                             \
+        AESNI_STORE(4, b4); AESNI_STORE(5, b5);                             \
+        AESNI_STORE(6, b6); AESNI_STORE(7, b7);                             \
+        in += 8 * AES_BLOCK_SIZE;                                           \
+        out += 8 * AES_BLOCK_SIZE;                                          \
+    }                                                                       \
+                                                                            \
+    for (; nblocks; nblocks--) {                                            \
+        b0 = _mm_xor_si128(AESNI_LOAD(0), k[0]);                            \
+        for (r = 1; r < rounds; r++) {                                      \
+            b0 = round(b0, k[r]);                                           \
+        }                                                                   \
+        AESNI_STORE(0, lastround(b0, k[rounds]));                           \
+        in += AES_BLOCK_SIZE;                                               \
+        out += AES_BLOCK_SIZE;                                              \
+    }                                                                       \
+}
+
+AESNI_CRYPT(qcrypto_aes_encrypt_aesni, _mm_aesenc_si128, _mm_aesenclast_si128)
+AESNI_CRYPT(qcrypto_aes_decrypt_aesni, _mm_aesdec_si128, _mm_aesdeclast_si128)
+
+#pragma GCC pop_options
+
+static void __attribute__((constructor)) qcrypto_aes_accel_init(void)
+{
+    unsigned a, b, c, d;
+
+    if (__get_cpuid(1, &a, &b, &c, &d) && (c & bit_AES)) {
+        aes_accel_encrypt = qcrypto_aes_encrypt_aesni;
+        aes_accel_decrypt = qcrypto_aes_decrypt_aesni;
+    }
+}
+
+#elif defined(CONFIG_AES_OPT) && defined(__aarch64__)
+#include <sys/auxv.h>
+#pragma GCC push_options
+#pragma GCC target("+crypto")
+#include <arm_neon.h>
+
+#ifndef HWCAP_AES
+#define HWCAP_AES (1 << 3)
+#endif
+
+/* AESE/AESD add the round key first, so the last one is a plain XOR */
+#define ARMCE_ROUND8(op, k) do {                        \
+        b0 = op(b0, k); b1 = op(b1, k);                 \
+        b2 = op(b2, k); b3 = op(b3, k);                 \
+        b4 = op(b4, k); b5 = op(b5, k);                 \
+        b6 = op(b6, k); b7 = op(b7, k);                 \
+    } while (0)
+
+#define ARMCE_ENC_ROUND(b, k)   vaesmcq_u8(vaeseq_u8(b, k))
+#define ARMCE_DEC_ROUND(b, k)   vaesimcq_u8(vaesdq_u8(b, k))
+
+#define ARMCE_CRYPT(name, round, lastround)                                 \
+static void name(const uint8_t (*rk)[AES_BLOCK_SIZE], int rounds,          \
+                 const uint8_t *in, uint8_t *out, size_t nblocks)           \
+{                                                                           \
+    uint8x16_t k[AES_MAXNR + 1];                                            \
+    uint8x16_t b0, b1, b2, b3, b4, b5, b6, b7;                              \
+    int r;                                                                  \
+                                                                            \
+    for (r = 0; r <= rounds; r++) {                                         \
+        k[r] = vld1q_u8(rk[r]);                                             \
+    }                                                                       \
+                                                                            \
+    for (; nblocks >= 8; nblocks -= 8) {                                    \
+        b0 = vld1q_u8(in + 0 * 16); b1 = vld1q_u8(in + 1 * 16);             \
+        b2 = vld1q_u8(in + 2 * 16); b3 = vld1q_u8(in + 3 * 16);             \
+        b4 = vld1q_u8(in + 4 * 16); b5 = vld1q_u8(in + 5 * 16);             \
+        b6 = vld1q_u8(in + 6 * 16); b7 = vld1q_u8(in + 7 * 16);             \
+        for (r = 0; r < rounds - 1; r++) {                                  \
+            ARMCE_ROUND8(round, k[r]);                                      \
+        }                                                                   \
+        ARMCE_ROUND8(lastround, k[rounds - 1]);                             \
+        ARMCE_ROUND8(veorq_u8, k[rounds]);                                  \
+        vst1q_u8(out + 0 * 16, b0); vst1q_u8(out + 1 * 16, b1);             \
+        vst1q_u8(out + 2 * 16, b2); vst1q_u8(out + 3 * 16, b3);             \
+        vst1q_u8(out + 4 * 16, b4); vst1q_u8(out + 5 * 16, b5);             \
+        vst1q_u8(out + 6 * 16, b6); vst1q_u8(out + 7 * 16, b7);             \
+        in += 8 * AES_BLOCK_SIZE;                                           \
+        out += 8 * AES_BLOCK_SIZE;                                          \
+    }                                                                       \
+                                                                            \
+    for (; nblocks; nblocks--) {                                            \
+        b0 = vld1q_u8(in);                                                  \
+        for (r = 0; r < rounds - 1; r++) {                                  \
+            b0 = round(b0, k[r]);                                           \
+        }                                                                   \
+        b0 = veorq_u8(lastround(b0, k[rounds - 1]), k[rounds]);             \
+        vst1q_u8(out, b0);                                                  \
+        in += AES_BLOCK_SIZE;                                               \
+        out += AES_BLOCK_SIZE;                                              \
+    }                                                                       \
+}
+
+ARMCE_CRYPT(qcrypto_aes_encrypt_armce, ARMCE_ENC_ROUND, vaeseq_u8)
+ARMCE_CRYPT(qcrypto_aes_decrypt_armce, ARMCE_DEC_ROUND, vaesdq_u8)
+
+#pragma GCC pop_options
+
+static void __attribute__((constructor)) qcrypto_aes_accel_init(void)
+{
+    if (qemu_getauxval(AT_HWCAP) & HWCAP_AES) {
+        aes_accel_encrypt = qcrypto_aes_encrypt_armce;
+        aes_accel_decrypt = qcrypto_aes_decrypt_armce;
+    }
+}
+#endif /* CONFIG_AES_OPT */
+
+bool test_qcrypto_cipher_aes_next_accel(void)
+{
+    /* Once the table lookups are in use, there is nothing left to test */
+    if (!aes_accel_encrypt) {
+        return false;
+    }
+    aes_accel_encrypt = NULL;
+    aes_accel_decrypt = NULL;
+    return true;
+}
+
+
+static void qcrypto_cipher_aes_accel_keys(uint8_t (*rk)[AES_BLOCK_SIZE],
+                                          const AES_KEY *key)
+{
+    int i;
+
+    for (i = 0; i < 4 * (key->rounds + 1); i++) {
+        stl_be_p(&rk[i / 4][(i % 4) * 4], key->rd_key[i]);
+    }
+}
+
+
+static void qcrypto_cipher_aes_ecb_encrypt(const QCryptoCipherBuiltinAESContext
+                                           *aesctx,
                                            const void *in,
                                            void *out,
                                            size_t len)
 {
+    const AES_KEY *key = &aesctx->enc;
     const uint8_t *inptr = in;
     uint8_t *outptr = out;
+
+    if (aes_accel_encrypt && len >= AES_BLOCK_SIZE) {
+        size_t nblocks = len / AES_BLOCK_SIZE;
+
+        aes_accel_encrypt(aesctx->enc_rk, key->rounds, inptr, outptr, nblocks);
+        inptr += nblocks * AES_BLOCK_SIZE;
+        outptr += nblocks * AES_BLOCK_SIZE;
+        len -= nblocks * AES_BLOCK_SIZE;
+    }
+
     while (len) {
         if (len > AES_BLOCK_SIZE) {
             AES_encrypt(inptr, outptr, key);
@@ -100,13 +304,25 @@ static void qcrypto_cipher_aes_ecb_encrypt(AES_KEY *key,
 }
 
 
-static void qcrypto_cipher_aes_ecb_decrypt(AES_KEY *key,
+static void qcrypto_cipher_aes_ecb_decrypt(const QCryptoCipherBuiltinAESContext
+                                           *aesctx,
                                            const void *in,
                                            void *out,
                                            size_t len)
 {
+    const AES_KEY *key = &aesctx->dec;
     const uint8_t *inptr = in;
     uint8_t *outptr = out;
+
+    if (aes_accel_decrypt && len >= AES_BLOCK_SIZE) {
+        size_t nblocks = len / AES_BLOCK_SIZE;
+
+        aes_accel_decrypt(aesctx->dec_rk, key->rounds, inptr, outptr, nblocks);
+        inptr += nblocks * AES_BLOCK_SIZE;
+        outptr += nblocks * AES_BLOCK_SIZE;
+        len -= nblocks * AES_BLOCK_SIZE;
+    }
+
     while (len) {
         if (len > AES_BLOCK_SIZE) {
             AES_decrypt(inptr, outptr, key);
@@ -131,10 +347,7 @@ static void qcrypto_cipher_aes_xts_encrypt(const void *ctx,
                                            uint8_t *dst,
                                            const uint8_t *src)
 {
-    const QCryptoCipherBuiltinAESContext *aesctx = ctx;
-
-    qcrypto_cipher_aes_ecb_encrypt((AES_KEY *)&aesctx->enc,
-                                   src, dst, length);
+    qcrypto_cipher_aes_ecb_encrypt(ctx, src, dst, length);
 }
 
 
@@ -143,10 +356,7 @@ static void qcrypto_cipher_aes_xts_decrypt(const void *ctx,
                                            uint8_t *dst,
                                            const uint8_t *src)
 {
-    const QCryptoCipherBuiltinAESContext *aesctx = ctx;
-
-    qcrypto_cipher_aes_ecb_decrypt((AES_KEY *)&aesctx->dec,
-                                   src, dst, length);
+    qcrypto_cipher_aes_ecb_decrypt(ctx, src, dst, length);
 }
 
 
@@ -160,7 +370,7 @@ static int qcrypto_cipher_encrypt_aes(QCryptoCipher *cipher,
 
     switch (cipher->mode) {
     case QCRYPTO_CIPHER_MODE_ECB:
-        qcrypto_cipher_aes_ecb_encrypt(&ctxt->state.aes.key.enc,
+        qcrypto_cipher_aes_ecb_encrypt(&ctxt->state.aes.key,
                                        in, out, len);
         break;
     case QCRYPTO_CIPHER_MODE_CBC:
@@ -194,7 +404,7 @@ static int qcrypto_cipher_decrypt_aes(QCryptoCipher *cipher,
 
     switch (cipher->mode) {
     case QCRYPTO_CIPHER_MODE_ECB:
-        qcrypto_cipher_aes_ecb_decrypt(&ctxt->state.aes.key.dec,
+        qcrypto_cipher_aes_ecb_decrypt(&ctxt->state.aes.key,
                                        in, out, len);
         break;
     case QCRYPTO_CIPHER_MODE_CBC:
@@ -287,6 +497,15 @@ qcrypto_cipher_init_aes(QCryptoCipherMode mode,
         }
     }
 
+    qcrypto_cipher_aes_accel_keys(ctxt->state.aes.key.enc_rk,
+                                  &ctxt->state.aes.key.enc);
+    qcrypto_cipher_aes_accel_keys(ctxt->state.aes.key.dec_rk,
+                                  &ctxt->state.aes.key.dec);
+    qcrypto_cipher_aes_accel_keys(ctxt->state.aes.key_tweak.enc_rk,
+                                  &ctxt->state.aes.key_tweak.enc);
+    qcrypto_cipher_aes_accel_keys(ctxt->state.aes.key_tweak.dec_rk,
+                                  &ctxt->state.aes.key_tweak.dec);
+
     ctxt->blocksize = AES_BLOCK_SIZE;
     ctxt->free = qcrypto_cipher_free_aes;
     ctxt->setiv = qcrypto_cipher_setiv_aes;
@@ -27,6 +27,14 @@
 #include "qemu/bswap.h"
 #include "crypto/xts.h"
 
+/*
+ * Number of blocks passed to the cipher function at once, enough for
+ * a 512 byte sector.  ECB implementations that pipeline several blocks,
+ * such as AES-NI or ARMv8 Crypto Extensions, need independent blocks
+ * in flight.
+ */
+#define XTS_BATCH_BLOCKS 32
+
 typedef union {
     uint8_t b[XTS_BLOCK_SIZE];
     uint64_t u[2];
@@ -54,18 +62,15 @@ static inline void xts_uint128_le_to_cpus(xts_uint128 *v)
 
 static void xts_mult_x(xts_uint128 *I)
 {
-    uint64_t tt;
+    uint64_t tt, poly;
 
     xts_uint128_le_to_cpus(I);
 
+    /* The carry out of the top bit is random, so avoid a branch */
     tt = I->u[0] >> 63;
-    I->u[0] <<= 1;
-
-    if (I->u[1] >> 63) {
-        I->u[0] ^= 0x87;
-    }
-    I->u[1] <<= 1;
-    I->u[1] |= tt;
+    poly = -(I->u[1] >> 63) & 0x87;
+    I->u[0] = (I->u[0] << 1) ^ poly;
+    I->u[1] = (I->u[1] << 1) | tt;
 
     xts_uint128_cpu_to_les(I);
 }
@@ -99,6 +104,45 @@ static inline void xts_tweak_encdec(const void *ctx,
 }
 
 
+/**
+ * xts_tweak_encdec_batch:
+ * @param ctxt: the cipher context
+ * @param func: the cipher function
+ * @src: buffer providing the input text of @n * XTS_BLOCK_SIZE bytes
+ * @dst: buffer to output the output text of @n * XTS_BLOCK_SIZE bytes
+ * @iv: the initialization vector tweak of XTS_BLOCK_SIZE bytes
+ * @n: number of blocks, at most XTS_BATCH_BLOCKS
+ *
+ * Encrypt/decrypt @n consecutive blocks with a single call to @func
+ */
+static void xts_tweak_encdec_batch(const void *ctx,
+                                   xts_cipher_func *func,
+                                   const uint8_t *src,
+                                   uint8_t *dst,
+                                   xts_uint128 *iv,
+                                   unsigned long n)
+{
+    xts_uint128 T[XTS_BATCH_BLOCKS], D[XTS_BATCH_BLOCKS];
+    unsigned long i;
+
+    memcpy(D, src, n * XTS_BLOCK_SIZE);
+
+    for (i = 0; i < n; i++) {
+        T[i] = *iv;
+        xts_uint128_xor(&D[i], &D[i], iv);
+        xts_mult_x(iv);
+    }
+
+    func(ctx, n * XTS_BLOCK_SIZE, D[0].b, D[0].b);
+
+    for (i = 0; i < n; i++) {
+        xts_uint128_xor(&D[i], &D[i], &T[i]);
+    }
+
+    memcpy(dst, D, n * XTS_BLOCK_SIZE);
+}
+
+
 void xts_decrypt(const void *datactx,
                  const void *tweakctx,
                  xts_cipher_func *encfunc,
@@ -109,7 +153,7 @@ void xts_decrypt(const void *datactx,
                  const uint8_t *src)
 {
     xts_uint128 PP, CC, T;
-    unsigned long i, m, mo, lim;
+    unsigned long i, n, m, mo, lim;
 
     /* get number of blocks */
     m = length >> 4;
@@ -127,23 +171,11 @@ void xts_decrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, decfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, decfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-            src += XTS_BLOCK_SIZE;
-            dst += XTS_BLOCK_SIZE;
-        }
+    for (i = 0; i < lim; i += n) {
+        n = MIN(lim - i, XTS_BATCH_BLOCKS);
+        xts_tweak_encdec_batch(datactx, decfunc, src, dst, &T, n);
+        src += n * XTS_BLOCK_SIZE;
+        dst += n * XTS_BLOCK_SIZE;
     }
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
@@ -185,7 +217,7 @@ void xts_encrypt(const void *datactx,
                  const uint8_t *src)
 {
     xts_uint128 PP, CC, T;
-    unsigned long i, m, mo, lim;
+    unsigned long i, n, m, mo, lim;
 
     /* get number of blocks */
     m = length >> 4;
@@ -203,24 +235,11 @@ void xts_encrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, encfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, encfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-
-            dst += XTS_BLOCK_SIZE;
-            src += XTS_BLOCK_SIZE;
-        }
+    for (i = 0; i < lim; i += n) {
+        n = MIN(lim - i, XTS_BATCH_BLOCKS);
+        xts_tweak_encdec_batch(datactx, encfunc, src, dst, &T, n);
+        src += n * XTS_BLOCK_SIZE;
+        dst += n * XTS_BLOCK_SIZE;
     }
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
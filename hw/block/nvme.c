@@ -19,25 +19,37 @@
  *      -drive file=<file>,if=none,id=<drive_id>
  *      -device nvme,drive=<drive_id>,serial=<serial>,id=<id[optional]>, \
  *              cmb_size_mb=<cmb_size_mb[optional]>, \
- *              num_queues=<N[optional]>
+ *              num_queues=<N[optional]>, ioeventfd=<on|off[optional]>, \
+ *              iothread=<iothread_id[optional]>
  *
  * Note cmb_size_mb denotes size of CMB in MB. CMB is assumed to be at
  * offset 0 in BAR2 and supports only WDS, RDS and SQS for now.
+ *
+ * The controller supports the Doorbell Buffer Config command.  Once the
+ * guest has set up shadow doorbells, ioeventfd=on turns doorbell writes
+ * for the I/O queues into eventfd kicks instead of traps into the device
+ * model.  With iothread set, the I/O queues are processed in that
+ * IOThread, which polls the shadow doorbells if its poll-max-ns allows.
  */
 
 #include "qemu/osdep.h"
 #include "qemu/units.h"
 #include "hw/block/block.h"
 #include "hw/hw.h"
+#include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
 #include "hw/pci/pci.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/kvm.h"
 #include "qapi/error.h"
 #include "qapi/visitor.h"
 #include "sysemu/block-backend.h"
+#include "block/aio-wait.h"
 
+#include "qemu/error-report.h"
 #include "qemu/log.h"
 #include "qemu/cutils.h"
+#include "qemu/main-loop.h"
 #include "trace.h"
 #include "nvme.h"
 
@@ -48,6 +60,9 @@
             " in %s: " fmt "\n", __func__, ## __VA_ARGS__); \
     } while (0)
 
+#define NVME_SQ_DB_OFFSET(qid) (0x1000 + ((qid) << 3))
+#define NVME_CQ_DB_OFFSET(qid) (0x1000 + ((qid) << 3) + (1 << 2))
+
 static void nvme_process_sq(void *opaque);
 
 static void nvme_addr_read(NvmeCtrl *n, hwaddr addr, void *buf, int size)
@@ -94,6 +109,83 @@ static uint8_t nvme_sq_empty(NvmeSQueue *sq)
     return sq->head == sq->tail;
 }
 
+static inline AioContext *nvme_queue_ctx(NvmeCtrl *n, uint16_t qid)
+{
+    /* The admin queue is always processed in the main loop */
+    return qid ? n->ctx : qemu_get_aio_context();
+}
+
+/*
+ * Run @cb in the AioContext of queue @qid and wait for it to finish.
+ * The caller must hold the AioContext lock of the I/O queues once.
+ */
+static void nvme_queue_run(NvmeCtrl *n, uint16_t qid, QEMUBHFunc *cb,
+                           void *opaque)
+{
+    if (qid && n->iothread) {
+        aio_wait_bh_oneshot(n->ctx, cb, opaque);
+    } else {
+        cb(opaque);
+    }
+}
+
+static uint32_t nvme_dbbuf_read(NvmeCtrl *n, uint64_t addr)
+{
+    uint32_t val;
+
+    pci_dma_read(&n->parent_obj, addr, &val, sizeof(val));
+    return le32_to_cpu(val);
+}
+
+static void nvme_dbbuf_write(NvmeCtrl *n, uint64_t addr, uint32_t val)
+{
+    val = cpu_to_le32(val);
+    pci_dma_write(&n->parent_obj, addr, &val, sizeof(val));
+}
+
+static void nvme_sq_read_shadow_tail(NvmeSQueue *sq)
+{
+    uint32_t new_tail = nvme_dbbuf_read(sq->ctrl, sq->db_addr);
+
+    if (unlikely(new_tail >= sq->size)) {
+        NVME_GUEST_ERR(nvme_ub_db_wr_invalid_sqtail,
+                       "shadow submission queue doorbell value"
+                       " beyond queue size, sqid=%"PRIu32","
+                       " new_tail=%"PRIu16", ignoring",
+                       sq->sqid, (uint16_t)new_tail);
+        return;
+    }
+    sq->tail = new_tail;
+}
+
+static void nvme_cq_read_shadow_head(NvmeCQueue *cq)
+{
+    uint32_t new_head = nvme_dbbuf_read(cq->ctrl, cq->db_addr);
+
+    if (unlikely(new_head >= cq->size)) {
+        NVME_GUEST_ERR(nvme_ub_db_wr_invalid_cqhead,
+                       "shadow completion queue doorbell value"
+                       " beyond queue size, cqid=%"PRIu32","
+                       " new_head=%"PRIu16", ignoring",
+                       cq->cqid, (uint16_t)new_head);
+        return;
+    }
+    cq->head = new_head;
+}
+
+/*
+ * Publish the consumed tail of @sq as its event index, so that the guest
+ * rings the doorbell for its next submission, then pick up entries that
+ * were added before the event index became visible.  Return true if
+ * there is more work to do.
+ */
+static bool nvme_sq_update_eventidx(NvmeSQueue *sq)
+{
+    nvme_dbbuf_write(sq->ctrl, sq->ei_addr, sq->tail);
+    nvme_sq_read_shadow_tail(sq);
+    return !nvme_sq_empty(sq) && !QTAILQ_EMPTY(&sq->req_list);
+}
+
 static void nvme_irq_check(NvmeCtrl *n)
 {
     if (msix_enabled(&(n->parent_obj))) {
@@ -136,6 +228,173 @@ static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
     }
 }
 
+/*
+ * Raise the interrupt of @cq if it holds entries the guest has not
+ * consumed, lower it otherwise.  Interrupts are injected with the BQL
+ * held, so queues serviced by an IOThread signal the irqfd of their
+ * MSI-X vector if there is one, and defer to a bottom half in the main
+ * loop otherwise; the bottom half also coalesces the interrupts for a
+ * burst of completions.
+ */
+static void nvme_irq_update(NvmeCtrl *n, NvmeCQueue *cq)
+{
+    if (!qemu_mutex_iothread_locked()) {
+        if (atomic_read(&n->irqfd_enabled) && cq->irq_enabled &&
+            cq->vector < n->num_queues) {
+            /* MSI-X is edge-triggered, there is nothing to lower */
+            if (cq->tail != cq->head) {
+                trace_nvme_irq_irqfd(cq->vector);
+                event_notifier_set(&n->msi_vectors[cq->vector].notifier);
+            }
+            return;
+        }
+        atomic_set(&cq->irq_pending, true);
+        qemu_bh_schedule(n->irq_bh);
+    } else if (cq->tail != cq->head) {
+        nvme_irq_assert(n, cq);
+    } else {
+        nvme_irq_deassert(n, cq);
+    }
+}
+
+static void nvme_irq_bh(void *opaque)
+{
+    NvmeCtrl *n = opaque;
+    int i;
+
+    aio_context_acquire(n->ctx);
+    for (i = 1; i < n->num_queues; i++) {
+        NvmeCQueue *cq = n->cq[i];
+
+        if (cq && atomic_xchg(&cq->irq_pending, false)) {
+            nvme_irq_update(n, cq);
+        }
+    }
+    aio_context_release(n->ctx);
+}
+
+static int nvme_vector_unmask(PCIDevice *dev, unsigned vector, MSIMessage msg)
+{
+    NvmeCtrl *n = NVME(dev);
+    NvmeMSIVector *v = &n->msi_vectors[vector];
+    int ret;
+
+    assert(!v->unmasked);
+    ret = kvm_irqchip_update_msi_route(kvm_state, v->virq, msg, dev);
+    if (ret < 0) {
+        return ret;
+    }
+    kvm_irqchip_commit_routes(kvm_state);
+
+    ret = kvm_irqchip_add_irqfd_notifier_gsi(kvm_state, &v->notifier, NULL,
+                                             v->virq);
+    if (ret < 0) {
+        return ret;
+    }
+    v->unmasked = true;
+    return 0;
+}
+
+static void nvme_vector_mask(PCIDevice *dev, unsigned vector)
+{
+    NvmeCtrl *n = NVME(dev);
+    NvmeMSIVector *v = &n->msi_vectors[vector];
+
+    assert(v->unmasked);
+    if (kvm_irqchip_remove_irqfd_notifier_gsi(kvm_state, &v->notifier,
+                                              v->virq) < 0) {
+        error_report("nvme: removing the irqfd of vector %u failed", vector);
+        return;
+    }
+    v->unmasked = false;
+}
+
+/* Completions signalled while a vector was masked become pending bits */
+static void nvme_vector_poll(PCIDevice *dev, unsigned int vector_start,
+                             unsigned int vector_end)
+{
+    NvmeCtrl *n = NVME(dev);
+    unsigned int vector;
+
+    vector_end = MIN(vector_end, n->num_queues);
+    for (vector = vector_start; vector < vector_end; vector++) {
+        if (msix_is_masked(dev, vector) &&
+            event_notifier_test_and_clear(&n->msi_vectors[vector].notifier)) {
+            msix_set_pending(dev, vector);
+        }
+    }
+}
+
+static void nvme_disable_irqfd(NvmeCtrl *n)
+{
+    PCIDevice *pdev = &n->parent_obj;
+    int i;
+
+    if (!n->msi_vectors || !pdev->msix_vector_use_notifier) {
+        return;
+    }
+
+    /* IOThreads go back to the bottom half before the routes disappear */
+    atomic_set(&n->irqfd_enabled, false);
+    msix_unset_vector_notifiers(pdev);
+    for (i = 0; i < n->num_queues; i++) {
+        NvmeMSIVector *v = &n->msi_vectors[i];
+
+        /* MSI-X may already be disabled, so keep masks and unmasks balanced */
+        if (v->unmasked) {
+            nvme_vector_mask(pdev, i);
+        }
+        kvm_irqchip_release_virq(kvm_state, v->virq);
+        v->virq = -1;
+    }
+}
+
+static void nvme_enable_irqfd(NvmeCtrl *n)
+{
+    PCIDevice *pdev = &n->parent_obj;
+    int i, ret;
+
+    for (i = 0; i < n->num_queues; i++) {
+        ret = kvm_irqchip_add_msi_route(kvm_state, i, pdev);
+        if (ret < 0) {
+            goto undo;
+        }
+        n->msi_vectors[i].virq = ret;
+    }
+
+    if (msix_set_vector_notifiers(pdev, nvme_vector_unmask, nvme_vector_mask,
+                                  nvme_vector_poll)) {
+        goto undo;
+    }
+    atomic_set(&n->irqfd_enabled, true);
+    return;
+
+undo:
+    error_report("nvme: cannot set up irqfds, completions from the IOThread "
+                 "go through the main loop");
+    while (--i >= 0) {
+        kvm_irqchip_release_virq(kvm_state, n->msi_vectors[i].virq);
+        n->msi_vectors[i].virq = -1;
+    }
+}
+
+static void nvme_write_config(PCIDevice *pdev, uint32_t address,
+                              uint32_t val, int len)
+{
+    NvmeCtrl *n = NVME(pdev);
+    bool was_enabled = msix_enabled(pdev);
+
+    pci_default_write_config(pdev, address, val, len);
+
+    if (n->msi_vectors) {
+        if (!was_enabled && msix_enabled(pdev)) {
+            nvme_enable_irqfd(n);
+        } else if (was_enabled && !msix_enabled(pdev)) {
+            nvme_disable_irqfd(n);
+        }
+    }
+}
+
 static uint16_t nvme_map_prp(QEMUSGList *qsg, QEMUIOVector *iov, uint64_t prp1,
                              uint64_t prp2, uint32_t len, NvmeCtrl *n)
 {
@@ -251,8 +510,16 @@ static void nvme_post_cqes(void *opaque)
 {
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
+    AioContext *ctx = nvme_queue_ctx(n, cq->cqid);
     NvmeRequest *req, *next;
 
+    aio_context_acquire(ctx);
+    if (cq->db_addr) {
+        /* Have the guest ring the doorbell when it consumes more entries */
+        nvme_dbbuf_write(n, cq->ei_addr, cq->head);
+        nvme_cq_read_shadow_head(cq);
+    }
+
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
         hwaddr addr;
@@ -273,8 +540,9 @@ static void nvme_post_cqes(void *opaque)
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
     }
     if (cq->tail != cq->head) {
-        nvme_irq_assert(n, cq);
+        nvme_irq_update(n, cq);
     }
+    aio_context_release(ctx);
 }
 
 static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
@@ -282,7 +550,7 @@ static void nvme_enqueue_req_completion(NvmeCQueue *cq, NvmeRequest *req)
     assert(cq->cqid == req->sq->cqid);
     QTAILQ_REMOVE(&req->sq->out_req_list, req, entry);
     QTAILQ_INSERT_TAIL(&cq->req_list, req, entry);
-    timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+    qemu_bh_schedule(cq->bh);
 }
 
 static void nvme_rw_cb(void *opaque, int ret)
@@ -292,6 +560,7 @@ static void nvme_rw_cb(void *opaque, int ret)
     NvmeCtrl *n = sq->ctrl;
     NvmeCQueue *cq = n->cq[sq->cqid];
 
+    aio_context_acquire(n->ctx);
     if (!ret) {
         block_acct_done(blk_get_stats(n->conf.blk), &req->acct);
         req->status = NVME_SUCCESS;
@@ -303,6 +572,7 @@ static void nvme_rw_cb(void *opaque, int ret)
         qemu_sglist_destroy(&req->qsg);
     }
     nvme_enqueue_req_completion(cq, req);
+    aio_context_release(n->ctx);
 }
 
 static uint16_t nvme_flush(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
@@ -311,6 +581,8 @@ static uint16_t nvme_flush(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     req->has_sg = false;
     block_acct_start(blk_get_stats(n->conf.blk), &req->acct, 0,
          BLOCK_ACCT_FLUSH);
+    block_acct_set_queue(blk_get_stats(n->conf.blk), &req->acct,
+                         req->sq->sqid);
     req->aiocb = blk_aio_flush(n->conf.blk, nvme_rw_cb, req);
 
     return NVME_NO_COMPLETE;
@@ -335,6 +607,8 @@ static uint16_t nvme_write_zeros(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     req->has_sg = false;
     block_acct_start(blk_get_stats(n->conf.blk), &req->acct, 0,
                      BLOCK_ACCT_WRITE);
+    block_acct_set_queue(blk_get_stats(n->conf.blk), &req->acct,
+                         req->sq->sqid);
     req->aiocb = blk_aio_pwrite_zeroes(n->conf.blk, aio_slba, aio_nlb,
                                         BDRV_REQ_MAY_UNMAP, nvme_rw_cb, req);
     return NVME_NO_COMPLETE;
@@ -370,6 +644,8 @@ static uint16_t nvme_rw(NvmeCtrl *n, NvmeNamespace *ns, NvmeCmd *cmd,
     }
 
     dma_acct_start(n->conf.blk, &req->acct, &req->qsg, acct);
+    block_acct_set_queue(blk_get_stats(n->conf.blk), &req->acct,
+                         req->sq->sqid);
     if (req->qsg.nsg > 0) {
         req->has_sg = true;
         req->aiocb = is_write ?
@@ -414,11 +690,123 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     }
 }
 
+static void nvme_sq_notifier(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (event_notifier_test_and_clear(e)) {
+        nvme_process_sq(sq);
+    }
+}
+
+static bool nvme_sq_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    /* Without a free request, processing the queue cannot make progress */
+    if (QTAILQ_EMPTY(&sq->req_list) ||
+        nvme_dbbuf_read(sq->ctrl, sq->db_addr) == sq->head) {
+        return false;
+    }
+    nvme_process_sq(sq);
+    return true;
+}
+
+static void nvme_sq_poll_begin(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    /* Leave the event index behind, so the guest stops ringing */
+    sq->polling = true;
+}
+
+static void nvme_sq_poll_end(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    sq->polling = false;
+    nvme_process_sq(sq);
+}
+
+static void nvme_init_sq_ioeventfd(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+    int ret;
+
+    ret = event_notifier_init(&sq->notifier, 0);
+    if (ret < 0) {
+        trace_nvme_ioeventfd_failed(sq->sqid, ret);
+        return;
+    }
+
+    aio_set_event_notifier(n->ctx, &sq->notifier, true,
+                           nvme_sq_notifier, nvme_sq_poll);
+    aio_set_event_notifier_poll(n->ctx, &sq->notifier,
+                                nvme_sq_poll_begin, nvme_sq_poll_end);
+    memory_region_add_eventfd(&n->iomem, NVME_SQ_DB_OFFSET(sq->sqid), 4,
+                              false, 0, &sq->notifier);
+    sq->ioeventfd_enabled = true;
+}
+
+static void nvme_init_sq_dbbuf(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+
+    sq->db_addr = n->dbbuf_dbs + (sq->sqid << 3);
+    sq->ei_addr = n->dbbuf_eis + (sq->sqid << 3);
+    nvme_dbbuf_write(n, sq->db_addr, sq->tail);
+    nvme_dbbuf_write(n, sq->ei_addr, sq->tail);
+
+    /* Without shadow doorbells an eventfd would lose the new tail */
+    if (n->ioeventfd && !sq->ioeventfd_enabled) {
+        nvme_init_sq_ioeventfd(sq);
+    }
+}
+
+/* Context: BH in the AioContext of @sq */
+static void nvme_stop_sq_bh(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+    AioContext *ctx = nvme_queue_ctx(sq->ctrl, sq->sqid);
+    NvmeRequest *req;
+
+    aio_context_acquire(ctx);
+    if (sq->ioeventfd_enabled) {
+        aio_set_event_notifier(ctx, &sq->notifier, true, NULL, NULL);
+    }
+    qemu_bh_delete(sq->bh);
+    while (!QTAILQ_EMPTY(&sq->out_req_list)) {
+        req = QTAILQ_FIRST(&sq->out_req_list);
+        assert(req->aiocb);
+        blk_aio_cancel(req->aiocb);
+    }
+    aio_context_release(ctx);
+}
+
+/*
+ * Stop fetching commands from @sq and cancel its outstanding requests.
+ * Called with the AioContext lock of the I/O queues held.
+ */
+static void nvme_stop_sq(NvmeSQueue *sq, NvmeCtrl *n)
+{
+    /* Nothing may kick @sq once it is stopped */
+    if (!nvme_check_cqid(n, sq->cqid)) {
+        QTAILQ_REMOVE(&n->cq[sq->cqid]->sq_list, sq, entry);
+    }
+    if (sq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem, NVME_SQ_DB_OFFSET(sq->sqid), 4,
+                                  false, 0, &sq->notifier);
+    }
+    nvme_queue_run(n, sq->sqid, nvme_stop_sq_bh, sq);
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     n->sq[sq->sqid] = NULL;
-    timer_del(sq->timer);
-    timer_free(sq->timer);
+    if (sq->ioeventfd_enabled) {
+        event_notifier_cleanup(&sq->notifier);
+    }
     g_free(sq->io_req);
     if (sq->sqid) {
         g_free(sq);
@@ -440,15 +828,11 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeCmd *cmd)
 
     trace_nvme_del_sq(qid);
 
+    aio_context_acquire(n->ctx);
     sq = n->sq[qid];
-    while (!QTAILQ_EMPTY(&sq->out_req_list)) {
-        req = QTAILQ_FIRST(&sq->out_req_list);
-        assert(req->aiocb);
-        blk_aio_cancel(req->aiocb);
-    }
+    nvme_stop_sq(sq, n);
     if (!nvme_check_cqid(n, sq->cqid)) {
         cq = n->cq[sq->cqid];
-        QTAILQ_REMOVE(&cq->sq_list, sq, entry);
 
         nvme_post_cqes(cq);
         QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
@@ -460,6 +844,7 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeCmd *cmd)
     }
 
     nvme_free_sq(sq, n);
+    aio_context_release(n->ctx);
     return NVME_SUCCESS;
 }
 
@@ -483,12 +868,17 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         sq->io_req[i].sq = sq;
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
-    sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
+    sq->bh = aio_bh_new(nvme_queue_ctx(n, sqid), nvme_process_sq, sq);
 
     assert(n->cq[cqid]);
     cq = n->cq[cqid];
     QTAILQ_INSERT_TAIL(&(cq->sq_list), sq, entry);
     n->sq[sqid] = sq;
+
+    /* The guest only uses shadow doorbells for the I/O queues */
+    if (sqid && n->dbbuf_enabled) {
+        nvme_init_sq_dbbuf(sq);
+    }
 }
 
 static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -525,15 +915,112 @@ static uint16_t nvme_create_sq(NvmeCtrl *n, NvmeCmd *cmd)
         return NVME_INVALID_FIELD | NVME_DNR;
     }
     sq = g_malloc0(sizeof(*sq));
+    aio_context_acquire(n->ctx);
     nvme_init_sq(sq, n, prp1, sqid, cqid, qsize + 1);
+    aio_context_release(n->ctx);
     return NVME_SUCCESS;
 }
 
+static void nvme_update_cq_head(NvmeCQueue *cq, uint16_t new_head)
+{
+    NvmeCtrl *n = cq->ctrl;
+    int start_sqs = nvme_cq_full(cq) ? 1 : 0;
+
+    cq->head = new_head;
+    if (start_sqs) {
+        NvmeSQueue *sq;
+        QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
+            qemu_bh_schedule(sq->bh);
+        }
+        qemu_bh_schedule(cq->bh);
+    }
+
+    if (cq->tail == cq->head) {
+        nvme_irq_update(n, cq);
+    }
+}
+
+static void nvme_cq_notifier(EventNotifier *e)
+{
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, notifier);
+    NvmeCtrl *n = cq->ctrl;
+    uint32_t new_head;
+
+    if (!event_notifier_test_and_clear(e)) {
+        return;
+    }
+
+    aio_context_acquire(n->ctx);
+    new_head = nvme_dbbuf_read(n, cq->db_addr);
+    if (unlikely(new_head >= cq->size)) {
+        NVME_GUEST_ERR(nvme_ub_db_wr_invalid_cqhead,
+                       "shadow completion queue doorbell value"
+                       " beyond queue size, cqid=%"PRIu32","
+                       " new_head=%"PRIu16", ignoring",
+                       cq->cqid, (uint16_t)new_head);
+    } else {
+        nvme_update_cq_head(cq, new_head);
+    }
+    aio_context_release(n->ctx);
+}
+
+static void nvme_init_cq_ioeventfd(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+    int ret;
+
+    ret = event_notifier_init(&cq->notifier, 0);
+    if (ret < 0) {
+        trace_nvme_ioeventfd_failed(cq->cqid, ret);
+        return;
+    }
+
+    aio_set_event_notifier(n->ctx, &cq->notifier, true,
+                           nvme_cq_notifier, NULL);
+    memory_region_add_eventfd(&n->iomem, NVME_CQ_DB_OFFSET(cq->cqid), 4,
+                              false, 0, &cq->notifier);
+    cq->ioeventfd_enabled = true;
+}
+
+static void nvme_init_cq_dbbuf(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+
+    cq->db_addr = n->dbbuf_dbs + (cq->cqid << 3) + (1 << 2);
+    cq->ei_addr = n->dbbuf_eis + (cq->cqid << 3) + (1 << 2);
+    nvme_dbbuf_write(n, cq->db_addr, cq->head);
+    nvme_dbbuf_write(n, cq->ei_addr, cq->head);
+
+    if (n->ioeventfd && !cq->ioeventfd_enabled) {
+        nvme_init_cq_ioeventfd(cq);
+    }
+}
+
+/* Context: BH in the AioContext of @cq */
+static void nvme_stop_cq_bh(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+    AioContext *ctx = nvme_queue_ctx(cq->ctrl, cq->cqid);
+
+    aio_context_acquire(ctx);
+    if (cq->ioeventfd_enabled) {
+        aio_set_event_notifier(ctx, &cq->notifier, true, NULL, NULL);
+    }
+    qemu_bh_delete(cq->bh);
+    aio_context_release(ctx);
+}
+
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     n->cq[cq->cqid] = NULL;
-    timer_del(cq->timer);
-    timer_free(cq->timer);
+    if (cq->ioeventfd_enabled) {
+        memory_region_del_eventfd(&n->iomem, NVME_CQ_DB_OFFSET(cq->cqid), 4,
+                                  false, 0, &cq->notifier);
+    }
+    nvme_queue_run(n, cq->cqid, nvme_stop_cq_bh, cq);
+    if (cq->ioeventfd_enabled) {
+        event_notifier_cleanup(&cq->notifier);
+    }
     msix_vector_unuse(&n->parent_obj, cq->vector);
     if (cq->cqid) {
         g_free(cq);
@@ -556,9 +1043,11 @@ static uint16_t nvme_del_cq(NvmeCtrl *n, NvmeCmd *cmd)
         trace_nvme_err_invalid_del_cq_notempty(qid);
         return NVME_INVALID_QUEUE_DEL;
     }
+    aio_context_acquire(n->ctx);
     nvme_irq_deassert(n, cq);
     trace_nvme_del_cq(qid);
     nvme_free_cq(cq, n);
+    aio_context_release(n->ctx);
     return NVME_SUCCESS;
 }
 
@@ -577,7 +1066,11 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     QTAILQ_INIT(&cq->sq_list);
     msix_vector_use(&n->parent_obj, cq->vector);
     n->cq[cqid] = cq;
-    cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
+    cq->bh = aio_bh_new(nvme_queue_ctx(n, cqid), nvme_post_cqes, cq);
+
+    if (cqid && n->dbbuf_enabled) {
+        nvme_init_cq_dbbuf(cq);
+    }
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeCmd *cmd)
@@ -615,8 +1108,10 @@ static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeCmd *cmd)
     }
 
     cq = g_malloc0(sizeof(*cq));
+    aio_context_acquire(n->ctx);
     nvme_init_cq(cq, n, prp1, cqid, vector, qsize + 1,
         NVME_CQ_FLAGS_IEN(qflags));
+    aio_context_release(n->ctx);
     return NVME_SUCCESS;
 }
 
@@ -742,6 +1237,36 @@ static uint16_t nvme_set_feature(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
     return NVME_SUCCESS;
 }
 
+static uint16_t nvme_dbbuf_config(NvmeCtrl *n, NvmeCmd *cmd)
+{
+    uint64_t dbs_addr = le64_to_cpu(cmd->prp1);
+    uint64_t eis_addr = le64_to_cpu(cmd->prp2);
+    int i;
+
+    trace_nvme_dbbuf_config(dbs_addr, eis_addr);
+
+    if (unlikely(!dbs_addr || dbs_addr & (n->page_size - 1) ||
+                 !eis_addr || eis_addr & (n->page_size - 1))) {
+        trace_nvme_err_invalid_dbbuf_config(dbs_addr, eis_addr);
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    aio_context_acquire(n->ctx);
+    n->dbbuf_dbs = dbs_addr;
+    n->dbbuf_eis = eis_addr;
+    n->dbbuf_enabled = true;
+    for (i = 1; i < n->num_queues; i++) {
+        if (n->cq[i]) {
+            nvme_init_cq_dbbuf(n->cq[i]);
+        }
+        if (n->sq[i]) {
+            nvme_init_sq_dbbuf(n->sq[i]);
+        }
+    }
+    aio_context_release(n->ctx);
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
 {
     switch (cmd->opcode) {
@@ -759,6 +1284,8 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeCmd *cmd, NvmeRequest *req)
         return nvme_set_feature(n, cmd, req);
     case NVME_ADM_CMD_GET_FEATURES:
         return nvme_get_feature(n, cmd, req);
+    case NVME_ADM_CMD_DBBUF_CONFIG:
+        return nvme_dbbuf_config(n, cmd);
     default:
         trace_nvme_err_invalid_admin_opc(cmd->opcode);
         return NVME_INVALID_OPCODE | NVME_DNR;
@@ -770,50 +1297,77 @@ static void nvme_process_sq(void *opaque)
     NvmeSQueue *sq = opaque;
     NvmeCtrl *n = sq->ctrl;
     NvmeCQueue *cq = n->cq[sq->cqid];
+    AioContext *ctx = nvme_queue_ctx(n, sq->sqid);
 
     uint16_t status;
     hwaddr addr;
     NvmeCmd cmd;
     NvmeRequest *req;
 
-    while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
-        addr = sq->dma_addr + sq->head * n->sqe_size;
-        nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd));
-        nvme_inc_sq_head(sq);
-
-        req = QTAILQ_FIRST(&sq->req_list);
-        QTAILQ_REMOVE(&sq->req_list, req, entry);
-        QTAILQ_INSERT_TAIL(&sq->out_req_list, req, entry);
-        memset(&req->cqe, 0, sizeof(req->cqe));
-        req->cqe.cid = cmd.cid;
-
-        status = sq->sqid ? nvme_io_cmd(n, &cmd, req) :
-            nvme_admin_cmd(n, &cmd, req);
-        if (status != NVME_NO_COMPLETE) {
-            req->status = status;
-            nvme_enqueue_req_completion(cq, req);
-        }
+    aio_context_acquire(ctx);
+    if (sq->db_addr) {
+        nvme_sq_read_shadow_tail(sq);
     }
+
+    do {
+        while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
+            addr = sq->dma_addr + sq->head * n->sqe_size;
+            nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd));
+            nvme_inc_sq_head(sq);
+
+            req = QTAILQ_FIRST(&sq->req_list);
+            QTAILQ_REMOVE(&sq->req_list, req, entry);
+            QTAILQ_INSERT_TAIL(&sq->out_req_list, req, entry);
+            memset(&req->cqe, 0, sizeof(req->cqe));
+            req->cqe.cid = cmd.cid;
+
+            status = sq->sqid ? nvme_io_cmd(n, &cmd, req) :
+                nvme_admin_cmd(n, &cmd, req);
+            if (status != NVME_NO_COMPLETE) {
+                req->status = status;
+                nvme_enqueue_req_completion(cq, req);
+            }
+        }
+        /* While polling, a stale event index suppresses doorbell writes */
+    } while (sq->db_addr && !sq->polling && nvme_sq_update_eventidx(sq));
+    aio_context_release(ctx);
 }
 
 static void nvme_clear_ctrl(NvmeCtrl *n)
 {
     int i;
 
-    blk_drain(n->conf.blk);
-
+    aio_context_acquire(n->ctx);
     for (i = 0; i < n->num_queues; i++) {
         if (n->sq[i] != NULL) {
-            nvme_free_sq(n->sq[i], n);
+            nvme_stop_sq(n->sq[i], n);
         }
     }
+
+    blk_drain(n->conf.blk);
+
     for (i = 0; i < n->num_queues; i++) {
         if (n->cq[i] != NULL) {
             nvme_free_cq(n->cq[i], n);
         }
     }
+    for (i = 0; i < n->num_queues; i++) {
+        if (n->sq[i] != NULL) {
+            nvme_free_sq(n->sq[i], n);
+        }
+    }
 
     blk_flush(n->conf.blk);
+
+    /* Switch the drive back to the QEMU main loop */
+    if (blk_get_aio_context(n->conf.blk) != qemu_get_aio_context()) {
+        blk_set_aio_context(n->conf.blk, qemu_get_aio_context());
+    }
+    aio_context_release(n->ctx);
+
+    n->dbbuf_dbs = 0;
+    n->dbbuf_eis = 0;
+    n->dbbuf_enabled = false;
     n->bar.cc = 0;
 }
 
@@ -907,6 +1461,10 @@ static int nvme_start_ctrl(NvmeCtrl *n)
     nvme_init_sq(&n->admin_sq, n, n->bar.asq, 0, 0,
         NVME_AQA_ASQS(n->bar.aqa) + 1);
 
+    if (n->iothread) {
+        blk_set_aio_context(n->conf.blk, n->ctx);
+    }
+
     return 0;
 }
 
@@ -1090,8 +1648,8 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         /* Completion queue doorbell write */
 
         uint16_t new_head = val & 0xffff;
-        int start_sqs;
         NvmeCQueue *cq;
+        AioContext *ctx;
 
         qid = (addr - (0x1000 + (1 << 2))) >> 3;
         if (unlikely(nvme_check_cqid(n, qid))) {
@@ -1112,24 +1670,16 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
             return;
         }
 
-        start_sqs = nvme_cq_full(cq) ? 1 : 0;
-        cq->head = new_head;
-        if (start_sqs) {
-            NvmeSQueue *sq;
-            QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
-                timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
-            }
-            timer_mod(cq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
-        }
-
-        if (cq->tail == cq->head) {
-            nvme_irq_deassert(n, cq);
-        }
+        ctx = nvme_queue_ctx(n, qid);
+        aio_context_acquire(ctx);
+        nvme_update_cq_head(cq, new_head);
+        aio_context_release(ctx);
     } else {
         /* Submission queue doorbell write */
 
         uint16_t new_tail = val & 0xffff;
         NvmeSQueue *sq;
+        AioContext *ctx;
 
         qid = (addr - 0x1000) >> 3;
         if (unlikely(nvme_check_sqid(n, qid))) {
@@ -1150,8 +1700,11 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
             return;
         }
 
+        ctx = nvme_queue_ctx(n, qid);
+        aio_context_acquire(ctx);
         sq->tail = new_tail;
-        timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
+        qemu_bh_schedule(sq->bh);
+        aio_context_release(ctx);
     }
 }
 
@@ -1228,6 +1781,8 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
                                        false, errp)) {
         return;
     }
+    /* Indexed by SQ id; the admin queue 0 does not do I/O */
+    block_acct_setup_queues(blk_get_stats(n->conf.blk), n->num_queues);
 
     pci_conf = pci_dev->config;
     pci_conf[PCI_INTERRUPT_PIN] = 1;
@@ -1243,6 +1798,28 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
     n->sq = g_new0(NvmeSQueue *, n->num_queues);
     n->cq = g_new0(NvmeCQueue *, n->num_queues);
 
+    if (n->iothread) {
+        n->ctx = iothread_get_aio_context(n->iothread);
+        object_ref(OBJECT(n->iothread));
+    } else {
+        n->ctx = qemu_get_aio_context();
+    }
+    n->irq_bh = qemu_bh_new(nvme_irq_bh, n);
+    if (n->iothread && kvm_msi_via_irqfd_enabled()) {
+        n->msi_vectors = g_new0(NvmeMSIVector, n->num_queues);
+        for (i = 0; i < n->num_queues; i++) {
+            n->msi_vectors[i].virq = -1;
+            if (event_notifier_init(&n->msi_vectors[i].notifier, 0) < 0) {
+                while (--i >= 0) {
+                    event_notifier_cleanup(&n->msi_vectors[i].notifier);
+                }
+                g_free(n->msi_vectors);
+                n->msi_vectors = NULL;
+                break;
+            }
+        }
+    }
+
     memory_region_init_io(&n->iomem, OBJECT(n), &nvme_mmio_ops, n,
                           "nvme", n->reg_size);
     pci_register_bar(&n->parent_obj, 0,
@@ -1259,7 +1836,7 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
     id->ieee[0] = 0x00;
     id->ieee[1] = 0x02;
     id->ieee[2] = 0xb3;
-    id->oacs = cpu_to_le16(0);
+    id->oacs = cpu_to_le16(NVME_OACS_DBBUF);
     id->frmw = 7 << 1;
     id->lpa = 1 << 0;
     id->sqes = (0x6 << 4) | 0x6;
@@ -1328,8 +1905,21 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
 static void nvme_exit(PCIDevice *pci_dev)
 {
     NvmeCtrl *n = NVME(pci_dev);
+    int i;
 
     nvme_clear_ctrl(n);
+    block_acct_setup_queues(blk_get_stats(n->conf.blk), 0);
+    qemu_bh_delete(n->irq_bh);
+    if (n->msi_vectors) {
+        nvme_disable_irqfd(n);
+        for (i = 0; i < n->num_queues; i++) {
+            event_notifier_cleanup(&n->msi_vectors[i].notifier);
+        }
+        g_free(n->msi_vectors);
+    }
+    if (n->iothread) {
+        object_unref(OBJECT(n->iothread));
+    }
     g_free(n->namespaces);
     g_free(n->cq);
     g_free(n->sq);
@@ -1345,9 +1935,18 @@ static Property nvme_props[] = {
     DEFINE_PROP_STRING("serial", NvmeCtrl, serial),
     DEFINE_PROP_UINT32("cmb_size_mb", NvmeCtrl, cmb_size_mb, 0),
     DEFINE_PROP_UINT32("num_queues", NvmeCtrl, num_queues, 64),
+    DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, ioeventfd, false),
+    DEFINE_PROP_LINK("iothread", NvmeCtrl, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
+/* A reset disables MSI-X without going through nvme_write_config() */
+static void nvme_reset(DeviceState *dev)
+{
+    nvme_disable_irqfd(NVME(dev));
+}
+
 static const VMStateDescription nvme_vmstate = {
     .name = "nvme",
     .unmigratable = 1,
@@ -1360,6 +1959,7 @@ static void nvme_class_init(ObjectClass *oc, void *data)
 
     pc->realize = nvme_realize;
     pc->exit = nvme_exit;
+    pc->config_write = nvme_write_config;
     pc->class_id = PCI_CLASS_STORAGE_EXPRESS;
     pc->vendor_id = PCI_VENDOR_ID_INTEL;
     pc->device_id = 0x5845;
@@ -1369,6 +1969,7 @@ static void nvme_class_init(ObjectClass *oc, void *data)
     dc->desc = "Non-Volatile Memory Express";
     dc->props = nvme_props;
     dc->vmsd = &nvme_vmstate;
+    dc->reset = nvme_reset;
 }
 
 static void nvme_instance_init(Object *obj)
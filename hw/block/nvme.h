@@ -1,6 +1,8 @@
 #ifndef HW_NVME_H
 #define HW_NVME_H
 #include "block/nvme.h"
+#include "qemu/event_notifier.h"
+#include "sysemu/iothread.h"
 
 typedef struct NvmeAsyncEvent {
     QSIMPLEQ_ENTRY(NvmeAsyncEvent) entry;
@@ -27,7 +29,12 @@ typedef struct NvmeSQueue {
     uint32_t    tail;
     uint32_t    size;
     uint64_t    dma_addr;
-    QEMUTimer   *timer;
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
+    QEMUBH      *bh;
+    EventNotifier notifier;
+    bool        ioeventfd_enabled;
+    bool        polling;
     NvmeRequest *io_req;
     QTAILQ_HEAD(sq_req_list, NvmeRequest) req_list;
     QTAILQ_HEAD(out_req_list, NvmeRequest) out_req_list;
@@ -44,11 +51,23 @@ typedef struct NvmeCQueue {
     uint32_t    vector;
     uint32_t    size;
     uint64_t    dma_addr;
-    QEMUTimer   *timer;
+    uint64_t    db_addr;
+    uint64_t    ei_addr;
+    QEMUBH      *bh;
+    EventNotifier notifier;
+    bool        ioeventfd_enabled;
+    bool        irq_pending;
     QTAILQ_HEAD(sq_list, NvmeSQueue) sq_list;
     QTAILQ_HEAD(cq_req_list, NvmeRequest) req_list;
 } NvmeCQueue;
 
+/* MSI-X vector that completions from an IOThread raise through an irqfd */
+typedef struct NvmeMSIVector {
+    EventNotifier notifier;
+    int virq;
+    bool unmasked;
+} NvmeMSIVector;
+
 typedef struct NvmeNamespace {
     NvmeIdNs        id_ns;
 } NvmeNamespace;
@@ -79,6 +98,17 @@ typedef struct NvmeCtrl {
     uint32_t    cmbloc;
     uint8_t     *cmbuf;
     uint64_t    irq_status;
+    uint64_t    dbbuf_dbs;
+    uint64_t    dbbuf_eis;
+    bool        dbbuf_enabled;
+    bool        ioeventfd;
+
+    IOThread        *iothread;
+    AioContext      *ctx;
+    QEMUBH          *irq_bh;
+    /* One per MSI-X vector, NULL if interrupts cannot bypass the main loop */
+    NvmeMSIVector   *msi_vectors;
+    bool            irqfd_enabled;
 
     char            *serial;
     NvmeNamespace   *namespaces;
@@ -336,7 +336,7 @@ static inline void submit_requests(BlockBackend *blk, MultiReqBuffer *mrb,
     bool is_write = mrb->is_write;
 
     if (num_reqs > 1) {
-        int i;
+        int i, num_window = 0;
         struct iovec *tmp_iov = qiov->iov;
         int tmp_niov = qiov->niov;
 
@@ -353,6 +353,9 @@ static inline void submit_requests(BlockBackend *blk, MultiReqBuffer *mrb,
             qemu_iovec_concat(qiov, &mrb->reqs[i]->qiov, 0,
                               mrb->reqs[i]->qiov.size);
             mrb->reqs[i - 1]->mr_next = mrb->reqs[i];
+            if (mrb->reqs[i]->batch != mrb->reqs[start]->batch) {
+                num_window++;
+            }
         }
 
         trace_virtio_blk_submit_multireq(VIRTIO_DEVICE(mrb->reqs[start]->dev),
@@ -362,6 +365,12 @@ static inline void submit_requests(BlockBackend *blk, MultiReqBuffer *mrb,
         block_acct_merge_done(blk_get_stats(blk),
                               is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ,
                               num_reqs - 1);
+        if (num_window) {
+            block_acct_merge_window_done(blk_get_stats(blk),
+                                         is_write ? BLOCK_ACCT_WRITE
+                                                  : BLOCK_ACCT_READ,
+                                         num_window);
+        }
     }
 
     if (is_write) {
@@ -446,6 +455,8 @@ static void virtio_blk_handle_flush(VirtIOBlockReq *req, MultiReqBuffer *mrb)
 {
     block_acct_start(blk_get_stats(req->dev->blk), &req->acct, 0,
                      BLOCK_ACCT_FLUSH);
+    block_acct_set_queue(blk_get_stats(req->dev->blk), &req->acct,
+                         virtio_get_queue_index(req->vq));
 
     /*
      * Make sure all outstanding writes are posted to the backing device.
@@ -547,6 +558,8 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
         block_acct_start(blk_get_stats(req->dev->blk),
                          &req->acct, req->qiov.size,
                          is_write ? BLOCK_ACCT_WRITE : BLOCK_ACCT_READ);
+        block_acct_set_queue(blk_get_stats(req->dev->blk), &req->acct,
+                             virtio_get_queue_index(req->vq));
 
         /* merge would exceed maximum number of requests or IO direction
          * changes */
@@ -591,21 +604,86 @@ static int virtio_blk_handle_request(VirtIOBlockReq *req, MultiReqBuffer *mrb)
     return 0;
 }
 
+/*
+ * Submit the requests held back in the merge window.  Called with the
+ * AioContext lock held.
+ */
+static void virtio_blk_merge_window_flush(VirtIOBlock *s)
+{
+    if (!s->merge_timer_armed) {
+        return;
+    }
+
+    trace_virtio_blk_merge_window_flush(s, s->mrb.num_reqs);
+    timer_del(&s->merge_timer);
+    s->merge_timer_armed = false;
+    if (s->mrb.num_reqs) {
+        blk_io_plug(s->blk);
+        virtio_blk_submit_multireq(s->blk, &s->mrb);
+        blk_io_unplug(s->blk);
+    }
+    blk_dec_in_flight(s->blk);
+}
+
+static void virtio_blk_merge_timer_cb(void *opaque)
+{
+    VirtIOBlock *s = opaque;
+    AioContext *ctx = blk_get_aio_context(s->blk);
+
+    aio_context_acquire(ctx);
+    virtio_blk_merge_window_flush(s);
+    aio_context_release(ctx);
+}
+
+/*
+ * Start the merge window if it is not open yet.  The held back requests
+ * count as in flight, so that draining the BlockBackend waits for the
+ * timer instead of missing them.
+ */
+static void virtio_blk_merge_window_arm(VirtIOBlock *s)
+{
+    AioContext *ctx = blk_get_aio_context(s->blk);
+
+    if (s->merge_timer_armed) {
+        return;
+    }
+
+    /* The timer is never armed while the AioContext changes */
+    if (s->merge_timer_ctx != ctx) {
+        aio_timer_init(ctx, &s->merge_timer, QEMU_CLOCK_REALTIME, SCALE_US,
+                       virtio_blk_merge_timer_cb, s);
+        s->merge_timer_ctx = ctx;
+    }
+
+    blk_inc_in_flight(s->blk);
+    s->merge_timer_armed = true;
+    timer_mod(&s->merge_timer, qemu_clock_get_us(QEMU_CLOCK_REALTIME) +
+                               s->conf.merge_window_us);
+}
+
 bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
 {
     VirtIOBlockReq *req;
-    MultiReqBuffer mrb = {};
+    MultiReqBuffer local_mrb = {};
+    MultiReqBuffer *mrb = &local_mrb;
+    bool use_window = s->conf.merge_window_us && s->conf.request_merging;
     bool progress = false;
 
     aio_context_acquire(blk_get_aio_context(s->blk));
     blk_io_plug(s->blk);
 
+    if (use_window) {
+        mrb = &s->mrb;
+    }
+    s->batch++;
+
     do {
         virtio_queue_set_notification(vq, 0);
 
         while ((req = virtio_blk_get_request(s, vq))) {
             progress = true;
-            if (virtio_blk_handle_request(req, &mrb)) {
+            req->batch = s->batch;
+            if (virtio_blk_handle_request(req, mrb)) {
                 virtqueue_detach_element(req->vq, &req->elem, 0);
                 virtio_blk_free_request(req);
                 break;
@@ -615,8 +693,12 @@ bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq)
         virtio_queue_set_notification(vq, 1);
     } while (!virtio_queue_empty(vq));
 
-    if (mrb.num_reqs) {
-        virtio_blk_submit_multireq(s->blk, &mrb);
+    if (mrb->num_reqs) {
+        if (use_window) {
+            virtio_blk_merge_window_arm(s);
+        } else {
+            virtio_blk_submit_multireq(s->blk, mrb);
+        }
     }
 
     blk_io_unplug(s->blk);
@@ -686,6 +768,12 @@ static void virtio_blk_dma_restart_cb(void *opaque, int running,
     VirtIOBlock *s = opaque;
 
     if (!running) {
+        AioContext *ctx = blk_get_aio_context(s->conf.conf.blk);
+
+        /* Submit held back requests before the block layer is drained */
+        aio_context_acquire(ctx);
+        virtio_blk_merge_window_flush(s);
+        aio_context_release(ctx);
         return;
     }
 
@@ -704,6 +792,7 @@ static void virtio_blk_reset(VirtIODevice *vdev)
 
     ctx = blk_get_aio_context(s->blk);
     aio_context_acquire(ctx);
+    virtio_blk_merge_window_flush(s);
     blk_drain(s->blk);
 
     /* We drop queued requests after blk_drain() because blk_drain() itself can
@@ -973,6 +1062,7 @@ static void virtio_blk_device_realize(DeviceState *dev, Error **errp)
 
     s->change = qemu_add_vm_change_state_handler(virtio_blk_dma_restart_cb, s);
     blk_set_dev_ops(s->blk, &virtio_block_ops, s);
+    block_acct_setup_queues(blk_get_stats(s->blk), conf->num_queues);
     blk_set_guest_block_size(s->blk, s->conf.conf.logical_block_size);
 
     blk_iostatus_enable(s->blk);
@@ -982,10 +1072,18 @@ static void virtio_blk_device_unrealize(DeviceState *dev, Error **errp)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOBlock *s = VIRTIO_BLK(dev);
+    AioContext *ctx = blk_get_aio_context(s->blk);
+
+    /* Requests from the merge window must not complete into a freed device */
+    aio_context_acquire(ctx);
+    virtio_blk_merge_window_flush(s);
+    blk_drain(s->blk);
+    aio_context_release(ctx);
 
     virtio_blk_data_plane_destroy(s->dataplane);
     s->dataplane = NULL;
     qemu_del_vm_change_state_handler(s->change);
+    block_acct_setup_queues(blk_get_stats(s->blk), 0);
     blockdev_mark_auto_del(s->blk);
     virtio_cleanup(vdev);
 }
@@ -1020,6 +1118,8 @@ static Property virtio_blk_properties[] = {
 #endif
     DEFINE_PROP_BIT("request-merging", VirtIOBlock, conf.request_merging, 0,
                     true),
+    DEFINE_PROP_UINT32("merge-window-us", VirtIOBlock, conf.merge_window_us,
+                       0),
     DEFINE_PROP_UINT16("num-queues", VirtIOBlock, conf.num_queues, 1),
     DEFINE_PROP_UINT16("queue-size", VirtIOBlock, conf.queue_size, 128),
     DEFINE_PROP_LINK("iothread", VirtIOBlock, conf.iothread, TYPE_IOTHREAD,
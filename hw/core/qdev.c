@@ -34,6 +34,7 @@
 #include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
+#include "qemu/rcu.h"
 #include "hw/hotplug.h"
 #include "hw/boards.h"
 #include "hw/sysbus.h"
@@ -1021,6 +1022,13 @@ static void device_unparent(Object *obj)
 
     if (dev->realized) {
         object_property_set_bool(obj, false, "realized", NULL);
+        /* Old flat views keep the device's MemoryRegions, and thus the
+         * device, alive; do not make hot-unplug wait for the batching
+         * delay of call_rcu.
+         */
+        if (qdev_hotplug) {
+            rcu_expedite_callbacks();
+        }
     }
     while (dev->num_child_bus) {
         bus = QLIST_FIRST(&dev->child_bus);
@@ -27,6 +27,7 @@
 
 #include "qemu/timed-average.h"
 #include "qemu/thread.h"
+#include "qemu/stats64.h"
 #include "qapi/qapi-builtin-types.h"
 
 typedef struct BlockAcctTimedStats BlockAcctTimedStats;
@@ -76,6 +77,30 @@ typedef struct BlockLatencyHistogram {
     uint64_t *bins;
 } BlockLatencyHistogram;
 
+/*
+ * Always-on latency histogram with log-linear buckets, in the style of
+ * HdrHistogram: latencies below 2^BLOCK_LATENCY_SUB_BITS ns have a bucket
+ * each, and every larger power of two is split into
+ * 2^BLOCK_LATENCY_SUB_BITS equal buckets.  Any value is therefore known
+ * to within 1/16 (6.25%).  Latencies of 2^BLOCK_LATENCY_MAX_EXP ns
+ * (about 18 minutes) or more all land in the last bucket.
+ *
+ * Buckets are updated with atomic adds, without taking the stats lock.
+ */
+#define BLOCK_LATENCY_SUB_BITS  4
+#define BLOCK_LATENCY_MAX_EXP   40
+#define BLOCK_LATENCY_BUCKETS \
+    ((BLOCK_LATENCY_MAX_EXP - BLOCK_LATENCY_SUB_BITS + 1) << \
+     BLOCK_LATENCY_SUB_BITS)
+
+typedef struct BlockLatencyHdr {
+    Stat64 buckets[BLOCK_LATENCY_BUCKETS];
+} BlockLatencyHdr;
+
+typedef struct BlockAcctQueueStats {
+    BlockLatencyHdr latency_hdr[BLOCK_MAX_IOTYPE];
+} BlockAcctQueueStats;
+
 struct BlockAcctStats {
     QemuMutex lock;
     uint64_t nr_bytes[BLOCK_MAX_IOTYPE];
@@ -84,17 +109,24 @@ struct BlockAcctStats {
     uint64_t failed_ops[BLOCK_MAX_IOTYPE];
     uint64_t total_time_ns[BLOCK_MAX_IOTYPE];
     uint64_t merged[BLOCK_MAX_IOTYPE];
+    uint64_t merged_window[BLOCK_MAX_IOTYPE];
     int64_t last_access_time_ns;
     QSLIST_HEAD(, BlockAcctTimedStats) intervals;
     bool account_invalid;
     bool account_failed;
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
+
+    BlockLatencyHdr latency_hdr[BLOCK_MAX_IOTYPE];
+    /* Per-queue histograms, see block_acct_setup_queues() */
+    unsigned nr_queues;
+    BlockAcctQueueStats *queues;
 };
 
 typedef struct BlockAcctCookie {
     int64_t bytes;
     int64_t start_time_ns;
     enum BlockAcctType type;
+    int queue;
 } BlockAcctCookie;
 
 void block_acct_init(BlockAcctStats *stats);
@@ -104,18 +136,27 @@ void block_acct_cleanup(BlockAcctStats *stats);
 void block_acct_add_interval(BlockAcctStats *stats, unsigned interval_length);
 BlockAcctTimedStats *block_acct_interval_next(BlockAcctStats *stats,
                                               BlockAcctTimedStats *s);
+void block_acct_setup_queues(BlockAcctStats *stats, unsigned nr_queues);
 void block_acct_start(BlockAcctStats *stats, BlockAcctCookie *cookie,
                       int64_t bytes, enum BlockAcctType type);
+void block_acct_set_queue(BlockAcctStats *stats, BlockAcctCookie *cookie,
+                          unsigned queue);
 void block_acct_done(BlockAcctStats *stats, BlockAcctCookie *cookie);
 void block_acct_failed(BlockAcctStats *stats, BlockAcctCookie *cookie);
 void block_acct_invalid(BlockAcctStats *stats, enum BlockAcctType type);
 void block_acct_merge_done(BlockAcctStats *stats, enum BlockAcctType type,
                            int num_requests);
+void block_acct_merge_window_done(BlockAcctStats *stats,
+                                  enum BlockAcctType type, int num_requests);
 int64_t block_acct_idle_time_ns(BlockAcctStats *stats);
 double block_acct_queue_depth(BlockAcctTimedStats *stats,
                               enum BlockAcctType type);
 int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
 void block_latency_histograms_clear(BlockAcctStats *stats);
+void block_latency_hdr_account(BlockLatencyHdr *hdr, uint64_t latency_ns);
+uint64_t block_latency_hdr_percentiles(BlockLatencyHdr *hdr, int n,
+                                       const unsigned *per_mille,
+                                       uint64_t *values);
 
 #endif
@@ -0,0 +1,174 @@
+/*
+ * block_copy API
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef BLOCK_COPY_H
+#define BLOCK_COPY_H
+
+#include "block/block.h"
+#include "qemu/coroutine.h"
+#include "qemu/hbitmap.h"
+#include "qemu/ratelimit.h"
+
+/* Default and maximum number of copy requests that a job keeps in flight */
+#define BLOCK_COPY_DEFAULT_WORKERS 16
+#define BLOCK_COPY_MAX_WORKERS 1024
+
+typedef struct BlockCopyInFlightReq {
+    int64_t start_byte;
+    int64_t end_byte;
+    QLIST_ENTRY(BlockCopyInFlightReq) list;
+    CoQueue wait_queue; /* coroutines blocked on this request */
+} BlockCopyInFlightReq;
+
+typedef void (*ProgressBytesCallbackFunc)(int64_t bytes, void *opaque);
+
+typedef struct BlockCopyState {
+    BlockBackend *source;
+    BlockBackend *target;
+
+    /*
+     * Clusters that still have to be copied, one bit per @cluster_size.
+     * NULL if the state is only used for block_copy_chunk().
+     */
+    HBitmap *copy_bitmap;
+    int64_t cluster_size;
+    int64_t len;
+
+    /*
+     * Maximum size of a single copy request.  It is a multiple of
+     * @cluster_size; copy offload requests are allowed to be larger than
+     * bounce-buffered ones.
+     */
+    int64_t copy_size;
+    bool use_copy_range;
+    int max_workers;
+
+    BdrvRequestFlags write_flags;
+
+    /* Write zeroes instead of data buffers that only contain zeroes */
+    bool detect_zeroes;
+
+    QLIST_HEAD(, BlockCopyInFlightReq) inflight_reqs;
+
+    /*
+     * Maximum speed of block_copy() in bytes per second, or 0 for
+     * unlimited; see block_copy_set_speed().
+     */
+    int64_t speed;
+    RateLimit rate_limit;
+
+    /* Called for every successfully copied chunk, from coroutine context */
+    ProgressBytesCallbackFunc progress_bytes_callback;
+    void *progress_opaque;
+} BlockCopyState;
+
+/**
+ * block_copy_state_new:
+ * @source: BlockBackend to read data from.
+ * @target: BlockBackend to write data to, at the same offsets.
+ * @cluster_size: Granularity of @copy_bitmap and of all copy requests.
+ * @max_workers: Number of copy requests a single block_copy() call may
+ *               have in flight at the same time, or 0 if the caller only
+ *               uses block_copy_chunk() and schedules requests itself.
+ * @write_flags: Flags for all writes to @target.
+ *
+ * Create the state shared by all copy operations between @source and
+ * @target.  The copy bitmap starts out clean; it is only allocated if
+ * @max_workers is not 0.
+ */
+BlockCopyState *block_copy_state_new(BlockBackend *source,
+                                     BlockBackend *target,
+                                     int64_t cluster_size, int max_workers,
+                                     BdrvRequestFlags write_flags,
+                                     Error **errp);
+
+void block_copy_set_callbacks(BlockCopyState *s,
+                              ProgressBytesCallbackFunc progress_bytes_callback,
+                              void *progress_opaque);
+
+void block_copy_state_free(BlockCopyState *s);
+
+/**
+ * block_copy_set_speed:
+ * @s: Copy state.
+ * @speed: Maximum speed in bytes per second, or 0 for unlimited.
+ *
+ * Limit the rate at which block_copy() starts copy requests.  Copies done
+ * from before-write notifiers count against the limit, but are never
+ * delayed so that guest writes are not throttled.
+ */
+void block_copy_set_speed(BlockCopyState *s, int64_t speed);
+
+/**
+ * block_copy_ratelimit_get_delay:
+ * @s: Copy state.
+ *
+ * Returns the time in nanoseconds that callers of block_copy() should
+ * sleep before trying again to copy the clusters it left dirty.
+ */
+int64_t block_copy_ratelimit_get_delay(BlockCopyState *s);
+
+/*
+ * Wait until no request overlapping the clusters around [@offset,
+ * @offset + @bytes) is in flight, and optionally register @req to cover
+ * them.  Other block_copy() calls touching those clusters wait for
+ * block_copy_inflight_req_end().
+ */
+void coroutine_fn block_copy_wait_for_overlapping(BlockCopyState *s,
+                                                  int64_t offset,
+                                                  uint64_t bytes);
+void block_copy_inflight_req_begin(BlockCopyState *s,
+                                   BlockCopyInFlightReq *req,
+                                   int64_t offset, uint64_t bytes);
+void block_copy_inflight_req_end(BlockCopyInFlightReq *req);
+
+/**
+ * block_copy_chunk:
+ * @s: Copy state.
+ * @offset: Offset of the chunk, in bytes.
+ * @bytes: Length of the chunk.
+ * @qiov: Buffer for bounce-buffered copies; NULL to allocate one.
+ * @read_flags: Flags for the reads from the source.
+ * @error_is_read: Set to true if a failure happened on the read side.
+ *
+ * Copy a single chunk, through copy offload if the nodes support it and
+ * through a bounce buffer otherwise.  Copy offload requests are split so
+ * that none exceeds the transfer limits of @source and @target.  The copy
+ * bitmap is not touched.
+ *
+ * Returns 0 on success, or a negative errno.
+ */
+int coroutine_fn block_copy_chunk(BlockCopyState *s,
+                                  int64_t offset, int64_t bytes,
+                                  QEMUIOVector *qiov,
+                                  BdrvRequestFlags read_flags,
+                                  bool *error_is_read);
+
+/**
+ * block_copy:
+ * @s: Copy state.
+ * @offset: Start of the area to copy.
+ * @bytes: Length of the area to copy.
+ * @error_is_read: Set to true if a failure happened on the read side;
+ *                 may be NULL.
+ * @is_write_notifier: True if called from a before-write notifier of the
+ *                     source, in which case reads must not serialise.
+ *
+ * Copy all dirty clusters of @copy_bitmap that intersect the given area,
+ * with up to @max_workers requests in flight.  Clusters are marked clean
+ * when their copy starts, and dirty again if it fails.
+ *
+ * Unless @is_write_notifier is true, no new request is started once the
+ * rate limit is exceeded; the remaining clusters are left dirty and the
+ * caller should sleep for block_copy_ratelimit_get_delay() before retrying.
+ *
+ * Returns 0 on success, or the first error that occurred.
+ */
+int coroutine_fn block_copy(BlockCopyState *s, int64_t offset, uint64_t bytes,
+                            bool *error_is_read, bool is_write_notifier);
+
+#endif /* BLOCK_COPY_H */
@@ -19,13 +19,9 @@
 #define BLOCK_BACKUP_H
 
 #include "block/block_int.h"
+#include "block/block-copy.h"
 
-typedef struct CowRequest {
-    int64_t start_byte;
-    int64_t end_byte;
-    QLIST_ENTRY(CowRequest) list;
-    CoQueue wait_queue; /* coroutines blocked on this request */
-} CowRequest;
+typedef BlockCopyInFlightReq CowRequest;
 
 void backup_wait_for_overlapping_requests(BlockJob *job, int64_t offset,
                                           uint64_t bytes);
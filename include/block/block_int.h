@@ -32,6 +32,7 @@
 #include "qemu/stats64.h"
 #include "qemu/timer.h"
 #include "qemu/hbitmap.h"
+#include "qemu/interval-tree.h"
 #include "block/snapshot.h"
 #include "qemu/main-loop.h"
 #include "qemu/throttle.h"
@@ -56,6 +57,7 @@
 #define BLOCK_OPT_NOCOW             "nocow"
 #define BLOCK_OPT_OBJECT_SIZE       "object_size"
 #define BLOCK_OPT_REFCOUNT_BITS     "refcount_bits"
+#define BLOCK_OPT_EXTL2             "extended_l2"
 
 #define BLOCK_PROBE_BUF_SIZE        512
 
@@ -76,13 +78,30 @@ typedef struct BdrvTrackedRequest {
     int64_t overlap_offset;
     uint64_t overlap_bytes;
 
-    QLIST_ENTRY(BdrvTrackedRequest) list;
+    /* Keyed by [overlap_offset, overlap_offset + overlap_bytes) */
+    IntervalTreeNode node;
     Coroutine *co; /* owner, used for deadlock detection */
     CoQueue wait_queue; /* coroutines blocked on this request */
 
     struct BdrvTrackedRequest *waiting_for;
 } BdrvTrackedRequest;
 
+/*
+ * Remembers the last data region that the driver of a protocol node
+ * reported, so that repeated block status queries over the same range do
+ * not have to go to the driver (e.g. lseek(SEEK_DATA/SEEK_HOLE)) again.
+ * Only the current AioContext of the node may access it.
+ */
+typedef struct BdrvBlockStatusCache {
+    bool valid;
+    int64_t data_start;
+    int64_t data_end;
+
+    /* Queries answered from the cache, and queries that missed it */
+    uint64_t hits;
+    uint64_t misses;
+} BdrvBlockStatusCache;
+
 struct BlockDriver {
     const char *format_name;
     int instance_size;
@@ -253,6 +272,10 @@ struct BlockDriver {
      * clamped to bdrv_getlength() and aligned to request_alignment,
      * as well as non-NULL pnum, map, and file; in turn, the driver
      * must return an error or set pnum to an aligned non-zero value.
+     * pnum may extend past the requested range if the driver knows
+     * the status of the following bytes for free; protocol drivers
+     * should do so, because the block layer caches data regions that
+     * they report.
      */
     int coroutine_fn (*bdrv_co_block_status)(BlockDriverState *bs,
         bool want_zero, int64_t offset, int64_t bytes, int64_t *pnum,
@@ -782,6 +805,8 @@ struct BlockDriverState {
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
+    BdrvBlockStatusCache block_status_cache;
+
     /* If true, copy read backing sectors into image.  Can be >1 if more
      * than one client has requested copy-on-read.  Accessed with atomic
      * ops.
@@ -810,7 +835,7 @@ struct BlockDriverState {
 
     /* Protected by reqs_lock.  */
     CoMutex reqs_lock;
-    QLIST_HEAD(, BdrvTrackedRequest) tracked_requests;
+    IntervalTreeRoot tracked_requests;
     CoQueue flush_queue;                  /* Serializing flush queue */
     bool active_flush_req;                /* Flush request in flight? */
 
@@ -1034,11 +1059,15 @@ void commit_active_start(const char *job_id, BlockDriverState *bs,
  * @speed: The maximum speed, in bytes per second, or 0 for unlimited.
  * @granularity: The chosen granularity for the dirty bitmap.
  * @buf_size: The amount of data that can be in flight at one time.
+ * @max_workers: The maximum number of copy operations in flight, or 0 for
+ *               the default.
  * @mode: Whether to collapse all images in the chain to the target.
  * @backing_mode: How to establish the target's backing chain after completion.
  * @on_source_error: The action to take upon error reading from the source.
  * @on_target_error: The action to take upon error writing to the target.
  * @unmap: Whether to unmap target where source sectors only contain zeroes.
+ * @skip_zeroes: Whether to consult the block status of the target too, and
+ *               skip areas that read as zeroes on both sides.
  * @filter_node_name: The node name that should be assigned to the filter
  * driver that the mirror job inserts into the graph above @bs. NULL means that
  * a node name should be autogenerated.
@@ -1053,11 +1082,11 @@ void commit_active_start(const char *job_id, BlockDriverState *bs,
 void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *target, const char *replaces,
                   int creation_flags, int64_t speed,
-                  uint32_t granularity, int64_t buf_size,
+                  uint32_t granularity, int64_t buf_size, int64_t max_workers,
                   MirrorSyncMode mode, BlockMirrorBackingMode backing_mode,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
-                  bool unmap, const char *filter_node_name,
+                  bool unmap, bool skip_zeroes, const char *filter_node_name,
                   MirrorCopyMode copy_mode, Error **errp);
 
 /*
@@ -1069,6 +1098,9 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
  * @speed: The maximum speed, in bytes per second, or 0 for unlimited.
  * @sync_mode: What parts of the disk image should be copied to the destination.
  * @sync_bitmap: The dirty bitmap if sync_mode is MIRROR_SYNC_MODE_INCREMENTAL.
+ * @compress: Whether to write compressed data to @target.
+ * @max_workers: The maximum number of copy requests in flight, or 0 for the
+ *               default.
  * @on_source_error: The action to take upon error reading from the source.
  * @on_target_error: The action to take upon error writing to the target.
  * @creation_flags: Flags that control the behavior of the Job lifetime.
@@ -1084,7 +1116,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
                             BlockDriverState *target, int64_t speed,
                             MirrorSyncMode sync_mode,
                             BdrvDirtyBitmap *sync_bitmap,
-                            bool compress,
+                            bool compress, int64_t max_workers,
                             BlockdevOnError on_source_error,
                             BlockdevOnError on_target_error,
                             int creation_flags,
@@ -1154,6 +1186,16 @@ bool blk_dev_is_medium_locked(BlockBackend *blk);
 
 void bdrv_set_dirty(BlockDriverState *bs, int64_t offset, int64_t bytes);
 
+/**
+ * bdrv_bsc_invalidate_range:
+ *
+ * Forget the cached block status of @bs if it overlaps
+ * [@offset, @offset + @bytes).  Must be called whenever an operation may
+ * turn data into a hole.
+ */
+void bdrv_bsc_invalidate_range(BlockDriverState *bs,
+                               int64_t offset, int64_t bytes);
+
 void bdrv_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap **out);
 void bdrv_restore_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap *backup);
 
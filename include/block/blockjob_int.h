@@ -63,6 +63,13 @@ struct BlockJobDriver {
      * stuff.
      */
     void (*drain)(BlockJob *job);
+
+    /*
+     * If the callback is not NULL, it will be invoked when the speed of the
+     * job is changed, for jobs that implement rate limiting themselves
+     * rather than through block_job_ratelimit_get_delay().
+     */
+    void (*set_speed)(BlockJob *job, int64_t speed);
 };
 
 /**
@@ -75,12 +75,20 @@ typedef enum {
  * @readfunc: callback for reading data from the volume
  * @opaque: data to pass to @readfunc
  * @flags: bitmask of QCryptoBlockOpenFlags values
+ * @n_threads: allow concurrent I/O from up to @n_threads threads
  * @errp: pointer to a NULL-initialized error object
  *
  * Create a new block encryption object for an existing
  * storage volume encrypted with format identified by
  * the parameters in @options.
  *
+ * qcrypto_block_encrypt() and qcrypto_block_decrypt() may be
+ * called from up to @n_threads threads at the same time; each
+ * one uses a separate cipher object.  Further callers wait for
+ * a cipher to become free.  One more cipher is reserved for
+ * callers in coroutine context, so that an event loop thread
+ * never waits for threads that hold all other ciphers.
+ *
  * This will use @readfunc to initialize the encryption
  * context based on the volume header(s), extracting the
  * master key(s) as required.
@@ -107,6 +115,7 @@ QCryptoBlock *qcrypto_block_open(QCryptoBlockOpenOptions *options,
                                  QCryptoBlockReadFunc readfunc,
                                  void *opaque,
                                  unsigned int flags,
+                                 size_t n_threads,
                                  Error **errp);
 
 /**
@@ -233,4 +233,16 @@ int qcrypto_cipher_setiv(QCryptoCipher *cipher,
                          const uint8_t *iv, size_t niv,
                          Error **errp);
 
+/**
+ * test_qcrypto_cipher_aes_next_accel:
+ *
+ * Switch the builtin AES cipher from the AES instructions of the
+ * host to the table-based implementation, for testing.
+ *
+ * Returns: false if the table-based implementation was
+ * already in use, or if AES is not provided by the builtin
+ * cipher backend
+ */
+bool test_qcrypto_cipher_aes_next_accel(void);
+
 #endif /* QCRYPTO_CIPHER_H */
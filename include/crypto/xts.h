@@ -30,6 +30,12 @@
 
 #define XTS_BLOCK_SIZE 16
 
+/*
+ * Encrypt or decrypt @length bytes of @src into @dst in ECB mode.
+ * @length may be any multiple of XTS_BLOCK_SIZE; xts_encrypt and
+ * xts_decrypt pass several blocks at once so that the cipher can
+ * process them in parallel.
+ */
 typedef void xts_cipher_func(const void *ctx,
                              size_t length,
                              uint8_t *dst,
@@ -67,6 +67,31 @@ typedef uint64_t target_ulong;
 #define CPU_TLB_ENTRY_BITS 5
 #endif
 
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/*
+ * The TLB of each MMU mode is allocated separately, and resized on flush
+ * according to how many of its entries were used since the last resize;
+ * see tlb_mmu_resize_locked().  The TCG backend loads the table pointer
+ * and the index mask from env instead of using constants.
+ */
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_DEFAULT_BITS 8
+
+# if HOST_LONG_BITS == 32
+/* Keep the index computation within a single host word */
+#  define CPU_TLB_DYN_MAX_BITS (32 - TARGET_PAGE_BITS)
+# else
+/*
+ * 2^22 entries cover 16 GiB with 4 KiB pages, which is in the same ballpark
+ * as the second level TLB of current host CPUs.  There is no point in
+ * going past the size of the guest virtual address space, either.
+ */
+#  define CPU_TLB_DYN_MAX_BITS \
+    MIN(22, TARGET_VIRT_ADDR_SPACE_BITS - TARGET_PAGE_BITS)
+# endif
+
+#else /* !TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 /* TCG_TARGET_TLB_DISPLACEMENT_BITS is used in CPU_TLB_BITS to ensure that
  * the TLB is not unnecessarily small, but still small enough for the
  * TLB lookup instruction sequence used by the TCG target.
@@ -99,6 +124,8 @@ typedef uint64_t target_ulong;
 
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
 
+#endif /* TCG_TARGET_IMPLEMENTS_DYN_TLB */
+
 typedef struct CPUTLBEntry {
     /* bit TARGET_LONG_BITS to TARGET_PAGE_BITS : virtual address
        bit TARGET_PAGE_BITS-1..4  : Nonzero for accesses that should not
@@ -152,6 +179,14 @@ typedef struct CPUTLBDesc {
     target_ulong large_page_mask;
     /* The next index to use in the tlb victim table.  */
     size_t vindex;
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    /* Start of the current resize window, see tlb_mmu_resize_locked() */
+    int64_t window_begin_ns;
+    /* Maximum number of entries in use during the current window */
+    size_t window_max_entries;
+    /* Number of valid entries in tlb_table since the last flush */
+    size_t n_used_entries;
+#endif
 } CPUTLBDesc;
 
 /*
@@ -174,6 +209,8 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t victim_hit_count;
+    size_t resize_count;
 } CPUTLBCommon;
 
 /*
@@ -181,6 +218,20 @@ typedef struct CPUTLBCommon {
  * Note that NB_MMU_MODES is not yet defined; we can only reference it
  * within preprocessor defines that will be expanded later.
  */
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/*
+ * tlb_mask[i] is (number of entries - 1) << CPU_TLB_ENTRY_BITS, so that
+ * the TCG backend can mask the shifted address into a byte offset.
+ */
+#define CPU_COMMON_TLB \
+    CPUTLBCommon tlb_c;                                                 \
+    CPUTLBDesc tlb_d[NB_MMU_MODES];                                     \
+    uintptr_t tlb_mask[NB_MMU_MODES];                                   \
+    CPUTLBEntry *tlb_table[NB_MMU_MODES];                               \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    CPUIOTLBEntry *iotlb[NB_MMU_MODES];                                 \
+    CPUIOTLBEntry iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];
+#else
 #define CPU_COMMON_TLB \
     CPUTLBCommon tlb_c;                                                 \
     CPUTLBDesc tlb_d[NB_MMU_MODES];                                     \
@@ -188,6 +239,7 @@ typedef struct CPUTLBCommon {
     CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
     CPUIOTLBEntry iotlb[NB_MMU_MODES][CPU_TLB_SIZE];                    \
     CPUIOTLBEntry iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];
+#endif
 
 #else
 
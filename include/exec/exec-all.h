@@ -67,6 +67,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base,
                               uint32_t flags,
                               int cflags);
+TranslationBlock *tb_gen_superblock(CPUState *cpu, TranslationBlock *tb);
 
 void QEMU_NORETURN cpu_loop_exit(CPUState *cpu);
 void QEMU_NORETURN cpu_loop_exit_restore(CPUState *cpu, uintptr_t pc);
@@ -104,6 +105,11 @@ void cpu_address_space_init(CPUState *cpu, int asidx,
  * @cpu: CPU whose TLB should be initialized
  */
 void tlb_init(CPUState *cpu);
+/**
+ * tlb_destroy - free a CPU's TLB
+ * @cpu: CPU whose TLB should be freed
+ */
+void tlb_destroy(CPUState *cpu);
 /**
  * tlb_flush_page:
  * @cpu: CPU whose TLB should be flushed
@@ -266,6 +272,9 @@ void probe_write(CPUArchState *env, target_ulong addr, int size, int mmu_idx,
 static inline void tlb_init(CPUState *cpu)
 {
 }
+static inline void tlb_destroy(CPUState *cpu)
+{
+}
 static inline void tlb_flush_page(CPUState *cpu, target_ulong addr)
 {
 }
@@ -351,6 +360,8 @@ struct TranslationBlock {
 #define CF_USE_ICOUNT  0x00020000
 #define CF_INVALID     0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL    0x00080000 /* Generate code for a parallel context */
+#define CF_PROFILE     0x00100000 /* Count executions in @exec_count */
+#define CF_SUPERBLOCK  0x00200000 /* Retranslation of a hot TB */
 /* cflags' mask for hashing/comparison */
 #define CF_HASH_MASK   \
     (CF_COUNT_MASK | CF_LAST_IO | CF_USE_ICOUNT | CF_PARALLEL)
@@ -358,6 +369,11 @@ struct TranslationBlock {
     /* Per-vCPU dynamic tracing state used to generate this TB */
     uint32_t trace_vcpu_dstate;
 
+    /* Number of executions so far, only counted with CF_PROFILE */
+    uint32_t exec_count;
+    /* Direct jumps that a CF_SUPERBLOCK translation continued past */
+    uint16_t superblock_jumps;
+
     struct tb_tc tc;
 
     /* original tb when cflags has CF_NOCACHE */
@@ -406,6 +422,12 @@ struct TranslationBlock {
 
 extern bool parallel_cpus;
 
+/*
+ * Number of executions after which a TB is retranslated as a superblock,
+ * or 0 to disable tiered translation.
+ */
+extern unsigned int tb_superblock_threshold;
+
 /* Hide the atomic_read to make code a little easier on the eyes */
 static inline uint32_t tb_cflags(const TranslationBlock *tb)
 {
@@ -6,6 +6,7 @@
 /* Helpers for instruction counting code generation.  */
 
 static TCGOp *icount_start_insn;
+static TCGLabel *tb_hot_label;
 
 static inline void gen_tb_start(TranslationBlock *tb)
 {
@@ -40,6 +41,17 @@ static inline void gen_tb_start(TranslationBlock *tb)
                          -ENV_OFFSET + offsetof(CPUState, icount_decr.u16.low));
     }
 
+    if (tb_cflags(tb) & CF_PROFILE) {
+        TCGv_ptr ptr = tcg_const_ptr(&tb->exec_count);
+
+        /* Leave before the first instruction when the TB becomes hot */
+        tb_hot_label = gen_new_label();
+        gen_helper_tb_profile(count, ptr);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, count, tb_superblock_threshold,
+                            tb_hot_label);
+        tcg_temp_free_ptr(ptr);
+    }
+
     tcg_temp_free_i32(count);
 }
 
@@ -51,6 +63,17 @@ static inline void gen_tb_end(TranslationBlock *tb, int num_insns)
         tcg_set_insn_param(icount_start_insn, 1, num_insns);
     }
 
+    if (tb_cflags(tb) & CF_PROFILE) {
+        /* Make the main loop look up the TB again, and promote it */
+        TCGv_i32 tmp;
+
+        gen_set_label(tb_hot_label);
+        tmp = tcg_const_i32(-1);
+        tcg_gen_st16_i32(tmp, cpu_env,
+                         -ENV_OFFSET + offsetof(CPUState, icount_decr.u16.high));
+        tcg_temp_free_i32(tmp);
+    }
+
     gen_set_label(tcg_ctx->exitreq_label);
     tcg_gen_exit_tb(tb, TB_EXIT_REQUESTED);
 }
@@ -38,6 +38,7 @@ struct VirtIOBlkConf
     uint32_t scsi;
     uint32_t config_wce;
     uint32_t request_merging;
+    uint32_t merge_window_us;
     uint16_t num_queues;
     uint16_t queue_size;
 };
@@ -45,6 +46,15 @@ struct VirtIOBlkConf
 struct VirtIOBlockDataPlane;
 
 struct VirtIOBlockReq;
+
+#define VIRTIO_BLK_MAX_MERGE_REQS 32
+
+typedef struct MultiReqBuffer {
+    struct VirtIOBlockReq *reqs[VIRTIO_BLK_MAX_MERGE_REQS];
+    unsigned int num_reqs;
+    bool is_write;
+} MultiReqBuffer;
+
 typedef struct VirtIOBlock {
     VirtIODevice parent_obj;
     BlockBackend *blk;
@@ -57,6 +67,17 @@ typedef struct VirtIOBlock {
     bool dataplane_disabled;
     bool dataplane_started;
     struct VirtIOBlockDataPlane *dataplane;
+
+    /*
+     * Read/write requests held back for up to conf.merge_window_us, so
+     * that they can be merged with requests from later notifications or
+     * other virtqueues.  Protected by the AioContext lock.
+     */
+    MultiReqBuffer mrb;
+    QEMUTimer merge_timer;
+    AioContext *merge_timer_ctx;
+    bool merge_timer_armed;
+    uint64_t batch;
 } VirtIOBlock;
 
 typedef struct VirtIOBlockReq {
@@ -70,17 +91,10 @@ typedef struct VirtIOBlockReq {
     size_t in_len;
     struct VirtIOBlockReq *next;
     struct VirtIOBlockReq *mr_next;
+    uint64_t batch;    /* virtio_blk_handle_vq() pass that fetched it */
     BlockAcctCookie acct;
 } VirtIOBlockReq;
 
-#define VIRTIO_BLK_MAX_MERGE_REQS 32
-
-typedef struct MultiReqBuffer {
-    VirtIOBlockReq *reqs[VIRTIO_BLK_MAX_MERGE_REQS];
-    unsigned int num_reqs;
-    bool is_write;
-} MultiReqBuffer;
-
 bool virtio_blk_handle_vq(VirtIOBlock *s, VirtQueue *vq);
 
 #endif
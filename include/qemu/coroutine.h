@@ -65,6 +65,43 @@ typedef void coroutine_fn CoroutineEntry(void *opaque);
  */
 Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque);
 
+/**
+ * Create a new coroutine with a small stack
+ *
+ * Like qemu_coroutine_create(), but the coroutine only gets a fraction of
+ * the usual stack size.  Only use this for coroutines that never call
+ * deep into the block layer or device emulation, for example ones that
+ * just wake up other coroutines; those run on their own stacks.
+ */
+Coroutine *qemu_coroutine_create_small(CoroutineEntry *entry, void *opaque);
+
+typedef enum {
+    COROUTINE_STACK_DEFAULT,
+    COROUTINE_STACK_SMALL,
+    COROUTINE_STACK__MAX,
+} CoroutineStackClass;
+
+typedef struct CoroutinePoolStats {
+    size_t stack_size;
+    /* coroutines that have been created and have not terminated yet */
+    uint64_t in_use;
+    /* terminated coroutines that are kept for reuse */
+    uint64_t pooled;
+    /* coroutines created by reusing a pooled one */
+    uint64_t pool_hits;
+    /* coroutines created with a newly allocated stack */
+    uint64_t allocations;
+} CoroutinePoolStats;
+
+/**
+ * Get coroutine pool statistics
+ *
+ * Fill @stats with the counters for each stack class, summed over all
+ * threads.  The counters are not sampled atomically with respect to each
+ * other.
+ */
+void qemu_coroutine_get_pool_stats(CoroutinePoolStats stats[COROUTINE_STACK__MAX]);
+
 /**
  * Transfer control to a coroutine
  */
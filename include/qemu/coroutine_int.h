@@ -30,6 +30,13 @@
 
 #define COROUTINE_STACK_SIZE (1 << 20)
 
+/* Sanitizers make stack frames much larger */
+#if defined(__SANITIZE_ADDRESS__) || defined(CONFIG_DEBUG_STACK_USAGE)
+#define COROUTINE_SMALL_STACK_SIZE COROUTINE_STACK_SIZE
+#else
+#define COROUTINE_SMALL_STACK_SIZE (64 << 10)
+#endif
+
 typedef enum {
     COROUTINE_YIELD = 1,
     COROUTINE_TERMINATE = 2,
@@ -44,6 +51,14 @@ struct Coroutine {
     /* Only used when the coroutine has terminated.  */
     QSLIST_ENTRY(Coroutine) pool_next;
 
+    CoroutineStackClass stack_class;
+
+    /* NUMA node that the stack memory was bound to when it was allocated */
+    int stack_node;
+
+    /* Thread that created the coroutine from its pool, for accounting */
+    struct CoroutineThreadState *pool_owner;
+
     size_t locks_held;
 
     /* Only used when the coroutine has yielded.  */
@@ -64,7 +79,7 @@ struct Coroutine {
     QSLIST_ENTRY(Coroutine) co_scheduled_next;
 };
 
-Coroutine *qemu_coroutine_new(void);
+Coroutine *qemu_coroutine_new(size_t stack_size, int node);
 void qemu_coroutine_delete(Coroutine *co);
 CoroutineAction qemu_coroutine_switch(Coroutine *from, Coroutine *to,
                                       CoroutineAction action);
@@ -0,0 +1,90 @@
+/*
+ * Interval trees
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_INTERVAL_TREE_H
+#define QEMU_INTERVAL_TREE_H
+
+/*
+ * An intrusive, height-balanced binary tree of half-open intervals
+ * [start, end), ordered by start and augmented with the largest end in
+ * each subtree.  Looking up the intervals that overlap a given range
+ * costs O(log n) plus the number of matches.
+ *
+ * An interval overlaps [start, end) if it begins before @end and finishes
+ * after @start.  Empty intervals follow the same rule, so they overlap a
+ * range that strictly contains their start.
+ *
+ * Several nodes may share the same interval.  No locking is done; callers
+ * must serialize all accesses to a tree.  A zero-initialized
+ * IntervalTreeRoot is an empty tree.
+ */
+
+typedef struct IntervalTreeNode IntervalTreeNode;
+
+struct IntervalTreeNode {
+    IntervalTreeNode *parent;
+    IntervalTreeNode *left;
+    IntervalTreeNode *right;
+    uint64_t start;
+    uint64_t end;
+    /* private: maximum end in the subtree rooted here */
+    uint64_t subtree_end;
+    int height;
+};
+
+typedef struct IntervalTreeRoot {
+    IntervalTreeNode *root;
+} IntervalTreeRoot;
+
+static inline bool interval_tree_empty(const IntervalTreeRoot *root)
+{
+    return root->root == NULL;
+}
+
+/**
+ * interval_tree_insert:
+ * @node: the node to add; @node->start and @node->end must be set,
+ *        with @node->start <= @node->end
+ * @root: the tree
+ */
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_tree_remove:
+ * @node: a node previously added to @root
+ * @root: the tree
+ *
+ * To change the interval of a node, remove it, update start and end,
+ * and insert it again.
+ */
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root);
+
+/**
+ * interval_tree_iter_first:
+ * @root: the tree
+ * @start: start of the range to look up
+ * @end: end of the range to look up, exclusive
+ *
+ * Return the overlapping node with the lowest start, or NULL.
+ */
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t end);
+
+/**
+ * interval_tree_iter_next:
+ * @node: a node returned by interval_tree_iter_first or
+ *        interval_tree_iter_next for the same range
+ * @start: start of the range to look up
+ * @end: end of the range to look up, exclusive
+ *
+ * Return the next overlapping node in order of start, or NULL.
+ * The tree must not be modified during the iteration.
+ */
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
+                                          uint64_t start, uint64_t end);
+
+#endif
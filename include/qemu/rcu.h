@@ -112,6 +112,14 @@ static inline void rcu_read_unlock(void)
 
 extern void synchronize_rcu(void);
 
+/*
+ * Like synchronize_rcu(), but busy-wait for readers for a while before
+ * going to sleep and use the expedited flavor of process-wide memory
+ * barriers.  This trades CPU time, on this thread and on the CPUs that
+ * run readers, for latency.
+ */
+extern void synchronize_rcu_expedited(void);
+
 /*
  * Reader thread registration.
  */
@@ -134,6 +142,25 @@ struct rcu_head {
 
 extern void call_rcu1(struct rcu_head *head, RCUCBFunc *func);
 
+/*
+ * Ask the call_rcu thread to process the callbacks queued so far right
+ * away, using an expedited grace period, instead of waiting for more of
+ * them to pile up.
+ */
+extern void rcu_expedite_callbacks(void);
+
+typedef struct RCUStats {
+    uint64_t grace_periods;          /* including expedited ones */
+    uint64_t expedited_grace_periods;
+    uint64_t grace_period_total_ns;
+    uint64_t grace_period_max_ns;
+    uint64_t callbacks_pending;      /* queued or waiting for a grace period */
+    uint64_t callbacks_invoked;
+    uint64_t callbacks_max_batch;
+} RCUStats;
+
+extern void rcu_get_stats(RCUStats *stats);
+
 /* The operands of the minus operator must have the same type,
  * which must be the one that we specify in the cast.
  */
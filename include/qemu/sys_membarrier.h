@@ -12,15 +12,18 @@
 #ifdef CONFIG_MEMBARRIER
 /* Only block reordering at the compiler level in the performance-critical
  * side.  The slow side forces processor-level ordering on all other cores
- * through a system call.
+ * through a system call.  smp_mb_global_expedited() is faster, at the
+ * cost of interrupting the other cores that run threads of this process.
  */
 extern void smp_mb_global_init(void);
 extern void smp_mb_global(void);
+extern void smp_mb_global_expedited(void);
 #define smp_mb_placeholder()       barrier()
 #else
 /* Keep it simple, execute a real memory barrier on both sides.  */
 static inline void smp_mb_global_init(void) {}
 #define smp_mb_global()            smp_mb()
+#define smp_mb_global_expedited()  smp_mb()
 #define smp_mb_placeholder()       smp_mb()
 #endif
 
@@ -85,7 +85,8 @@ struct QEMUTimer {
     QEMUTimerList *timer_list;
     QEMUTimerCB *cb;
     void *opaque;
-    QEMUTimer *next;
+    uint64_t seq;               /* orders timers with equal expire_time */
+    int heap_index;             /* position in the timer list's heap */
     int attributes;
     int scale;
 };
@@ -56,6 +56,7 @@ bool is_daemonized(void);
 /**
  * qemu_alloc_stack:
  * @sz: pointer to a size_t holding the requested usable stack size
+ * @node: host NUMA node that the stack memory should come from, or -1
  *
  * Allocate memory that can be used as a stack, for instance for
  * coroutines. If the memory cannot be allocated, this function
@@ -63,12 +64,14 @@ bool is_daemonized(void);
  * additional guard page to catch a potential stack overflow.
  * Note that the memory required for the guard page and alignment
  * and minimal stack size restrictions will increase the value of sz.
+ * The NUMA node is only a preference, and it is ignored on hosts that
+ * do not support memory policies.
  *
  * The allocated stack must be freed with qemu_free_stack().
  *
  * Returns: pointer to (the lowest address of) the stack memory.
  */
-void *qemu_alloc_stack(size_t *sz);
+void *qemu_alloc_stack(size_t *sz, int node);
 
 /**
  * qemu_free_stack:
@@ -18,6 +18,7 @@
 #include "qapi/error.h"
 #include "qemu-common.h"
 #include "qemu/host-utils.h"
+#include "qemu/rcu.h"
 #include "page_cache.h"
 
 #ifdef DEBUG_CACHE
@@ -40,6 +41,7 @@ struct CacheItem {
 };
 
 struct PageCache {
+    struct rcu_head rcu;
     CacheItem *page_cache;
     size_t page_size;
     size_t max_num_items;
@@ -113,6 +115,11 @@ void cache_fini(PageCache *cache)
     g_free(cache);
 }
 
+void cache_free_rcu(PageCache *cache)
+{
+    call_rcu(cache, cache_fini, rcu);
+}
+
 static size_t cache_get_cache_pos(const PageCache *cache,
                                   uint64_t address)
 {
@@ -35,6 +35,16 @@ PageCache *cache_init(int64_t cache_size, size_t page_size, Error **errp);
  */
 void cache_fini(PageCache *cache);
 
+/**
+ * cache_free_rcu: free all cache resources after an RCU grace period
+ *
+ * Use this instead of cache_fini() for caches that may still be in use
+ * by readers within an RCU critical section.
+ *
+ * @cache pointer to the PageCache struct
+ */
+void cache_free_rcu(PageCache *cache);
+
 /**
  * cache_is_cached: Checks to see if the page is cached
  *
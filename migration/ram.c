@@ -91,7 +91,11 @@ static struct {
     uint8_t *encoded_buf;
     /* buffer for storing page content */
     uint8_t *current_buf;
-    /* Cache for XBZRLE, Protected by lock. */
+    /*
+     * Cache for XBZRLE.  Readers use RCU, so that resizing it does not
+     * stall the migration thread; updates to the pointer are protected
+     * by lock.
+     */
     PageCache *cache;
     QemuMutex lock;
     /* it will store a page full of zeros */
@@ -112,13 +116,25 @@ static void XBZRLE_cache_unlock(void)
         qemu_mutex_unlock(&XBZRLE.lock);
 }
 
+/* Must be called under rcu_read_lock(); may return NULL */
+static PageCache *XBZRLE_cache_get(void)
+{
+    PageCache *cache;
+
+    /* PageCache is opaque here, which atomic_rcu_read() cannot cope with */
+    atomic_rcu_read__nocheck(&XBZRLE.cache, &cache);
+    return cache;
+}
+
 /**
  * xbzrle_cache_resize: resize the xbzrle cache
  *
  * This function is called from qmp_migrate_set_cache_size in main
  * thread, possibly while a migration is in progress.  A running
  * migration may be using the cache and might finish during this call,
- * hence changes to the cache are protected by XBZRLE.lock().
+ * hence changes to the cache are protected by XBZRLE.lock().  The old
+ * cache is freed after an RCU grace period, since the migration thread
+ * does not take the lock to look it up.
  *
  * Returns 0 for success or -1 for error
  *
@@ -127,7 +143,7 @@ static void XBZRLE_cache_unlock(void)
  */
 int xbzrle_cache_resize(int64_t new_size, Error **errp)
 {
-    PageCache *new_cache;
+    PageCache *new_cache, *old_cache;
     int64_t ret = 0;
 
     /* Check for truncation */
@@ -151,8 +167,9 @@ int xbzrle_cache_resize(int64_t new_size, Error **errp)
             goto out;
         }
 
-        cache_fini(XBZRLE.cache);
-        XBZRLE.cache = new_cache;
+        old_cache = XBZRLE.cache;
+        atomic_rcu_set(&XBZRLE.cache, new_cache);
+        cache_free_rcu(old_cache);
     }
 out:
     XBZRLE_cache_unlock();
@@ -516,7 +533,7 @@ exit:
 /* Multiple fd's */
 
 #define MULTIFD_MAGIC 0x11223344U
-#define MULTIFD_VERSION 1
+#define MULTIFD_VERSION 2
 
 #define MULTIFD_FLAG_SYNC (1 << 0)
 
@@ -532,7 +549,10 @@ typedef struct {
     uint32_t version;
     uint32_t flags;
     uint32_t size;
+    /* number of pages whose contents follow the packet */
     uint32_t used;
+    /* number of zero pages, their offsets follow the normal ones */
+    uint32_t zero;
     uint64_t packet_num;
     char ramblock[256];
     uint64_t offset[];
@@ -549,6 +569,10 @@ typedef struct {
     ram_addr_t *offset;
     /* pointer to each page */
     struct iovec *iov;
+    /* number of zero pages */
+    uint32_t zero_num;
+    /* offset of each zero page, they are not in @offset/@iov */
+    ram_addr_t *zero;
     RAMBlock *block;
 } MultiFDPages_t;
 
@@ -587,8 +611,12 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages found by this channel, only sent as offsets */
+    uint64_t num_zero_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
+    /* zero pages not yet accounted in ram_counters, protected by mutex */
+    uint64_t zero_pages_unaccounted;
 }  MultiFDSendParams;
 
 typedef struct {
@@ -620,6 +648,8 @@ typedef struct {
     uint64_t num_packets;
     /* pages sent through this channel */
     uint64_t num_pages;
+    /* zero pages received through this channel */
+    uint64_t num_zero_pages;
     /* syncs main thread and channels */
     QemuSemaphore sem_sync;
 } MultiFDRecvParams;
@@ -693,6 +723,7 @@ static MultiFDPages_t *multifd_pages_init(size_t size)
     pages->allocated = size;
     pages->iov = g_new0(struct iovec, size);
     pages->offset = g_new0(ram_addr_t, size);
+    pages->zero = g_new0(ram_addr_t, size);
 
     return pages;
 }
@@ -707,6 +738,9 @@ static void multifd_pages_clear(MultiFDPages_t *pages)
     pages->iov = NULL;
     g_free(pages->offset);
     pages->offset = NULL;
+    pages->zero_num = 0;
+    g_free(pages->zero);
+    pages->zero = NULL;
     g_free(pages);
 }
 
@@ -720,6 +754,7 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     packet->flags = cpu_to_be32(p->flags);
     packet->size = cpu_to_be32(migrate_multifd_page_count());
     packet->used = cpu_to_be32(p->pages->used);
+    packet->zero = cpu_to_be32(p->pages->zero_num);
     packet->packet_num = cpu_to_be64(p->packet_num);
 
     if (p->pages->block) {
@@ -729,6 +764,9 @@ static void multifd_send_fill_packet(MultiFDSendParams *p)
     for (i = 0; i < p->pages->used; i++) {
         packet->offset[i] = cpu_to_be64(p->pages->offset[i]);
     }
+    for (i = 0; i < p->pages->zero_num; i++) {
+        packet->offset[p->pages->used + i] = cpu_to_be64(p->pages->zero[i]);
+    }
 }
 
 static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
@@ -771,9 +809,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    p->pages->zero_num = be32_to_cpu(packet->zero);
+    if (p->pages->zero_num > packet->size - p->pages->used) {
+        error_setg(errp, "multifd: received packet "
+                   "with %d zero pages and expected maximum %d",
+                   p->pages->zero_num, packet->size - p->pages->used);
+        return -1;
+    }
+
     p->packet_num = be64_to_cpu(packet->packet_num);
 
-    if (p->pages->used) {
+    p->pages->block = NULL;
+    if (p->pages->used || p->pages->zero_num) {
         /* make sure that ramblock is 0 terminated */
         packet->ramblock[255] = 0;
         block = qemu_ram_block_by_name(packet->ramblock);
@@ -782,6 +829,7 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
                        packet->ramblock);
             return -1;
         }
+        p->pages->block = block;
     }
 
     for (i = 0; i < p->pages->used; i++) {
@@ -797,6 +845,18 @@ static int multifd_recv_unfill_packet(MultiFDRecvParams *p, Error **errp)
         p->pages->iov[i].iov_len = TARGET_PAGE_SIZE;
     }
 
+    for (i = 0; i < p->pages->zero_num; i++) {
+        ram_addr_t offset = be64_to_cpu(packet->offset[p->pages->used + i]);
+
+        if (offset > (block->used_length - TARGET_PAGE_SIZE)) {
+            error_setg(errp, "multifd: zero page offset too long "
+                       RAM_ADDR_FMT " (max " RAM_ADDR_FMT ")",
+                       offset, block->max_length);
+            return -1;
+        }
+        p->pages->zero[i] = offset;
+    }
+
     return 0;
 }
 
@@ -814,6 +874,22 @@ struct {
     QemuSemaphore channels_ready;
 } *multifd_send_state;
 
+/*
+ * Zero pages are only found by the channel threads, after the migration
+ * thread has already accounted them as normal pages.  Fix up the counters
+ * with what channel @p found so far.  Called with p->mutex held.
+ */
+static void multifd_send_account_zero_pages(MultiFDSendParams *p)
+{
+    uint64_t zero = p->zero_pages_unaccounted;
+
+    p->zero_pages_unaccounted = 0;
+    ram_counters.normal -= zero;
+    ram_counters.duplicate += zero;
+    ram_counters.multifd_bytes -= zero * TARGET_PAGE_SIZE;
+    ram_counters.transferred -= zero * TARGET_PAGE_SIZE;
+}
+
 /*
  * How we use multifd_send_state->pages and channel->pages?
  *
@@ -852,6 +928,7 @@ static void multifd_send_pages(void)
         }
         qemu_mutex_unlock(&p->mutex);
     }
+    multifd_send_account_zero_pages(p);
     p->pages->used = 0;
 
     p->packet_num = multifd_send_state->packet_num++;
@@ -985,9 +1062,39 @@ static void multifd_send_sync_main(void)
         trace_multifd_send_sync_main_wait(p->id);
         qemu_sem_wait(&multifd_send_state->sem_sync);
     }
+    for (i = 0; i < migrate_multifd_channels(); i++) {
+        MultiFDSendParams *p = &multifd_send_state->params[i];
+
+        qemu_mutex_lock(&p->mutex);
+        multifd_send_account_zero_pages(p);
+        qemu_mutex_unlock(&p->mutex);
+    }
     trace_multifd_send_sync_main(multifd_send_state->packet_num);
 }
 
+/*
+ * Move the zero pages of @pages from @offset/@iov to @zero, so that only
+ * their offsets are sent.  This is done here rather than in the
+ * migration thread so that scanning guest memory scales with the number
+ * of channels.
+ */
+static void multifd_send_zero_page_detect(MultiFDPages_t *pages)
+{
+    uint32_t i, normal = 0;
+
+    pages->zero_num = 0;
+    for (i = 0; i < pages->used; i++) {
+        if (is_zero_range(pages->iov[i].iov_base, TARGET_PAGE_SIZE)) {
+            pages->zero[pages->zero_num++] = pages->offset[i];
+        } else {
+            pages->offset[normal] = pages->offset[i];
+            pages->iov[normal] = pages->iov[i];
+            normal++;
+        }
+    }
+    pages->used = normal;
+}
+
 static void *multifd_send_thread(void *opaque)
 {
     MultiFDSendParams *p = opaque;
@@ -1008,18 +1115,31 @@ static void *multifd_send_thread(void *opaque)
         qemu_mutex_lock(&p->mutex);
 
         if (p->pending_job) {
-            uint32_t used = p->pages->used;
-            uint64_t packet_num = p->packet_num;
-            uint32_t flags = p->flags;
+            uint32_t used, zero;
+            uint64_t packet_num;
+            uint32_t flags;
+
+            /* p->pages is ours until pending_job is decremented */
+            qemu_mutex_unlock(&p->mutex);
+            multifd_send_zero_page_detect(p->pages);
+            qemu_mutex_lock(&p->mutex);
+
+            used = p->pages->used;
+            zero = p->pages->zero_num;
+            packet_num = p->packet_num;
+            flags = p->flags;
 
             multifd_send_fill_packet(p);
             p->flags = 0;
             p->num_packets++;
             p->num_pages += used;
+            p->num_zero_pages += zero;
+            p->zero_pages_unaccounted += zero;
             p->pages->used = 0;
+            p->pages->zero_num = 0;
             qemu_mutex_unlock(&p->mutex);
 
-            trace_multifd_send(p->id, packet_num, used, flags);
+            trace_multifd_send(p->id, packet_num, used, zero, flags);
 
             ret = qio_channel_write_all(p->c, (void *)p->packet,
                                         p->packet_len, &local_err);
@@ -1059,7 +1179,8 @@ out:
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_send_thread_end(p->id, p->num_packets, p->num_pages);
+    trace_multifd_send_thread_end(p->id, p->num_packets, p->num_pages,
+                                  p->num_zero_pages);
 
     return NULL;
 }
@@ -1221,6 +1342,21 @@ static void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/* Zero pages are only sent as offsets, clear the ones that need it */
+static void multifd_recv_zero_pages(MultiFDPages_t *pages)
+{
+    uint32_t i;
+
+    for (i = 0; i < pages->zero_num; i++) {
+        uint8_t *host = pages->block->host + pages->zero[i];
+
+        /* Avoid dirtying pages that are still untouched on this side */
+        if (!is_zero_range(host, TARGET_PAGE_SIZE)) {
+            memset(host, 0, TARGET_PAGE_SIZE);
+        }
+    }
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
@@ -1231,7 +1367,7 @@ static void *multifd_recv_thread(void *opaque)
     rcu_register_thread();
 
     while (true) {
-        uint32_t used;
+        uint32_t used, zero;
         uint32_t flags;
 
         ret = qio_channel_read_all_eof(p->c, (void *)p->packet,
@@ -1251,10 +1387,12 @@ static void *multifd_recv_thread(void *opaque)
         }
 
         used = p->pages->used;
+        zero = p->pages->zero_num;
         flags = p->flags;
-        trace_multifd_recv(p->id, p->packet_num, used, flags);
+        trace_multifd_recv(p->id, p->packet_num, used, zero, flags);
         p->num_packets++;
         p->num_pages += used;
+        p->num_zero_pages += zero;
         qemu_mutex_unlock(&p->mutex);
 
         ret = qio_channel_readv_all(p->c, p->pages->iov, used, &local_err);
@@ -1262,6 +1400,8 @@ static void *multifd_recv_thread(void *opaque)
             break;
         }
 
+        multifd_recv_zero_pages(p->pages);
+
         if (flags & MULTIFD_FLAG_SYNC) {
             qemu_sem_post(&multifd_recv_state->sem_sync);
             qemu_sem_wait(&p->sem_sync);
@@ -1276,7 +1416,8 @@ static void *multifd_recv_thread(void *opaque)
     qemu_mutex_unlock(&p->mutex);
 
     rcu_unregister_thread();
-    trace_multifd_recv_thread_end(p->id, p->num_packets, p->num_pages);
+    trace_multifd_recv_thread_end(p->id, p->num_packets, p->num_pages,
+                                  p->num_zero_pages);
 
     return NULL;
 }
@@ -1417,6 +1558,7 @@ static void mig_throttle_guest_down(void)
  * xbzrle_cache_zero_page: insert a zero page in the XBZRLE cache
  *
  * @rs: current RAM state
+ * @cache: the XBZRLE cache, looked up under rcu_read_lock()
  * @current_addr: address for the zero page
  *
  * Update the xbzrle cache to reflect a page that's been sent as all 0.
@@ -1425,15 +1567,16 @@ static void mig_throttle_guest_down(void)
  * As a bonus, if the page wasn't in the cache it gets added so that
  * when a small write is made into the 0'd page it gets XBZRLE sent.
  */
-static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
+static void xbzrle_cache_zero_page(RAMState *rs, PageCache *cache,
+                                   ram_addr_t current_addr)
 {
-    if (rs->ram_bulk_stage || !migrate_use_xbzrle()) {
+    if (rs->ram_bulk_stage || !cache) {
         return;
     }
 
     /* We don't care if this fails to allocate a new cache page
      * as long as it updated an old one */
-    cache_insert(XBZRLE.cache, current_addr, XBZRLE.zero_target_page,
+    cache_insert(cache, current_addr, XBZRLE.zero_target_page,
                  ram_counters.dirty_sync_count);
 }
 
@@ -1447,36 +1590,38 @@ static void xbzrle_cache_zero_page(RAMState *rs, ram_addr_t current_addr)
  *          -1 means that xbzrle would be longer than normal
  *
  * @rs: current RAM state
+ * @cache: the XBZRLE cache, looked up under rcu_read_lock()
  * @current_data: pointer to the address of the page contents
  * @current_addr: addr of the page
  * @block: block that contains the page we want to send
  * @offset: offset inside the block for the page
  * @last_stage: if we are at the completion stage
  */
-static int save_xbzrle_page(RAMState *rs, uint8_t **current_data,
+static int save_xbzrle_page(RAMState *rs, PageCache *cache,
+                            uint8_t **current_data,
                             ram_addr_t current_addr, RAMBlock *block,
                             ram_addr_t offset, bool last_stage)
 {
     int encoded_len = 0, bytes_xbzrle;
     uint8_t *prev_cached_page;
 
-    if (!cache_is_cached(XBZRLE.cache, current_addr,
+    if (!cache_is_cached(cache, current_addr,
                          ram_counters.dirty_sync_count)) {
         xbzrle_counters.cache_miss++;
         if (!last_stage) {
-            if (cache_insert(XBZRLE.cache, current_addr, *current_data,
+            if (cache_insert(cache, current_addr, *current_data,
                              ram_counters.dirty_sync_count) == -1) {
                 return -1;
             } else {
                 /* update *current_data when the page has been
                    inserted into cache */
-                *current_data = get_cached_data(XBZRLE.cache, current_addr);
+                *current_data = get_cached_data(cache, current_addr);
             }
         }
         return -1;
     }
 
-    prev_cached_page = get_cached_data(XBZRLE.cache, current_addr);
+    prev_cached_page = get_cached_data(cache, current_addr);
 
     /* save current buffer into memory */
     memcpy(XBZRLE.current_buf, *current_data, TARGET_PAGE_SIZE);
@@ -1840,14 +1985,15 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
     RAMBlock *block = pss->block;
     ram_addr_t offset = pss->page << TARGET_PAGE_BITS;
     ram_addr_t current_addr = block->offset + offset;
+    PageCache *cache;
 
     p = block->host + offset;
     trace_ram_save_page(block->idstr, (uint64_t)offset, p);
 
-    XBZRLE_cache_lock();
-    if (!rs->ram_bulk_stage && !migration_in_postcopy() &&
-        migrate_use_xbzrle()) {
-        pages = save_xbzrle_page(rs, &p, current_addr, block,
+    rcu_read_lock();
+    cache = migrate_use_xbzrle() ? XBZRLE_cache_get() : NULL;
+    if (!rs->ram_bulk_stage && !migration_in_postcopy() && cache) {
+        pages = save_xbzrle_page(rs, cache, &p, current_addr, block,
                                  offset, last_stage);
         if (!last_stage) {
             /* Can't send this cached data async, since the cache page
@@ -1862,7 +2008,7 @@ static int ram_save_page(RAMState *rs, PageSearchStatus *pss, bool last_stage)
         pages = save_normal_page(rs, block, offset, p, send_async);
     }
 
-    XBZRLE_cache_unlock();
+    rcu_read_unlock();
 
     return pages;
 }
@@ -2324,28 +2470,30 @@ static int ram_save_target_page(RAMState *rs, PageSearchStatus *pss,
         return 1;
     }
 
+    /*
+     * do not use multifd for compression as the first page in the new
+     * block should be posted out before sending the compressed page.
+     * Zero pages are detected by the multifd channels themselves.
+     */
+    if (!save_page_use_compression(rs) && migrate_use_multifd()) {
+        return ram_save_multifd_page(rs, block, offset);
+    }
+
     res = save_zero_page(rs, block, offset);
     if (res > 0) {
         /* Must let xbzrle know, otherwise a previous (now 0'd) cached
          * page would be stale
          */
-        if (!save_page_use_compression(rs)) {
-            XBZRLE_cache_lock();
-            xbzrle_cache_zero_page(rs, block->offset + offset);
-            XBZRLE_cache_unlock();
+        if (!save_page_use_compression(rs) && migrate_use_xbzrle()) {
+            rcu_read_lock();
+            xbzrle_cache_zero_page(rs, XBZRLE_cache_get(),
+                                   block->offset + offset);
+            rcu_read_unlock();
         }
         ram_release_pages(block->idstr, offset, res);
         return res;
     }
 
-    /*
-     * do not use multifd for compression as the first page in the new
-     * block should be posted out before sending the compressed page
-     */
-    if (!save_page_use_compression(rs) && migrate_use_multifd()) {
-        return ram_save_multifd_page(rs, block, offset);
-    }
-
     return ram_save_page(rs, pss, last_stage);
 }
 
@@ -2511,11 +2659,13 @@ static void xbzrle_cleanup(void)
 {
     XBZRLE_cache_lock();
     if (XBZRLE.cache) {
-        cache_fini(XBZRLE.cache);
+        PageCache *cache = XBZRLE.cache;
+
+        atomic_rcu_set(&XBZRLE.cache, NULL);
+        cache_free_rcu(cache);
         g_free(XBZRLE.encoded_buf);
         g_free(XBZRLE.current_buf);
         g_free(XBZRLE.zero_target_page);
-        XBZRLE.cache = NULL;
         XBZRLE.encoded_buf = NULL;
         XBZRLE.current_buf = NULL;
         XBZRLE.zero_target_page = NULL;
@@ -2966,6 +3116,7 @@ err:
  */
 static int xbzrle_init(void)
 {
+    PageCache *cache;
     Error *local_err = NULL;
 
     if (!migrate_use_xbzrle()) {
@@ -2980,9 +3131,9 @@ static int xbzrle_init(void)
         goto err_out;
     }
 
-    XBZRLE.cache = cache_init(migrate_xbzrle_cache_size(),
-                              TARGET_PAGE_SIZE, &local_err);
-    if (!XBZRLE.cache) {
+    cache = cache_init(migrate_xbzrle_cache_size(), TARGET_PAGE_SIZE,
+                       &local_err);
+    if (!cache) {
         error_report_err(local_err);
         goto free_zero_page;
     }
@@ -3000,6 +3151,7 @@ static int xbzrle_init(void)
     }
 
     /* We are all good */
+    atomic_rcu_set(&XBZRLE.cache, cache);
     XBZRLE_cache_unlock();
     return 0;
 
@@ -3007,8 +3159,7 @@ free_encoded_buf:
     g_free(XBZRLE.encoded_buf);
     XBZRLE.encoded_buf = NULL;
 free_cache:
-    cache_fini(XBZRLE.cache);
-    XBZRLE.cache = NULL;
+    cache_fini(cache);
 free_zero_page:
     g_free(XBZRLE.zero_target_page);
     XBZRLE.zero_target_page = NULL;
@@ -12,6 +12,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/host-utils.h"
 #include "xbzrle.h"
 
 /*
@@ -24,17 +25,14 @@
 
   length = uleb128 encoded integer
  */
-int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
-                         uint8_t *dst, int dlen)
+static int xbzrle_encode_buffer_int(uint8_t *old_buf, uint8_t *new_buf,
+                                    int slen, uint8_t *dst, int dlen)
 {
     uint32_t zrun_len = 0, nzrun_len = 0;
     int d = 0, i = 0;
     long res;
     uint8_t *nzrun_start = NULL;
 
-    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
-               sizeof(long)));
-
     while (i < slen) {
         /* overflow */
         if (d + 2 > dlen) {
@@ -126,6 +124,210 @@ int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
     return d;
 }
 
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512BW_OPT)
+/*
+ * The vector encoders produce exactly the same output as the scalar one.
+ * @find_end returns the first index at or after @i whose bytes compare
+ * equal (or different, depending on @equal) in the two buffers, or @slen.
+ */
+static inline int QEMU_ARTIFICIAL
+xbzrle_encode_runs(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                   uint8_t *dst, int dlen,
+                   int (*find_end)(const uint8_t *, const uint8_t *,
+                                   int, int, bool))
+{
+    uint32_t zrun_len, nzrun_len;
+    int d = 0, i = 0, j;
+
+    while (i < slen) {
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        j = find_end(old_buf, new_buf, i, slen, true);
+        zrun_len = j - i;
+
+        /* buffer unchanged */
+        if (zrun_len == slen) {
+            return 0;
+        }
+
+        /* skip last zero run */
+        if (j == slen) {
+            return d;
+        }
+
+        d += uleb128_encode_small(dst + d, zrun_len);
+
+        /* overflow */
+        if (d + 2 > dlen) {
+            return -1;
+        }
+
+        i = find_end(old_buf, new_buf, j, slen, false);
+        nzrun_len = i - j;
+
+        d += uleb128_encode_small(dst + d, nzrun_len);
+        /* overflow */
+        if (d + nzrun_len > dlen) {
+            return -1;
+        }
+        memcpy(dst + d, new_buf + j, nzrun_len);
+        d += nzrun_len;
+    }
+
+    return d;
+}
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static inline int find_end_avx2(const uint8_t *old_buf, const uint8_t *new_buf,
+                                int i, int slen, bool equal)
+{
+    for (; i + 32 <= slen; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(old_buf + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(new_buf + i));
+        uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b));
+        uint32_t stop = equal ? ~eq : eq;
+
+        if (stop) {
+            return i + ctz32(stop);
+        }
+    }
+    while (i < slen && (old_buf[i] == new_buf[i]) == equal) {
+        i++;
+    }
+    return i;
+}
+
+static int xbzrle_encode_buffer_avx2(uint8_t *old_buf, uint8_t *new_buf,
+                                     int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              find_end_avx2);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+#ifdef CONFIG_AVX512BW_OPT
+#pragma GCC push_options
+#pragma GCC target("avx512bw")
+#include <immintrin.h>
+
+static inline int find_end_avx512(const uint8_t *old_buf,
+                                  const uint8_t *new_buf,
+                                  int i, int slen, bool equal)
+{
+    for (; i + 64 <= slen; i += 64) {
+        __m512i a = _mm512_loadu_si512(old_buf + i);
+        __m512i b = _mm512_loadu_si512(new_buf + i);
+        uint64_t eq = _mm512_cmpeq_epi8_mask(a, b);
+        uint64_t stop = equal ? ~eq : eq;
+
+        if (stop) {
+            return i + ctz64(stop);
+        }
+    }
+    while (i < slen && (old_buf[i] == new_buf[i]) == equal) {
+        i++;
+    }
+    return i;
+}
+
+static int xbzrle_encode_buffer_avx512(uint8_t *old_buf, uint8_t *new_buf,
+                                       int slen, uint8_t *dst, int dlen)
+{
+    return xbzrle_encode_runs(old_buf, new_buf, slen, dst, dlen,
+                              find_end_avx512);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX512BW_OPT */
+
+/* Note that for test_xbzrle_encode_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_AVX512BW 1
+#define CACHE_AVX2     2
+
+static unsigned cpuid_cache;
+static int (*encode_accel)(uint8_t *, uint8_t *, int, uint8_t *, int) =
+    xbzrle_encode_buffer_int;
+
+static void init_accel(unsigned cache)
+{
+    int (*fn)(uint8_t *, uint8_t *, int, uint8_t *, int) =
+        xbzrle_encode_buffer_int;
+
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = xbzrle_encode_buffer_avx2;
+    }
+#endif
+#ifdef CONFIG_AVX512BW_OPT
+    if (cache & CACHE_AVX512BW) {
+        fn = xbzrle_encode_buffer_avx512;
+    }
+#endif
+    encode_accel = fn;
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(CONFIG_AVX512BW_OPT)
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    /* We must check that AVX is not just available, but usable.  */
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+            /* The opmask and upper ZMM state must be enabled too.  */
+            if ((bv & 0xe6) == 0xe6 && (b & bit_AVX512BW)) {
+                cache |= CACHE_AVX512BW;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif
+
+bool test_xbzrle_encode_next_accel(void)
+{
+    /* If no bits set, we just tested the scalar encoder, and there
+       are no more acceleration options to test.  */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+int xbzrle_encode_buffer(uint8_t *old_buf, uint8_t *new_buf, int slen,
+                         uint8_t *dst, int dlen)
+{
+    g_assert(!(((uintptr_t)old_buf | (uintptr_t)new_buf | slen) %
+               sizeof(long)));
+
+    return encode_accel(old_buf, new_buf, slen, dst, dlen);
+}
+
 int xbzrle_decode_buffer(uint8_t *src, int slen, uint8_t *dst, int dlen)
 {
     int i = 0, d = 0;
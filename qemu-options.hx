@@ -118,9 +118,11 @@ Select CPU model (@code{-cpu help} for list and additional feature selection)
 ETEXI
 
 DEF("accel", HAS_ARG, QEMU_OPTION_accel,
-    "-accel [accel=]accelerator[,thread=single|multi]\n"
+    "-accel [accel=]accelerator[,thread=single|multi][,superblock-threshold=n]\n"
     "                select accelerator (kvm, xen, hax, hvf, whpx or tcg; use 'help' for a list)\n"
-    "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
+    "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                superblock-threshold=n (retranslate TBs as superblocks\n"
+    "                after n executions, 0 to disable)\n", QEMU_ARCH_ALL)
 STEXI
 @item -accel @var{name}[,prop=@var{value}[,...]]
 @findex -accel
@@ -134,6 +136,14 @@ Controls number of TCG threads. When the TCG is multi-threaded there will be one
 thread per vCPU therefor taking advantage of additional host cores. The default
 is to enable multi-threading where both the back-end and front-ends support it and
 no incompatible TCG features have been enabled (e.g. icount/replay).
+@item superblock-threshold=@var{n}
+Count how many times each translation block runs, and translate it again
+as a superblock once it has run @var{n} times.  A superblock is not
+profiled any more, and it continues past direct jumps and calls to a
+later address in the same page, so that code on both sides of the jump
+is optimized together.  Only x86 targets support superblocks.  The
+default is 0, which disables profiling.  Profiling is always disabled
+with icount/replay.
 @end table
 ETEXI
 
@@ -750,6 +760,10 @@ Clean unused entries in the L2 and refcount caches. The interval is in seconds.
 The default value is 600 on supporting platforms, and 0 on other platforms.
 Setting it to 0 disables this feature.
 
+@item cache-warmup
+Save the hot L2 tables and refcount blocks in the image when it is closed and
+prefetch them into the caches when it is opened again (on/off; default: off)
+
 @item pass-discard-request
 Whether discard requests to the qcow2 device should be forwarded to the data
 source (on/off; default: on if discard=unmap is specified, off otherwise)
@@ -16,6 +16,8 @@
 #include "qemu/osdep.h"
 #include "qemu-version.h"
 #include "qemu/cutils.h"
+#include "qemu/coroutine.h"
+#include "qemu/rcu.h"
 #include "qemu/option.h"
 #include "monitor/monitor.h"
 #include "sysemu/sysemu.h"
@@ -737,3 +739,44 @@ MemoryInfo *qmp_query_memory_size_summary(Error **errp)
 
     return mem_info;
 }
+
+CoroutinePoolInfoList *qmp_query_coroutine_pools(Error **errp)
+{
+    CoroutinePoolStats stats[COROUTINE_STACK__MAX];
+    CoroutinePoolInfoList *head = NULL, **prev = &head;
+    int i;
+
+    qemu_coroutine_get_pool_stats(stats);
+    for (i = 0; i < COROUTINE_STACK__MAX; i++) {
+        CoroutinePoolInfoList *entry = g_new0(CoroutinePoolInfoList, 1);
+
+        entry->value = g_new0(CoroutinePoolInfo, 1);
+        entry->value->stack_size = stats[i].stack_size;
+        entry->value->in_use = stats[i].in_use;
+        entry->value->pooled = stats[i].pooled;
+        entry->value->pool_hits = stats[i].pool_hits;
+        entry->value->allocations = stats[i].allocations;
+
+        *prev = entry;
+        prev = &entry->next;
+    }
+
+    return head;
+}
+
+RcuInfo *qmp_query_rcu(Error **errp)
+{
+    RcuInfo *info = g_new0(RcuInfo, 1);
+    RCUStats stats;
+
+    rcu_get_stats(&stats);
+    info->grace_periods = stats.grace_periods;
+    info->expedited_grace_periods = stats.expedited_grace_periods;
+    info->grace_period_total_ns = stats.grace_period_total_ns;
+    info->grace_period_max_ns = stats.grace_period_max_ns;
+    info->callbacks_pending = stats.callbacks_pending;
+    info->callbacks_invoked = stats.callbacks_invoked;
+    info->callbacks_max_batch = stats.callbacks_max_batch;
+
+    return info;
+}
@@ -115,6 +115,7 @@ typedef struct DisasContext {
     int iopl;
     int tf;     /* TF cpu flag */
     int jmp_opt; /* use direct block chaining for direct jumps */
+    int superblock_jumps; /* direct jumps followed in a superblock */
     int repz_opt; /* optimize jumps within repz instructions */
     int mem_index; /* select memory access functions */
     uint64_t flags; /* all execution flags */
@@ -850,11 +851,45 @@ static CCPrepare gen_prepare_eflags_s(DisasContext *s, TCGv reg)
 /* compute eflags.O to reg */
 static CCPrepare gen_prepare_eflags_o(DisasContext *s, TCGv reg)
 {
+    TCGMemOp size;
+
     switch (s->cc_op) {
+    case CC_OP_ADDB ... CC_OP_ADDQ:
+        /* (CC_SRC ^ CC_DST) & (src2 ^ CC_DST), with src2 = CC_DST - CC_SRC */
+        size = s->cc_op - CC_OP_ADDB;
+        tcg_gen_sub_tl(s->tmp0, cpu_cc_dst, cpu_cc_src);
+        tcg_gen_xor_tl(s->tmp0, s->tmp0, cpu_cc_dst);
+        tcg_gen_xor_tl(reg, cpu_cc_src, cpu_cc_dst);
+        tcg_gen_and_tl(reg, reg, s->tmp0);
+        return (CCPrepare) { .cond = TCG_COND_NE, .reg = reg,
+                             .mask = (target_ulong)1 << ((8 << size) - 1) };
+    case CC_OP_SUBB ... CC_OP_SUBQ:
+        /* (CC_SRCT ^ CC_SRC) & (CC_SRCT ^ CC_DST) */
+        size = s->cc_op - CC_OP_SUBB;
+        tcg_gen_xor_tl(s->tmp0, s->cc_srcT, cpu_cc_dst);
+        tcg_gen_xor_tl(reg, s->cc_srcT, cpu_cc_src);
+        tcg_gen_and_tl(reg, reg, s->tmp0);
+        return (CCPrepare) { .cond = TCG_COND_NE, .reg = reg,
+                             .mask = (target_ulong)1 << ((8 << size) - 1) };
+    case CC_OP_INCB ... CC_OP_INCQ:
+        /* (DATA_TYPE)CC_DST == SIGNED_MIN */
+        size = s->cc_op - CC_OP_INCB;
+        return (CCPrepare) { .cond = TCG_COND_EQ,
+                             .reg = gen_ext_tl(reg, cpu_cc_dst, size, false),
+                             .imm = (target_ulong)1 << ((8 << size) - 1),
+                             .mask = -1 };
+    case CC_OP_DECB ... CC_OP_DECQ:
+        /* (DATA_TYPE)CC_DST == SIGNED_MAX */
+        size = s->cc_op - CC_OP_DECB;
+        return (CCPrepare) { .cond = TCG_COND_EQ,
+                             .reg = gen_ext_tl(reg, cpu_cc_dst, size, false),
+                             .imm = ((target_ulong)1 << ((8 << size) - 1)) - 1,
+                             .mask = -1 };
     case CC_OP_ADOX:
     case CC_OP_ADCOX:
         return (CCPrepare) { .cond = TCG_COND_NE, .reg = cpu_cc_src2,
                              .mask = -1, .no_setcond = true };
+    case CC_OP_LOGICB ... CC_OP_LOGICQ:
     case CC_OP_CLR:
     case CC_OP_POPCNT:
         return (CCPrepare) { .cond = TCG_COND_NEVER, .mask = -1 };
@@ -898,6 +933,7 @@ static CCPrepare gen_prepare_cc(DisasContext *s, int b, TCGv reg)
 {
     int inv, jcc_op, cond;
     TCGMemOp size;
+    target_ulong imm;
     CCPrepare cc;
     TCGv t0;
 
@@ -935,9 +971,51 @@ static CCPrepare gen_prepare_cc(DisasContext *s, int b, TCGv reg)
         }
         break;
 
+    case CC_OP_LOGICB ... CC_OP_LOGICQ:
+        /* C and O are clear, so these only look at the result.  */
+        size = s->cc_op - CC_OP_LOGICB;
+        switch (jcc_op) {
+        case JCC_BE:
+            cond = TCG_COND_EQ;
+            t0 = gen_ext_tl(reg, cpu_cc_dst, size, false);
+            break;
+        case JCC_L:
+            cond = TCG_COND_LT;
+            t0 = gen_ext_tl(reg, cpu_cc_dst, size, true);
+            break;
+        case JCC_LE:
+            cond = TCG_COND_LE;
+            t0 = gen_ext_tl(reg, cpu_cc_dst, size, true);
+            break;
+        default:
+            goto slow_jcc;
+        }
+        cc = (CCPrepare) { .cond = cond, .reg = t0, .mask = -1 };
+        break;
+
+    case CC_OP_INCB ... CC_OP_INCQ:
+    case CC_OP_DECB ... CC_OP_DECQ:
+        /* Compare the operand, CC_DST -/+ 1, with the implicit 1.  */
+        if (jcc_op != JCC_L && jcc_op != JCC_LE) {
+            goto slow_jcc;
+        }
+        if (s->cc_op <= CC_OP_INCQ) {
+            size = s->cc_op - CC_OP_INCB;
+            tcg_gen_subi_tl(reg, cpu_cc_dst, 1);
+            imm = -1;
+        } else {
+            size = s->cc_op - CC_OP_DECB;
+            tcg_gen_addi_tl(reg, cpu_cc_dst, 1);
+            imm = 1;
+        }
+        gen_exts(size, reg);
+        cc = (CCPrepare) { .cond = jcc_op == JCC_L ? TCG_COND_LT : TCG_COND_LE,
+                           .reg = reg, .imm = imm, .mask = -1 };
+        break;
+
     default:
     slow_jcc:
-        /* This actually generates good code for JC, JZ and JS.  */
+        /* This actually generates good code for JC, JZ, JS and JO.  */
         switch (jcc_op) {
         case JCC_O:
             cc = gen_prepare_eflags_o(s, reg);
@@ -2643,6 +2721,30 @@ static void gen_jmp(DisasContext *s, target_ulong eip)
     gen_jmp_tb(s, eip, 0);
 }
 
+/* Maximum number of direct jumps followed in a single superblock */
+#define SUPERBLOCK_MAX_JUMPS 8
+
+/*
+ * Direct jump or call to @eip.  In a superblock, keep translating at the
+ * destination if it lies ahead in the same page, so that the TB still
+ * covers a single range of guest code; the lazy flags state then also
+ * carries over the jump.
+ */
+static void gen_jmp_direct(DisasContext *s, target_ulong eip)
+{
+    target_ulong pc = s->cs_base + eip;
+
+    if ((tb_cflags(s->base.tb) & CF_SUPERBLOCK) && s->jmp_opt
+        && s->superblock_jumps < SUPERBLOCK_MAX_JUMPS
+        && pc > s->pc
+        && (pc & TARGET_PAGE_MASK) == (s->base.pc_first & TARGET_PAGE_MASK)) {
+        s->superblock_jumps++;
+        s->pc = pc;
+        return;
+    }
+    gen_jmp(s, eip);
+}
+
 static inline void gen_ldq_env_A0(DisasContext *s, int offset)
 {
     tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index, MO_LEQ);
@@ -6553,7 +6655,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tcg_gen_movi_tl(s->T0, next_eip);
             gen_push_v(s, s->T0);
             gen_bnd_jmp(s);
-            gen_jmp(s, tval);
+            gen_jmp_direct(s, tval);
         }
         break;
     case 0x9a: /* lcall im */
@@ -6583,7 +6685,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tval &= 0xffffffff;
         }
         gen_bnd_jmp(s);
-        gen_jmp(s, tval);
+        gen_jmp_direct(s, tval);
         break;
     case 0xea: /* ljmp im */
         {
@@ -6605,7 +6707,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (dflag == MO_16) {
             tval &= 0xffff;
         }
-        gen_jmp(s, tval);
+        gen_jmp_direct(s, tval);
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
         tval = (int8_t)insn_get(env, s, MO_8);
@@ -8462,6 +8564,7 @@ static void i386_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
     dc->flags = flags;
     dc->jmp_opt = !(dc->tf || dc->base.singlestep_enabled ||
                     (flags & HF_INHIBIT_IRQ_MASK));
+    dc->superblock_jumps = 0;
     /* Do not optimize repz jumps at all in icount mode, because
        rep movsS instructions are execured with different paths
        in !repz_opt and repz_opt modes. The first one was used
@@ -8563,6 +8666,7 @@ static void i386_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
         gen_jmp_im(dc, dc->base.pc_next - dc->cs_base);
         gen_eob(dc);
     }
+    dc->base.tb->superblock_jumps = dc->superblock_jumps;
 }
 
 static void i386_tr_disas_log(const DisasContextBase *dcbase,
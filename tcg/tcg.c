@@ -1593,6 +1593,16 @@ bool tcg_op_supported(TCGOpcode op)
         return have_vec && TCG_TARGET_HAS_orc_vec;
     case INDEX_op_mul_vec:
         return have_vec && TCG_TARGET_HAS_mul_vec;
+    case INDEX_op_ssadd_vec:
+    case INDEX_op_usadd_vec:
+    case INDEX_op_sssub_vec:
+    case INDEX_op_ussub_vec:
+        return have_vec && TCG_TARGET_HAS_sat_vec;
+    case INDEX_op_smin_vec:
+    case INDEX_op_umin_vec:
+    case INDEX_op_smax_vec:
+    case INDEX_op_umax_vec:
+        return have_vec && TCG_TARGET_HAS_minmax_vec;
     case INDEX_op_shli_vec:
     case INDEX_op_shri_vec:
     case INDEX_op_sari_vec:
@@ -2259,6 +2269,27 @@ static void tcg_la_bb_end(TCGContext *s)
     }
 }
 
+/* liveness analysis: conditional branch: all temps are dead, globals
+   and local temps should be synced.  Unlike at the end of a basic block,
+   they stay live in registers for the fall-through path, so that the
+   extended basic block that starts there does not have to reload them;
+   only the branch target, which is a label, expects them in memory. */
+static void tcg_la_bb_sync(TCGContext *s)
+{
+    int ng = s->nb_globals;
+    int nt = s->nb_temps;
+    int i;
+
+    for (i = 0; i < ng; ++i) {
+        s->temps[i].state |= TS_MEM;
+    }
+    for (i = ng; i < nt; ++i) {
+        s->temps[i].state = (s->temps[i].temp_local
+                             ? s->temps[i].state | TS_MEM
+                             : TS_DEAD);
+    }
+}
+
 /* Liveness analysis : update the opc_arg_life array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
@@ -2457,7 +2488,9 @@ static void liveness_pass_1(TCGContext *s)
                 }
 
                 /* if end of basic block, update */
-                if (def->flags & TCG_OPF_BB_END) {
+                if (def->flags & TCG_OPF_COND_BRANCH) {
+                    tcg_la_bb_sync(s);
+                } else if (def->flags & TCG_OPF_BB_END) {
                     tcg_la_bb_end(s);
                 } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
                     /* globals should be synced to memory */
@@ -2528,7 +2561,10 @@ static bool liveness_pass_2(TCGContext *s)
             nb_oargs = def->nb_oargs;
 
             /* Set flags similar to how calls require.  */
-            if (def->flags & TCG_OPF_BB_END) {
+            if (def->flags & TCG_OPF_COND_BRANCH) {
+                /* Like reading globals: sync_globals */
+                call_flags = TCG_CALL_NO_WRITE_GLOBALS;
+            } else if (def->flags & TCG_OPF_BB_END) {
                 /* Like writing globals: save_globals */
                 call_flags = 0;
             } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
@@ -2555,6 +2591,7 @@ static bool liveness_pass_2(TCGContext *s)
                     lop->args[0] = temp_arg(dir_ts);
                     lop->args[1] = temp_arg(arg_ts->mem_base);
                     lop->args[2] = arg_ts->mem_offset;
+                    s->nb_fills++;
 
                     /* Loaded, but synced with memory.  */
                     arg_ts->state = TS_MEM;
@@ -2601,6 +2638,16 @@ static bool liveness_pass_2(TCGContext *s)
             }
         }
 
+        /* The direct temps are ordinary temps and do not survive a
+           conditional branch; reload the indirect globals after it.  */
+        if (def->flags & TCG_OPF_COND_BRANCH) {
+            for (i = 0; i < nb_globals; ++i) {
+                if (s->temps[i].state_ptr) {
+                    s->temps[i].state = TS_DEAD;
+                }
+            }
+        }
+
         /* Outputs become available.  */
         for (i = 0; i < nb_oargs; i++) {
             arg_ts = arg_temp(op->args[i]);
@@ -2624,6 +2671,7 @@ static bool liveness_pass_2(TCGContext *s)
                 sop->args[0] = temp_arg(dir_ts);
                 sop->args[1] = temp_arg(arg_ts->mem_base);
                 sop->args[2] = arg_ts->mem_offset;
+                s->nb_spills++;
 
                 arg_ts->state = TS_MEM;
             }
@@ -2773,6 +2821,7 @@ static void temp_sync(TCGContext *s, TCGTemp *ts,
             if (free_or_dead
                 && tcg_out_sti(s, ts->type, ts->val,
                                ts->mem_base->reg, ts->mem_offset)) {
+                s->nb_spills++;
                 break;
             }
             temp_load(s, ts, tcg_target_available_regs[ts->type],
@@ -2782,6 +2831,7 @@ static void temp_sync(TCGContext *s, TCGTemp *ts,
         case TEMP_VAL_REG:
             tcg_out_st(s, ts->type, ts->reg,
                        ts->mem_base->reg, ts->mem_offset);
+            s->nb_spills++;
             break;
 
         case TEMP_VAL_MEM:
@@ -2857,6 +2907,7 @@ static void temp_load(TCGContext *s, TCGTemp *ts, TCGRegSet desired_regs,
         reg = tcg_reg_alloc(s, desired_regs, allocated_regs, ts->indirect_base);
         tcg_out_ld(s, ts->type, reg, ts->mem_base->reg, ts->mem_offset);
         ts->mem_coherent = 1;
+        s->nb_fills++;
         break;
     case TEMP_VAL_DEAD:
     default:
@@ -2923,6 +2974,28 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
     save_globals(s, allocated_regs);
 }
 
+/* at a conditional branch, we assume all temporaries are dead and all
+   globals and local temps are synced to their location.  Registers keep
+   their values for the fall-through path. */
+static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
+{
+    int i;
+
+    sync_globals(s, allocated_regs);
+
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+        /* The liveness analysis already ensures that temps are dead.
+           Keep tcg_debug_asserts for safety. */
+        if (ts->temp_local) {
+            tcg_debug_assert(ts->val_type != TEMP_VAL_REG
+                             || ts->mem_coherent);
+        } else {
+            tcg_debug_assert(ts->val_type == TEMP_VAL_DEAD);
+        }
+    }
+}
+
 static void tcg_reg_alloc_do_movi(TCGContext *s, TCGTemp *ots,
                                   tcg_target_ulong val, TCGLifeData arg_life)
 {
@@ -3118,7 +3191,9 @@ static void tcg_reg_alloc_op(TCGContext *s, const TCGOp *op)
         }
     }
 
-    if (def->flags & TCG_OPF_BB_END) {
+    if (def->flags & TCG_OPF_COND_BRANCH) {
+        tcg_reg_alloc_cbranch(s, i_allocated_regs);
+    } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, i_allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -3379,6 +3454,8 @@ void tcg_profile_snapshot(TCGProfile *prof, bool counters, bool table)
             PROF_ADD(prof, orig, opt_time);
             PROF_ADD(prof, orig, restore_count);
             PROF_ADD(prof, orig, restore_time);
+            PROF_ADD(prof, orig, spill_count);
+            PROF_ADD(prof, orig, fill_count);
         }
         if (table) {
             int i;
@@ -3486,6 +3563,9 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
     atomic_set(&prof->opt_time, prof->opt_time - profile_getclock());
 #endif
 
+    s->nb_spills = 0;
+    s->nb_fills = 0;
+
 #ifdef USE_TCG_OPTIMIZATIONS
     tcg_optimize(s);
 #endif
@@ -3624,6 +3704,21 @@ int tcg_gen_code(TCGContext *s, TranslationBlock *tb)
     }
 #endif
 
+#ifdef CONFIG_PROFILER
+    atomic_set(&prof->spill_count, prof->spill_count + s->nb_spills);
+    atomic_set(&prof->fill_count, prof->fill_count + s->nb_fills);
+#endif
+
+#ifdef DEBUG_DISAS
+    if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP_OPT)
+                 && qemu_log_in_addr_range(tb->pc))) {
+        qemu_log_lock();
+        qemu_log("OP register allocation: %d spills, %d fills\n\n",
+                 s->nb_spills, s->nb_fills);
+        qemu_log_unlock();
+    }
+#endif
+
     /* flush instruction cache */
     flush_icache_range((uintptr_t)s->code_buf, (uintptr_t)s->code_ptr);
 
@@ -3657,6 +3752,10 @@ void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
                 (double)s->del_op_count / tb_div_count);
     cpu_fprintf(f, "avg temps/TB        %0.2f max=%d\n",
                 (double)s->temp_count / tb_div_count, s->temp_count_max);
+    cpu_fprintf(f, "avg spills/TB       %0.2f\n",
+                (double)s->spill_count / tb_div_count);
+    cpu_fprintf(f, "avg fills/TB        %0.2f\n",
+                (double)s->fill_count / tb_div_count);
     cpu_fprintf(f, "avg host code/TB    %0.1f\n",
                 (double)s->code_out_len / tb_div_count);
     cpu_fprintf(f, "avg search data/TB  %0.1f\n",
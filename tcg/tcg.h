@@ -183,6 +183,8 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_HAS_shs_vec          0
 #define TCG_TARGET_HAS_shv_vec          0
 #define TCG_TARGET_HAS_mul_vec          0
+#define TCG_TARGET_HAS_sat_vec          0
+#define TCG_TARGET_HAS_minmax_vec       0
 #else
 #define TCG_TARGET_MAYBE_vec            1
 #endif
@@ -647,6 +649,8 @@ typedef struct TCGProfile {
     int64_t opt_time;
     int64_t restore_count;
     int64_t restore_time;
+    int64_t spill_count;
+    int64_t fill_count;
     int64_t table_op_count[NB_OPS];
 } TCGProfile;
 
@@ -659,6 +663,10 @@ struct TCGContext {
     int nb_indirects;
     int nb_ops;
 
+    /* Register allocator traffic to and from memory in the current TB */
+    int nb_spills;
+    int nb_fills;
+
     /* goto_tb support */
     tcg_insn_unit *code_buf;
     uint16_t *tb_jmp_reset_offset; /* tb->jmp_reset_offset */
@@ -1040,6 +1048,9 @@ enum {
     TCG_OPF_NOT_PRESENT  = 0x10,
     /* Instruction operands are vectors.  */
     TCG_OPF_VECTOR       = 0x20,
+    /* Instruction is a conditional branch: globals only need to be synced
+       to memory, and stay valid in registers on the fall-through path.  */
+    TCG_OPF_COND_BRANCH  = 0x40,
 };
 
 typedef struct TCGOpDef {
@@ -0,0 +1,344 @@
+/*
+ * fp-bench.c - measure the performance of common softfloat operations
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#ifndef HW_POISON_H
+#error Must define HW_POISON_H to work around TARGET_* poisoning
+#endif
+
+#include "qemu/osdep.h"
+#include <math.h>
+#include "qemu/timer.h"
+#include "fpu/softfloat.h"
+
+enum op {
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_FMA,
+    OP_SQRT,
+};
+
+static const char * const op_names[] = {
+    [OP_ADD] = "add",
+    [OP_SUB] = "sub",
+    [OP_MUL] = "mul",
+    [OP_DIV] = "div",
+    [OP_FMA] = "fma",
+    [OP_SQRT] = "sqrt",
+};
+
+enum tester {
+    TESTER_SOFT,
+    TESTER_HOST,
+};
+
+static const char * const tester_names[] = {
+    [TESTER_SOFT] = "soft",
+    [TESTER_HOST] = "host",
+};
+
+static const struct {
+    const char *name;
+    int mode;
+} round_modes[] = {
+    { "even", float_round_nearest_even },
+    { "zero", float_round_to_zero },
+    { "down", float_round_down },
+    { "up", float_round_up },
+};
+
+/* Operands are generated once and then cycled through */
+#define N_OPERANDS 4096
+#define OPS_PER_CLOCK_CHECK 4096
+
+static enum op op = OP_ADD;
+static enum tester tester = TESTER_SOFT;
+static bool precision_double;
+static int rounding_mode = float_round_nearest_even;
+static bool clear_inexact;
+static unsigned int duration = 1;
+
+static float32 f32_operands[3][N_OPERANDS];
+static float64 f64_operands[3][N_OPERANDS];
+
+static const char commands_string[] =
+    " -o = floating point operation (add, sub, mul, div, fma, sqrt).\n"
+    "      Default: add\n"
+    " -p = precision (single, double). Default: single\n"
+    " -r = rounding mode (even, zero, down, up). Default: even\n"
+    " -t = tester (soft, host). Default: soft\n"
+    " -i = clear the inexact flag before every operation\n"
+    " -d = duration in seconds. Default: 1";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/*
+ * From: https://en.wikipedia.org/wiki/Xorshift
+ * This is faster than rand_r(), and gives us a wider range (RAND_MAX is only
+ * guaranteed to be >= INT_MAX).
+ */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+/*
+ * Positive normal numbers with exponents close to zero, so that neither
+ * the operations nor the square roots leave the normal range.
+ */
+static void init_operands(void)
+{
+    uint64_t r = 0xdeadbeefULL;
+    int i, j;
+
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < N_OPERANDS; j++) {
+            uint64_t exp;
+
+            r = xorshift64star(r);
+            exp = r % 32;
+            f32_operands[i][j] = make_float32(((127 - 16 + exp) << 23) |
+                                              (r >> 41));
+            f64_operands[i][j] = make_float64(((1023 - 16 + exp) << 52) |
+                                              (r >> 12));
+        }
+    }
+}
+
+static float32 bench_f32(float_status *s, int i)
+{
+    float32 a = f32_operands[0][i];
+    float32 b = f32_operands[1][i];
+    float32 c = f32_operands[2][i];
+
+    if (clear_inexact) {
+        s->float_exception_flags &= ~float_flag_inexact;
+    }
+    if (tester == TESTER_HOST) {
+        union {
+            float32 s;
+            float h;
+        } ua = { .s = a }, ub = { .s = b }, uc = { .s = c }, ur;
+
+        switch (op) {
+        case OP_ADD:
+            ur.h = ua.h + ub.h;
+            break;
+        case OP_SUB:
+            ur.h = ua.h - ub.h;
+            break;
+        case OP_MUL:
+            ur.h = ua.h * ub.h;
+            break;
+        case OP_DIV:
+            ur.h = ua.h / ub.h;
+            break;
+        case OP_FMA:
+            ur.h = fmaf(ua.h, ub.h, uc.h);
+            break;
+        case OP_SQRT:
+            ur.h = sqrtf(ua.h);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        return ur.s;
+    }
+
+    switch (op) {
+    case OP_ADD:
+        return float32_add(a, b, s);
+    case OP_SUB:
+        return float32_sub(a, b, s);
+    case OP_MUL:
+        return float32_mul(a, b, s);
+    case OP_DIV:
+        return float32_div(a, b, s);
+    case OP_FMA:
+        return float32_muladd(a, b, c, 0, s);
+    case OP_SQRT:
+        return float32_sqrt(a, s);
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static float64 bench_f64(float_status *s, int i)
+{
+    float64 a = f64_operands[0][i];
+    float64 b = f64_operands[1][i];
+    float64 c = f64_operands[2][i];
+
+    if (clear_inexact) {
+        s->float_exception_flags &= ~float_flag_inexact;
+    }
+    if (tester == TESTER_HOST) {
+        union {
+            float64 s;
+            double h;
+        } ua = { .s = a }, ub = { .s = b }, uc = { .s = c }, ur;
+
+        switch (op) {
+        case OP_ADD:
+            ur.h = ua.h + ub.h;
+            break;
+        case OP_SUB:
+            ur.h = ua.h - ub.h;
+            break;
+        case OP_MUL:
+            ur.h = ua.h * ub.h;
+            break;
+        case OP_DIV:
+            ur.h = ua.h / ub.h;
+            break;
+        case OP_FMA:
+            ur.h = fma(ua.h, ub.h, uc.h);
+            break;
+        case OP_SQRT:
+            ur.h = sqrt(ua.h);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+        return ur.s;
+    }
+
+    switch (op) {
+    case OP_ADD:
+        return float64_add(a, b, s);
+    case OP_SUB:
+        return float64_sub(a, b, s);
+    case OP_MUL:
+        return float64_mul(a, b, s);
+    case OP_DIV:
+        return float64_div(a, b, s);
+    case OP_FMA:
+        return float64_muladd(a, b, c, 0, s);
+    case OP_SQRT:
+        return float64_sqrt(a, s);
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void run_bench(void)
+{
+    float_status status = {
+        .float_rounding_mode = rounding_mode,
+        /* Flags are sticky; most guests almost never clear inexact */
+        .float_exception_flags = float_flag_inexact,
+    };
+    int64_t start, end, elapsed = 0;
+    unsigned long long n_ops = 0;
+    uint64_t sink = 0;
+    int i = 0, j;
+
+    start = get_clock();
+    end = start + duration * NANOSECONDS_PER_SECOND;
+    do {
+        for (j = 0; j < OPS_PER_CLOCK_CHECK; j++) {
+            if (precision_double) {
+                sink += float64_val(bench_f64(&status, i));
+            } else {
+                sink += float32_val(bench_f32(&status, i));
+            }
+            i = (i + 1) % N_OPERANDS;
+        }
+        n_ops += OPS_PER_CLOCK_CHECK;
+        elapsed = get_clock() - start;
+    } while (start + elapsed < end);
+
+    printf("%s-%s-%s: %.2f MFlops (checksum %" PRIx64 ")\n",
+           tester_names[tester], precision_double ? "double" : "single",
+           op_names[op], n_ops * 1e3 / elapsed, sink);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+    int i;
+
+    for (;;) {
+        c = getopt(argc, argv, "hd:io:p:r:t:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'd':
+            duration = MAX(atoi(optarg), 1);
+            break;
+        case 'i':
+            clear_inexact = true;
+            break;
+        case 'o':
+            for (i = 0; i < ARRAY_SIZE(op_names); i++) {
+                if (!strcmp(optarg, op_names[i])) {
+                    op = i;
+                    break;
+                }
+            }
+            if (i == ARRAY_SIZE(op_names)) {
+                fprintf(stderr, "Unknown op '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'p':
+            if (!strcmp(optarg, "single")) {
+                precision_double = false;
+            } else if (!strcmp(optarg, "double")) {
+                precision_double = true;
+            } else {
+                fprintf(stderr, "Unknown precision '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'r':
+            for (i = 0; i < ARRAY_SIZE(round_modes); i++) {
+                if (!strcmp(optarg, round_modes[i].name)) {
+                    rounding_mode = round_modes[i].mode;
+                    break;
+                }
+            }
+            if (i == ARRAY_SIZE(round_modes)) {
+                fprintf(stderr, "Unknown rounding mode '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 't':
+            if (!strcmp(optarg, "soft")) {
+                tester = TESTER_SOFT;
+            } else if (!strcmp(optarg, "host")) {
+                tester = TESTER_HOST;
+            } else {
+                fprintf(stderr, "Unknown tester '%s'\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            usage_complete(argv);
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    init_operands();
+    run_bench();
+    return 0;
+}
@@ -17,6 +17,7 @@
 #include "qapi/qmp/qjson.h"
 #include "qemu/option.h"
 #include "qemu/range.h"
+#include "qemu/cutils.h"
 #include "qemu/sockets.h"
 #include "chardev/char.h"
 #include "sysemu/sysemu.h"
@@ -781,6 +782,74 @@ static void test_precopy_unix(void)
     g_free(uri);
 }
 
+/* Number of guest pages above the test area that the destination fills */
+#define MULTIFD_DIRTY_PAGES 16
+
+static void test_multifd_unix(void)
+{
+    char *uri = g_strdup_printf("unix:%s/migsocket", tmpfs);
+    uint8_t buf[TEST_MEM_PAGE_SIZE];
+    QTestState *from, *to;
+    QDict *rsp_return, *rsp_ram;
+    unsigned address;
+    int i;
+
+    if (test_migrate_start(&from, &to, uri, false)) {
+        return;
+    }
+
+    migrate_set_parameter(from, "downtime-limit", 1);
+    migrate_set_parameter(from, "max-bandwidth", 1000000000);
+    migrate_set_parameter(from, "x-multifd-channels", 2);
+    migrate_set_parameter(to, "x-multifd-channels", 2);
+    migrate_set_capability(from, "x-multifd", true);
+    migrate_set_capability(to, "x-multifd", true);
+
+    /* The guest never writes above end_address, so these pages are zero on
+     * the source and are only sent as offsets; the destination has to clear
+     * its stale contents.
+     */
+    memset(buf, 0x5a, sizeof(buf));
+    for (i = 0; i < MULTIFD_DIRTY_PAGES; i++) {
+        qtest_memwrite(to, end_address + i * TEST_MEM_PAGE_SIZE,
+                       buf, sizeof(buf));
+    }
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate(from, uri, "{}");
+
+    wait_for_migration_pass(from);
+
+    migrate_set_parameter(from, "downtime-limit", 300);
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+    wait_for_migration_complete(from);
+
+    /* Most of the guest's memory is zero and was detected as such */
+    rsp_return = migrate_query(from);
+    rsp_ram = qdict_get_qdict(rsp_return, "ram");
+    g_assert_cmpint(qdict_get_int(rsp_ram, "duplicate"), >, 0);
+    qobject_unref(rsp_return);
+
+    for (address = end_address;
+         address < end_address + MULTIFD_DIRTY_PAGES * TEST_MEM_PAGE_SIZE;
+         address += TEST_MEM_PAGE_SIZE) {
+        qtest_memread(to, address, buf, sizeof(buf));
+        g_assert(buffer_is_zero(buf, sizeof(buf)));
+    }
+
+    test_migrate_end(from, to, true);
+    g_free(uri);
+}
+
 int main(int argc, char **argv)
 {
     char template[] = "/tmp/migration-test-XXXXXX";
@@ -832,6 +901,7 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/deprecated", test_deprecated);
     qtest_add_func("/migration/bad_dest", test_baddest);
     qtest_add_func("/migration/precopy/unix", test_precopy_unix);
+    qtest_add_func("/migration/multifd/unix", test_multifd_unix);
 
     ret = g_test_run();
 
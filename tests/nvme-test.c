@@ -9,8 +9,42 @@
 
 #include "qemu/osdep.h"
 #include "qemu/units.h"
+#include "qemu/bswap.h"
 #include "libqtest.h"
 #include "libqos/libqos-pc.h"
+#include "block/nvme.h"
+
+#define NVME_QUEUE_SIZE     8
+#define NVME_TIMEOUT_US     (5 * G_USEC_PER_SEC)
+
+/* Register offsets in BAR0 */
+#define NVME_REG_CC         0x14
+#define NVME_REG_CSTS       0x1c
+#define NVME_REG_AQA        0x24
+#define NVME_REG_ASQ        0x28
+#define NVME_REG_ACQ        0x30
+#define NVME_REG_SQTDBL(q)  (0x1000 + (q) * 8)
+#define NVME_REG_CQHDBL(q)  (0x1000 + (q) * 8 + 4)
+
+typedef struct QNvmeQueue {
+    uint16_t qid;
+    uint64_t sq_addr;
+    uint64_t cq_addr;
+    uint16_t sq_tail;
+    uint16_t cq_head;
+    bool phase;
+} QNvmeQueue;
+
+typedef struct QNvme {
+    QOSState *qs;
+    QPCIDevice *dev;
+    QPCIBar bar;
+    QNvmeQueue admin;
+    QNvmeQueue io;
+    uint64_t dbs;
+    uint64_t eis;
+    uint16_t cid;
+} QNvme;
 
 static QOSState *qnvme_start(const char *extra_opts)
 {
@@ -70,11 +104,211 @@ static void nvmetest_cmb_test(void)
     qnvme_stop(qs);
 }
 
+static void qnvme_queue_init(QNvme *n, QNvmeQueue *q, uint16_t qid)
+{
+    q->qid = qid;
+    q->sq_addr = guest_alloc(n->qs->alloc, NVME_QUEUE_SIZE * sizeof(NvmeCmd));
+    q->cq_addr = guest_alloc(n->qs->alloc, NVME_QUEUE_SIZE * sizeof(NvmeCqe));
+    qmemset(q->sq_addr, 0, NVME_QUEUE_SIZE * sizeof(NvmeCmd));
+    qmemset(q->cq_addr, 0, NVME_QUEUE_SIZE * sizeof(NvmeCqe));
+    q->sq_tail = 0;
+    q->cq_head = 0;
+    q->phase = true;
+}
+
+/*
+ * Queue @cmd on @q and ring its doorbell.  Once shadow doorbells are set
+ * up, the new tail goes to the shadow buffer only and the MMIO doorbell
+ * is written with a stale value, so that the test fails unless the
+ * controller picks the tail up from the shadow buffer.
+ */
+static void qnvme_submit(QNvme *n, QNvmeQueue *q, NvmeCmd *cmd)
+{
+    cmd->cid = cpu_to_le16(n->cid++);
+    memwrite(q->sq_addr + q->sq_tail * sizeof(NvmeCmd), cmd, sizeof(*cmd));
+    q->sq_tail = (q->sq_tail + 1) % NVME_QUEUE_SIZE;
+
+    if (q->qid && n->dbs) {
+        writel(n->dbs + q->qid * 8, q->sq_tail);
+        qpci_io_writel(n->dev, n->bar, NVME_REG_SQTDBL(q->qid), 0);
+    } else {
+        qpci_io_writel(n->dev, n->bar, NVME_REG_SQTDBL(q->qid), q->sq_tail);
+    }
+}
+
+/* Wait for the next completion on @q and return its status field */
+static uint16_t qnvme_complete(QNvme *n, QNvmeQueue *q)
+{
+    gint64 end_time = g_get_monotonic_time() + NVME_TIMEOUT_US;
+    NvmeCqe cqe;
+
+    for (;;) {
+        memread(q->cq_addr + q->cq_head * sizeof(NvmeCqe), &cqe, sizeof(cqe));
+        if ((le16_to_cpu(cqe.status) & 1) == q->phase) {
+            break;
+        }
+        g_assert(g_get_monotonic_time() < end_time);
+        clock_step(100);
+    }
+    g_assert_cmpint(le16_to_cpu(cqe.cid), ==, (uint16_t)(n->cid - 1));
+
+    q->cq_head = (q->cq_head + 1) % NVME_QUEUE_SIZE;
+    if (!q->cq_head) {
+        q->phase = !q->phase;
+    }
+    if (q->qid && n->dbs) {
+        writel(n->dbs + q->qid * 8 + 4, q->cq_head);
+        qpci_io_writel(n->dev, n->bar, NVME_REG_CQHDBL(q->qid), 0);
+    } else {
+        qpci_io_writel(n->dev, n->bar, NVME_REG_CQHDBL(q->qid), q->cq_head);
+    }
+    return le16_to_cpu(cqe.status) >> 1;
+}
+
+static uint16_t qnvme_cmd(QNvme *n, QNvmeQueue *q, NvmeCmd *cmd)
+{
+    qnvme_submit(n, q, cmd);
+    return qnvme_complete(n, q);
+}
+
+static void qnvme_enable(QNvme *n, const char *extra_opts)
+{
+    gint64 end_time;
+
+    n->qs = qnvme_start(extra_opts);
+    n->dev = qpci_device_find(n->qs->pcibus, QPCI_DEVFN(4, 0));
+    g_assert(n->dev != NULL);
+    qpci_device_enable(n->dev);
+    n->bar = qpci_iomap(n->dev, 0, NULL);
+
+    qnvme_queue_init(n, &n->admin, 0);
+    qpci_io_writel(n->dev, n->bar, NVME_REG_AQA,
+                   (NVME_QUEUE_SIZE - 1) << 16 | (NVME_QUEUE_SIZE - 1));
+    qpci_io_writeq(n->dev, n->bar, NVME_REG_ASQ, n->admin.sq_addr);
+    qpci_io_writeq(n->dev, n->bar, NVME_REG_ACQ, n->admin.cq_addr);
+    qpci_io_writel(n->dev, n->bar, NVME_REG_CC,
+                   1 << CC_EN_SHIFT | 6 << CC_IOSQES_SHIFT |
+                   4 << CC_IOCQES_SHIFT);
+
+    end_time = g_get_monotonic_time() + NVME_TIMEOUT_US;
+    while (!NVME_CSTS_RDY(qpci_io_readl(n->dev, n->bar, NVME_REG_CSTS))) {
+        g_assert(g_get_monotonic_time() < end_time);
+        clock_step(100);
+    }
+}
+
+static void qnvme_disable(QNvme *n)
+{
+    g_free(n->dev);
+    qnvme_stop(n->qs);
+}
+
+static void qnvme_dbbuf_config(QNvme *n)
+{
+    NvmeCmd cmd = { .opcode = NVME_ADM_CMD_DBBUF_CONFIG };
+
+    n->dbs = guest_alloc(n->qs->alloc, 4096);
+    n->eis = guest_alloc(n->qs->alloc, 4096);
+    qmemset(n->dbs, 0, 4096);
+    qmemset(n->eis, 0, 4096);
+
+    cmd.prp1 = cpu_to_le64(n->dbs);
+    cmd.prp2 = cpu_to_le64(n->eis);
+    g_assert_cmpint(qnvme_cmd(n, &n->admin, &cmd), ==, NVME_SUCCESS);
+}
+
+static void qnvme_create_io_queue(QNvme *n)
+{
+    NvmeCmd cmd;
+
+    qnvme_queue_init(n, &n->io, 1);
+
+    cmd = (NvmeCmd) {
+        .opcode = NVME_ADM_CMD_CREATE_CQ,
+        .prp1 = cpu_to_le64(n->io.cq_addr),
+        .cdw10 = cpu_to_le32((NVME_QUEUE_SIZE - 1) << 16 | n->io.qid),
+        .cdw11 = cpu_to_le32(NVME_Q_PC),
+    };
+    g_assert_cmpint(qnvme_cmd(n, &n->admin, &cmd), ==, NVME_SUCCESS);
+
+    cmd = (NvmeCmd) {
+        .opcode = NVME_ADM_CMD_CREATE_SQ,
+        .prp1 = cpu_to_le64(n->io.sq_addr),
+        .cdw10 = cpu_to_le32((NVME_QUEUE_SIZE - 1) << 16 | n->io.qid),
+        .cdw11 = cpu_to_le32(n->io.qid << 16 | NVME_Q_PC),
+    };
+    g_assert_cmpint(qnvme_cmd(n, &n->admin, &cmd), ==, NVME_SUCCESS);
+}
+
+/*
+ * Run I/O through shadow doorbells for more than one lap of the queue and,
+ * unless the controller may be polling the shadow doorbell, check that it
+ * publishes its progress in the event index buffer.
+ */
+static void nvmetest_dbbuf(const char *extra_opts, bool polling)
+{
+    QNvme n = { 0 };
+    uint64_t buf;
+    int i;
+
+    qnvme_enable(&n, extra_opts);
+    qnvme_dbbuf_config(&n);
+    qnvme_create_io_queue(&n);
+
+    g_assert_cmpint(readl(n.dbs + 8), ==, 0);
+    g_assert_cmpint(readl(n.eis + 8), ==, 0);
+
+    buf = guest_alloc(n.qs->alloc, 4096);
+    for (i = 0; i < 2 * NVME_QUEUE_SIZE; i++) {
+        NvmeCmd cmd = {
+            .opcode = i & 1 ? NVME_CMD_READ : NVME_CMD_WRITE,
+            .nsid = cpu_to_le32(1),
+            .prp1 = cpu_to_le64(buf),
+            .cdw10 = cpu_to_le32(i),
+        };
+
+        g_assert_cmpint(qnvme_cmd(&n, &n.io, &cmd), ==, NVME_SUCCESS);
+        if (!polling) {
+            g_assert_cmpint(readl(n.eis + 8), ==, n.io.sq_tail);
+        }
+    }
+
+    qnvme_disable(&n);
+}
+
+static void nvmetest_dbbuf_mmio(void)
+{
+    nvmetest_dbbuf(NULL, false);
+}
+
+static void nvmetest_dbbuf_ioeventfd(void)
+{
+    nvmetest_dbbuf("-global nvme.ioeventfd=on", false);
+}
+
+static void nvmetest_dbbuf_iothread(void)
+{
+    nvmetest_dbbuf("-object iothread,id=iothread0,poll-max-ns=0 "
+                   "-global nvme.ioeventfd=on "
+                   "-global nvme.iothread=iothread0", false);
+}
+
+static void nvmetest_dbbuf_iothread_poll(void)
+{
+    nvmetest_dbbuf("-object iothread,id=iothread0 "
+                   "-global nvme.ioeventfd=on "
+                   "-global nvme.iothread=iothread0", true);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
     qtest_add_func("/nvme/nop", nop);
     qtest_add_func("/nvme/cmb_test", nvmetest_cmb_test);
+    qtest_add_func("/nvme/dbbuf/mmio", nvmetest_dbbuf_mmio);
+    qtest_add_func("/nvme/dbbuf/ioeventfd", nvmetest_dbbuf_ioeventfd);
+    qtest_add_func("/nvme/dbbuf/iothread", nvmetest_dbbuf_iothread);
+    qtest_add_func("/nvme/dbbuf/iothread-poll", nvmetest_dbbuf_iothread_poll);
 
     return g_test_run();
 }
@@ -28,9 +28,12 @@ static void ptimer_test_expire_qemu_timers(int64_t expire_time,
                                            QEMUClockType type)
 {
     QEMUTimerList *timer_list = main_loop_tlg.tl[type];
-    QEMUTimer *t = timer_list->active_timers.next;
+    GList *l = timer_list->active_timers;
 
-    while (t != NULL) {
+    while (l != NULL) {
+        QEMUTimer *t = l->data;
+
+        l = l->next;
         if (t->expire_time == expire_time) {
             timer_del(t);
 
@@ -38,8 +41,6 @@ static void ptimer_test_expire_qemu_timers(int64_t expire_time,
                 t->cb(t->opaque);
             }
         }
-
-        t = t->next;
     }
 }
 
@@ -5,6 +5,8 @@ import sys
 import struct
 import string
 
+QCOW2_EXT_MAGIC_CACHE_HINTS = 0x7c2b4dd1
+
 class QcowHeaderExtension:
 
     def __init__(self, magic, length, data):
@@ -137,7 +139,14 @@ class QcowHeader:
         for ex in self.extensions:
 
             data = ex.data[:ex.length]
-            if all(c in string.printable.encode('ascii') for c in data):
+            if ex.magic == QCOW2_EXT_MAGIC_CACHE_HINTS and ex.length >= 8:
+                nb_l2, nb_refblock = struct.unpack('>II', data[:8])
+                nb_hints = (ex.length - 8) // 8
+                hints = struct.unpack('>%dQ' % nb_hints,
+                                      data[8:8 + nb_hints * 8])
+                data = "l2 %s refblock %s" % (list(hints[:nb_l2]),
+                                              list(hints[nb_l2:]))
+            elif all(c in string.printable.encode('ascii') for c in data):
                 data = "'%s'" % data.decode('ascii')
             else:
                 data = "<binary>"
@@ -75,6 +75,18 @@ int nthreadsrunning;
 
 static volatile int goflag = GOFLAG_INIT;
 
+/* Use synchronize_rcu_expedited() in the updaters */
+static bool expedited;
+
+static void updater_synchronize_rcu(void)
+{
+    if (expedited) {
+        synchronize_rcu_expedited();
+    } else {
+        synchronize_rcu();
+    }
+}
+
 #define RCU_READ_RUN 1000
 
 #define NR_THREADS 100
@@ -147,7 +159,7 @@ static void *rcu_update_perf_test(void *arg)
         g_usleep(1000);
     }
     while (goflag == GOFLAG_RUN) {
-        synchronize_rcu();
+        updater_synchronize_rcu();
         n_updates_local++;
     }
     qemu_mutex_lock(&counts_mutex);
@@ -308,7 +320,7 @@ static void *rcu_update_stress_test(void *arg)
                 rcu_stress_array[i].pipe_count++;
             }
         }
-        synchronize_rcu();
+        updater_synchronize_rcu();
         n_updates++;
     }
 
@@ -407,6 +419,18 @@ static void gtest_stress_10_5(void)
     gtest_stress(10, 5);
 }
 
+static void gtest_stress_10_1_expedited(void)
+{
+    expedited = true;
+    gtest_stress(10, 1);
+}
+
+static void gtest_stress_10_5_expedited(void)
+{
+    expedited = true;
+    gtest_stress(10, 5);
+}
+
 /*
  * Mainprogram.
  */
@@ -414,6 +438,7 @@ static void gtest_stress_10_5(void)
 static void usage(int argc, char *argv[])
 {
     fprintf(stderr, "Usage: %s [nreaders [ perf | stress ] ]\n", argv[0]);
+    fprintf(stderr, "Append -expedited to use expedited grace periods\n");
     exit(-1);
 }
 
@@ -428,9 +453,13 @@ int main(int argc, char *argv[])
         if (g_test_quick()) {
             g_test_add_func("/rcu/torture/1reader", gtest_stress_1_1);
             g_test_add_func("/rcu/torture/10readers", gtest_stress_10_1);
+            g_test_add_func("/rcu/torture/10readers-expedited",
+                            gtest_stress_10_1_expedited);
         } else {
             g_test_add_func("/rcu/torture/1reader", gtest_stress_1_5);
             g_test_add_func("/rcu/torture/10readers", gtest_stress_10_5);
+            g_test_add_func("/rcu/torture/10readers-expedited",
+                            gtest_stress_10_5_expedited);
         }
         return g_test_run();
     }
@@ -441,6 +470,10 @@ int main(int argc, char *argv[])
     if (argc > 3) {
         duration = strtoul(argv[3], NULL, 0);
     }
+    if (argc >= 3 && g_str_has_suffix(argv[2], "-expedited")) {
+        expedited = true;
+        argv[2][strlen(argv[2]) - strlen("-expedited")] = '\0';
+    }
     if (argc < 3 || strcmp(argv[2], "stress") == 0) {
         stresstest(nreaders, duration);
     } else if (strcmp(argv[2], "rperf") == 0) {
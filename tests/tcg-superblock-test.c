@@ -0,0 +1,122 @@
+/*
+ * QTest testcase for TCG superblock formation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * A mini BIOS runs a loop whose body is split by a direct forward jump
+ * over a dead instruction.  A normal TB ends at the jump, while a
+ * superblock continues at its target.  The test checks that the loop
+ * computes the same result with and without superblocks, and that the
+ * hot TB was retranslated as a superblock that followed the jump.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "libqtest.h"
+
+#define BIOS_SIZE       (64 * KiB)
+#define LOOP_COUNT      10000
+
+/* Guest addresses written by the loop */
+#define ADDR_ITER       0x1000
+#define ADDR_SUM        0x1002
+#define ADDR_DONE       0x1004
+#define ADDR_DEAD       0x1006
+
+/* Loaded at 0xf0000, i.e. f000:0000 */
+static const uint8_t bios_code[] = {
+    0x31, 0xc0,                         /* xor %ax,%ax */
+    0x8e, 0xd8,                         /* mov %ax,%ds */
+    0xb9, 0x10, 0x27,                   /* mov $10000,%cx */
+    0xff, 0x06, 0x00, 0x10,             /* 1: incw 0x1000 */
+    0xeb, 0x04,                         /* jmp 2f */
+    0xff, 0x06, 0x06, 0x10,             /* incw 0x1006 */
+    0x83, 0x06, 0x02, 0x10, 0x03,       /* 2: addw $3,0x1002 */
+    0x49,                               /* dec %cx */
+    0x75, 0xee,                         /* jnz 1b */
+    0xc7, 0x06, 0x04, 0x10, 0x01, 0x00, /* movw $1,0x1004 */
+    0xf4,                               /* 3: hlt */
+    0xeb, 0xfd,                         /* jmp 3b */
+};
+
+/* At 0xffff0, the reset vector */
+static const uint8_t bios_reset[] = {
+    0xea, 0x00, 0x00, 0x00, 0xf0,       /* ljmp $0xf000,$0 */
+};
+
+/* Parse the "@name  N" line of "info jit" */
+static size_t info_jit_stat(const char *name)
+{
+    char *info = hmp("info jit");
+    const char *p = strstr(info, name);
+    size_t count;
+
+    g_assert(p != NULL);
+    g_assert_cmpint(sscanf(p + strlen(name), "%zu", &count), ==, 1);
+    g_free(info);
+    return count;
+}
+
+static void run_loop(const char *accel_opts, bool expect_superblocks)
+{
+    char biostmp[] = "/tmp/qtest-tcg-superblock-XXXXXX";
+    uint8_t *bios;
+    gint64 end_time;
+    ssize_t wlen;
+    int fd;
+
+    bios = g_malloc0(BIOS_SIZE);
+    memcpy(bios, bios_code, sizeof(bios_code));
+    memcpy(bios + BIOS_SIZE - 16, bios_reset, sizeof(bios_reset));
+
+    fd = mkstemp(biostmp);
+    g_assert(fd != -1);
+    wlen = write(fd, bios, BIOS_SIZE);
+    g_assert(wlen == BIOS_SIZE);
+    close(fd);
+    g_free(bios);
+
+    global_qtest = qtest_initf("-nodefaults -bios %s -M pc -accel %s",
+                               biostmp, accel_opts);
+    unlink(biostmp);
+
+    end_time = g_get_monotonic_time() + 60 * G_USEC_PER_SEC;
+    while (!readw(ADDR_DONE)) {
+        g_assert(g_get_monotonic_time() < end_time);
+        g_usleep(1000);
+    }
+
+    g_assert_cmpint(readw(ADDR_ITER), ==, LOOP_COUNT);
+    g_assert_cmpint(readw(ADDR_SUM), ==, (uint16_t)(3 * LOOP_COUNT));
+    g_assert_cmpint(readw(ADDR_DEAD), ==, 0);
+    if (expect_superblocks) {
+        g_assert_cmpint(info_jit_stat("superblock count"), >, 0);
+        g_assert_cmpint(info_jit_stat("superblock jumps"), >, 0);
+    } else {
+        g_assert_cmpint(info_jit_stat("superblock count"), ==, 0);
+        g_assert_cmpint(info_jit_stat("superblock jumps"), ==, 0);
+    }
+
+    qtest_quit(global_qtest);
+}
+
+static void test_superblock_disabled(void)
+{
+    run_loop("tcg", false);
+}
+
+static void test_superblock_enabled(void)
+{
+    run_loop("tcg,superblock-threshold=16", true);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/tcg/superblock/disabled", test_superblock_disabled);
+    qtest_add_func("/tcg/superblock/enabled", test_superblock_enabled);
+
+    return g_test_run();
+}
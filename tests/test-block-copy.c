@@ -0,0 +1,391 @@
+/*
+ * block_copy tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/cutils.h"
+#include "block/block_int.h"
+#include "block/block-copy.h"
+#include "sysemu/block-backend.h"
+#include "qapi/error.h"
+
+#define TEST_SIZE           (4 * MiB)
+#define TEST_CLUSTER_SIZE   (64 * KiB)
+#define TEST_MAX_TRANSFER   (256 * KiB)
+
+/* An in-memory image that keeps track of the requests it sees */
+typedef struct BDRVTestState {
+    uint8_t *buf;
+    bool no_copy_range;
+    int64_t fail_read_offset;
+
+    int in_flight;
+    int max_in_flight;
+    int copy_range_calls;
+    int64_t max_copy_range_bytes;
+} BDRVTestState;
+
+static int bdrv_test_open(BlockDriverState *bs, QDict *options, int flags,
+                          Error **errp)
+{
+    BDRVTestState *s = bs->opaque;
+
+    s->buf = g_malloc0(TEST_SIZE);
+    s->fail_read_offset = -1;
+    return 0;
+}
+
+static void bdrv_test_close(BlockDriverState *bs)
+{
+    BDRVTestState *s = bs->opaque;
+
+    g_free(s->buf);
+}
+
+static int64_t bdrv_test_getlength(BlockDriverState *bs)
+{
+    return TEST_SIZE;
+}
+
+static void bdrv_test_refresh_limits(BlockDriverState *bs, Error **errp)
+{
+    bs->bl.max_transfer = TEST_MAX_TRANSFER;
+}
+
+static int coroutine_fn bdrv_test_co_preadv(BlockDriverState *bs,
+                                            uint64_t offset, uint64_t bytes,
+                                            QEMUIOVector *qiov, int flags)
+{
+    BDRVTestState *s = bs->opaque;
+
+    s->in_flight++;
+    s->max_in_flight = MAX(s->max_in_flight, s->in_flight);
+
+    /* Let the other workers start before this one completes */
+    aio_co_schedule(qemu_get_current_aio_context(), qemu_coroutine_self());
+    qemu_coroutine_yield();
+
+    s->in_flight--;
+    if (s->fail_read_offset >= 0 && s->fail_read_offset >= offset &&
+        s->fail_read_offset < offset + bytes) {
+        return -EIO;
+    }
+    qemu_iovec_from_buf(qiov, 0, s->buf + offset, bytes);
+    return 0;
+}
+
+static int coroutine_fn bdrv_test_co_pwritev(BlockDriverState *bs,
+                                             uint64_t offset, uint64_t bytes,
+                                             QEMUIOVector *qiov, int flags)
+{
+    BDRVTestState *s = bs->opaque;
+
+    qemu_iovec_to_buf(qiov, 0, s->buf + offset, bytes);
+    return 0;
+}
+
+static int coroutine_fn bdrv_test_co_pwrite_zeroes(BlockDriverState *bs,
+                                                   int64_t offset, int bytes,
+                                                   BdrvRequestFlags flags)
+{
+    BDRVTestState *s = bs->opaque;
+
+    memset(s->buf + offset, 0, bytes);
+    return 0;
+}
+
+static int coroutine_fn bdrv_test_co_copy_range_from(BlockDriverState *bs,
+                                                     BdrvChild *src,
+                                                     uint64_t src_offset,
+                                                     BdrvChild *dst,
+                                                     uint64_t dst_offset,
+                                                     uint64_t bytes,
+                                                     BdrvRequestFlags
+                                                     read_flags,
+                                                     BdrvRequestFlags
+                                                     write_flags)
+{
+    BDRVTestState *s = bs->opaque;
+
+    if (s->no_copy_range) {
+        return -ENOTSUP;
+    }
+    return bdrv_co_copy_range_to(src, src_offset, dst, dst_offset, bytes,
+                                 read_flags, write_flags);
+}
+
+static int coroutine_fn bdrv_test_co_copy_range_to(BlockDriverState *bs,
+                                                   BdrvChild *src,
+                                                   uint64_t src_offset,
+                                                   BdrvChild *dst,
+                                                   uint64_t dst_offset,
+                                                   uint64_t bytes,
+                                                   BdrvRequestFlags read_flags,
+                                                   BdrvRequestFlags
+                                                   write_flags)
+{
+    BDRVTestState *s = bs->opaque;
+    BDRVTestState *src_s = src->bs->opaque;
+
+    s->copy_range_calls++;
+    s->max_copy_range_bytes = MAX(s->max_copy_range_bytes, bytes);
+    memcpy(s->buf + dst_offset, src_s->buf + src_offset, bytes);
+    return 0;
+}
+
+static BlockDriver bdrv_test = {
+    .format_name                = "test",
+    .instance_size              = sizeof(BDRVTestState),
+
+    .bdrv_open                  = bdrv_test_open,
+    .bdrv_close                 = bdrv_test_close,
+    .bdrv_getlength             = bdrv_test_getlength,
+    .bdrv_refresh_limits        = bdrv_test_refresh_limits,
+    .bdrv_co_preadv             = bdrv_test_co_preadv,
+    .bdrv_co_pwritev            = bdrv_test_co_pwritev,
+    .bdrv_co_pwrite_zeroes      = bdrv_test_co_pwrite_zeroes,
+    .bdrv_co_copy_range_from    = bdrv_test_co_copy_range_from,
+    .bdrv_co_copy_range_to      = bdrv_test_co_copy_range_to,
+};
+
+typedef struct TestEnv {
+    BlockBackend *src_blk, *dst_blk;
+    BlockDriverState *src_bs, *dst_bs;
+    BDRVTestState *src, *dst;
+    BlockCopyState *bcs;
+} TestEnv;
+
+static void test_env_init(TestEnv *env, int max_workers, bool copy_range)
+{
+    int i;
+
+    env->src_blk = blk_new(BLK_PERM_ALL, BLK_PERM_ALL);
+    env->src_bs = bdrv_new_open_driver(&bdrv_test, "source", BDRV_O_RDWR,
+                                       &error_abort);
+    blk_insert_bs(env->src_blk, env->src_bs, &error_abort);
+    env->src = env->src_bs->opaque;
+    env->src->no_copy_range = !copy_range;
+
+    env->dst_blk = blk_new(BLK_PERM_ALL, BLK_PERM_ALL);
+    env->dst_bs = bdrv_new_open_driver(&bdrv_test, "target", BDRV_O_RDWR,
+                                       &error_abort);
+    blk_insert_bs(env->dst_blk, env->dst_bs, &error_abort);
+    env->dst = env->dst_bs->opaque;
+
+    for (i = 0; i < TEST_SIZE; i++) {
+        env->src->buf[i] = (i / 512) % 251 + 1;
+    }
+
+    env->bcs = block_copy_state_new(env->src_blk, env->dst_blk,
+                                    TEST_CLUSTER_SIZE, max_workers, 0,
+                                    &error_abort);
+}
+
+static void test_env_cleanup(TestEnv *env)
+{
+    block_copy_state_free(env->bcs);
+    blk_unref(env->src_blk);
+    blk_unref(env->dst_blk);
+    bdrv_unref(env->src_bs);
+    bdrv_unref(env->dst_bs);
+}
+
+typedef struct CopyData {
+    TestEnv *env;
+    int64_t offset;
+    int64_t bytes;
+    bool chunk;
+    bool is_write_notifier;
+    bool error_is_read;
+    int ret;
+    bool done;
+} CopyData;
+
+static void coroutine_fn copy_entry(void *opaque)
+{
+    CopyData *data = opaque;
+    BlockCopyState *bcs = data->env->bcs;
+
+    if (data->chunk) {
+        data->ret = block_copy_chunk(bcs, data->offset, data->bytes, NULL, 0,
+                                     &data->error_is_read);
+    } else {
+        data->ret = block_copy(bcs, data->offset, data->bytes,
+                               &data->error_is_read, data->is_write_notifier);
+    }
+    data->done = true;
+}
+
+static int run_copy_full(TestEnv *env, int64_t offset, int64_t bytes,
+                         bool chunk, bool is_write_notifier,
+                         bool *error_is_read)
+{
+    CopyData data = {
+        .env                = env,
+        .offset             = offset,
+        .bytes              = bytes,
+        .chunk              = chunk,
+        .is_write_notifier  = is_write_notifier,
+    };
+    Coroutine *co;
+
+    co = qemu_coroutine_create(copy_entry, &data);
+    qemu_coroutine_enter(co);
+    while (!data.done) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+
+    if (error_is_read) {
+        *error_is_read = data.error_is_read;
+    }
+    return data.ret;
+}
+
+static int run_copy(TestEnv *env, int64_t offset, int64_t bytes, bool chunk,
+                    bool *error_is_read)
+{
+    return run_copy_full(env, offset, bytes, chunk, false, error_is_read);
+}
+
+static void test_parallel(void)
+{
+    TestEnv env;
+    int ret;
+
+    test_env_init(&env, 4, false);
+    hbitmap_set(env.bcs->copy_bitmap, 0, TEST_SIZE / TEST_CLUSTER_SIZE);
+
+    ret = run_copy(&env, 0, TEST_SIZE, false, NULL);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert(!memcmp(env.src->buf, env.dst->buf, TEST_SIZE));
+    g_assert_cmpint(hbitmap_count(env.bcs->copy_bitmap), ==, 0);
+
+    /* All workers were busy at the same time, but never more of them */
+    g_assert_cmpint(env.src->max_in_flight, ==, 4);
+    g_assert_cmpint(env.dst->copy_range_calls, ==, 0);
+
+    test_env_cleanup(&env);
+}
+
+static void test_clean_clusters(void)
+{
+    TestEnv env;
+    int ret;
+
+    test_env_init(&env, 4, false);
+    hbitmap_set(env.bcs->copy_bitmap, 0, TEST_SIZE / TEST_CLUSTER_SIZE);
+    hbitmap_reset(env.bcs->copy_bitmap, 1, 1);
+
+    ret = run_copy(&env, 0, TEST_SIZE, false, NULL);
+    g_assert_cmpint(ret, ==, 0);
+
+    /* Clean clusters are not copied */
+    g_assert(!memcmp(env.src->buf, env.dst->buf, TEST_CLUSTER_SIZE));
+    g_assert(buffer_is_zero(env.dst->buf + TEST_CLUSTER_SIZE,
+                            TEST_CLUSTER_SIZE));
+    g_assert(!memcmp(env.src->buf + 2 * TEST_CLUSTER_SIZE,
+                     env.dst->buf + 2 * TEST_CLUSTER_SIZE,
+                     TEST_SIZE - 2 * TEST_CLUSTER_SIZE));
+
+    test_env_cleanup(&env);
+}
+
+static void test_read_error(void)
+{
+    TestEnv env;
+    bool error_is_read = false;
+    int64_t fail_cluster = TEST_SIZE / 2 / TEST_CLUSTER_SIZE;
+    int ret;
+
+    test_env_init(&env, 4, false);
+    hbitmap_set(env.bcs->copy_bitmap, 0, TEST_SIZE / TEST_CLUSTER_SIZE);
+    env.src->fail_read_offset = fail_cluster * TEST_CLUSTER_SIZE;
+
+    ret = run_copy(&env, 0, TEST_SIZE, false, &error_is_read);
+    g_assert_cmpint(ret, ==, -EIO);
+    g_assert(error_is_read);
+
+    /* The failed request is dirty again, and the rest may have been copied */
+    g_assert(hbitmap_get(env.bcs->copy_bitmap, fail_cluster));
+    g_assert_cmpint(env.src->in_flight, ==, 0);
+
+    /* Retrying copies what is left */
+    env.src->fail_read_offset = -1;
+    ret = run_copy(&env, 0, TEST_SIZE, false, NULL);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert(!memcmp(env.src->buf, env.dst->buf, TEST_SIZE));
+
+    test_env_cleanup(&env);
+}
+
+static void test_copy_range_split(void)
+{
+    TestEnv env;
+    int ret;
+
+    /* Without workers, there is no copy bitmap */
+    test_env_init(&env, 0, true);
+    g_assert(env.bcs->copy_bitmap == NULL);
+
+    ret = run_copy(&env, 0, 1 * MiB, true, NULL);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert(!memcmp(env.src->buf, env.dst->buf, 1 * MiB));
+    g_assert(buffer_is_zero(env.dst->buf + 1 * MiB, TEST_SIZE - 1 * MiB));
+
+    /* The chunk was split according to the transfer limits */
+    g_assert_cmpint(env.dst->copy_range_calls, ==, 1 * MiB / TEST_MAX_TRANSFER);
+    g_assert_cmpint(env.dst->max_copy_range_bytes, ==, TEST_MAX_TRANSFER);
+    g_assert_cmpint(env.src->max_in_flight, ==, 0);
+
+    test_env_cleanup(&env);
+}
+
+static void test_ratelimit(void)
+{
+    TestEnv env;
+    int64_t nr_clusters = TEST_SIZE / TEST_CLUSTER_SIZE;
+    int64_t dirty;
+    int ret;
+
+    test_env_init(&env, 4, false);
+    hbitmap_set(env.bcs->copy_bitmap, 0, nr_clusters);
+
+    /* A tenth of the speed is allowed per slice, i.e. a couple of clusters */
+    block_copy_set_speed(env.bcs, 1 * MiB);
+
+    /* Background copies stop once the quota is exhausted */
+    ret = run_copy(&env, 0, TEST_SIZE, false, NULL);
+    g_assert_cmpint(ret, ==, 0);
+    dirty = hbitmap_count(env.bcs->copy_bitmap);
+    g_assert_cmpint(dirty, >, 0);
+    g_assert_cmpint(dirty, <, nr_clusters);
+    g_assert_cmpint(block_copy_ratelimit_get_delay(env.bcs), >, 0);
+
+    /* Copy-before-write is never delayed */
+    ret = run_copy_full(&env, 0, TEST_SIZE, false, true, NULL);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert_cmpint(hbitmap_count(env.bcs->copy_bitmap), ==, 0);
+    g_assert(!memcmp(env.src->buf, env.dst->buf, TEST_SIZE));
+
+    test_env_cleanup(&env);
+}
+
+int main(int argc, char **argv)
+{
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/block-copy/parallel", test_parallel);
+    g_test_add_func("/block-copy/clean-clusters", test_clean_clusters);
+    g_test_add_func("/block-copy/read-error", test_read_error);
+    g_test_add_func("/block-copy/copy-range-split", test_copy_range_split);
+    g_test_add_func("/block-copy/ratelimit", test_ratelimit);
+
+    return g_test_run();
+}
@@ -0,0 +1,134 @@
+/*
+ * Block accounting latency percentile tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "block/accounting.h"
+
+static const unsigned per_mille[] = { 500, 990, 999 };
+
+static void test_empty(void)
+{
+    BlockLatencyHdr hdr = {};
+    uint64_t values[3] = { 42, 42, 42 };
+
+    g_assert_cmpint(block_latency_hdr_percentiles(&hdr, 3, per_mille, values),
+                    ==, 0);
+    g_assert_cmpint(values[0], ==, 42);
+}
+
+/* Small values are exact */
+static void test_exact(void)
+{
+    BlockLatencyHdr hdr = {};
+    uint64_t values[3];
+    int i;
+
+    for (i = 1; i <= 1000; i++) {
+        block_latency_hdr_account(&hdr, i <= 990 ? 7 : i < 1000 ? 20 : 31);
+    }
+    g_assert_cmpint(block_latency_hdr_percentiles(&hdr, 3, per_mille, values),
+                    ==, 1000);
+    g_assert_cmpint(values[0], ==, 7);
+    g_assert_cmpint(values[1], ==, 7);
+    g_assert_cmpint(values[2], ==, 20);
+}
+
+/* Larger values are reported as the top of their bucket */
+static void test_precision(void)
+{
+    uint64_t v;
+
+    for (v = 1; v < (1ULL << 40); v = v * 3 + 1) {
+        BlockLatencyHdr hdr = {};
+        uint64_t value;
+
+        block_latency_hdr_account(&hdr, v);
+        block_latency_hdr_percentiles(&hdr, 1, per_mille, &value);
+        g_assert_cmpint(value, >=, v);
+        g_assert_cmpint(value - v, <=, v / 16);
+    }
+}
+
+static void test_huge(void)
+{
+    BlockLatencyHdr hdr = {};
+    uint64_t values[3];
+
+    block_latency_hdr_account(&hdr, UINT64_MAX);
+    block_latency_hdr_account(&hdr, 1ULL << 45);
+    g_assert_cmpint(block_latency_hdr_percentiles(&hdr, 3, per_mille, values),
+                    ==, 2);
+    g_assert_cmpint(values[0], ==, (1ULL << 40) - 1);
+    g_assert_cmpint(values[2], ==, (1ULL << 40) - 1);
+}
+
+static void test_uniform(void)
+{
+    BlockLatencyHdr hdr = {};
+    uint64_t values[3];
+    int i;
+
+    /* 1us to 10ms */
+    for (i = 1; i <= 10000; i++) {
+        block_latency_hdr_account(&hdr, i * 1000);
+    }
+    block_latency_hdr_percentiles(&hdr, 3, per_mille, values);
+    g_assert_cmpint(values[0], >=, 5000000);
+    g_assert_cmpint(values[0], <=, 5000000 + 5000000 / 16);
+    g_assert_cmpint(values[1], >=, 9900000);
+    g_assert_cmpint(values[1], <=, 9900000 + 9900000 / 16);
+    g_assert_cmpint(values[2], >=, 9990000);
+    g_assert_cmpint(values[2], <=, 9990000 + 9990000 / 16);
+}
+
+static void test_queues(void)
+{
+    BlockAcctStats stats = {};
+    BlockAcctCookie cookie;
+    uint64_t value;
+
+    block_acct_init(&stats);
+    block_acct_setup_queues(&stats, 2);
+
+    block_acct_start(&stats, &cookie, 512, BLOCK_ACCT_WRITE);
+    block_acct_set_queue(&stats, &cookie, 1);
+    block_acct_done(&stats, &cookie);
+
+    /* Out of range queues are only accounted for the device */
+    block_acct_start(&stats, &cookie, 512, BLOCK_ACCT_WRITE);
+    block_acct_set_queue(&stats, &cookie, 2);
+    block_acct_done(&stats, &cookie);
+
+    g_assert_cmpint(block_latency_hdr_percentiles(
+                        &stats.latency_hdr[BLOCK_ACCT_WRITE], 1, per_mille,
+                        &value), ==, 2);
+    g_assert_cmpint(block_latency_hdr_percentiles(
+                        &stats.queues[1].latency_hdr[BLOCK_ACCT_WRITE], 1,
+                        per_mille, &value), ==, 1);
+    g_assert_cmpint(block_latency_hdr_percentiles(
+                        &stats.queues[0].latency_hdr[BLOCK_ACCT_WRITE], 1,
+                        per_mille, &value), ==, 0);
+    g_assert_cmpint(block_latency_hdr_percentiles(
+                        &stats.queues[1].latency_hdr[BLOCK_ACCT_READ], 1,
+                        per_mille, &value), ==, 0);
+
+    block_acct_cleanup(&stats);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/block-latency/empty", test_empty);
+    g_test_add_func("/block-latency/exact", test_exact);
+    g_test_add_func("/block-latency/precision", test_precision);
+    g_test_add_func("/block-latency/huge", test_huge);
+    g_test_add_func("/block-latency/uniform", test_uniform);
+    g_test_add_func("/block-latency/queues", test_queues);
+
+    return g_test_run();
+}
@@ -0,0 +1,294 @@
+/*
+ * Block status cache tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "block/block_int.h"
+#include "sysemu/block-backend.h"
+#include "qapi/error.h"
+
+#define TEST_SIZE       (1 * MiB)
+#define TEST_DATA_END   (512 * KiB)
+
+/* [0, data_end) is data, everything after it is a hole */
+typedef struct BDRVTestState {
+    int64_t size;
+    int64_t data_end;
+    int block_status_calls;
+} BDRVTestState;
+
+static int bdrv_test_open(BlockDriverState *bs, QDict *options, int flags,
+                          Error **errp)
+{
+    BDRVTestState *s = bs->opaque;
+
+    s->size = TEST_SIZE;
+    s->data_end = TEST_DATA_END;
+    return 0;
+}
+
+static int64_t bdrv_test_getlength(BlockDriverState *bs)
+{
+    BDRVTestState *s = bs->opaque;
+    return s->size;
+}
+
+static int coroutine_fn bdrv_test_co_block_status(BlockDriverState *bs,
+                                                  bool want_zero,
+                                                  int64_t offset,
+                                                  int64_t bytes,
+                                                  int64_t *pnum,
+                                                  int64_t *map,
+                                                  BlockDriverState **file)
+{
+    BDRVTestState *s = bs->opaque;
+    int ret;
+
+    s->block_status_calls++;
+    if (offset < s->data_end) {
+        /* Like file-posix, report the whole extent */
+        *pnum = s->data_end - offset;
+        ret = BDRV_BLOCK_DATA;
+    } else {
+        *pnum = MIN(bytes, s->size - offset);
+        ret = BDRV_BLOCK_ZERO;
+    }
+    *map = offset;
+    *file = bs;
+    return ret | BDRV_BLOCK_OFFSET_VALID;
+}
+
+static int coroutine_fn bdrv_test_co_preadv(BlockDriverState *bs,
+                                            uint64_t offset, uint64_t bytes,
+                                            QEMUIOVector *qiov, int flags)
+{
+    return 0;
+}
+
+static int coroutine_fn bdrv_test_co_pwritev(BlockDriverState *bs,
+                                             uint64_t offset, uint64_t bytes,
+                                             QEMUIOVector *qiov, int flags)
+{
+    return 0;
+}
+
+static int coroutine_fn bdrv_test_co_pwrite_zeroes(BlockDriverState *bs,
+                                                   int64_t offset, int bytes,
+                                                   BdrvRequestFlags flags)
+{
+    return 0;
+}
+
+static int coroutine_fn bdrv_test_co_pdiscard(BlockDriverState *bs,
+                                              int64_t offset, int bytes)
+{
+    return 0;
+}
+
+static int coroutine_fn bdrv_test_co_truncate(BlockDriverState *bs,
+                                              int64_t offset,
+                                              PreallocMode prealloc,
+                                              Error **errp)
+{
+    BDRVTestState *s = bs->opaque;
+
+    s->size = offset;
+    return 0;
+}
+
+static BlockDriver bdrv_test = {
+    .format_name            = "test",
+    .instance_size          = sizeof(BDRVTestState),
+
+    .bdrv_open              = bdrv_test_open,
+    .bdrv_getlength         = bdrv_test_getlength,
+    .bdrv_co_block_status   = bdrv_test_co_block_status,
+    .bdrv_co_preadv         = bdrv_test_co_preadv,
+    .bdrv_co_pwritev        = bdrv_test_co_pwritev,
+    .bdrv_co_pwrite_zeroes  = bdrv_test_co_pwrite_zeroes,
+    .bdrv_co_pdiscard       = bdrv_test_co_pdiscard,
+    .bdrv_co_truncate       = bdrv_test_co_truncate,
+};
+
+typedef struct TestEnv {
+    BlockBackend *blk;
+    BlockDriverState *bs;
+    BDRVTestState *s;
+} TestEnv;
+
+static void test_env_init(TestEnv *env)
+{
+    env->blk = blk_new(BLK_PERM_ALL, BLK_PERM_ALL);
+    env->bs = bdrv_new_open_driver(&bdrv_test, "test-node",
+                                   BDRV_O_RDWR | BDRV_O_UNMAP,
+                                   &error_abort);
+    env->s = env->bs->opaque;
+    blk_insert_bs(env->blk, env->bs, &error_abort);
+}
+
+static void test_env_cleanup(TestEnv *env)
+{
+    blk_unref(env->blk);
+    bdrv_unref(env->bs);
+}
+
+/* Query the status at @offset and check it against the test layout */
+static void check_status(TestEnv *env, int64_t offset, int64_t bytes)
+{
+    int64_t pnum, map;
+    BlockDriverState *file;
+    int ret;
+
+    ret = bdrv_block_status(env->bs, offset, bytes, &pnum, &map, &file);
+    g_assert_cmpint(ret, >=, 0);
+    g_assert(ret & BDRV_BLOCK_OFFSET_VALID);
+    g_assert_cmpint(map, ==, offset);
+    g_assert(file == env->bs);
+
+    if (offset < env->s->data_end) {
+        g_assert(ret & BDRV_BLOCK_DATA);
+        g_assert_cmpint(pnum, ==, MIN(bytes, env->s->data_end - offset));
+    } else {
+        g_assert(ret & BDRV_BLOCK_ZERO);
+        g_assert(!(ret & BDRV_BLOCK_DATA));
+    }
+}
+
+static void test_hit(void)
+{
+    TestEnv env;
+    int64_t offset;
+
+    test_env_init(&env);
+
+    check_status(&env, 0, 4096);
+    g_assert_cmpint(env.s->block_status_calls, ==, 1);
+
+    /* The first query cached the whole extent, not just 4k */
+    for (offset = 4096; offset < TEST_DATA_END; offset += 64 * KiB) {
+        check_status(&env, offset, 64 * KiB);
+    }
+    check_status(&env, TEST_DATA_END - 512, TEST_SIZE);
+    g_assert_cmpint(env.s->block_status_calls, ==, 1);
+
+    g_assert_cmpint(env.bs->block_status_cache.hits, ==, 9);
+    g_assert_cmpint(env.bs->block_status_cache.misses, ==, 1);
+
+    test_env_cleanup(&env);
+}
+
+static void test_hole(void)
+{
+    TestEnv env;
+
+    test_env_init(&env);
+
+    /* Holes go to the driver every time */
+    check_status(&env, TEST_DATA_END, 4096);
+    check_status(&env, TEST_DATA_END, 4096);
+    g_assert_cmpint(env.s->block_status_calls, ==, 2);
+    g_assert(!env.bs->block_status_cache.valid);
+
+    /* ...and do not evict cached data */
+    check_status(&env, 0, 4096);
+    check_status(&env, TEST_DATA_END, 4096);
+    check_status(&env, 4096, 4096);
+    g_assert_cmpint(env.s->block_status_calls, ==, 4);
+
+    test_env_cleanup(&env);
+}
+
+static void test_write(void)
+{
+    TestEnv env;
+    uint8_t buf[4096];
+    int ret;
+
+    test_env_init(&env);
+    memset(buf, 0x55, sizeof(buf));
+
+    check_status(&env, 0, 4096);
+
+    /* Writing data cannot create a hole */
+    ret = blk_pwrite(env.blk, 8192, buf, sizeof(buf), 0);
+    g_assert_cmpint(ret, ==, sizeof(buf));
+    check_status(&env, 8192, 4096);
+    g_assert_cmpint(env.s->block_status_calls, ==, 1);
+
+    test_env_cleanup(&env);
+}
+
+static void test_invalidate(void)
+{
+    TestEnv env;
+    int ret;
+
+    test_env_init(&env);
+
+    check_status(&env, 0, 4096);
+
+    /* Requests outside the cached extent keep it */
+    ret = blk_pdiscard(env.blk, TEST_DATA_END, 4096);
+    g_assert_cmpint(ret, ==, 0);
+    check_status(&env, 4096, 4096);
+    g_assert_cmpint(env.s->block_status_calls, ==, 1);
+
+    ret = blk_pdiscard(env.blk, 64 * KiB, 4096);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert(!env.bs->block_status_cache.valid);
+    check_status(&env, 4096, 4096);
+    g_assert_cmpint(env.s->block_status_calls, ==, 2);
+
+    ret = blk_pwrite_zeroes(env.blk, TEST_DATA_END - 4096, 4096,
+                            BDRV_REQ_MAY_UNMAP);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert(!env.bs->block_status_cache.valid);
+    check_status(&env, 4096, 4096);
+    g_assert_cmpint(env.s->block_status_calls, ==, 3);
+
+    /* Truncation drops the cache even if the extent stays in bounds */
+    ret = blk_truncate(env.blk, 2 * TEST_SIZE, PREALLOC_MODE_OFF,
+                       &error_abort);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert(!env.bs->block_status_cache.valid);
+    check_status(&env, 4096, 4096);
+    g_assert_cmpint(env.s->block_status_calls, ==, 4);
+
+    test_env_cleanup(&env);
+}
+
+static void test_want_zero(void)
+{
+    TestEnv env;
+    int ret;
+
+    test_env_init(&env);
+
+    /* Allocation queries neither use nor fill the cache */
+    ret = bdrv_is_allocated(env.bs, 0, 4096, NULL);
+    g_assert_cmpint(ret, ==, 1);
+    g_assert(!env.bs->block_status_cache.valid);
+    g_assert_cmpint(env.bs->block_status_cache.misses, ==, 0);
+
+    test_env_cleanup(&env);
+}
+
+int main(int argc, char **argv)
+{
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/block-status-cache/hit", test_hit);
+    g_test_add_func("/block-status-cache/hole", test_hole);
+    g_test_add_func("/block-status-cache/write", test_write);
+    g_test_add_func("/block-status-cache/invalidate", test_invalidate);
+    g_test_add_func("/block-status-cache/want-zero", test_want_zero);
+
+    return g_test_run();
+}
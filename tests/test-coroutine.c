@@ -165,6 +165,108 @@ static void test_yield(void)
     g_assert_cmpint(i, ==, 5); /* coroutine must yield 5 times */
 }
 
+/*
+ * Check that coroutines with a small stack work and are accounted
+ * separately from the default ones
+ */
+
+static void test_small_stack(void)
+{
+    CoroutinePoolStats before[COROUTINE_STACK__MAX];
+    CoroutinePoolStats after[COROUTINE_STACK__MAX];
+    Coroutine *coroutines[16];
+    bool done[16] = { false };
+    int i, j;
+
+    qemu_coroutine_get_pool_stats(before);
+    g_assert_cmpint(before[COROUTINE_STACK_SMALL].stack_size, <=,
+                    before[COROUTINE_STACK_DEFAULT].stack_size);
+
+    for (i = 0; i < ARRAY_SIZE(coroutines); i++) {
+        coroutines[i] = qemu_coroutine_create_small(yield_5_times, &done[i]);
+        qemu_coroutine_enter(coroutines[i]);
+    }
+
+    qemu_coroutine_get_pool_stats(after);
+    if (CONFIG_COROUTINE_POOL) {
+        g_assert_cmpint(after[COROUTINE_STACK_SMALL].in_use, ==,
+                        before[COROUTINE_STACK_SMALL].in_use +
+                        ARRAY_SIZE(coroutines));
+        g_assert_cmpint(after[COROUTINE_STACK_DEFAULT].in_use, ==,
+                        before[COROUTINE_STACK_DEFAULT].in_use);
+    }
+
+    for (j = 0; j < 5; j++) {
+        for (i = 0; i < ARRAY_SIZE(coroutines); i++) {
+            qemu_coroutine_enter(coroutines[i]);
+        }
+    }
+    for (i = 0; i < ARRAY_SIZE(coroutines); i++) {
+        g_assert(done[i]);
+    }
+
+    qemu_coroutine_get_pool_stats(after);
+    if (CONFIG_COROUTINE_POOL) {
+        g_assert_cmpint(after[COROUTINE_STACK_SMALL].in_use, ==,
+                        before[COROUTINE_STACK_SMALL].in_use);
+        g_assert_cmpint(after[COROUTINE_STACK_SMALL].pool_hits +
+                        after[COROUTINE_STACK_SMALL].allocations, ==,
+                        before[COROUTINE_STACK_SMALL].pool_hits +
+                        before[COROUTINE_STACK_SMALL].allocations +
+                        ARRAY_SIZE(coroutines));
+    }
+}
+
+#ifndef _WIN32
+/*
+ * Check that the pool of a thread that QEMU did not create is released
+ * when the thread exits, even if one of its coroutines is still alive
+ */
+
+static void coroutine_fn yield_once(void *opaque)
+{
+    qemu_coroutine_yield();
+}
+
+static void *foreign_thread_fn(void *opaque)
+{
+    Coroutine **co = opaque;
+
+    /* This one terminates right away and stays in the thread's pool */
+    qemu_coroutine_enter(qemu_coroutine_create(verify_in_coroutine, NULL));
+
+    *co = qemu_coroutine_create(yield_once, NULL);
+    qemu_coroutine_enter(*co);
+    return NULL;
+}
+
+static void test_foreign_thread(void)
+{
+    CoroutinePoolStats before[COROUTINE_STACK__MAX];
+    CoroutinePoolStats after[COROUTINE_STACK__MAX];
+    Coroutine *co = NULL;
+    pthread_t thread;
+
+    qemu_coroutine_get_pool_stats(before);
+    g_assert_cmpint(pthread_create(&thread, NULL, foreign_thread_fn, &co),
+                    ==, 0);
+    g_assert_cmpint(pthread_join(thread, NULL), ==, 0);
+
+    qemu_coroutine_get_pool_stats(after);
+    g_assert_cmpint(after[COROUTINE_STACK_DEFAULT].in_use, ==,
+                    before[COROUTINE_STACK_DEFAULT].in_use + 1);
+    g_assert_cmpint(after[COROUTINE_STACK_DEFAULT].pooled, ==,
+                    before[COROUTINE_STACK_DEFAULT].pooled);
+
+    /* Terminate it here, after its creator is gone */
+    qemu_coroutine_enter(co);
+
+    qemu_coroutine_get_pool_stats(after);
+    g_assert_cmpint(after[COROUTINE_STACK_DEFAULT].in_use, ==,
+                    before[COROUTINE_STACK_DEFAULT].in_use);
+}
+#endif
+
 static void coroutine_fn c2_fn(void *opaque)
 {
     qemu_coroutine_yield();
@@ -426,8 +528,60 @@ static void perf_yield(void)
     }
     duration = g_test_timer_elapsed();
 
-    g_test_message("Yield %u iterations: %f s\n",
-        maxcycles, duration);
+    g_test_message("Yield %u iterations: %f s, %.1f ns per switch\n",
+        maxcycles, duration, duration * 1e9 / (2.0 * maxcycles));
+}
+
+/*
+ * Switch benchmark: the outer coroutine enters the inner one, so every
+ * iteration goes through two levels of nesting and four switches.
+ */
+
+typedef struct {
+    Coroutine *inner;
+    unsigned int counter;
+} SwitchData;
+
+static void coroutine_fn switch_inner(void *opaque)
+{
+    SwitchData *sd = opaque;
+
+    while (sd->counter > 0) {
+        sd->counter--;
+        qemu_coroutine_yield();
+    }
+}
+
+static void coroutine_fn switch_outer(void *opaque)
+{
+    SwitchData *sd = opaque;
+
+    while (sd->counter > 0) {
+        qemu_coroutine_enter(sd->inner);
+        qemu_coroutine_yield();
+    }
+}
+
+static void perf_switch(void)
+{
+    unsigned int maxcycles;
+    double duration;
+    SwitchData sd;
+    Coroutine *outer;
+
+    maxcycles = 50000000;
+    sd.counter = maxcycles;
+    sd.inner = qemu_coroutine_create(switch_inner, &sd);
+    outer = qemu_coroutine_create(switch_outer, &sd);
+
+    g_test_timer_start();
+    while (sd.counter > 0) {
+        qemu_coroutine_enter(outer);
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("Switch %u iterations: %f s, %.1f ns per switch\n",
+        maxcycles, duration, duration * 1e9 / (4.0 * maxcycles));
 }
 
 static __attribute__((noinline)) void dummy(unsigned *i)
@@ -492,10 +646,14 @@ int main(int argc, char **argv)
      */
     if (CONFIG_COROUTINE_POOL) {
         g_test_add_func("/basic/no-dangling-access", test_no_dangling_access);
+#ifndef _WIN32
+        g_test_add_func("/basic/foreign-thread", test_foreign_thread);
+#endif
     }
 
     g_test_add_func("/basic/lifecycle", test_lifecycle);
     g_test_add_func("/basic/yield", test_yield);
+    g_test_add_func("/basic/small-stack", test_small_stack);
     g_test_add_func("/basic/nesting", test_nesting);
     g_test_add_func("/basic/self", test_self);
     g_test_add_func("/basic/entered", test_entered);
@@ -507,6 +665,7 @@ int main(int argc, char **argv)
         g_test_add_func("/perf/lifecycle", perf_lifecycle);
         g_test_add_func("/perf/nesting", perf_nesting);
         g_test_add_func("/perf/yield", perf_yield);
+        g_test_add_func("/perf/switch", perf_switch);
         g_test_add_func("/perf/function-call", perf_baseline);
         g_test_add_func("/perf/cost", perf_cost);
     }
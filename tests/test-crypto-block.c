@@ -24,6 +24,10 @@
 #include "crypto/block.h"
 #include "qemu/buffer.h"
 #include "crypto/secret.h"
+#include "qemu/main-loop.h"
+#include "qemu/units.h"
+#include "block/block.h"
+#include "block/crypto.h"
 #ifndef _WIN32
 #include <sys/resource.h>
 #endif
@@ -272,6 +276,25 @@ static void test_block_assert_setup(const struct QCryptoBlockTestData *data,
 }
 
 
+static void test_block_assert_crypt(QCryptoBlock *blk)
+{
+    uint8_t plain[4096], buf[4096];
+    size_t i;
+
+    for (i = 0; i < sizeof(plain); i++) {
+        plain[i] = i * 7;
+    }
+    memcpy(buf, plain, sizeof(buf));
+
+    g_assert(qcrypto_block_encrypt(blk, 8192, buf, sizeof(buf),
+                                   &error_abort) == 0);
+    g_assert(memcmp(buf, plain, sizeof(buf)) != 0);
+    g_assert(qcrypto_block_decrypt(blk, 8192, buf, sizeof(buf),
+                                   &error_abort) == 0);
+    g_assert(memcmp(buf, plain, sizeof(buf)) == 0);
+}
+
+
 static void test_block(gconstpointer opaque)
 {
     const struct QCryptoBlockTestData *data = opaque;
@@ -305,6 +328,7 @@ static void test_block(gconstpointer opaque)
                              test_block_read_func,
                              &header,
                              0,
+                             1,
                              NULL);
     g_assert(blk == NULL);
 
@@ -313,6 +337,7 @@ static void test_block(gconstpointer opaque)
                              test_block_read_func,
                              &header,
                              QCRYPTO_BLOCK_OPEN_NO_IO,
+                             1,
                              &error_abort);
 
     g_assert(qcrypto_block_get_cipher(blk) == NULL);
@@ -327,10 +352,12 @@ static void test_block(gconstpointer opaque)
                              test_block_read_func,
                              &header,
                              0,
+                             4,
                              &error_abort);
     g_assert(blk);
 
     test_block_assert_setup(data, blk);
+    test_block_assert_crypt(blk);
 
     qcrypto_block_free(blk);
 
@@ -340,11 +367,116 @@ static void test_block(gconstpointer opaque)
 }
 
 
+typedef struct TestBlockCoCrypt {
+    BlockDriverState *bs;
+    QCryptoBlock *blk;
+    uint8_t *buf;
+    size_t len;
+    bool encrypt;
+    int ret;
+    bool done;
+} TestBlockCoCrypt;
+
+#define TEST_CO_CRYPT_OFFSET (1 * MiB)
+
+static void coroutine_fn test_block_co_crypt_entry(void *opaque)
+{
+    TestBlockCoCrypt *data = opaque;
+
+    if (data->encrypt) {
+        data->ret = block_crypto_co_encrypt(data->bs, data->blk,
+                                            TEST_CO_CRYPT_OFFSET,
+                                            data->buf, data->len);
+    } else {
+        data->ret = block_crypto_co_decrypt(data->bs, data->blk,
+                                            TEST_CO_CRYPT_OFFSET,
+                                            data->buf, data->len);
+    }
+    data->done = true;
+}
+
+static void test_block_co_crypt_run(BlockDriverState *bs, QCryptoBlock *blk,
+                                    uint8_t *buf, size_t len, bool encrypt)
+{
+    TestBlockCoCrypt data = {
+        .bs = bs,
+        .blk = blk,
+        .buf = buf,
+        .len = len,
+        .encrypt = encrypt,
+    };
+    Coroutine *co;
+
+    co = qemu_coroutine_create(test_block_co_crypt_entry, &data);
+    qemu_coroutine_enter(co);
+    while (!data.done) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+    g_assert_cmpint(data.ret, ==, 0);
+}
+
+/*
+ * Encrypt and decrypt in coroutine context, both inline and split across
+ * thread pool workers, and compare against a single synchronous call.
+ */
+static void test_block_co_crypt(void)
+{
+    static const size_t lens[] = {
+        4 * KiB,                /* inline */
+        128 * KiB,              /* two workers, equal chunks */
+        3 * 64 * KiB + 512,     /* three workers, shorter last chunk */
+        1 * MiB,                /* BLOCK_CRYPTO_MAX_THREADS workers */
+    };
+    BlockDriverState *bs;
+    QCryptoBlock *blk;
+    Object *sec = test_block_secret();
+    size_t i, j;
+
+    bs = bdrv_open("null-co://", NULL, NULL, BDRV_O_RDWR | BDRV_O_PROTOCOL,
+                   &error_abort);
+
+    /* qcow needs no header, only the secret */
+    blk = qcrypto_block_open(&qcow_open_opts, NULL, NULL, NULL, 0,
+                             BLOCK_CRYPTO_MAX_THREADS, &error_abort);
+
+    for (i = 0; i < G_N_ELEMENTS(lens); i++) {
+        size_t len = lens[i];
+        uint8_t *plain = g_malloc(len);
+        uint8_t *expected = g_malloc(len);
+        uint8_t *buf = g_malloc(len);
+
+        for (j = 0; j < len; j++) {
+            plain[j] = j * 7 + j / 512;
+        }
+        memcpy(expected, plain, len);
+        g_assert(qcrypto_block_encrypt(blk, TEST_CO_CRYPT_OFFSET, expected,
+                                       len, &error_abort) == 0);
+
+        memcpy(buf, plain, len);
+        test_block_co_crypt_run(bs, blk, buf, len, true);
+        g_assert(memcmp(buf, expected, len) == 0);
+
+        test_block_co_crypt_run(bs, blk, buf, len, false);
+        g_assert(memcmp(buf, plain, len) == 0);
+
+        g_free(plain);
+        g_free(expected);
+        g_free(buf);
+    }
+
+    qcrypto_block_free(blk);
+    bdrv_unref(bs);
+    object_unparent(sec);
+}
+
+
 int main(int argc, char **argv)
 {
     gsize i;
 
     module_call_init(MODULE_INIT_QOM);
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
     g_test_init(&argc, &argv, NULL);
 
     g_assert(qcrypto_init(NULL) == 0);
@@ -359,6 +491,7 @@ int main(int argc, char **argv)
             g_test_add_data_func(test_data[i].path, &test_data[i], test_block);
         }
     }
+    g_test_add_func("/crypto/block/qcow/co-crypt", test_block_co_crypt);
 
     return g_test_run();
 }
@@ -781,6 +781,95 @@ static void test_cipher_short_plaintext(void)
     qcrypto_cipher_free(cipher);
 }
 
+static void fill_random(uint8_t *buf, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        buf[i] = g_test_rand_int();
+    }
+}
+
+/* Enough blocks to cover both the 8-block loop and the tail */
+#define AES_ACCEL_LEN (67 * 16)
+
+static void test_cipher_aes_accel(void)
+{
+    static const QCryptoCipherAlgorithm algs[] = {
+        QCRYPTO_CIPHER_ALG_AES_128,
+        QCRYPTO_CIPHER_ALG_AES_192,
+        QCRYPTO_CIPHER_ALG_AES_256,
+    };
+    static const QCryptoCipherMode modes[] = {
+        QCRYPTO_CIPHER_MODE_ECB,
+        QCRYPTO_CIPHER_MODE_XTS,
+    };
+    uint8_t *expected[G_N_ELEMENTS(algs)][G_N_ELEMENTS(modes)] = { { 0 } };
+    uint8_t key[64], iv[16];
+    uint8_t plaintext[AES_ACCEL_LEN];
+    uint8_t ciphertext[AES_ACCEL_LEN];
+    uint8_t outtext[AES_ACCEL_LEN];
+    size_t i, j;
+
+    fill_random(key, sizeof(key));
+    fill_random(iv, sizeof(iv));
+    fill_random(plaintext, sizeof(plaintext));
+
+    /*
+     * The first pass uses the AES instructions of the host if the
+     * builtin backend has them, and records the cipher text.  Further
+     * passes fall back to the table lookups and must agree with it.
+     */
+    do {
+        for (i = 0; i < G_N_ELEMENTS(algs); i++) {
+            for (j = 0; j < G_N_ELEMENTS(modes); j++) {
+                QCryptoCipher *cipher;
+                size_t nkey = qcrypto_cipher_get_key_len(algs[i]);
+
+                if (!qcrypto_cipher_supports(algs[i], modes[j])) {
+                    continue;
+                }
+                if (modes[j] == QCRYPTO_CIPHER_MODE_XTS) {
+                    nkey *= 2;
+                }
+
+                cipher = qcrypto_cipher_new(algs[i], modes[j], key, nkey,
+                                            &error_abort);
+                if (modes[j] == QCRYPTO_CIPHER_MODE_XTS) {
+                    g_assert(qcrypto_cipher_setiv(cipher, iv, sizeof(iv),
+                                                  &error_abort) == 0);
+                }
+                g_assert(qcrypto_cipher_encrypt(cipher, plaintext, ciphertext,
+                                                sizeof(plaintext),
+                                                &error_abort) == 0);
+                if (expected[i][j]) {
+                    g_assert(memcmp(ciphertext, expected[i][j],
+                                    sizeof(ciphertext)) == 0);
+                } else {
+                    expected[i][j] = g_memdup(ciphertext, sizeof(ciphertext));
+                }
+
+                if (modes[j] == QCRYPTO_CIPHER_MODE_XTS) {
+                    g_assert(qcrypto_cipher_setiv(cipher, iv, sizeof(iv),
+                                                  &error_abort) == 0);
+                }
+                g_assert(qcrypto_cipher_decrypt(cipher, ciphertext, outtext,
+                                                sizeof(ciphertext),
+                                                &error_abort) == 0);
+                g_assert(memcmp(outtext, plaintext, sizeof(outtext)) == 0);
+
+                qcrypto_cipher_free(cipher);
+            }
+        }
+    } while (test_qcrypto_cipher_aes_next_accel());
+
+    for (i = 0; i < G_N_ELEMENTS(algs); i++) {
+        for (j = 0; j < G_N_ELEMENTS(modes); j++) {
+            g_free(expected[i][j]);
+        }
+    }
+}
+
 int main(int argc, char **argv)
 {
     size_t i;
@@ -801,5 +890,8 @@ int main(int argc, char **argv)
     g_test_add_func("/crypto/cipher/short-plaintext",
                     test_cipher_short_plaintext);
 
+    g_test_add_func("/crypto/cipher/aes-accel",
+                    test_cipher_aes_accel);
+
     return g_test_run();
 }
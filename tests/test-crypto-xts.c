@@ -27,6 +27,8 @@
 #include "crypto/init.h"
 #include "crypto/xts.h"
 #include "crypto/aes.h"
+#include "crypto/cipher.h"
+#include "qapi/error.h"
 
 typedef struct {
     const char *path;
@@ -322,7 +324,9 @@ static void test_xts_aes_encrypt(const void *ctx,
 {
     const struct TestAES *aesctx = ctx;
 
-    AES_encrypt(src, dst, &aesctx->enc);
+    for (; length; length -= 16, src += 16, dst += 16) {
+        AES_encrypt(src, dst, &aesctx->enc);
+    }
 }
 
 
@@ -333,7 +337,9 @@ static void test_xts_aes_decrypt(const void *ctx,
 {
     const struct TestAES *aesctx = ctx;
 
-    AES_decrypt(src, dst, &aesctx->dec);
+    for (; length; length -= 16, src += 16, dst += 16) {
+        AES_decrypt(src, dst, &aesctx->dec);
+    }
 }
 
 
@@ -498,6 +504,81 @@ static void test_xts_unaligned(const void *opaque)
 }
 
 
+/* Several sectors, and an odd number of blocks in the last one */
+#define XTS_RANDOM_LEN (3 * 512 + 5 * 16)
+
+/*
+ * Compare AES-XTS through the cipher API, which may use the AES
+ * instructions of the host, with the table-based AES used above.
+ */
+static void test_xts_cipher_random(void)
+{
+    static const QCryptoCipherAlgorithm algs[] = {
+        QCRYPTO_CIPHER_ALG_AES_128,
+        QCRYPTO_CIPHER_ALG_AES_192,
+        QCRYPTO_CIPHER_ALG_AES_256,
+    };
+    uint8_t key[64], iv[16], T[16];
+    uint8_t plaintext[XTS_RANDOM_LEN];
+    uint8_t expected[G_N_ELEMENTS(algs)][XTS_RANDOM_LEN];
+    uint8_t out[XTS_RANDOM_LEN];
+    struct TestAES aesdata;
+    struct TestAES aestweak;
+    QCryptoCipher *cipher;
+    size_t i, keylen;
+
+    for (i = 0; i < sizeof(key); i++) {
+        key[i] = g_test_rand_int();
+    }
+    for (i = 0; i < sizeof(iv); i++) {
+        iv[i] = g_test_rand_int();
+    }
+    for (i = 0; i < sizeof(plaintext); i++) {
+        plaintext[i] = g_test_rand_int();
+    }
+
+    for (i = 0; i < G_N_ELEMENTS(algs); i++) {
+        keylen = qcrypto_cipher_get_key_len(algs[i]);
+        AES_set_encrypt_key(key, keylen * 8, &aesdata.enc);
+        AES_set_decrypt_key(key, keylen * 8, &aesdata.dec);
+        AES_set_encrypt_key(key + keylen, keylen * 8, &aestweak.enc);
+        AES_set_decrypt_key(key + keylen, keylen * 8, &aestweak.dec);
+
+        memcpy(T, iv, sizeof(T));
+        xts_encrypt(&aesdata, &aestweak,
+                    test_xts_aes_encrypt,
+                    test_xts_aes_decrypt,
+                    T, sizeof(plaintext), expected[i], plaintext);
+    }
+
+    /* Switching away from the AES instructions affects all key sizes */
+    do {
+        for (i = 0; i < G_N_ELEMENTS(algs); i++) {
+            if (!qcrypto_cipher_supports(algs[i], QCRYPTO_CIPHER_MODE_XTS)) {
+                continue;
+            }
+            keylen = qcrypto_cipher_get_key_len(algs[i]);
+            cipher = qcrypto_cipher_new(algs[i], QCRYPTO_CIPHER_MODE_XTS,
+                                        key, keylen * 2, &error_abort);
+
+            g_assert(qcrypto_cipher_setiv(cipher, iv, sizeof(iv),
+                                          &error_abort) == 0);
+            g_assert(qcrypto_cipher_encrypt(cipher, plaintext, out,
+                                            sizeof(out), &error_abort) == 0);
+            g_assert(memcmp(out, expected[i], sizeof(out)) == 0);
+
+            g_assert(qcrypto_cipher_setiv(cipher, iv, sizeof(iv),
+                                          &error_abort) == 0);
+            g_assert(qcrypto_cipher_decrypt(cipher, expected[i], out,
+                                            sizeof(out), &error_abort) == 0);
+            g_assert(memcmp(out, plaintext, sizeof(out)) == 0);
+
+            qcrypto_cipher_free(cipher);
+        }
+    } while (test_qcrypto_cipher_aes_next_accel());
+}
+
+
 int main(int argc, char **argv)
 {
     size_t i;
@@ -525,5 +606,7 @@ int main(int argc, char **argv)
         g_free(path);
     }
 
+    g_test_add_func("/crypto/xts/cipher-random", test_xts_cipher_random);
+
     return g_test_run();
 }
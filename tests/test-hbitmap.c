@@ -992,6 +992,64 @@ static void test_hbitmap_next_zero_4(TestHBitmapData *data, const void *unused)
     test_hbitmap_next_zero_do(data, 4);
 }
 
+static void hbitmap_test_check_merge(HBitmap *a, HBitmap *b, HBitmap *result,
+                                     uint64_t size)
+{
+    uint64_t i, count = 0;
+
+    for (i = 0; i < size; i++) {
+        bool set = hbitmap_get(a, i) || hbitmap_get(b, i);
+        g_assert_cmpint(hbitmap_get(result, i), ==, set);
+        count += set;
+    }
+    g_assert_cmpint(hbitmap_count(result), ==, count);
+}
+
+static void test_hbitmap_merge(TestHBitmapData *data, const void *unused)
+{
+    HBitmap *b, *result;
+
+    hbitmap_test_init(data, L3 * 2, 0);
+    b = hbitmap_alloc(L3 * 2, 0);
+    result = hbitmap_alloc(L3 * 2, 0);
+
+    hbitmap_test_set(data, L1 - 1, L1 + 2);
+    hbitmap_test_set(data, L3 / 2, L3);
+    hbitmap_set(b, L2, L1);
+    hbitmap_set(b, L3 + L2, L3 - L2);
+    hbitmap_set(result, 0, L3 * 2);
+
+    g_assert(hbitmap_merge(data->hb, b, result));
+    hbitmap_test_check_merge(data->hb, b, result, L3 * 2);
+
+    hbitmap_reset(b, 0, L3 * 2);
+    hbitmap_set(b, L3 - 1, 2);
+    g_assert(hbitmap_merge(b, data->hb, b));
+    hbitmap_test_check_merge(data->hb, b, b, L3 * 2);
+
+    hbitmap_free(result);
+    hbitmap_free(b);
+}
+
+static void test_hbitmap_deserialize_ones(TestHBitmapData *data,
+                                          const void *unused)
+{
+    hbitmap_test_init(data, L3 * 2, 0);
+
+    hbitmap_deserialize_ones(data->hb, 0, L3 * 2, true);
+    g_assert_cmpint(hbitmap_count(data->hb), ==, L3 * 2);
+    test_hbitmap_next_zero_check(data, 0);
+
+    hbitmap_reset(data->hb, L3 - L1, L2);
+    g_assert_cmpint(hbitmap_count(data->hb), ==, L3 * 2 - L2);
+    test_hbitmap_next_zero_check(data, 0);
+    test_hbitmap_next_zero_check(data, L3 - L1 + L2);
+
+    hbitmap_deserialize_zeroes(data->hb, 0, L3, true);
+    g_assert_cmpint(hbitmap_count(data->hb), ==, L3 - L2 + L1);
+    test_hbitmap_next_zero_check(data, L3 + L2);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -1058,6 +1116,10 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/next_zero/next_zero_4",
                      test_hbitmap_next_zero_4);
 
+    hbitmap_test_add("/hbitmap/merge", test_hbitmap_merge);
+    hbitmap_test_add("/hbitmap/deserialize_ones",
+                     test_hbitmap_deserialize_ones);
+
     g_test_run();
 
     return 0;
@@ -0,0 +1,205 @@
+/*
+ * Interval tree tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+#define N 2000
+
+static IntervalTreeRoot root;
+static IntervalTreeNode nodes[N];
+static bool in_tree[N];
+
+/* Check the AVL invariant and the augmented data; return the height */
+static int check_subtree(IntervalTreeNode *node, uint64_t *subtree_end,
+                         int *count)
+{
+    int lh = 0, rh = 0;
+    uint64_t end = node->end, e;
+
+    if (node->left) {
+        g_assert(node->left->parent == node);
+        g_assert_cmpuint(node->left->start, <=, node->start);
+        lh = check_subtree(node->left, &e, count);
+        end = MAX(end, e);
+    }
+    if (node->right) {
+        g_assert(node->right->parent == node);
+        g_assert_cmpuint(node->right->start, >=, node->start);
+        rh = check_subtree(node->right, &e, count);
+        end = MAX(end, e);
+    }
+    g_assert_cmpint(ABS(lh - rh), <=, 1);
+    g_assert_cmpint(node->height, ==, MAX(lh, rh) + 1);
+    g_assert_cmpuint(node->subtree_end, ==, end);
+    *subtree_end = end;
+    (*count)++;
+    return node->height;
+}
+
+static void check_tree(void)
+{
+    uint64_t end;
+    int count = 0, i, expected = 0;
+
+    for (i = 0; i < N; i++) {
+        expected += in_tree[i];
+    }
+    if (root.root) {
+        g_assert(root.root->parent == NULL);
+        check_subtree(root.root, &end, &count);
+    }
+    g_assert_cmpint(count, ==, expected);
+}
+
+static void check_lookup(uint64_t start, uint64_t end)
+{
+    IntervalTreeNode *node;
+    bool seen[N] = { false };
+    uint64_t last_start = 0;
+    int i;
+
+    for (node = interval_tree_iter_first(&root, start, end); node;
+         node = interval_tree_iter_next(node, start, end)) {
+        i = node - nodes;
+        g_assert(in_tree[i]);
+        g_assert(!seen[i]);
+        g_assert_cmpuint(node->start, >=, last_start);
+        last_start = node->start;
+        seen[i] = true;
+    }
+    for (i = 0; i < N; i++) {
+        bool overlaps = in_tree[i] && nodes[i].start < end &&
+                        start < nodes[i].end;
+        g_assert_cmpint(seen[i], ==, overlaps);
+    }
+}
+
+static void test_empty(void)
+{
+    IntervalTreeRoot empty = { 0 };
+
+    g_assert(interval_tree_empty(&empty));
+    g_assert(interval_tree_iter_first(&empty, 0, UINT64_MAX) == NULL);
+}
+
+static void test_overlaps(void)
+{
+    IntervalTreeRoot r = { 0 };
+    IntervalTreeNode a = { .start = 10, .end = 20 };
+    IntervalTreeNode b = { .start = 20, .end = 30 };
+    IntervalTreeNode z = { .start = 25, .end = 25 };
+
+    interval_tree_insert(&a, &r);
+    interval_tree_insert(&b, &r);
+    interval_tree_insert(&z, &r);
+
+    /* Half-open: touching intervals do not overlap */
+    g_assert(interval_tree_iter_first(&r, 0, 10) == NULL);
+    g_assert(interval_tree_iter_first(&r, 30, 40) == NULL);
+    g_assert(interval_tree_iter_first(&r, 19, 20) == &a);
+    g_assert(interval_tree_iter_next(&a, 19, 21) == &b);
+    g_assert(interval_tree_iter_next(&b, 19, 21) == NULL);
+
+    /* An empty interval overlaps ranges that strictly contain its start */
+    g_assert(interval_tree_iter_first(&r, 24, 26) == &b);
+    g_assert(interval_tree_iter_next(&b, 24, 26) == &z);
+    g_assert(interval_tree_iter_next(&z, 25, 26) == NULL);
+    g_assert(interval_tree_iter_first(&r, 25, 26) == &b);
+    g_assert(interval_tree_iter_next(&b, 25, 26) == NULL);
+
+    interval_tree_remove(&a, &r);
+    interval_tree_remove(&z, &r);
+    interval_tree_remove(&b, &r);
+    g_assert(interval_tree_empty(&r));
+}
+
+static void test_random(void)
+{
+    GRand *rand = g_rand_new_with_seed(1);
+    int i, iter;
+
+    memset(&root, 0, sizeof(root));
+    memset(in_tree, 0, sizeof(in_tree));
+
+    for (iter = 0; iter < 20 * N; iter++) {
+        uint64_t start, len;
+
+        i = g_rand_int_range(rand, 0, N);
+        if (in_tree[i]) {
+            interval_tree_remove(&nodes[i], &root);
+            in_tree[i] = false;
+        } else {
+            /* Many duplicate starts and some empty intervals */
+            nodes[i].start = g_rand_int_range(rand, 0, 4096) * 512;
+            nodes[i].end = nodes[i].start +
+                           g_rand_int_range(rand, 0, 64) * 512;
+            interval_tree_insert(&nodes[i], &root);
+            in_tree[i] = true;
+        }
+
+        if (iter % 64 == 0) {
+            check_tree();
+        }
+        start = g_rand_int_range(rand, 0, 4096 * 512);
+        len = g_rand_int_range(rand, 0, 64 * 512);
+        check_lookup(start, start + len);
+    }
+
+    for (i = 0; i < N; i++) {
+        if (in_tree[i]) {
+            interval_tree_remove(&nodes[i], &root);
+            in_tree[i] = false;
+        }
+    }
+    check_tree();
+    g_assert(interval_tree_empty(&root));
+    g_rand_free(rand);
+}
+
+/* Sequential keys are the worst case for an unbalanced tree */
+static void test_sequential(void)
+{
+    IntervalTreeNode *node;
+    int i;
+
+    memset(&root, 0, sizeof(root));
+    memset(in_tree, 0, sizeof(in_tree));
+
+    for (i = 0; i < N; i++) {
+        nodes[i].start = i * 4096;
+        nodes[i].end = nodes[i].start + 8192;
+        interval_tree_insert(&nodes[i], &root);
+        in_tree[i] = true;
+    }
+    check_tree();
+    /* An AVL tree is at most ~1.44 * log2(n) high */
+    g_assert_cmpint(root.root->height, <=, 16);
+
+    node = interval_tree_iter_first(&root, 4096 * 100 + 1, 4096 * 100 + 2);
+    g_assert(node == &nodes[99]);
+    node = interval_tree_iter_next(node, 4096 * 100 + 1, 4096 * 100 + 2);
+    g_assert(node == &nodes[100]);
+    g_assert(interval_tree_iter_next(node, 4096 * 100 + 1,
+                                     4096 * 100 + 2) == NULL);
+
+    for (i = 0; i < N; i += 2) {
+        interval_tree_remove(&nodes[i], &root);
+        in_tree[i] = false;
+    }
+    check_tree();
+    check_lookup(0, N * 4096);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/interval-tree/empty", test_empty);
+    g_test_add_func("/interval-tree/overlaps", test_overlaps);
+    g_test_add_func("/interval-tree/random", test_random);
+    g_test_add_func("/interval-tree/sequential", test_sequential);
+    return g_test_run();
+}
@@ -174,6 +174,80 @@ static void test_encode_decode(void)
     }
 }
 
+#define ACCEL_ROUNDS 64
+
+static void test_encode_accel(void)
+{
+    uint8_t *old_buf = g_malloc(PAGE_SIZE * ACCEL_ROUNDS);
+    uint8_t *new_buf = g_malloc(PAGE_SIZE * ACCEL_ROUNDS);
+    uint8_t *expected = g_malloc(PAGE_SIZE * ACCEL_ROUNDS);
+    uint8_t *compressed = g_malloc(PAGE_SIZE);
+    uint8_t *test = g_malloc(PAGE_SIZE);
+    int expected_len[ACCEL_ROUNDS];
+    bool first = true;
+    int i, j;
+
+    for (i = 0; i < ACCEL_ROUNDS; i++) {
+        uint8_t *o = old_buf + i * PAGE_SIZE;
+        uint8_t *n = new_buf + i * PAGE_SIZE;
+        int changes = g_test_rand_int_range(0, 64);
+
+        for (j = 0; j < PAGE_SIZE; j++) {
+            o[j] = g_test_rand_int();
+        }
+        memcpy(n, o, PAGE_SIZE);
+
+        /* Runs of differing bytes at random places, some crossing vector
+         * boundaries, some merging with each other */
+        while (changes--) {
+            int start = g_test_rand_int_range(0, PAGE_SIZE);
+            int len = g_test_rand_int_range(1, 80);
+
+            for (j = start; j < MIN(start + len, PAGE_SIZE); j++) {
+                n[j] = o[j] ^ g_test_rand_int_range(1, 256);
+            }
+        }
+    }
+
+    do {
+        for (i = 0; i < ACCEL_ROUNDS; i++) {
+            uint8_t *o = old_buf + i * PAGE_SIZE;
+            uint8_t *n = new_buf + i * PAGE_SIZE;
+            int dlen = xbzrle_encode_buffer(o, n, PAGE_SIZE, compressed,
+                                            PAGE_SIZE);
+
+            /* All encoders must produce the very same stream */
+            if (first) {
+                expected_len[i] = dlen;
+                if (dlen > 0) {
+                    memcpy(expected + i * PAGE_SIZE, compressed, dlen);
+                }
+            } else {
+                g_assert_cmpint(dlen, ==, expected_len[i]);
+                if (dlen > 0) {
+                    g_assert(memcmp(expected + i * PAGE_SIZE, compressed,
+                                    dlen) == 0);
+                }
+            }
+
+            if (dlen > 0) {
+                memcpy(test, o, PAGE_SIZE);
+                g_assert_cmpint(xbzrle_decode_buffer(compressed, dlen, test,
+                                                     PAGE_SIZE), <=,
+                                PAGE_SIZE);
+                g_assert(memcmp(test, n, PAGE_SIZE) == 0);
+            }
+        }
+        first = false;
+    } while (test_xbzrle_encode_next_accel());
+
+    g_free(old_buf);
+    g_free(new_buf);
+    g_free(expected);
+    g_free(compressed);
+    g_free(test);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -186,6 +260,8 @@ int main(int argc, char **argv)
     g_test_add_func("/xbzrle/encode_decode_overflow",
                     test_encode_decode_overflow);
     g_test_add_func("/xbzrle/encode_decode", test_encode_decode);
+    /* Must come last, it leaves the scalar encoder selected */
+    g_test_add_func("/xbzrle/encode_accel", test_encode_accel);
 
     return g_test_run();
 }
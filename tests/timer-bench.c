@@ -0,0 +1,203 @@
+/*
+ * Timer list re-arm microbenchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/processor.h"
+
+struct thread_info {
+    uint64_t r;
+    unsigned long long ops;
+    QEMUTimer *timers;
+} QEMU_ALIGNED(64);
+
+static QEMUTimerListGroup tlg;
+static QemuThread *threads;
+static struct thread_info *th_info;
+static unsigned int n_threads = 1;
+static unsigned int n_ready_threads;
+static unsigned int n_timers = 1024;
+static unsigned int duration = 1;
+static int64_t range_ns = 1000000000;
+static bool test_start;
+static bool test_stop;
+
+static const char commands_string[] =
+    " -n = number of threads\n"
+    " -t = number of armed timers per thread\n"
+    " -d = duration in seconds\n"
+    " -r = range of the expire times, in microseconds";
+
+static void usage_complete(char *argv[])
+{
+    fprintf(stderr, "Usage: %s [options]\n", argv[0]);
+    fprintf(stderr, "options:\n%s\n", commands_string);
+}
+
+/*
+ * From: https://en.wikipedia.org/wiki/Xorshift
+ * This is faster than rand_r(), and gives us a wider range (RAND_MAX is only
+ * guaranteed to be >= INT_MAX).
+ */
+static uint64_t xorshift64star(uint64_t x)
+{
+    x ^= x >> 12; /* a */
+    x ^= x << 25; /* b */
+    x ^= x >> 27; /* c */
+    return x * UINT64_C(2685821657736338717);
+}
+
+static void timer_cb(void *opaque)
+{
+}
+
+/* Timers are far enough in the future that they never fire */
+static int64_t next_expire_time(struct thread_info *info, int64_t now)
+{
+    info->r = xorshift64star(info->r);
+    return now + range_ns + info->r % range_ns;
+}
+
+static void *thread_func(void *arg)
+{
+    struct thread_info *info = arg;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    unsigned int i;
+
+    for (i = 0; i < n_timers; i++) {
+        timer_mod_ns(&info->timers[i], next_expire_time(info, now));
+    }
+
+    atomic_inc(&n_ready_threads);
+    while (!atomic_read(&test_start)) {
+        cpu_relax();
+    }
+
+    while (!atomic_read(&test_stop)) {
+        QEMUTimer *ts;
+
+        info->r = xorshift64star(info->r);
+        ts = &info->timers[info->r % n_timers];
+        timer_mod_ns(ts, next_expire_time(info, now));
+
+        /* What the event loop does before every poll */
+        timerlist_deadline_ns(tlg.tl[QEMU_CLOCK_REALTIME]);
+        info->ops++;
+    }
+
+    for (i = 0; i < n_timers; i++) {
+        timer_del(&info->timers[i]);
+    }
+    return NULL;
+}
+
+static void run_test(void)
+{
+    unsigned int remaining;
+    unsigned int i;
+
+    while (atomic_read(&n_ready_threads) != n_threads) {
+        cpu_relax();
+    }
+    atomic_set(&test_start, true);
+    do {
+        remaining = sleep(duration);
+    } while (remaining);
+    atomic_set(&test_stop, true);
+
+    for (i = 0; i < n_threads; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+}
+
+static void create_threads(void)
+{
+    unsigned int i, j;
+
+    timerlistgroup_init(&tlg, NULL, NULL);
+    threads = g_new(QemuThread, n_threads);
+    th_info = g_new0(struct thread_info, n_threads);
+
+    for (i = 0; i < n_threads; i++) {
+        struct thread_info *info = &th_info[i];
+
+        info->r = (i + 1) ^ time(NULL);
+        info->timers = g_new0(QEMUTimer, n_timers);
+        for (j = 0; j < n_timers; j++) {
+            timer_init_full(&info->timers[j], &tlg, QEMU_CLOCK_REALTIME,
+                            SCALE_NS, 0, timer_cb, NULL);
+        }
+        qemu_thread_create(&threads[i], NULL, thread_func, info,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void pr_params(void)
+{
+    printf("Parameters:\n");
+    printf(" # of threads:      %u\n", n_threads);
+    printf(" # of timers:       %u per thread\n", n_timers);
+    printf(" duration:          %u\n", duration);
+    printf(" expire range:      %" PRId64 " us\n", range_ns / 1000);
+}
+
+static void pr_stats(void)
+{
+    unsigned long long val = 0;
+    unsigned int i;
+    double tx;
+
+    for (i = 0; i < n_threads; i++) {
+        val += th_info[i].ops;
+    }
+    tx = val / duration / 1e6;
+
+    printf("Results:\n");
+    printf("Duration:            %u s\n", duration);
+    printf(" Throughput:         %.2f Mrearms/s\n", tx);
+    printf(" Throughput/thread:  %.2f Mrearms/s/thread\n", tx / n_threads);
+}
+
+static void parse_args(int argc, char *argv[])
+{
+    int c;
+
+    for (;;) {
+        c = getopt(argc, argv, "hd:n:t:r:");
+        if (c < 0) {
+            break;
+        }
+        switch (c) {
+        case 'h':
+            usage_complete(argv);
+            exit(0);
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'n':
+            n_threads = atoi(optarg);
+            break;
+        case 't':
+            n_timers = MAX(atoi(optarg), 1);
+            break;
+        case 'r':
+            range_ns = MAX(atoll(optarg), 1) * 1000;
+            break;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    parse_args(argc, argv);
+    pr_params();
+    init_clocks(NULL);
+    create_threads();
+    run_test();
+    pr_stats();
+    return 0;
+}
@@ -17,6 +17,7 @@
 #include "libqos/virtio-mmio.h"
 #include "libqos/malloc-generic.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
 #include "qemu/bswap.h"
 #include "standard-headers/linux/virtio_ids.h"
 #include "standard-headers/linux/virtio_config.h"
@@ -61,7 +62,8 @@ static char *drive_create(void)
     return tmp_path;
 }
 
-static QOSState *pci_test_start(void)
+/* @device_opts are appended to the -device option of the tested device */
+static QOSState *pci_test_start_opts(const char *device_opts)
 {
     QOSState *qs;
     const char *arch = qtest_get_arch();
@@ -69,14 +71,14 @@ static QOSState *pci_test_start(void)
     const char *cmd = "-drive if=none,id=drive0,file=%s,format=raw "
                       "-drive if=none,id=drive1,file=null-co://,format=raw "
                       "-device virtio-blk-pci,id=drv0,drive=drive0,"
-                      "addr=%x.%x";
+                      "addr=%x.%x%s";
 
     tmp_path = drive_create();
 
     if (strcmp(arch, "i386") == 0 || strcmp(arch, "x86_64") == 0) {
-        qs = qtest_pc_boot(cmd, tmp_path, PCI_SLOT, PCI_FN);
+        qs = qtest_pc_boot(cmd, tmp_path, PCI_SLOT, PCI_FN, device_opts);
     } else if (strcmp(arch, "ppc64") == 0) {
-        qs = qtest_spapr_boot(cmd, tmp_path, PCI_SLOT, PCI_FN);
+        qs = qtest_spapr_boot(cmd, tmp_path, PCI_SLOT, PCI_FN, device_opts);
     } else {
         g_printerr("virtio-blk tests are only available on x86 or ppc64\n");
         exit(EXIT_FAILURE);
@@ -87,6 +89,11 @@ static QOSState *pci_test_start(void)
     return qs;
 }
 
+static QOSState *pci_test_start(void)
+{
+    return pci_test_start_opts("");
+}
+
 static void arm_test_start(void)
 {
     char *tmp_path;
@@ -657,6 +664,132 @@ static void pci_idx(void)
     qtest_shutdown(qs);
 }
 
+/* Wait for a request without looking at the ISR, which is shared */
+static uint8_t wait_status_byte(uint64_t addr)
+{
+    gint64 start_time = g_get_monotonic_time();
+    uint8_t val;
+
+    while ((val = readb(addr)) == 0xff) {
+        clock_step(100);
+        g_assert(g_get_monotonic_time() - start_time <=
+                 QVIRTIO_BLK_TIMEOUT_US);
+    }
+    return val;
+}
+
+/* Queue a request with a 3 descriptor layout and notify the device */
+static uint64_t submit_request(QOSState *qs, QVirtioDevice *dev,
+                               QVirtQueue *vq, uint32_t type, uint64_t sector,
+                               const char *data)
+{
+    QVirtioBlkReq req;
+    uint64_t req_addr;
+    uint32_t free_head;
+
+    req.type = type;
+    req.ioprio = 1;
+    req.sector = sector;
+    req.data = g_malloc0(512);
+    if (data) {
+        strcpy(req.data, data);
+    }
+
+    req_addr = virtio_blk_request(qs->alloc, dev, &req, 512);
+    g_free(req.data);
+
+    free_head = qvirtqueue_add(vq, req_addr, 16, false, true);
+    qvirtqueue_add(vq, req_addr + 16, 512, type == VIRTIO_BLK_T_IN, true);
+    qvirtqueue_add(vq, req_addr + 528, 1, true, false);
+    qvirtqueue_kick(dev, vq, free_head);
+
+    return req_addr;
+}
+
+/* Return a counter from the query-blockstats entry of drive0 */
+static int64_t get_blockstat(const char *name)
+{
+    QDict *rsp, *entry, *stats;
+    QListEntry *e;
+    int64_t value = -1;
+
+    rsp = qmp("{ 'execute': 'query-blockstats' }");
+    g_assert(qdict_haskey(rsp, "return"));
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(rsp, "return"), e) {
+        entry = qobject_to(QDict, qlist_entry_obj(e));
+        if (!strcmp(qdict_get_try_str(entry, "device") ?: "", "drive0")) {
+            stats = qdict_get_qdict(entry, "stats");
+            value = qdict_get_int(stats, name);
+        }
+    }
+    qobject_unref(rsp);
+
+    g_assert_cmpint(value, >=, 0);
+    return value;
+}
+
+/*
+ * Adjacent requests that are held back in the merge window and submitted
+ * together must still read and write the right data.
+ */
+static void pci_merge_window(void)
+{
+    static const char *const patterns[] = { "AAAA", "BBBB", "CCCC" };
+    QVirtioPCIDevice *dev;
+    QOSState *qs;
+    QVirtQueuePCI *vqpci;
+    uint64_t req_addr[ARRAY_SIZE(patterns)];
+    uint32_t features;
+    char data[512];
+    int i;
+
+    qs = pci_test_start_opts(",merge-window-us=100000");
+    dev = virtio_blk_pci_init(qs->pcibus, PCI_SLOT);
+
+    features = qvirtio_get_features(&dev->vdev);
+    features = features & ~(QVIRTIO_F_BAD_FEATURE |
+                            (1u << VIRTIO_RING_F_INDIRECT_DESC) |
+                            (1u << VIRTIO_RING_F_EVENT_IDX) |
+                            (1u << VIRTIO_BLK_F_SCSI));
+    qvirtio_set_features(&dev->vdev, features);
+
+    vqpci = (QVirtQueuePCI *)qvirtqueue_setup(&dev->vdev, qs->alloc, 0);
+    qvirtio_set_driver_ok(&dev->vdev);
+
+    /* Write sectors 2, 0 and 1, so that merging has to sort them */
+    for (i = 0; i < ARRAY_SIZE(patterns); i++) {
+        req_addr[i] = submit_request(qs, &dev->vdev, &vqpci->vq,
+                                     VIRTIO_BLK_T_OUT, (i + 2) % 3,
+                                     patterns[i]);
+    }
+    for (i = 0; i < ARRAY_SIZE(patterns); i++) {
+        g_assert_cmpint(wait_status_byte(req_addr[i] + 528), ==, 0);
+        guest_free(qs->alloc, req_addr[i]);
+    }
+
+    /* Each request was kicked on its own, only the window merged them */
+    g_assert_cmpint(get_blockstat("wr_merged_window"), >, 0);
+
+    for (i = 0; i < ARRAY_SIZE(patterns); i++) {
+        req_addr[i] = submit_request(qs, &dev->vdev, &vqpci->vq,
+                                     VIRTIO_BLK_T_IN, i, NULL);
+    }
+    for (i = 0; i < ARRAY_SIZE(patterns); i++) {
+        g_assert_cmpint(wait_status_byte(req_addr[i] + 528), ==, 0);
+        memread(req_addr[i] + 16, data, sizeof(data));
+        g_assert_cmpstr(data, ==, patterns[(i + 1) % 3]);
+        guest_free(qs->alloc, req_addr[i]);
+    }
+
+    g_assert_cmpint(get_blockstat("rd_merged_window"), >, 0);
+
+    /* End test */
+    qvirtqueue_cleanup(dev->vdev.bus, &vqpci->vq, qs->alloc);
+    qvirtio_pci_device_disable(dev);
+    qvirtio_pci_device_free(dev);
+    qtest_shutdown(qs);
+}
+
 static void pci_hotplug(void)
 {
     QVirtioPCIDevice *dev;
@@ -757,6 +890,7 @@ int main(int argc, char **argv)
         qtest_add_func("/virtio/blk/pci/indirect", pci_indirect);
         qtest_add_func("/virtio/blk/pci/config", pci_config);
         qtest_add_func("/virtio/blk/pci/nxvirtq", test_nonexistent_virtqueue);
+        qtest_add_func("/virtio/blk/pci/merge-window", pci_merge_window);
         if (strcmp(arch, "i386") == 0 || strcmp(arch, "x86_64") == 0) {
             qtest_add_func("/virtio/blk/pci/msix", pci_msix);
             qtest_add_func("/virtio/blk/pci/idx", pci_idx);
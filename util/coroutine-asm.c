@@ -0,0 +1,245 @@
+/*
+ * Host-specific assembly coroutine switching
+ *
+ * Copyright (C) 2006  Anthony Liguori <anthony@codemonkey.ws>
+ * Copyright (C) 2011  Kevin Wolf <kwolf@redhat.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.0 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/coroutine_int.h"
+
+#ifdef CONFIG_VALGRIND_H
+#include <valgrind/valgrind.h>
+#endif
+
+#if defined(__SANITIZE_ADDRESS__) || __has_feature(address_sanitizer)
+#ifdef CONFIG_ASAN_IFACE_FIBER
+#define CONFIG_ASAN 1
+#include <sanitizer/asan_interface.h>
+#endif
+#endif
+
+typedef struct {
+    Coroutine base;
+    void *sp;
+    void *stack;
+    size_t stack_size;
+    bool fresh; /* @sp is the top of a stack that was never entered */
+
+#ifdef CONFIG_VALGRIND_H
+    unsigned int valgrind_stack_id;
+#endif
+
+} CoroutineAsm;
+
+/**
+ * Per-thread coroutine bookkeeping
+ */
+static __thread CoroutineAsm leader;
+static __thread Coroutine *current;
+
+/*
+ * CO_SWITCH() saves the frame pointer and a resume address on the stack
+ * of @from, stores the stack pointer in @from->sp and loads @to->sp.
+ * CO_SWITCH_RET() then pops the resume address that @to pushed when it
+ * was switched out, while CO_SWITCH_NEW() enters coroutine_trampoline()
+ * on the fresh stack of @to.  In both cases @to arrives in the first
+ * argument register and @action in the register CO_SWITCH() returns.
+ *
+ * All other callee-saved registers are listed as clobbers, so that the
+ * compiler spills only the ones that the calling function actually uses;
+ * this is the whole advantage over sigsetjmp(), which always saves the
+ * complete register file and (with glibc) mangles the pointers it saves.
+ */
+#if defined(__x86_64__)
+/*
+ * The pushes would overwrite the red zone of the calling function, so
+ * skip it first.  "call" rather than "jmp" keeps the stack aligned as
+ * required at function entry.  The resume address is reached with an
+ * indirect jump rather than "ret", because a "ret" that does not match
+ * a "call" desynchronizes the return stack predictor and makes the
+ * following returns mispredict as well.
+ */
+#ifdef __CET__
+#define CO_ENDBR "endbr64\n"
+#else
+#define CO_ENDBR ""
+#endif
+
+#define CO_SWITCH(from, to, action, jump) ({                                 \
+    uintptr_t action_ = action;                                             \
+    void *from_ = from;                                                     \
+    void *to_ = to;                                                         \
+    asm volatile(                                                           \
+        "leaq -128(%%rsp), %%rsp\n"                                         \
+        "pushq %%rbp\n"                                                     \
+        "leaq 2f(%%rip), %%rcx\n"                                           \
+        "pushq %%rcx\n"                                                     \
+        "movq %%rsp, %c[SP](%[FROM])\n"                                     \
+        "movq %c[SP](%[TO]), %%rsp\n"                                       \
+        jump "\n"                                                           \
+        "2:\n"                                                              \
+        CO_ENDBR                                                            \
+        "popq %%rbp\n"                                                      \
+        "leaq 128(%%rsp), %%rsp\n"                                          \
+        : "+a" (action_), [FROM] "+b" (from_), [TO] "+D" (to_)              \
+        : [SP] "i" (offsetof(CoroutineAsm, sp))                             \
+        : "rcx", "rdx", "rsi", "r8", "r9", "r10", "r11",                    \
+          "r12", "r13", "r14", "r15",                                       \
+          "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6", "xmm7",   \
+          "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14",      \
+          "xmm15", "cc", "memory");                                         \
+    action_;                                                                \
+})
+
+#define CO_SWITCH_NEW(from, to)                                             \
+    CO_SWITCH(from, to, 0, "call coroutine_trampoline")
+#define CO_SWITCH_RET(from, to, action)                                     \
+    CO_SWITCH(from, to, action, "popq %%rcx\n" "jmpq *%%rcx")
+
+#else
+#error "The asm coroutine backend does not support this host"
+#endif
+
+static void finish_switch_fiber(void *fake_stack_save)
+{
+#ifdef CONFIG_ASAN
+    const void *bottom_old;
+    size_t size_old;
+
+    __sanitizer_finish_switch_fiber(fake_stack_save, &bottom_old, &size_old);
+
+    if (!leader.stack) {
+        leader.stack = (void *)bottom_old;
+        leader.stack_size = size_old;
+    }
+#endif
+}
+
+static void start_switch_fiber(void **fake_stack_save,
+                               const void *bottom, size_t size)
+{
+#ifdef CONFIG_ASAN
+    __sanitizer_start_switch_fiber(fake_stack_save, bottom, size);
+#endif
+}
+
+/* Only ever reached from the inline assembly in CO_SWITCH_NEW() */
+static void __attribute__((__used__, __noreturn__))
+coroutine_trampoline(CoroutineAsm *self)
+{
+    Coroutine *co = &self->base;
+
+    finish_switch_fiber(NULL);
+
+    while (true) {
+        co->entry(co->entry_arg);
+        qemu_coroutine_switch(co, co->caller, COROUTINE_TERMINATE);
+    }
+}
+
+Coroutine *qemu_coroutine_new(size_t stack_size, int node)
+{
+    CoroutineAsm *co;
+
+    co = g_malloc0(sizeof(*co));
+    co->stack_size = stack_size;
+    co->stack = qemu_alloc_stack(&co->stack_size, node);
+
+    /* The first switch to the coroutine starts at the top of its stack */
+    co->sp = (void *)QEMU_ALIGN_DOWN((uintptr_t)co->stack + co->stack_size,
+                                     16);
+    co->fresh = true;
+
+#ifdef CONFIG_VALGRIND_H
+    co->valgrind_stack_id =
+        VALGRIND_STACK_REGISTER(co->stack, co->stack + co->stack_size);
+#endif
+
+    return &co->base;
+}
+
+#ifdef CONFIG_VALGRIND_H
+#if defined(CONFIG_PRAGMA_DIAGNOSTIC_AVAILABLE) && !defined(__clang__)
+/* Work around an unused variable in the valgrind.h macro... */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-but-set-variable"
+#endif
+static inline void valgrind_stack_deregister(CoroutineAsm *co)
+{
+    VALGRIND_STACK_DEREGISTER(co->valgrind_stack_id);
+}
+#if defined(CONFIG_PRAGMA_DIAGNOSTIC_AVAILABLE) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+void qemu_coroutine_delete(Coroutine *co_)
+{
+    CoroutineAsm *co = DO_UPCAST(CoroutineAsm, base, co_);
+
+#ifdef CONFIG_VALGRIND_H
+    valgrind_stack_deregister(co);
+#endif
+
+    qemu_free_stack(co->stack, co->stack_size);
+    g_free(co);
+}
+
+/* This function is marked noinline to prevent GCC from inlining it
+ * into coroutine_trampoline(). If we allow it to do that then it
+ * hoists the code to get the address of the TLS variable "current"
+ * out of the while() loop. This is an invalid transformation because
+ * the switch may be started when running thread A but return in
+ * thread B, and so we might be in a different thread context each
+ * time round the loop.
+ */
+CoroutineAction __attribute__((noinline))
+qemu_coroutine_switch(Coroutine *from_, Coroutine *to_,
+                      CoroutineAction action)
+{
+    CoroutineAsm *from = DO_UPCAST(CoroutineAsm, base, from_);
+    CoroutineAsm *to = DO_UPCAST(CoroutineAsm, base, to_);
+    void *fake_stack_save = NULL;
+
+    current = to_;
+
+    start_switch_fiber(action == COROUTINE_TERMINATE ?
+                       NULL : &fake_stack_save, to->stack, to->stack_size);
+    if (unlikely(to->fresh)) {
+        to->fresh = false;
+        action = CO_SWITCH_NEW(from, to);
+    } else {
+        action = CO_SWITCH_RET(from, to, action);
+    }
+    finish_switch_fiber(fake_stack_save);
+
+    return action;
+}
+
+Coroutine *qemu_coroutine_self(void)
+{
+    if (!current) {
+        current = &leader.base;
+    }
+    return current;
+}
+
+bool qemu_in_coroutine(void)
+{
+    return current && current->caller;
+}
@@ -142,7 +142,7 @@ static void coroutine_trampoline(int signal)
     coroutine_bootstrap(self, co);
 }
 
-Coroutine *qemu_coroutine_new(void)
+Coroutine *qemu_coroutine_new(size_t stack_size, int node)
 {
     CoroutineSigAltStack *co;
     CoroutineThreadState *coTS;
@@ -164,8 +164,8 @@ Coroutine *qemu_coroutine_new(void)
      */
 
     co = g_malloc0(sizeof(*co));
-    co->stack_size = COROUTINE_STACK_SIZE;
-    co->stack = qemu_alloc_stack(&co->stack_size);
+    co->stack_size = stack_size;
+    co->stack = qemu_alloc_stack(&co->stack_size, node);
     co->base.entry_arg = &old_env; /* stash away our jmp_buf */
 
     coTS = coroutine_get_thread_state();
@@ -118,7 +118,7 @@ static void coroutine_trampoline(int i0, int i1)
     }
 }
 
-Coroutine *qemu_coroutine_new(void)
+Coroutine *qemu_coroutine_new(size_t stack_size, int node)
 {
     CoroutineUContext *co;
     ucontext_t old_uc, uc;
@@ -139,8 +139,8 @@ Coroutine *qemu_coroutine_new(void)
     }
 
     co = g_malloc0(sizeof(*co));
-    co->stack_size = COROUTINE_STACK_SIZE;
-    co->stack = qemu_alloc_stack(&co->stack_size);
+    co->stack_size = stack_size;
+    co->stack = qemu_alloc_stack(&co->stack_size, node);
     co->base.entry_arg = &old_env; /* stash away our jmp_buf */
 
     uc.uc_link = &old_uc;
@@ -69,9 +69,8 @@ static void CALLBACK coroutine_trampoline(void *co_)
     }
 }
 
-Coroutine *qemu_coroutine_new(void)
+Coroutine *qemu_coroutine_new(size_t stack_size, int node)
 {
-    const size_t stack_size = COROUTINE_STACK_SIZE;
     CoroutineWin32 *co;
 
     co = g_malloc0(sizeof(*co));
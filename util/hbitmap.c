@@ -89,13 +89,133 @@ struct HBitmap {
      *
      * Note that all bitmaps have the same number of levels.  Even a 1-bit
      * bitmap will still allocate HBITMAP_LEVELS arrays.
+     *
+     * The last level is not stored here, see chunks below.
+     */
+    unsigned long *levels[HBITMAP_LEVELS - 1];
+
+    /* The last level, which is as large as all the others together, is split
+     * into chunks of HB_CHUNK_WORDS words that are only allocated when a bit
+     * in them is set.  A NULL chunk is all zeroes and a chunk pointing to
+     * hb_full_chunk is all ones; either can be read but not written, see
+     * hb_chunk_get_writable().  With the usual backup/mirror usage pattern
+     * (a mostly clean bitmap, or one that has just been filled), this makes
+     * the memory cost proportional to the number of dirty regions rather
+     * than to the size of the disk.
      */
-    unsigned long *levels[HBITMAP_LEVELS];
+    unsigned long **chunks;
+
+    /* The length of the chunks[] array. */
+    uint64_t nb_chunks;
 
-    /* The length of each levels[] array. */
+    /* The length of each level, in words.  */
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+#define HB_CHUNK_SHIFT          9
+#define HB_CHUNK_WORDS          (1 << HB_CHUNK_SHIFT)
+#define HB_CHUNK_MASK           (HB_CHUNK_WORDS - 1)
+
+/* Number of words in the second-to-last level that describe one chunk. */
+#define HB_CHUNK_PARENT_WORDS   (HB_CHUNK_WORDS >> BITS_PER_LEVEL)
+
+static const unsigned long hb_full_chunk[HB_CHUNK_WORDS] = {
+    [0 ... HB_CHUNK_WORDS - 1] = ~0UL
+};
+
+static const unsigned long hb_zero_chunk[HB_CHUNK_WORDS];
+
+#define HB_CHUNK_FULL           ((unsigned long *)hb_full_chunk)
+
+static inline unsigned long hb_last_word(const HBitmap *hb, uint64_t pos)
+{
+    const unsigned long *chunk = hb->chunks[pos >> HB_CHUNK_SHIFT];
+
+    return chunk ? chunk[pos & HB_CHUNK_MASK] : 0;
+}
+
+static inline unsigned long hb_word(const HBitmap *hb, int level, uint64_t pos)
+{
+    if (level == HBITMAP_LEVELS - 1) {
+        return hb_last_word(hb, pos);
+    }
+    return hb->levels[level][pos];
+}
+
+static void hb_chunk_free(HBitmap *hb, uint64_t chunk)
+{
+    if (hb->chunks[chunk] != HB_CHUNK_FULL) {
+        g_free(hb->chunks[chunk]);
+    }
+    hb->chunks[chunk] = NULL;
+}
+
+/* Return a private copy of @chunk that can be modified in place. */
+static unsigned long *hb_chunk_get_writable(HBitmap *hb, uint64_t chunk)
+{
+    unsigned long *p = hb->chunks[chunk];
+
+    if (p == NULL) {
+        p = g_new0(unsigned long, HB_CHUNK_WORDS);
+    } else if (p == HB_CHUNK_FULL) {
+        p = g_memdup(hb_full_chunk, sizeof(hb_full_chunk));
+    } else {
+        return p;
+    }
+    hb->chunks[chunk] = p;
+    return p;
+}
+
+/* Return a pointer to word @pos of @level.  If @alloc is false and the
+ * word lives in a chunk of the last level that is not allocated yet, return
+ * NULL: such a word is zero and the caller only wants to clear bits.
+ */
+static inline unsigned long *hb_elem(HBitmap *hb, int level, uint64_t pos,
+                                     bool alloc)
+{
+    unsigned long *chunk;
+
+    if (level != HBITMAP_LEVELS - 1) {
+        return &hb->levels[level][pos];
+    }
+
+    chunk = hb->chunks[pos >> HB_CHUNK_SHIFT];
+    if (chunk == NULL && !alloc) {
+        return NULL;
+    }
+    if (chunk == NULL || chunk == HB_CHUNK_FULL) {
+        chunk = hb_chunk_get_writable(hb, pos >> HB_CHUNK_SHIFT);
+    }
+    return &chunk[pos & HB_CHUNK_MASK];
+}
+
+/* Release chunks between @first_chunk and @last_chunk whose words
+ * are all zero, according to the second-to-last level.
+ */
+static void hb_chunks_trim(HBitmap *hb, uint64_t first_chunk,
+                           uint64_t last_chunk)
+{
+    const unsigned long *parent = hb->levels[HBITMAP_LEVELS - 2];
+    uint64_t c, i, start, end;
+
+    for (c = first_chunk; c <= last_chunk; c++) {
+        if (hb->chunks[c] == NULL) {
+            continue;
+        }
+        start = c * HB_CHUNK_PARENT_WORDS;
+        end = MIN(start + HB_CHUNK_PARENT_WORDS,
+                  hb->sizes[HBITMAP_LEVELS - 2]);
+        for (i = start; i < end; i++) {
+            if (parent[i]) {
+                break;
+            }
+        }
+        if (i == end) {
+            hb_chunk_free(hb, c);
+        }
+    }
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -131,7 +251,7 @@ unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
         hbi->cur[i] = cur & (cur - 1);
 
         /* Set up next level for iteration.  */
-        cur = hb->levels[i + 1][pos];
+        cur = hb_word(hb, i + 1, pos);
     }
 
     hbi->pos = pos;
@@ -144,7 +264,7 @@ unsigned long hbitmap_iter_skip_words(HBitmapIter *hbi)
 int64_t hbitmap_iter_next(HBitmapIter *hbi, bool advance)
 {
     unsigned long cur = hbi->cur[HBITMAP_LEVELS - 1] &
-            hbi->hb->levels[HBITMAP_LEVELS - 1][hbi->pos];
+            hb_last_word(hbi->hb, hbi->pos);
     int64_t item;
 
     if (cur == 0) {
@@ -181,7 +301,7 @@ void hbitmap_iter_init(HBitmapIter *hbi, const HBitmap *hb, uint64_t first)
         pos >>= BITS_PER_LEVEL;
 
         /* Drop bits representing items before first.  */
-        hbi->cur[i] = hb->levels[i][pos] & ~((1UL << bit) - 1);
+        hbi->cur[i] = hb_word(hb, i, pos) & ~((1UL << bit) - 1);
 
         /* We have already added level i+1, so the lowest set bit has
          * been processed.  Clear it.
@@ -195,9 +315,8 @@ void hbitmap_iter_init(HBitmapIter *hbi, const HBitmap *hb, uint64_t first)
 int64_t hbitmap_next_zero(const HBitmap *hb, uint64_t start)
 {
     size_t pos = (start >> hb->granularity) >> BITS_PER_LEVEL;
-    unsigned long *last_lev = hb->levels[HBITMAP_LEVELS - 1];
     uint64_t sz = hb->sizes[HBITMAP_LEVELS - 1];
-    unsigned long cur = last_lev[pos];
+    unsigned long cur = hb_last_word(hb, pos);
     unsigned start_bit_offset =
             (start >> hb->granularity) & (BITS_PER_LONG - 1);
     int64_t res;
@@ -208,13 +327,18 @@ int64_t hbitmap_next_zero(const HBitmap *hb, uint64_t start)
     if (cur == (unsigned long)-1) {
         do {
             pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
+            /* Skip chunks that are known to be full.  */
+            while ((pos & HB_CHUNK_MASK) == 0 && pos < sz &&
+                   hb->chunks[pos >> HB_CHUNK_SHIFT] == HB_CHUNK_FULL) {
+                pos += HB_CHUNK_WORDS;
+            }
+        } while (pos < sz && hb_last_word(hb, pos) == (unsigned long)-1);
 
         if (pos >= sz) {
             return -1;
         }
 
-        cur = last_lev[pos];
+        cur = hb_last_word(hb, pos);
     }
 
     res = (pos << BITS_PER_LEVEL) + ctol(cur);
@@ -294,6 +418,33 @@ static inline bool hb_set_elem(unsigned long *elem, uint64_t start, uint64_t las
     return old != *elem;
 }
 
+static inline bool hb_set_word(HBitmap *hb, int level, uint64_t pos,
+                               uint64_t start, uint64_t last)
+{
+    if (level == HBITMAP_LEVELS - 1 &&
+        hb->chunks[pos >> HB_CHUNK_SHIFT] == HB_CHUNK_FULL) {
+        return false;
+    }
+    return hb_set_elem(hb_elem(hb, level, pos, true), start, last);
+}
+
+/* Mark a whole chunk of the last level as full.  Returns true if at least
+ * one bit is changed.
+ */
+static bool hb_chunk_fill(HBitmap *hb, uint64_t chunk)
+{
+    unsigned long *p = hb->chunks[chunk];
+    bool changed;
+
+    if (p == HB_CHUNK_FULL) {
+        return false;
+    }
+    changed = !p || memcmp(p, hb_full_chunk, sizeof(hb_full_chunk)) != 0;
+    g_free(p);
+    hb->chunks[chunk] = HB_CHUNK_FULL;
+    return changed;
+}
+
 /* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
  * Returns true if at least one bit is changed. */
 static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
@@ -307,18 +458,31 @@ static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
     i = pos;
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
-        changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
+        changed |= hb_set_word(hb, level, i, start, next - 1);
         for (;;) {
+            unsigned long *elem;
+
             start = next;
             next += BITS_PER_LONG;
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] == 0);
-            hb->levels[level][i] = ~0UL;
+            if (level == HBITMAP_LEVELS - 1 &&
+                (i & HB_CHUNK_MASK) == 0 && i + HB_CHUNK_MASK < lastpos) {
+                changed |= hb_chunk_fill(hb, i >> HB_CHUNK_SHIFT);
+                i += HB_CHUNK_MASK;
+                next += (uint64_t)HB_CHUNK_MASK << BITS_PER_LEVEL;
+                continue;
+            }
+            if (hb_word(hb, level, i) == ~0UL) {
+                continue;
+            }
+            elem = hb_elem(hb, level, i, true);
+            changed |= (*elem == 0);
+            *elem = ~0UL;
         }
     }
-    changed |= hb_set_elem(&hb->levels[level][i], start, last);
+    changed |= hb_set_word(hb, level, i, start, last);
 
     /* If there was any change in this layer, we may have to update
      * the one above.
@@ -368,6 +532,31 @@ static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t l
     return blanked;
 }
 
+static inline bool hb_reset_word(HBitmap *hb, int level, uint64_t pos,
+                                 uint64_t start, uint64_t last)
+{
+    unsigned long *elem = hb_elem(hb, level, pos, false);
+
+    return elem && hb_reset_elem(elem, start, last);
+}
+
+/* Mark a whole chunk of the last level as empty.  Returns true if at least
+ * one bit is changed.
+ */
+static bool hb_chunk_clear(HBitmap *hb, uint64_t chunk)
+{
+    unsigned long *p = hb->chunks[chunk];
+    bool changed;
+
+    if (p == NULL) {
+        return false;
+    }
+    changed = p == HB_CHUNK_FULL ||
+              memcmp(p, hb_zero_chunk, sizeof(hb_zero_chunk)) != 0;
+    hb_chunk_free(hb, chunk);
+    return changed;
+}
+
 /* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
  * Returns true if at least one bit is changed. */
 static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
@@ -387,25 +576,37 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
          * unless the lower-level word became entirely zero.  So, remove pos
          * from the upper-level range if bits remain set.
          */
-        if (hb_reset_elem(&hb->levels[level][i], start, next - 1)) {
+        if (hb_reset_word(hb, level, i, start, next - 1)) {
             changed = true;
         } else {
             pos++;
         }
 
         for (;;) {
+            unsigned long *elem;
+
             start = next;
             next += BITS_PER_LONG;
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] != 0);
-            hb->levels[level][i] = 0UL;
+            if (level == HBITMAP_LEVELS - 1 &&
+                (i & HB_CHUNK_MASK) == 0 && i + HB_CHUNK_MASK < lastpos) {
+                changed |= hb_chunk_clear(hb, i >> HB_CHUNK_SHIFT);
+                i += HB_CHUNK_MASK;
+                next += (uint64_t)HB_CHUNK_MASK << BITS_PER_LEVEL;
+                continue;
+            }
+            elem = hb_elem(hb, level, i, false);
+            if (elem) {
+                changed |= (*elem != 0);
+                *elem = 0UL;
+            }
         }
     }
 
     /* Same as above, this time for lastpos.  */
-    if (hb_reset_elem(&hb->levels[level][i], start, last)) {
+    if (hb_reset_word(hb, level, i, start, last)) {
         changed = true;
     } else {
         lastpos--;
@@ -437,14 +638,21 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
         hb->meta) {
         hbitmap_set(hb->meta, start, count);
     }
+    hb_chunks_trim(hb, (first >> BITS_PER_LEVEL) >> HB_CHUNK_SHIFT,
+                   (last >> BITS_PER_LEVEL) >> HB_CHUNK_SHIFT);
 }
 
 void hbitmap_reset_all(HBitmap *hb)
 {
     unsigned int i;
 
+    uint64_t c;
+
     /* Same as hbitmap_alloc() except for memset() instead of malloc() */
-    for (i = HBITMAP_LEVELS; --i >= 1; ) {
+    for (c = 0; c < hb->nb_chunks; c++) {
+        hb_chunk_free(hb, c);
+    }
+    for (i = HBITMAP_LEVELS - 1; --i >= 1; ) {
         memset(hb->levels[i], 0, hb->sizes[i] * sizeof(unsigned long));
     }
 
@@ -477,7 +685,7 @@ bool hbitmap_get(const HBitmap *hb, uint64_t item)
     unsigned long bit = 1UL << (pos & (BITS_PER_LONG - 1));
     assert(pos < hb->size);
 
-    return (hb->levels[HBITMAP_LEVELS - 1][pos >> BITS_PER_LEVEL] & bit) != 0;
+    return (hb_last_word(hb, pos >> BITS_PER_LEVEL) & bit) != 0;
 }
 
 uint64_t hbitmap_serialization_align(const HBitmap *hb)
@@ -494,7 +702,7 @@ uint64_t hbitmap_serialization_align(const HBitmap *hb)
  */
 static void serialization_chunk(const HBitmap *hb,
                                 uint64_t start, uint64_t count,
-                                unsigned long **first_el, uint64_t *el_count)
+                                uint64_t *first_el, uint64_t *el_count)
 {
     uint64_t last = start + count - 1;
     uint64_t gran = hbitmap_serialization_align(hb);
@@ -508,7 +716,7 @@ static void serialization_chunk(const HBitmap *hb,
     start = (start >> hb->granularity) >> BITS_PER_LEVEL;
     last = (last >> hb->granularity) >> BITS_PER_LEVEL;
 
-    *first_el = &hb->levels[HBITMAP_LEVELS - 1][start];
+    *first_el = start;
     *el_count = last - start + 1;
 }
 
@@ -516,7 +724,7 @@ uint64_t hbitmap_serialization_size(const HBitmap *hb,
                                     uint64_t start, uint64_t count)
 {
     uint64_t el_count;
-    unsigned long *cur;
+    uint64_t cur;
 
     if (!count) {
         return 0;
@@ -530,7 +738,7 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
                             uint64_t start, uint64_t count)
 {
     uint64_t el_count;
-    unsigned long *cur, *end;
+    uint64_t cur, end;
 
     if (!count) {
         return;
@@ -539,9 +747,9 @@ void hbitmap_serialize_part(const HBitmap *hb, uint8_t *buf,
     end = cur + el_count;
 
     while (cur != end) {
-        unsigned long el =
-            (BITS_PER_LONG == 32 ? cpu_to_le32(*cur) : cpu_to_le64(*cur));
+        unsigned long el = hb_last_word(hb, cur);
 
+        el = (BITS_PER_LONG == 32 ? cpu_to_le32(el) : cpu_to_le64(el));
         memcpy(buf, &el, sizeof(el));
         buf += sizeof(el);
         cur++;
@@ -553,7 +761,7 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
                               bool finish)
 {
     uint64_t el_count;
-    unsigned long *cur, *end;
+    uint64_t cur, end;
 
     if (!count) {
         return;
@@ -562,12 +770,21 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     end = cur + el_count;
 
     while (cur != end) {
-        memcpy(cur, buf, sizeof(*cur));
+        unsigned long el;
+        unsigned long *elem;
+
+        memcpy(&el, buf, sizeof(el));
 
         if (BITS_PER_LONG == 32) {
-            le32_to_cpus((uint32_t *)cur);
+            le32_to_cpus((uint32_t *)&el);
         } else {
-            le64_to_cpus((uint64_t *)cur);
+            le64_to_cpus((uint64_t *)&el);
+        }
+
+        /* Do not allocate chunks only to store zeroes in them.  */
+        elem = hb_elem(hb, HBITMAP_LEVELS - 1, cur, el != 0);
+        if (elem) {
+            *elem = el;
         }
 
         buf += sizeof(unsigned long);
@@ -578,18 +795,46 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
     }
 }
 
+/* Fill @count words of the last level, starting at @first, with all zeroes
+ * or all ones.  Upper levels are not updated.
+ */
+static void hb_fill_words(HBitmap *hb, uint64_t first, uint64_t count,
+                          bool ones)
+{
+    uint64_t end = first + count;
+    uint64_t cur;
+    unsigned long *elem;
+
+    for (cur = first; cur < end; cur++) {
+        if ((cur & HB_CHUNK_MASK) == 0 && cur + HB_CHUNK_MASK < end) {
+            if (ones) {
+                hb_chunk_fill(hb, cur >> HB_CHUNK_SHIFT);
+            } else {
+                hb_chunk_clear(hb, cur >> HB_CHUNK_SHIFT);
+            }
+            cur += HB_CHUNK_MASK;
+            continue;
+        }
+
+        elem = hb_elem(hb, HBITMAP_LEVELS - 1, cur, ones);
+        if (elem) {
+            *elem = ones ? ~0UL : 0UL;
+        }
+    }
+}
+
 void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
                                 bool finish)
 {
     uint64_t el_count;
-    unsigned long *first;
+    uint64_t first;
 
     if (!count) {
         return;
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0, el_count * sizeof(unsigned long));
+    hb_fill_words(hb, first, el_count, false);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -599,24 +844,48 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
                               bool finish)
 {
     uint64_t el_count;
-    unsigned long *first;
+    uint64_t first;
 
     if (!count) {
         return;
     }
     serialization_chunk(hb, start, count, &first, &el_count);
 
-    memset(first, 0xff, el_count * sizeof(unsigned long));
+    hb_fill_words(hb, first, el_count, true);
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
 }
 
+/* Replace allocated chunks of the last level that are entirely clear or
+ * entirely set with their compact representation.
+ */
+static void hb_chunks_compact(HBitmap *hb)
+{
+    uint64_t c;
+    unsigned long *p;
+
+    for (c = 0; c < hb->nb_chunks; c++) {
+        p = hb->chunks[c];
+        if (p == NULL || p == HB_CHUNK_FULL) {
+            continue;
+        }
+        if (memcmp(p, hb_zero_chunk, sizeof(hb_zero_chunk)) == 0) {
+            hb_chunk_free(hb, c);
+        } else if ((c + 1) * HB_CHUNK_WORDS <= hb->sizes[HBITMAP_LEVELS - 1] &&
+                   memcmp(p, hb_full_chunk, sizeof(hb_full_chunk)) == 0) {
+            hb_chunk_fill(hb, c);
+        }
+    }
+}
+
 void hbitmap_deserialize_finish(HBitmap *bitmap)
 {
     int64_t i, size, prev_size;
     int lev;
 
+    hb_chunks_compact(bitmap);
+
     /* restore levels starting from penultimate to zero level, assuming
      * that the last level is ok */
     size = MAX((bitmap->size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
@@ -626,7 +895,12 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
         memset(bitmap->levels[lev], 0, size * sizeof(unsigned long));
 
         for (i = 0; i < prev_size; ++i) {
-            if (bitmap->levels[lev + 1][i]) {
+            if (lev == HBITMAP_LEVELS - 2 && (i & HB_CHUNK_MASK) == 0 &&
+                !bitmap->chunks[i >> HB_CHUNK_SHIFT]) {
+                i += HB_CHUNK_MASK;
+                continue;
+            }
+            if (hb_word(bitmap, lev + 1, i)) {
                 bitmap->levels[lev][i >> BITS_PER_LEVEL] |=
                     1UL << (i & (BITS_PER_LONG - 1));
             }
@@ -637,11 +911,34 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
     bitmap->count = hb_count_between(bitmap, 0, bitmap->size - 1);
 }
 
+/* Grow or shrink the array of chunks of the last level.  When shrinking,
+ * the chunks that go away must not have any bit set.
+ */
+static void hb_chunks_resize(HBitmap *hb, uint64_t nb_chunks)
+{
+    uint64_t c;
+
+    for (c = nb_chunks; c < hb->nb_chunks; c++) {
+        hb_chunk_free(hb, c);
+    }
+    hb->chunks = g_renew(unsigned long *, hb->chunks, nb_chunks);
+    for (c = hb->nb_chunks; c < nb_chunks; c++) {
+        hb->chunks[c] = NULL;
+    }
+    hb->nb_chunks = nb_chunks;
+}
+
 void hbitmap_free(HBitmap *hb)
 {
     unsigned i;
+    uint64_t c;
+
     assert(!hb->meta);
-    for (i = HBITMAP_LEVELS; i-- > 0; ) {
+    for (c = 0; c < hb->nb_chunks; c++) {
+        hb_chunk_free(hb, c);
+    }
+    g_free(hb->chunks);
+    for (i = HBITMAP_LEVELS - 1; i-- > 0; ) {
         g_free(hb->levels[i]);
     }
     g_free(hb);
@@ -661,7 +958,12 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     for (i = HBITMAP_LEVELS; i-- > 0; ) {
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
         hb->sizes[i] = size;
-        hb->levels[i] = g_new0(unsigned long, size);
+        if (i == HBITMAP_LEVELS - 1) {
+            hb->nb_chunks = DIV_ROUND_UP(size, HB_CHUNK_WORDS);
+            hb->chunks = g_new0(unsigned long *, hb->nb_chunks);
+        } else {
+            hb->levels[i] = g_new0(unsigned long, size);
+        }
     }
 
     /* We necessarily have free bits in level 0 due to the definition
@@ -712,6 +1014,14 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
         }
         old = hb->sizes[i];
         hb->sizes[i] = size;
+        if (i == HBITMAP_LEVELS - 1) {
+            /* Chunks are always allocated in full and the words past the
+             * end of the bitmap are kept clear, so there is nothing to
+             * zero when growing.
+             */
+            hb_chunks_resize(hb, DIV_ROUND_UP(size, HB_CHUNK_WORDS));
+            continue;
+        }
         hb->levels[i] = g_realloc(hb->levels[i], size * sizeof(unsigned long));
         if (!shrink) {
             memset(&hb->levels[i][old], 0x00,
@@ -728,6 +1038,44 @@ bool hbitmap_can_merge(const HBitmap *a, const HBitmap *b)
     return (a->size == b->size) && (a->granularity == b->granularity);
 }
 
+/* Store in @dst a copy of the chunk @src, which belongs to another bitmap. */
+static void hb_chunk_copy(HBitmap *dst, uint64_t chunk, const unsigned long *src)
+{
+    if (src == NULL) {
+        hb_chunk_free(dst, chunk);
+    } else if (src == HB_CHUNK_FULL) {
+        hb_chunk_fill(dst, chunk);
+    } else {
+        memcpy(hb_chunk_get_writable(dst, chunk), src, sizeof(hb_full_chunk));
+    }
+}
+
+static void hb_chunk_merge(const HBitmap *a, const HBitmap *b,
+                           HBitmap *result, uint64_t chunk)
+{
+    unsigned long *pa = a->chunks[chunk];
+    unsigned long *pb = b->chunks[chunk];
+    unsigned long *dst;
+    int i;
+
+    if (pa == HB_CHUNK_FULL || pb == HB_CHUNK_FULL) {
+        hb_chunk_fill(result, chunk);
+    } else if (pb == NULL) {
+        if (result != a) {
+            hb_chunk_copy(result, chunk, pa);
+        }
+    } else if (pa == NULL) {
+        if (result != b) {
+            hb_chunk_copy(result, chunk, pb);
+        }
+    } else {
+        dst = hb_chunk_get_writable(result, chunk);
+        for (i = 0; i < HB_CHUNK_WORDS; i++) {
+            dst[i] = pa[i] | pb[i];
+        }
+    }
+}
+
 /**
  * Given HBitmaps A and B, let A := A (BITOR) B.
  * Bitmap B will not be modified.
@@ -752,12 +1100,17 @@ bool hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
     /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
      * It may be possible to improve running times for sparsely populated maps
      * by using hbitmap_iter_next, but this is suboptimal for dense maps.
+     * Chunks of the last level that are clear in both bitmaps, or full in
+     * either, are handled without looking at their contents.
      */
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
+    for (i = HBITMAP_LEVELS - 2; i >= 0; i--) {
         for (j = 0; j < a->sizes[i]; j++) {
             result->levels[i][j] = a->levels[i][j] | b->levels[i][j];
         }
     }
+    for (j = 0; j < a->nb_chunks; j++) {
+        hb_chunk_merge(a, b, result, j);
+    }
 
     /* Recompute the dirty count */
     result->count = hb_count_between(result, 0, result->size - 1);
@@ -783,10 +1136,21 @@ void hbitmap_free_meta(HBitmap *hb)
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
 {
-    size_t size = bitmap->sizes[HBITMAP_LEVELS - 1] * sizeof(unsigned long);
-    char *data = (char *)bitmap->levels[HBITMAP_LEVELS - 1];
+    uint64_t size = bitmap->sizes[HBITMAP_LEVELS - 1];
+    struct iovec *iov = g_new(struct iovec, bitmap->nb_chunks);
+    const unsigned long *chunk;
     char *hash = NULL;
-    qcrypto_hash_digest(QCRYPTO_HASH_ALG_SHA256, data, size, &hash, errp);
+    uint64_t c;
+
+    for (c = 0; c < bitmap->nb_chunks; c++) {
+        chunk = bitmap->chunks[c] ? bitmap->chunks[c] : hb_zero_chunk;
+        iov[c].iov_base = (void *)chunk;
+        iov[c].iov_len = MIN(HB_CHUNK_WORDS, size - c * HB_CHUNK_WORDS) *
+                         sizeof(unsigned long);
+    }
+    qcrypto_hash_digestv(QCRYPTO_HASH_ALG_SHA256, iov, bitmap->nb_chunks,
+                         &hash, errp);
+    g_free(iov);
 
     return hash;
 }
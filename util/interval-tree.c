@@ -0,0 +1,241 @@
+/*
+ * Interval trees
+ *
+ * An AVL tree ordered by interval start, where every node also records
+ * the maximum interval end within its subtree.  The lookup functions are
+ * modeled after the Linux kernel's interval_tree_generic.h.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/interval-tree.h"
+
+static inline int node_height(IntervalTreeNode *node)
+{
+    return node ? node->height : 0;
+}
+
+/* Recompute the height and the augmented data of @node from its children */
+static void node_update(IntervalTreeNode *node)
+{
+    uint64_t end = node->end;
+
+    if (node->left && node->left->subtree_end > end) {
+        end = node->left->subtree_end;
+    }
+    if (node->right && node->right->subtree_end > end) {
+        end = node->right->subtree_end;
+    }
+    node->subtree_end = end;
+    node->height = MAX(node_height(node->left), node_height(node->right)) + 1;
+}
+
+static void replace_child(IntervalTreeRoot *root, IntervalTreeNode *parent,
+                          IntervalTreeNode *old, IntervalTreeNode *new)
+{
+    if (!parent) {
+        root->root = new;
+    } else if (parent->left == old) {
+        parent->left = new;
+    } else {
+        parent->right = new;
+    }
+}
+
+static IntervalTreeNode *rotate_left(IntervalTreeRoot *root,
+                                     IntervalTreeNode *x)
+{
+    IntervalTreeNode *y = x->right;
+
+    x->right = y->left;
+    if (y->left) {
+        y->left->parent = x;
+    }
+    y->parent = x->parent;
+    replace_child(root, x->parent, x, y);
+    y->left = x;
+    x->parent = y;
+
+    node_update(x);
+    node_update(y);
+    return y;
+}
+
+static IntervalTreeNode *rotate_right(IntervalTreeRoot *root,
+                                      IntervalTreeNode *x)
+{
+    IntervalTreeNode *y = x->left;
+
+    x->left = y->right;
+    if (y->right) {
+        y->right->parent = x;
+    }
+    y->parent = x->parent;
+    replace_child(root, x->parent, x, y);
+    y->right = x;
+    x->parent = y;
+
+    node_update(x);
+    node_update(y);
+    return y;
+}
+
+/*
+ * Walk from @node up to the root, restoring the AVL invariant and
+ * refreshing the augmented data on the way.
+ */
+static void rebalance(IntervalTreeRoot *root, IntervalTreeNode *node)
+{
+    while (node) {
+        int balance;
+
+        node_update(node);
+        balance = node_height(node->left) - node_height(node->right);
+        if (balance > 1) {
+            if (node_height(node->left->left) <
+                node_height(node->left->right)) {
+                rotate_left(root, node->left);
+            }
+            node = rotate_right(root, node);
+        } else if (balance < -1) {
+            if (node_height(node->right->right) <
+                node_height(node->right->left)) {
+                rotate_right(root, node->right);
+            }
+            node = rotate_left(root, node);
+        }
+        node = node->parent;
+    }
+}
+
+void interval_tree_insert(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    IntervalTreeNode *parent = NULL;
+    IntervalTreeNode **link = &root->root;
+
+    assert(node->start <= node->end);
+
+    while (*link) {
+        parent = *link;
+        link = node->start < parent->start ? &parent->left : &parent->right;
+    }
+
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    *link = node;
+
+    rebalance(root, node);
+}
+
+void interval_tree_remove(IntervalTreeNode *node, IntervalTreeRoot *root)
+{
+    IntervalTreeNode *fixup;
+
+    if (!node->left || !node->right) {
+        IntervalTreeNode *child = node->left ? node->left : node->right;
+
+        if (child) {
+            child->parent = node->parent;
+        }
+        replace_child(root, node->parent, node, child);
+        fixup = node->parent;
+    } else {
+        /* Replace @node with its successor, which has no left child.  */
+        IntervalTreeNode *succ = node->right;
+
+        while (succ->left) {
+            succ = succ->left;
+        }
+
+        if (succ->parent != node) {
+            fixup = succ->parent;
+            fixup->left = succ->right;
+            if (succ->right) {
+                succ->right->parent = fixup;
+            }
+            succ->right = node->right;
+            node->right->parent = succ;
+        } else {
+            fixup = succ;
+        }
+
+        succ->left = node->left;
+        node->left->parent = succ;
+        succ->parent = node->parent;
+        replace_child(root, node->parent, node, succ);
+    }
+
+    rebalance(root, fixup);
+}
+
+/*
+ * Find the leftmost node in the subtree rooted at @node that overlaps
+ * [start, end).  The caller guarantees node->subtree_end > start.
+ */
+static IntervalTreeNode *subtree_search(IntervalTreeNode *node,
+                                        uint64_t start, uint64_t end)
+{
+    while (true) {
+        if (node->left && node->left->subtree_end > start) {
+            /*
+             * Some node in the left subtree finishes after @start.  The
+             * leftmost such node either overlaps the range, or starts at
+             * or after @end like everything to its right.
+             */
+            node = node->left;
+            continue;
+        }
+        if (node->start < end) {
+            if (node->end > start) {
+                return node;
+            }
+            node = node->right;
+            if (node && node->subtree_end > start) {
+                continue;
+            }
+        }
+        return NULL;
+    }
+}
+
+IntervalTreeNode *interval_tree_iter_first(IntervalTreeRoot *root,
+                                           uint64_t start, uint64_t end)
+{
+    if (!root->root || root->root->subtree_end <= start) {
+        return NULL;
+    }
+    return subtree_search(root->root, start, end);
+}
+
+IntervalTreeNode *interval_tree_iter_next(IntervalTreeNode *node,
+                                          uint64_t start, uint64_t end)
+{
+    IntervalTreeNode *right = node->right;
+    IntervalTreeNode *prev;
+
+    while (true) {
+        if (right && right->subtree_end > start) {
+            return subtree_search(right, start, end);
+        }
+
+        /* Move up the tree until we come from a node's left child.  */
+        do {
+            prev = node;
+            node = node->parent;
+            if (!node) {
+                return NULL;
+            }
+            right = node->right;
+        } while (prev == right);
+
+        if (node->start >= end) {
+            return NULL;
+        }
+        if (node->end > start) {
+            return node;
+        }
+    }
+}
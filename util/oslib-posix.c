@@ -41,6 +41,7 @@
 
 #ifdef CONFIG_LINUX
 #include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #endif
 
 #ifdef __FreeBSD__
@@ -593,7 +594,7 @@ pid_t qemu_fork(Error **errp)
     return pid;
 }
 
-void *qemu_alloc_stack(size_t *sz)
+void *qemu_alloc_stack(size_t *sz, int node)
 {
     void *ptr, *guardpage;
     int flags;
@@ -628,6 +629,17 @@ void *qemu_alloc_stack(size_t *sz)
         abort();
     }
 
+#if defined(CONFIG_LINUX) && defined(SYS_mbind)
+    if (node >= 0 && node < sizeof(unsigned long) * CHAR_BIT) {
+        unsigned long nodemask = 1UL << node;
+
+        /* Best effort; if it fails, the pages are simply allocated on the
+         * node of the thread that touches them first */
+        syscall(SYS_mbind, ptr, *sz, MPOL_PREFERRED, &nodemask,
+                sizeof(nodemask) * CHAR_BIT + 1, 0);
+    }
+#endif
+
 #if defined(HOST_IA64)
     /* separate register stack */
     guardpage = ptr + (((*sz - pagesz) / 2) & ~pagesz);
@@ -17,63 +17,274 @@
 #include "qemu-common.h"
 #include "qemu/thread.h"
 #include "qemu/atomic.h"
+#include "qemu/host-utils.h"
 #include "qemu/coroutine.h"
 #include "qemu/coroutine_int.h"
 #include "block/aio.h"
 
+#ifdef CONFIG_LINUX
+#include <sys/syscall.h>
+#endif
+
 enum {
+    /* Initial and minimum capacity of the per-thread pools */
     POOL_BATCH_SIZE = 64,
+    /* Upper bound for the adaptive per-thread pool capacity */
+    POOL_MAX_BATCH_SIZE = 1024,
+    /* Number of creations after which the pool capacity is recomputed */
+    POOL_RESIZE_INTERVAL = 4096,
+    /* Number of NUMA nodes that get their own release pool */
+    POOL_MAX_NODES = 16,
+};
+
+static const size_t coroutine_stack_size[COROUTINE_STACK__MAX] = {
+    [COROUTINE_STACK_DEFAULT] = COROUTINE_STACK_SIZE,
+    [COROUTINE_STACK_SMALL] = COROUTINE_SMALL_STACK_SIZE,
 };
 
-/** Free list to speed up creation */
-static QSLIST_HEAD(, Coroutine) release_pool = QSLIST_HEAD_INITIALIZER(pool);
-static unsigned int release_pool_size;
-static __thread QSLIST_HEAD(, Coroutine) alloc_pool = QSLIST_HEAD_INITIALIZER(pool);
-static __thread unsigned int alloc_pool_size;
-static __thread Notifier coroutine_pool_cleanup_notifier;
+/*
+ * Free list for the stacks bound to one NUMA node, for coroutines that
+ * terminate in a thread whose own pool is full or that runs on another node.
+ */
+typedef struct CoroutineReleasePool {
+    QSLIST_HEAD(, Coroutine) list;
+    unsigned int size;
+} QEMU_ALIGNED(64) CoroutineReleasePool;
+
+/* Per-thread free list to speed up creation */
+typedef struct CoroutineThreadPool {
+    QSLIST_HEAD(, Coroutine) list;
+    unsigned int size;
+
+    /*
+     * Capacity of @list.  It follows the peak number of coroutines this
+     * thread had in flight during the last POOL_RESIZE_INTERVAL creations,
+     * so that deep I/O queues do not keep going back to the allocator.
+     */
+    unsigned int batch_size;
+    /*
+     * Coroutines created from this pool that have not terminated yet.  The
+     * thread that they terminate in, which need not be this one, updates it
+     * atomically.
+     */
+    int in_use;
+    int peak_in_use;
+    unsigned int creations;
+
+    /* Only written by the owning thread, read by qemu_coroutine_get_pool_stats */
+    int64_t hits;
+    int64_t allocations;
+    int64_t terminations;
+    int64_t frees;
+} CoroutineThreadPool;
+
+typedef struct CoroutineThreadState {
+    CoroutineThreadPool pool[COROUTINE_STACK__MAX];
+    /* Host NUMA node that new stacks of this thread are bound to */
+    int node;
+    /*
+     * One reference for the thread itself and one for each coroutine that
+     * it created and that has not terminated yet, so that the state
+     * outlives the thread if those coroutines terminate elsewhere.
+     */
+    int refcnt;
+#ifdef _WIN32
+    Notifier cleanup_notifier;
+#endif
+    QLIST_ENTRY(CoroutineThreadState) next;
+} CoroutineThreadState;
+
+static CoroutineReleasePool release_pool[COROUTINE_STACK__MAX][POOL_MAX_NODES];
+static __thread CoroutineThreadState *thread_state;
+
+/* Threads that have pools, and the counters of threads that have exited */
+static QemuMutex thread_states_lock;
+static QLIST_HEAD(, CoroutineThreadState) thread_states =
+    QLIST_HEAD_INITIALIZER(thread_states);
+static CoroutineThreadPool exited_threads[COROUTINE_STACK__MAX];
+
+#ifndef _WIN32
+/*
+ * qemu_thread_atexit_add() only covers threads created with
+ * qemu_thread_create(), but coroutines also run in threads that QEMU does
+ * not create itself.  A key destructor runs whenever any thread exits.
+ */
+static pthread_key_t thread_state_key;
+#endif
+
+static void coroutine_pool_cleanup(CoroutineThreadState *ts);
 
-static void coroutine_pool_cleanup(Notifier *n, void *value)
+#ifndef _WIN32
+static void coroutine_pool_key_destroy(void *value)
+{
+    coroutine_pool_cleanup(value);
+}
+#else
+static void coroutine_pool_notify_exit(Notifier *n, void *value)
+{
+    coroutine_pool_cleanup(container_of(n, CoroutineThreadState,
+                                        cleanup_notifier));
+}
+#endif
+
+static void __attribute__((__constructor__)) coroutine_pool_init(void)
+{
+    qemu_mutex_init(&thread_states_lock);
+#ifndef _WIN32
+    if (pthread_key_create(&thread_state_key, coroutine_pool_key_destroy)) {
+        abort();
+    }
+#endif
+}
+
+static int coroutine_pool_node(void)
+{
+#if defined(CONFIG_LINUX) && defined(SYS_getcpu)
+    unsigned int cpu, node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+        return node;
+    }
+#endif
+    return 0;
+}
+
+static CoroutineReleasePool *coroutine_release_pool(CoroutineStackClass cls,
+                                                    int node)
+{
+    return &release_pool[cls][node % POOL_MAX_NODES];
+}
+
+static void coroutine_thread_state_unref(CoroutineThreadState *ts)
+{
+    if (atomic_fetch_dec(&ts->refcnt) == 1) {
+        g_free(ts);
+    }
+}
+
+static inline void pool_stat_inc(int64_t *counter, int64_t n)
+{
+    atomic_set_i64(counter, *counter + n);
+}
+
+static void coroutine_pool_cleanup(CoroutineThreadState *ts)
 {
     Coroutine *co;
     Coroutine *tmp;
+    int i;
+
+    qemu_mutex_lock(&thread_states_lock);
+    QLIST_REMOVE(ts, next);
+    for (i = 0; i < COROUTINE_STACK__MAX; i++) {
+        CoroutineThreadPool *pool = &ts->pool[i];
+
+        QSLIST_FOREACH_SAFE(co, &pool->list, pool_next, tmp) {
+            QSLIST_REMOVE_HEAD(&pool->list, pool_next);
+            qemu_coroutine_delete(co);
+            pool->frees++;
+        }
+        pool->size = 0;
 
-    QSLIST_FOREACH_SAFE(co, &alloc_pool, pool_next, tmp) {
-        QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
-        qemu_coroutine_delete(co);
+        exited_threads[i].hits += pool->hits;
+        exited_threads[i].allocations += pool->allocations;
+        exited_threads[i].terminations += pool->terminations;
+        exited_threads[i].frees += pool->frees;
     }
+    qemu_mutex_unlock(&thread_states_lock);
+
+    thread_state = NULL;
+    coroutine_thread_state_unref(ts);
 }
 
-Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
+static CoroutineThreadState *coroutine_thread_state(void)
+{
+    CoroutineThreadState *ts = thread_state;
+    int i;
+
+    if (unlikely(!ts)) {
+        ts = g_new0(CoroutineThreadState, 1);
+        for (i = 0; i < COROUTINE_STACK__MAX; i++) {
+            ts->pool[i].batch_size = POOL_BATCH_SIZE;
+        }
+        ts->node = coroutine_pool_node();
+        ts->refcnt = 1;
+#ifndef _WIN32
+        pthread_setspecific(thread_state_key, ts);
+#else
+        ts->cleanup_notifier.notify = coroutine_pool_notify_exit;
+        qemu_thread_atexit_add(&ts->cleanup_notifier);
+#endif
+
+        qemu_mutex_lock(&thread_states_lock);
+        QLIST_INSERT_HEAD(&thread_states, ts, next);
+        qemu_mutex_unlock(&thread_states_lock);
+        thread_state = ts;
+    }
+    return ts;
+}
+
+static void coroutine_pool_account_create(CoroutineThreadPool *pool)
+{
+    int in_use = atomic_fetch_inc(&pool->in_use) + 1;
+
+    pool->peak_in_use = MAX(pool->peak_in_use, in_use);
+
+    if (++pool->creations == POOL_RESIZE_INTERVAL) {
+        pool->batch_size = MIN(MAX(pow2ceil(pool->peak_in_use),
+                                   POOL_BATCH_SIZE),
+                               POOL_MAX_BATCH_SIZE);
+        trace_qemu_coroutine_pool_resize(pool, pool->peak_in_use,
+                                         pool->batch_size);
+        pool->peak_in_use = atomic_read(&pool->in_use);
+        pool->creations = 0;
+    }
+}
+
+static Coroutine *coroutine_create(CoroutineEntry *entry, void *opaque,
+                                   CoroutineStackClass stack_class)
 {
     Coroutine *co = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        co = QSLIST_FIRST(&alloc_pool);
+        CoroutineThreadState *ts = coroutine_thread_state();
+        CoroutineThreadPool *pool = &ts->pool[stack_class];
+
+        co = QSLIST_FIRST(&pool->list);
         if (!co) {
-            if (release_pool_size > POOL_BATCH_SIZE) {
-                /* Slow path; a good place to register the destructor, too.  */
-                if (!coroutine_pool_cleanup_notifier.notify) {
-                    coroutine_pool_cleanup_notifier.notify = coroutine_pool_cleanup;
-                    qemu_thread_atexit_add(&coroutine_pool_cleanup_notifier);
-                }
+            CoroutineReleasePool *release;
 
+            /* Slow path; the thread may have moved to another node */
+            ts->node = coroutine_pool_node();
+            release = coroutine_release_pool(stack_class, ts->node);
+            if (atomic_read(&release->size) > POOL_BATCH_SIZE) {
                 /* This is not exact; there could be a little skew between
-                 * release_pool_size and the actual size of release_pool.  But
+                 * release->size and the actual size of release->list.  But
                  * it is just a heuristic, it does not need to be perfect.
                  */
-                alloc_pool_size = atomic_xchg(&release_pool_size, 0);
-                QSLIST_MOVE_ATOMIC(&alloc_pool, &release_pool);
-                co = QSLIST_FIRST(&alloc_pool);
+                pool->size = atomic_xchg(&release->size, 0);
+                QSLIST_MOVE_ATOMIC(&pool->list, &release->list);
+                co = QSLIST_FIRST(&pool->list);
             }
         }
         if (co) {
-            QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
-            alloc_pool_size--;
+            QSLIST_REMOVE_HEAD(&pool->list, pool_next);
+            pool->size--;
+            pool_stat_inc(&pool->hits, 1);
+        } else {
+            pool_stat_inc(&pool->allocations, 1);
+            co = qemu_coroutine_new(coroutine_stack_size[stack_class],
+                                    ts->node);
+            co->stack_class = stack_class;
+            co->stack_node = ts->node;
         }
+        coroutine_pool_account_create(pool);
+        atomic_inc(&ts->refcnt);
+        co->pool_owner = ts;
     }
 
     if (!co) {
-        co = qemu_coroutine_new();
+        co = qemu_coroutine_new(coroutine_stack_size[stack_class], -1);
+        co->stack_class = stack_class;
     }
 
     co->entry = entry;
@@ -82,26 +293,80 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
     return co;
 }
 
+Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
+{
+    return coroutine_create(entry, opaque, COROUTINE_STACK_DEFAULT);
+}
+
+Coroutine *qemu_coroutine_create_small(CoroutineEntry *entry, void *opaque)
+{
+    return coroutine_create(entry, opaque, COROUTINE_STACK_SMALL);
+}
+
 static void coroutine_delete(Coroutine *co)
 {
     co->caller = NULL;
 
     if (CONFIG_COROUTINE_POOL) {
-        if (release_pool_size < POOL_BATCH_SIZE * 2) {
-            QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
-            atomic_inc(&release_pool_size);
+        CoroutineThreadState *owner = co->pool_owner;
+        CoroutineThreadState *ts = coroutine_thread_state();
+        CoroutineThreadPool *pool = &ts->pool[co->stack_class];
+        CoroutineReleasePool *release;
+
+        atomic_dec(&owner->pool[co->stack_class].in_use);
+        co->pool_owner = NULL;
+        coroutine_thread_state_unref(owner);
+        pool_stat_inc(&pool->terminations, 1);
+
+        /* Keep the stack in the local pool if it is on this thread's node */
+        if (co->stack_node == ts->node && pool->size < pool->batch_size) {
+            QSLIST_INSERT_HEAD(&pool->list, co, pool_next);
+            pool->size++;
             return;
         }
-        if (alloc_pool_size < POOL_BATCH_SIZE) {
-            QSLIST_INSERT_HEAD(&alloc_pool, co, pool_next);
-            alloc_pool_size++;
+        release = coroutine_release_pool(co->stack_class, co->stack_node);
+        if (atomic_read(&release->size) < POOL_BATCH_SIZE * 2) {
+            QSLIST_INSERT_HEAD_ATOMIC(&release->list, co, pool_next);
+            atomic_inc(&release->size);
             return;
         }
+        pool_stat_inc(&pool->frees, 1);
     }
 
     qemu_coroutine_delete(co);
 }
 
+void qemu_coroutine_get_pool_stats(CoroutinePoolStats stats[COROUTINE_STACK__MAX])
+{
+    CoroutineThreadState *ts;
+    int i;
+
+    for (i = 0; i < COROUTINE_STACK__MAX; i++) {
+        int64_t hits = 0, allocations = 0, terminations = 0, frees = 0;
+
+        qemu_mutex_lock(&thread_states_lock);
+        QLIST_FOREACH(ts, &thread_states, next) {
+            hits += atomic_read_i64(&ts->pool[i].hits);
+            allocations += atomic_read_i64(&ts->pool[i].allocations);
+            terminations += atomic_read_i64(&ts->pool[i].terminations);
+            frees += atomic_read_i64(&ts->pool[i].frees);
+        }
+        hits += exited_threads[i].hits;
+        allocations += exited_threads[i].allocations;
+        terminations += exited_threads[i].terminations;
+        frees += exited_threads[i].frees;
+        qemu_mutex_unlock(&thread_states_lock);
+
+        stats[i] = (CoroutinePoolStats) {
+            .stack_size     = coroutine_stack_size[i],
+            .in_use         = MAX(hits + allocations - terminations, 0),
+            .pooled         = MAX(terminations - hits - frees, 0),
+            .pool_hits      = hits,
+            .allocations    = allocations,
+        };
+    }
+}
+
 void qemu_aio_coroutine_enter(AioContext *ctx, Coroutine *co)
 {
     QSIMPLEQ_HEAD(, Coroutine) pending = QSIMPLEQ_HEAD_INITIALIZER(pending);
@@ -68,7 +68,19 @@ static QEMUClock qemu_clocks[QEMU_CLOCK_MAX];
 struct QEMUTimerList {
     QEMUClock *clock;
     QemuMutex active_timers_lock;
-    QEMUTimer *active_timers;
+    /*
+     * Binary min-heap of the active timers, ordered by expire_time and
+     * then by insertion order.  Protected by active_timers_lock.
+     */
+    QEMUTimer **active_timers;
+    int nr_active_timers;
+    int max_active_timers;
+    uint64_t next_seq;
+    /*
+     * Expire time of the first timer, or -1 if there is none.  Written
+     * under active_timers_lock, but can be read without it.
+     */
+    int64_t deadline;
     QLIST_ENTRY(QEMUTimerList) list;
     QEMUTimerListNotifyCB *notify_cb;
     void *notify_opaque;
@@ -95,6 +107,106 @@ static bool timer_expired_ns(QEMUTimer *timer_head, int64_t current_time)
     return timer_head && (timer_head->expire_time <= current_time);
 }
 
+static inline bool timer_before(QEMUTimer *a, QEMUTimer *b)
+{
+    return a->expire_time < b->expire_time ||
+           (a->expire_time == b->expire_time && a->seq < b->seq);
+}
+
+static inline void timer_heap_set(QEMUTimerList *timer_list, int i,
+                                  QEMUTimer *ts)
+{
+    timer_list->active_timers[i] = ts;
+    ts->heap_index = i;
+}
+
+static void timer_heap_sift_up(QEMUTimerList *timer_list, int i)
+{
+    QEMUTimer *ts = timer_list->active_timers[i];
+
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+
+        if (!timer_before(ts, timer_list->active_timers[parent])) {
+            break;
+        }
+        timer_heap_set(timer_list, i, timer_list->active_timers[parent]);
+        i = parent;
+    }
+    timer_heap_set(timer_list, i, ts);
+}
+
+static void timer_heap_sift_down(QEMUTimerList *timer_list, int i)
+{
+    QEMUTimer *ts = timer_list->active_timers[i];
+    int n = timer_list->nr_active_timers;
+
+    for (;;) {
+        int child = 2 * i + 1;
+
+        if (child >= n) {
+            break;
+        }
+        if (child + 1 < n &&
+            timer_before(timer_list->active_timers[child + 1],
+                         timer_list->active_timers[child])) {
+            child++;
+        }
+        if (!timer_before(timer_list->active_timers[child], ts)) {
+            break;
+        }
+        timer_heap_set(timer_list, i, timer_list->active_timers[child]);
+        i = child;
+    }
+    timer_heap_set(timer_list, i, ts);
+}
+
+static void timer_heap_insert(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    int i = timer_list->nr_active_timers;
+
+    if (i == timer_list->max_active_timers) {
+        timer_list->max_active_timers = MAX(16, i * 2);
+        timer_list->active_timers = g_renew(QEMUTimer *,
+                                            timer_list->active_timers,
+                                            timer_list->max_active_timers);
+    }
+    timer_list->nr_active_timers++;
+    timer_heap_set(timer_list, i, ts);
+    timer_heap_sift_up(timer_list, i);
+}
+
+static void timer_heap_remove(QEMUTimerList *timer_list, QEMUTimer *ts)
+{
+    int i = ts->heap_index;
+    int last = --timer_list->nr_active_timers;
+
+    assert(timer_list->active_timers[i] == ts);
+    if (i != last) {
+        timer_heap_set(timer_list, i, timer_list->active_timers[last]);
+        if (i > 0 && timer_before(timer_list->active_timers[i],
+                                  timer_list->active_timers[(i - 1) / 2])) {
+            timer_heap_sift_up(timer_list, i);
+        } else {
+            timer_heap_sift_down(timer_list, i);
+        }
+    }
+    ts->heap_index = -1;
+}
+
+static inline QEMUTimer *timerlist_first(QEMUTimerList *timer_list)
+{
+    return timer_list->nr_active_timers ? timer_list->active_timers[0] : NULL;
+}
+
+/* Publish the new deadline after changing the heap */
+static void timerlist_update_deadline(QEMUTimerList *timer_list)
+{
+    QEMUTimer *ts = timerlist_first(timer_list);
+
+    atomic_set_i64(&timer_list->deadline, ts ? ts->expire_time : -1);
+}
+
 QEMUTimerList *timerlist_new(QEMUClockType type,
                              QEMUTimerListNotifyCB *cb,
                              void *opaque)
@@ -107,6 +219,7 @@ QEMUTimerList *timerlist_new(QEMUClockType type,
     timer_list->clock = clock;
     timer_list->notify_cb = cb;
     timer_list->notify_opaque = opaque;
+    timer_list->deadline = -1;
     qemu_mutex_init(&timer_list->active_timers_lock);
     QLIST_INSERT_HEAD(&clock->timerlists, timer_list, list);
     return timer_list;
@@ -119,6 +232,7 @@ void timerlist_free(QEMUTimerList *timer_list)
         QLIST_REMOVE(timer_list, list);
     }
     qemu_mutex_destroy(&timer_list->active_timers_lock);
+    g_free(timer_list->active_timers);
     g_free(timer_list);
 }
 
@@ -175,7 +289,7 @@ void qemu_clock_enable(QEMUClockType type, bool enabled)
 
 bool timerlist_has_timers(QEMUTimerList *timer_list)
 {
-    return !!atomic_read(&timer_list->active_timers);
+    return atomic_read_i64(&timer_list->deadline) != -1;
 }
 
 bool qemu_clock_has_timers(QEMUClockType type)
@@ -186,20 +300,12 @@ bool qemu_clock_has_timers(QEMUClockType type)
 
 bool timerlist_expired(QEMUTimerList *timer_list)
 {
-    int64_t expire_time;
+    int64_t expire_time = atomic_read_i64(&timer_list->deadline);
 
-    if (!atomic_read(&timer_list->active_timers)) {
+    if (expire_time == -1) {
         return false;
     }
 
-    qemu_mutex_lock(&timer_list->active_timers_lock);
-    if (!timer_list->active_timers) {
-        qemu_mutex_unlock(&timer_list->active_timers_lock);
-        return false;
-    }
-    expire_time = timer_list->active_timers->expire_time;
-    qemu_mutex_unlock(&timer_list->active_timers_lock);
-
     return expire_time <= qemu_clock_get_ns(timer_list->clock->type);
 }
 
@@ -219,25 +325,18 @@ int64_t timerlist_deadline_ns(QEMUTimerList *timer_list)
     int64_t delta;
     int64_t expire_time;
 
-    if (!atomic_read(&timer_list->active_timers)) {
-        return -1;
-    }
-
-    if (!timer_list->clock->enabled) {
-        return -1;
-    }
-
     /* The active timers list may be modified before the caller uses our return
      * value but ->notify_cb() is called when the deadline changes.  Therefore
      * the caller should notice the change and there is no race condition.
      */
-    qemu_mutex_lock(&timer_list->active_timers_lock);
-    if (!timer_list->active_timers) {
-        qemu_mutex_unlock(&timer_list->active_timers_lock);
+    expire_time = atomic_read_i64(&timer_list->deadline);
+    if (expire_time == -1) {
+        return -1;
+    }
+
+    if (!timer_list->clock->enabled) {
         return -1;
     }
-    expire_time = timer_list->active_timers->expire_time;
-    qemu_mutex_unlock(&timer_list->active_timers_lock);
 
     delta = expire_time - qemu_clock_get_ns(timer_list->clock->type);
 
@@ -353,6 +452,7 @@ void timer_init_full(QEMUTimer *ts,
     ts->scale = scale;
     ts->attributes = attributes;
     ts->expire_time = -1;
+    ts->heap_index = -1;
 }
 
 void timer_deinit(QEMUTimer *ts)
@@ -361,43 +461,28 @@ void timer_deinit(QEMUTimer *ts)
     ts->timer_list = NULL;
 }
 
+/* The caller must update the deadline */
 static void timer_del_locked(QEMUTimerList *timer_list, QEMUTimer *ts)
 {
-    QEMUTimer **pt, *t;
-
-    ts->expire_time = -1;
-    pt = &timer_list->active_timers;
-    for(;;) {
-        t = *pt;
-        if (!t)
-            break;
-        if (t == ts) {
-            atomic_set(pt, t->next);
-            break;
-        }
-        pt = &t->next;
+    if (ts->heap_index >= 0) {
+        timer_heap_remove(timer_list, ts);
     }
+    ts->expire_time = -1;
 }
 
 static bool timer_mod_ns_locked(QEMUTimerList *timer_list,
                                 QEMUTimer *ts, int64_t expire_time)
 {
-    QEMUTimer **pt, *t;
+    bool rearm;
 
-    /* add the timer in the sorted list */
-    pt = &timer_list->active_timers;
-    for (;;) {
-        t = *pt;
-        if (!timer_expired_ns(t, expire_time)) {
-            break;
-        }
-        pt = &t->next;
-    }
+    /* Timers with the same expire_time fire in the order they were added */
     ts->expire_time = MAX(expire_time, 0);
-    ts->next = *pt;
-    atomic_set(pt, ts);
+    ts->seq = timer_list->next_seq++;
+    timer_heap_insert(timer_list, ts);
 
-    return pt == &timer_list->active_timers;
+    rearm = ts->heap_index == 0;
+    timerlist_update_deadline(timer_list);
+    return rearm;
 }
 
 static void timerlist_rearm(QEMUTimerList *timer_list)
@@ -417,6 +502,7 @@ void timer_del(QEMUTimer *ts)
     if (timer_list) {
         qemu_mutex_lock(&timer_list->active_timers_lock);
         timer_del_locked(timer_list, ts);
+        timerlist_update_deadline(timer_list);
         qemu_mutex_unlock(&timer_list->active_timers_lock);
     }
 }
@@ -491,7 +577,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
     void *opaque;
     bool need_replay_checkpoint = false;
 
-    if (!atomic_read(&timer_list->active_timers)) {
+    if (!timerlist_has_timers(timer_list)) {
         return false;
     }
 
@@ -540,7 +626,7 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
      */
     current_time = qemu_clock_get_ns(timer_list->clock->type);
     qemu_mutex_lock(&timer_list->active_timers_lock);
-    while ((ts = timer_list->active_timers)) {
+    while ((ts = timerlist_first(timer_list))) {
         if (!timer_expired_ns(ts, current_time)) {
             /* No expired timers left.  The checkpoint can be skipped
              * if no timers fired or they were all external.
@@ -563,9 +649,8 @@ bool timerlist_run_timers(QEMUTimerList *timer_list)
         }
 
         /* remove timer from the list before calling the callback */
-        timer_list->active_timers = ts->next;
-        ts->next = NULL;
-        ts->expire_time = -1;
+        timer_del_locked(timer_list, ts);
+        timerlist_update_deadline(timer_list);
         cb = ts->cb;
         opaque = ts->opaque;
 
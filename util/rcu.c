@@ -32,6 +32,11 @@
 #include "qemu/atomic.h"
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
+#include "qemu/notify.h"
+#include "qemu/processor.h"
+#include "qemu/stats64.h"
+#include "qemu/timer.h"
+#include "trace.h"
 #if defined(CONFIG_MALLOC_TRIM)
 #include <malloc.h>
 #endif
@@ -49,6 +54,20 @@ QemuEvent rcu_gp_event;
 static QemuMutex rcu_registry_lock;
 static QemuMutex rcu_sync_lock;
 
+/* Statistics, written under rcu_sync_lock or by the call_rcu thread */
+static Stat64 rcu_gp_count;
+static Stat64 rcu_gp_expedited_count;
+static Stat64 rcu_gp_total_ns;
+static Stat64 rcu_gp_max_ns;
+static Stat64 rcu_call_invoked;
+static Stat64 rcu_call_max_batch;
+
+/*
+ * Number of times an expedited grace period polls the readers before
+ * falling back to sleeping on rcu_gp_event.
+ */
+#define RCU_EXPEDITED_POLLS     1000
+
 /*
  * Check whether a quiescent state was crossed between the beginning of
  * update_counter_and_wait and now.
@@ -71,12 +90,35 @@ typedef QLIST_HEAD(, rcu_reader_data) ThreadList;
 static ThreadList registry = QLIST_HEAD_INITIALIZER(registry);
 
 /* Wait for previous parity/grace period to be empty of readers.  */
-static void wait_for_readers(void)
+static void wait_for_readers(bool expedited)
 {
     ThreadList qsreaders = QLIST_HEAD_INITIALIZER(qsreaders);
     struct rcu_reader_data *index, *tmp;
+    int polls;
 
-    for (;;) {
+    /* Read-side critical sections are short, so most readers will leave
+     * them within microseconds.  Polling them does not need the
+     * rcu_gp_event handshake and its process-wide barriers.
+     */
+    for (polls = 0; expedited && polls < RCU_EXPEDITED_POLLS; polls++) {
+        QLIST_FOREACH_SAFE(index, &registry, node, tmp) {
+            if (!rcu_gp_ongoing(&index->ctr)) {
+                QLIST_REMOVE(index, node);
+                QLIST_INSERT_HEAD(&qsreaders, index, node);
+            }
+        }
+        if (QLIST_EMPTY(&registry)) {
+            break;
+        }
+        cpu_relax();
+    }
+
+    /* Order the loads of index->ctr above before the caller frees
+     * anything.  Pairs with atomic_store_release() in rcu_read_unlock().
+     */
+    smp_mb_acquire();
+
+    while (!QLIST_EMPTY(&registry)) {
         /* We want to be notified of changes made to rcu_gp_ongoing
          * while we walk the list.
          */
@@ -96,7 +138,11 @@ static void wait_for_readers(void)
          * index->ctr.  Pairs with smp_mb_placeholder() in rcu_read_unlock(),
          * ensuring that the loads of index->ctr are sequentially consistent.
          */
-        smp_mb_global();
+        if (expedited) {
+            smp_mb_global_expedited();
+        } else {
+            smp_mb_global();
+        }
 
         QLIST_FOREACH_SAFE(index, &registry, node, tmp) {
             if (!rcu_gp_ongoing(&index->ctr)) {
@@ -140,14 +186,21 @@ static void wait_for_readers(void)
     QLIST_SWAP(&registry, &qsreaders, node);
 }
 
-void synchronize_rcu(void)
+static void synchronize_rcu_common(bool expedited)
 {
+    int64_t start = get_clock();
+    int64_t duration;
+
     qemu_mutex_lock(&rcu_sync_lock);
 
     /* Write RCU-protected pointers before reading p_rcu_reader->ctr.
      * Pairs with smp_mb_placeholder() in rcu_read_lock().
      */
-    smp_mb_global();
+    if (expedited) {
+        smp_mb_global_expedited();
+    } else {
+        smp_mb_global();
+    }
 
     qemu_mutex_lock(&rcu_registry_lock);
     if (!QLIST_EMPTY(&registry)) {
@@ -161,141 +214,271 @@ void synchronize_rcu(void)
              * Switch parity: 0 -> 1, 1 -> 0.
              */
             atomic_mb_set(&rcu_gp_ctr, rcu_gp_ctr ^ RCU_GP_CTR);
-            wait_for_readers();
+            wait_for_readers(expedited);
             atomic_mb_set(&rcu_gp_ctr, rcu_gp_ctr ^ RCU_GP_CTR);
         } else {
             /* Increment current grace period.  */
             atomic_mb_set(&rcu_gp_ctr, rcu_gp_ctr + RCU_GP_CTR);
         }
 
-        wait_for_readers();
+        wait_for_readers(expedited);
     }
 
     qemu_mutex_unlock(&rcu_registry_lock);
+
+    duration = get_clock() - start;
+    stat64_add(&rcu_gp_count, 1);
+    if (expedited) {
+        stat64_add(&rcu_gp_expedited_count, 1);
+    }
+    stat64_add(&rcu_gp_total_ns, duration);
+    stat64_max(&rcu_gp_max_ns, duration);
     qemu_mutex_unlock(&rcu_sync_lock);
+
+    trace_rcu_grace_period(expedited, duration);
+}
+
+void synchronize_rcu(void)
+{
+    synchronize_rcu_common(false);
+}
+
+void synchronize_rcu_expedited(void)
+{
+    synchronize_rcu_common(true);
 }
 
 
 #define RCU_CALL_MIN_SIZE        30
 
-/* Multi-producer, single-consumer queue based on urcu/static/wfqueue.h
- * from liburcu.  Note that head is only used by the consumer.
+/* A batch this large uses an expedited grace period, to bound the backlog */
+#define RCU_CALL_EXPEDITE_SIZE   1000
+
+/* Each thread that calls call_rcu1() pushes callbacks on its own queue,
+ * so that producers do not bounce a shared tail pointer between CPUs.
+ * The call_rcu thread detaches whole queues with an atomic exchange;
+ * because it never removes single nodes, a compare-and-swap push is
+ * safe from ABA problems.
  */
-static struct rcu_head dummy;
-static struct rcu_head *head = &dummy, **tail = &dummy.next;
-static int rcu_call_count;
+struct rcu_call_queue {
+    struct rcu_head *head;      /* newest callback first */
+    int count;                  /* may overestimate transiently */
+    bool orphan;                /* owner has exited; protected by rcu_call_lock */
+#ifdef _WIN32
+    Notifier exit_notifier;
+#endif
+    QLIST_ENTRY(rcu_call_queue) node;
+};
+
+static QemuMutex rcu_call_lock;
+static QLIST_HEAD(, rcu_call_queue) rcu_call_queues =
+    QLIST_HEAD_INITIALIZER(rcu_call_queues);
+static __thread struct rcu_call_queue *rcu_call_queue;
+
 static QemuEvent rcu_call_ready_event;
+static QemuSemaphore rcu_call_expedite_sem;
+static bool rcu_call_expedited;
+static int rcu_call_inflight;
+
+#ifndef _WIN32
+/*
+ * qemu_thread_atexit_add() only covers threads created with
+ * qemu_thread_create(), but library threads can call call_rcu1() too.
+ * A key destructor runs whenever any thread exits.
+ */
+static pthread_key_t rcu_call_queue_key;
+#endif
 
-static void enqueue(struct rcu_head *node)
+static void rcu_call_queue_exit(struct rcu_call_queue *q)
 {
-    struct rcu_head **old_tail;
+    /* The call_rcu thread runs what is left and then frees the queue */
+    qemu_mutex_lock(&rcu_call_lock);
+    q->orphan = true;
+    qemu_mutex_unlock(&rcu_call_lock);
+    rcu_call_queue = NULL;
+}
 
-    node->next = NULL;
-    old_tail = atomic_xchg(&tail, &node->next);
-    atomic_mb_set(old_tail, node);
+#ifndef _WIN32
+static void rcu_call_queue_key_destroy(void *value)
+{
+    rcu_call_queue_exit(value);
+}
+#else
+static void rcu_call_queue_notify_exit(Notifier *n, void *unused)
+{
+    rcu_call_queue_exit(container_of(n, struct rcu_call_queue,
+                                     exit_notifier));
 }
+#endif
 
-static struct rcu_head *try_dequeue(void)
+static struct rcu_call_queue *rcu_call_queue_new(void)
 {
-    struct rcu_head *node, *next;
+    struct rcu_call_queue *q = g_new0(struct rcu_call_queue, 1);
 
-retry:
-    /* Test for an empty list, which we do not expect.  Note that for
-     * the consumer head and tail are always consistent.  The head
-     * is consistent because only the consumer reads/writes it.
-     * The tail, because it is the first step in the enqueuing.
-     * It is only the next pointers that might be inconsistent.
-     */
-    if (head == &dummy && atomic_mb_read(&tail) == &dummy.next) {
-        abort();
-    }
+#ifndef _WIN32
+    pthread_setspecific(rcu_call_queue_key, q);
+#else
+    q->exit_notifier.notify = rcu_call_queue_notify_exit;
+    qemu_thread_atexit_add(&q->exit_notifier);
+#endif
 
-    /* If the head node has NULL in its next pointer, the value is
-     * wrong and we need to wait until its enqueuer finishes the update.
-     */
-    node = head;
-    next = atomic_mb_read(&head->next);
-    if (!next) {
-        return NULL;
+    qemu_mutex_lock(&rcu_call_lock);
+    QLIST_INSERT_HEAD(&rcu_call_queues, q, node);
+    qemu_mutex_unlock(&rcu_call_lock);
+
+    rcu_call_queue = q;
+    return q;
+}
+
+static int rcu_call_pending(void)
+{
+    struct rcu_call_queue *q;
+    int n = 0;
+
+    qemu_mutex_lock(&rcu_call_lock);
+    QLIST_FOREACH(q, &rcu_call_queues, node) {
+        n += atomic_read(&q->count);
     }
+    qemu_mutex_unlock(&rcu_call_lock);
+    return n;
+}
 
-    /* Since we are the sole consumer, and we excluded the empty case
-     * above, the queue will always have at least two nodes: the
-     * dummy node, and the one being removed.  So we do not need to update
-     * the tail pointer.
-     */
-    head = next;
+/* Detach all queued callbacks and return them, oldest first per thread */
+static struct rcu_head *rcu_call_steal(int *count)
+{
+    struct rcu_call_queue *q, *next_q;
+    struct rcu_head *batch = NULL, **batch_tail = &batch;
+    int n = 0;
+
+    qemu_mutex_lock(&rcu_call_lock);
+    QLIST_FOREACH_SAFE(q, &rcu_call_queues, node, next_q) {
+        struct rcu_head *node = atomic_xchg(&q->head, NULL);
+        struct rcu_head *reversed = NULL, *next;
+        int stolen = 0;
+
+        if (node) {
+            /* Reverse the queue to run callbacks in submission order */
+            while (node) {
+                next = node->next;
+                node->next = reversed;
+                reversed = node;
+                node = next;
+                stolen++;
+            }
+            atomic_sub(&q->count, stolen);
 
-    /* If we dequeued the dummy node, add it back at the end and retry.  */
-    if (node == &dummy) {
-        enqueue(node);
-        goto retry;
+            *batch_tail = reversed;
+            for (node = reversed; node->next; node = node->next) {
+                continue;
+            }
+            batch_tail = &node->next;
+            n += stolen;
+        } else if (q->orphan) {
+            QLIST_REMOVE(q, node);
+            g_free(q);
+        }
     }
+    qemu_mutex_unlock(&rcu_call_lock);
 
-    return node;
+    *count = n;
+    return batch;
 }
 
 static void *call_rcu_thread(void *opaque)
 {
-    struct rcu_head *node;
+    struct rcu_head *node, *next;
 
     rcu_register_thread();
 
     for (;;) {
         int tries = 0;
-        int n = atomic_read(&rcu_call_count);
+        int n;
+        bool expedited;
 
-        /* Heuristically wait for a decent number of callbacks to pile up.
-         * Fetch rcu_call_count now, we only must process elements that were
-         * added before synchronize_rcu() starts.
+        /* Heuristically wait for a decent number of callbacks to pile up,
+         * unless somebody asked for them to be processed quickly.
          */
-        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
-            g_usleep(10000);
+        for (;;) {
+            n = rcu_call_pending();
             if (n == 0) {
                 qemu_event_reset(&rcu_call_ready_event);
-                n = atomic_read(&rcu_call_count);
+                n = rcu_call_pending();
                 if (n == 0) {
 #if defined(CONFIG_MALLOC_TRIM)
                     malloc_trim(4 * 1024 * 1024);
 #endif
                     qemu_event_wait(&rcu_call_ready_event);
+                    continue;
                 }
             }
-            n = atomic_read(&rcu_call_count);
+            if (n >= RCU_CALL_MIN_SIZE || ++tries > 5 ||
+                atomic_read(&rcu_call_expedited)) {
+                break;
+            }
+            qemu_sem_timedwait(&rcu_call_expedite_sem, 10);
         }
 
-        atomic_sub(&rcu_call_count, n);
-        synchronize_rcu();
+        /* We only must process elements that were added before
+         * synchronize_rcu() starts, so take them off the queues now.
+         */
+        expedited = atomic_xchg(&rcu_call_expedited, false);
+        node = rcu_call_steal(&n);
+        expedited |= n >= RCU_CALL_EXPEDITE_SIZE;
+        atomic_set(&rcu_call_inflight, n);
+        stat64_max(&rcu_call_max_batch, n);
+        trace_call_rcu_batch(n, expedited);
+
+        synchronize_rcu_common(expedited);
         qemu_mutex_lock_iothread();
-        while (n > 0) {
-            node = try_dequeue();
-            while (!node) {
-                qemu_mutex_unlock_iothread();
-                qemu_event_reset(&rcu_call_ready_event);
-                node = try_dequeue();
-                if (!node) {
-                    qemu_event_wait(&rcu_call_ready_event);
-                    node = try_dequeue();
-                }
-                qemu_mutex_lock_iothread();
-            }
-
-            n--;
+        for (; node; node = next) {
+            next = node->next;
             node->func(node);
         }
         qemu_mutex_unlock_iothread();
+
+        stat64_add(&rcu_call_invoked, n);
+        atomic_set(&rcu_call_inflight, 0);
     }
     abort();
 }
 
 void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
 {
+    struct rcu_call_queue *q = rcu_call_queue;
+    struct rcu_head *old;
+
+    if (unlikely(!q)) {
+        q = rcu_call_queue_new();
+    }
+
     node->func = func;
-    enqueue(node);
-    atomic_inc(&rcu_call_count);
+    atomic_inc(&q->count);
+    do {
+        old = atomic_read(&q->head);
+        node->next = old;
+    } while (atomic_cmpxchg(&q->head, old, node) != old);
     qemu_event_set(&rcu_call_ready_event);
 }
 
+void rcu_expedite_callbacks(void)
+{
+    if (!atomic_xchg(&rcu_call_expedited, true)) {
+        qemu_sem_post(&rcu_call_expedite_sem);
+    }
+}
+
+void rcu_get_stats(RCUStats *stats)
+{
+    stats->grace_periods = stat64_get(&rcu_gp_count);
+    stats->expedited_grace_periods = stat64_get(&rcu_gp_expedited_count);
+    stats->grace_period_total_ns = stat64_get(&rcu_gp_total_ns);
+    stats->grace_period_max_ns = stat64_get(&rcu_gp_max_ns);
+    stats->callbacks_pending = rcu_call_pending() +
+                               atomic_read(&rcu_call_inflight);
+    stats->callbacks_invoked = stat64_get(&rcu_call_invoked);
+    stats->callbacks_max_batch = stat64_get(&rcu_call_max_batch);
+}
+
 void rcu_register_thread(void)
 {
     assert(rcu_reader.ctr == 0);
@@ -319,7 +502,9 @@ static void rcu_init_complete(void)
     qemu_mutex_init(&rcu_sync_lock);
     qemu_event_init(&rcu_gp_event, true);
 
+    qemu_mutex_init(&rcu_call_lock);
     qemu_event_init(&rcu_call_ready_event, false);
+    qemu_sem_init(&rcu_call_expedite_sem, 0);
 
     /* The caller is assumed to have iothread lock, so the call_rcu thread
      * must have been quiescent even after forking, just recreate it.
@@ -351,6 +536,7 @@ static void rcu_init_lock(void)
 
     qemu_mutex_lock(&rcu_sync_lock);
     qemu_mutex_lock(&rcu_registry_lock);
+    qemu_mutex_lock(&rcu_call_lock);
 }
 
 static void rcu_init_unlock(void)
@@ -359,6 +545,7 @@ static void rcu_init_unlock(void)
         return;
     }
 
+    qemu_mutex_unlock(&rcu_call_lock);
     qemu_mutex_unlock(&rcu_registry_lock);
     qemu_mutex_unlock(&rcu_sync_lock);
 }
@@ -377,6 +564,11 @@ static void rcu_init_child(void)
 static void __attribute__((__constructor__)) rcu_init(void)
 {
     smp_mb_global_init();
+#ifndef _WIN32
+    if (pthread_key_create(&rcu_call_queue_key, rcu_call_queue_key_destroy)) {
+        abort();
+    }
+#endif
 #ifdef CONFIG_POSIX
     pthread_atfork(rcu_init_lock, rcu_init_unlock, rcu_init_child);
 #endif
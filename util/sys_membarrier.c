@@ -19,6 +19,8 @@ membarrier(int cmd, int flags)
 {
     return syscall(__NR_membarrier, cmd, flags);
 }
+
+static bool membarrier_expedited;
 #endif
 
 void smp_mb_global(void)
@@ -32,6 +34,24 @@ void smp_mb_global(void)
 #endif
 }
 
+void smp_mb_global_expedited(void)
+{
+#if defined CONFIG_WIN32
+    FlushProcessWriteBuffers();
+#elif defined CONFIG_LINUX
+    /*
+     * Registration is not inherited by fork()ed children, so be ready
+     * for the command to fail and go the slow way then.
+     */
+    if (!membarrier_expedited ||
+        membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) < 0) {
+        membarrier(MEMBARRIER_CMD_SHARED, 0);
+    }
+#else
+#error --enable-membarrier is not supported on this operating system.
+#endif
+}
+
 void smp_mb_global_init(void)
 {
 #ifdef CONFIG_LINUX
@@ -46,5 +66,15 @@ void smp_mb_global_init(void)
         error_report("Please upgrade your system to a newer version of Linux");
         exit(1);
     }
+
+    /*
+     * MEMBARRIER_CMD_SHARED waits for a grace period of the kernel's own
+     * RCU, which can take milliseconds.  The private expedited command
+     * interrupts the CPUs that run our threads instead; it needs Linux 4.14.
+     */
+    if ((ret & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+        membarrier(MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0) {
+        membarrier_expedited = true;
+    }
 #endif
 }
@@ -313,6 +313,11 @@ static QemuOptsList qemu_accel_opts = {
             .type = QEMU_OPT_STRING,
             .help = "Enable/disable multi-threaded TCG",
         },
+        {
+            .name = "superblock-threshold",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Executions before a TB is retranslated as a superblock",
+        },
         { /* end of list */ }
     },
 };